@@ -0,0 +1,47 @@
+#include "Camera.h"
+
+
+bool cameraViewForKey(char key, CameraView& view) {
+    switch (key) {
+    case 'c': view = CONTROL_DESK; return true;
+    case 's': view = FRONT_STATION; return true;
+    case 't': view = BEHIND_SHIP; return true;
+    case 'w': view = TOP_VIEW; return true;
+    }
+    return false;
+}
+
+
+void cameraLookAt(CameraView view, const SimState& state, const dvec3& sceneAnchor, dvec3& eye, dvec3& at, vec3& up) {
+    const dvec3& shipPosition = state.shipPosition;
+    const vec3& shipDirection = state.shipDirection;
+
+    if (view == CONTROL_DESK) {
+        //Position the camera slightly behind and above the spaceship looking forward
+        vec3 offset = -normalize(shipDirection) * 3.0f + vec3(0.0f, 0.0f, 1.5f); 
+        eye = shipPosition + dvec3(offset);
+        at = shipPosition + dvec3(normalize(shipDirection) * 10.0f); 
+        up = vec3(0.0, 0.0, 1.0);
+    }
+    else if (view == FRONT_STATION) {
+        // Camera is placed in front of the station looking at it
+        dvec3 stationPos = sceneAnchor + dvec3(100.0, 10.0, 10.0);
+        dvec3 stationFront = dvec3(1.0, 0.0, 0.0);
+        eye = stationPos - stationFront * 30.0;
+        at = stationPos;
+        up = vec3(0.0, 0.0, 1.0);
+    }
+    else if (view == BEHIND_SHIP) {
+        //Camera is behind and above the spaceship looking in its movement direction
+        vec3 offset = -normalize(shipDirection) * 15.0f + vec3(0.0f, 0.0f, 10.0f); 
+        eye = shipPosition + dvec3(offset);
+        at = shipPosition + dvec3(normalize(shipDirection) * 5.0f); 
+        up = vec3(0.0, 0.0, 1.0);
+    }
+    else if (view == TOP_VIEW) {
+        //High above looking down to see the whole scene
+        eye = sceneAnchor + dvec3(100.0, 100.0, 400.0);  
+        at = sceneAnchor + dvec3(100.0, 10.0, 10.0);     
+        up = vec3(0.0, 1.0, 0.0);
+    }
+}
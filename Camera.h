@@ -0,0 +1,31 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- Camera.h ---
+//
+//   The four camera views and where each one puts the camera for a given
+//   ship and station state.  Eye and target are world-space doubles; the
+//   renderer rebases around the eye (see WorldSpace.h).
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __CAMERA_H__
+#define __CAMERA_H__
+
+#include "Angel.h"
+#include "Simulation.h"
+
+enum CameraView {
+    CONTROL_DESK,  
+    FRONT_STATION, 
+    BEHIND_SHIP,   
+    TOP_VIEW       
+};
+
+// Maps the camera keys c/s/t/w to their views; returns false for any other key
+bool cameraViewForKey(char key, CameraView& view);
+
+// Eye, target and up vector of view for the (usually interpolated) state,
+// with the station placed relative to sceneAnchor
+void cameraLookAt(CameraView view, const SimState& state, const dvec3& sceneAnchor, dvec3& eye, dvec3& at, vec3& up);
+
+#endif // __CAMERA_H__
@@ -0,0 +1,306 @@
+#include "ClusteredLighting.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+
+void ClusteredLights::configure(int viewportWidth, int viewportHeight, float fovyDegrees, float nearPlane, float farPlane,
+    int tilesAcross, int tilesUp, int sliceCount) {
+    width = std::max(viewportWidth, 1);
+    height = std::max(viewportHeight, 1);
+    tilesX = std::max(tilesAcross, 1);
+    tilesY = std::max(tilesUp, 1);
+    slices = std::min(std::max(sliceCount, 1), 255);   // slice numbers are kept in bytes
+    zNear = nearPlane;
+    zFar = farPlane;
+
+    projY = 1.0f / tan(fovyDegrees * DegreesToRadians * 0.5f);
+    projX = projY * height / width;
+
+    // Slice 0 is [zNear, ClusterNearDepth); the others split the rest of
+    // the depth range evenly in log depth
+    sliceScale = slices > 1 ? (slices - 1) / log(std::max(zFar / ClusterNearDepth, 1.0001f)) : 0.0f;
+    tileWidth = (width + tilesX - 1) / tilesX;
+    tileHeight = (height + tilesY - 1) / tilesY;
+}
+
+
+// Same expression as the shader's, so fragments look up the slice they were assigned to
+int ClusteredLights::sliceOf(float depth) const {
+    if (depth < ClusterNearDepth) {
+        return 0;
+    }
+    return std::min(slices - 1, 1 + (int)(log(depth / ClusterNearDepth) * sliceScale));
+}
+
+
+float ClusteredLights::sliceNear(int slice) const {
+    return slice == 0 ? zNear : ClusterNearDepth * exp((slice - 1) / sliceScale);
+}
+
+
+float ClusteredLights::sliceFar(int slice) const {
+    return slice == slices - 1 ? zFar : ClusterNearDepth * exp(slice / sliceScale);
+}
+
+
+// Tiles covered by the part of the light's bounding box inside the slice,
+// projected; false when that part is empty or off screen
+bool ClusteredLights::tileRect(const PointLight& light, int slice, TileRect& rect) const {
+    float depth = -light.position[2], radius = light.radius;
+    float d0 = std::max(std::max(sliceNear(slice), depth - radius), zNear);
+    float d1 = std::min(sliceFar(slice), depth + radius);
+    if (d0 > d1) {
+        return false;
+    }
+
+    // x / d over the box is lowest at the near end when x is negative and at
+    // the far end otherwise, and the other way around for the highest
+    float lowX = light.position[0] - radius, highX = light.position[0] + radius;
+    float lowY = light.position[1] - radius, highY = light.position[1] + radius;
+    float ndcX0 = projX * lowX / (lowX < 0.0f ? d0 : d1), ndcX1 = projX * highX / (highX > 0.0f ? d0 : d1);
+    float ndcY0 = projY * lowY / (lowY < 0.0f ? d0 : d1), ndcY1 = projY * highY / (highY > 0.0f ? d0 : d1);
+    if (ndcX1 < -1.0f || ndcX0 > 1.0f || ndcY1 < -1.0f || ndcY0 > 1.0f) {
+        return false;
+    }
+
+    // Pixels from the bottom left, like gl_FragCoord
+    rect.x0 = std::max(0, (int)floor((ndcX0 * 0.5f + 0.5f) * width / tileWidth));
+    rect.x1 = std::min(tilesX - 1, (int)floor((ndcX1 * 0.5f + 0.5f) * width / tileWidth));
+    rect.y0 = std::max(0, (int)floor((ndcY0 * 0.5f + 0.5f) * height / tileHeight));
+    rect.y1 = std::min(tilesY - 1, (int)floor((ndcY1 * 0.5f + 0.5f) * height / tileHeight));
+    return rect.x0 <= rect.x1 && rect.y0 <= rect.y1;
+}
+
+
+// Fills the grid cells of one slice with offsets into sliceIndices[slice]:
+// count the lights per tile, turn the counts into offsets, then place them
+void ClusteredLights::assignSlice(int slice) {
+    std::vector<TileRect>& rects = sliceRects[slice];
+    rects.clear();
+    for (uint32_t k = sliceStart[slice]; k < sliceStart[slice + 1]; k++) {
+        TileRect rect;
+        if (tileRect(eyeLights[sliceLights[k]], slice, rect)) {
+            rect.light = sliceLights[k];
+            rects.push_back(rect);
+        }
+    }
+
+    int tiles = tilesX * tilesY;
+    GLuint* cells = &grid[2 * (size_t)slice * tiles];
+    std::fill(cells, cells + 2 * tiles, 0);
+    for (const TileRect& rect : rects) {
+        for (int y = rect.y0; y <= rect.y1; y++) {
+            for (int x = rect.x0; x <= rect.x1; x++) {
+                cells[2 * (y * tilesX + x) + 1]++;
+            }
+        }
+    }
+    GLuint offset = 0;
+    for (int t = 0; t < tiles; t++) {
+        cells[2 * t] = offset;
+        offset += cells[2 * t + 1];
+        cells[2 * t + 1] = 0;
+    }
+
+    std::vector<GLuint>& list = sliceIndices[slice];
+    list.resize(offset);
+    for (const TileRect& rect : rects) {
+        for (int y = rect.y0; y <= rect.y1; y++) {
+            for (int x = rect.x0; x <= rect.x1; x++) {
+                GLuint* cell = &cells[2 * (y * tilesX + x)];
+                list[cell[0] + cell[1]++] = rect.light;
+            }
+        }
+    }
+}
+
+
+void ClusteredLights::assign(const std::vector<PointLight>& lights, const Simd::Mat4& view, JobSystem& jobs) {
+    auto start = std::chrono::steady_clock::now();
+    size_t count = lights.size();
+    eyeLights.resize(count);
+    firstSlice.resize(count);
+    lastSlice.resize(count);
+
+    // Eye-space positions and the slices each light's depth range covers;
+    // the jobs refer to the body, so it has to outlive them
+    std::function<void(size_t, size_t)> transform = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            PointLight light = lights[i];
+            Simd::Vec4 p = view * Simd::Vec4(light.position[0], light.position[1], light.position[2], 1.0f);
+            light.position[0] = p[0];
+            light.position[1] = p[1];
+            light.position[2] = p[2];
+            eyeLights[i] = light;
+
+            float depth = -p[2];
+            if (depth + light.radius < zNear || depth - light.radius > zFar) {
+                firstSlice[i] = 1;
+                lastSlice[i] = 0;
+            }
+            else {
+                firstSlice[i] = (unsigned char)sliceOf(std::max(depth - light.radius, zNear));
+                lastSlice[i] = (unsigned char)sliceOf(std::min(depth + light.radius, zFar));
+            }
+        }
+    };
+    JobCounter transformed;
+    jobs.parallelFor(count, 1024, transform, transformed);
+    jobs.wait(transformed);
+
+    // Bin the lights by slice, keeping their order within each
+    sliceStart.assign(slices + 1, 0);
+    for (size_t i = 0; i < count; i++) {
+        for (int s = firstSlice[i]; s <= lastSlice[i]; s++) {
+            sliceStart[s + 1]++;
+        }
+    }
+    for (int s = 0; s < slices; s++) {
+        sliceStart[s + 1] += sliceStart[s];
+    }
+    sliceLights.resize(sliceStart[slices]);
+    std::vector<uint32_t> next(sliceStart.begin(), sliceStart.end() - 1);
+    for (size_t i = 0; i < count; i++) {
+        for (int s = firstSlice[i]; s <= lastSlice[i]; s++) {
+            sliceLights[next[s]++] = (uint32_t)i;
+        }
+    }
+
+    // Every slice owns its own cells and list, so slices run independently
+    grid.resize(2 * (size_t)clusterCount());
+    sliceIndices.resize(slices);
+    sliceRects.resize(slices);
+    std::function<void(size_t, size_t)> fill = [this](size_t begin, size_t end) {
+        for (size_t s = begin; s < end; s++) {
+            assignSlice((int)s);
+        }
+    };
+    JobCounter binned;
+    jobs.parallelFor(slices, 1, fill, binned);
+    jobs.wait(binned);
+
+    // Join the slices' lists and rebase their cells onto the joined list
+    size_t total = 0;
+    for (int s = 0; s < slices; s++) {
+        total += sliceIndices[s].size();
+    }
+    indices.resize(total);
+    stats = ClusterStats();
+    int tiles = tilesX * tilesY;
+    GLuint base = 0;
+    std::vector<unsigned char> reached(count, 0);
+    for (int s = 0; s < slices; s++) {
+        const std::vector<GLuint>& list = sliceIndices[s];
+        if (!list.empty()) {
+            memcpy(&indices[base], &list[0], list.size() * sizeof(GLuint));
+        }
+        for (GLuint light : list) {
+            reached[light] = 1;
+        }
+        GLuint* cells = &grid[2 * (size_t)s * tiles];
+        for (int t = 0; t < tiles; t++) {
+            cells[2 * t] += base;
+            if (cells[2 * t + 1] > 0) {
+                stats.occupiedClusters++;
+                stats.maxPerCluster = std::max(stats.maxPerCluster, (int)cells[2 * t + 1]);
+            }
+        }
+        base += (GLuint)list.size();
+    }
+    stats.lights = (int)count;
+    stats.assigned = (int)std::count(reached.begin(), reached.end(), 1);
+    stats.indices = (int)total;
+    stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// Orphans buffer with bytes of data and binds it to a storage binding;
+// a bound storage buffer may not be empty, so nothing still gets a few bytes
+static void streamStorage(GLuint buffer, GLuint binding, size_t bytes, const void* data) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, bytes > 0 ? bytes : 16, bytes > 0 ? data : NULL, GL_STREAM_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+}
+
+
+void ClusteredLights::upload() {
+    if (lightBuffer == 0) {
+        glGenBuffers(1, &lightBuffer);
+        glGenBuffers(1, &gridBuffer);
+        glGenBuffers(1, &indexBuffer);
+        glGenBuffers(1, &dataBuffer);
+    }
+    streamStorage(lightBuffer, PointLightBinding, eyeLights.size() * sizeof(PointLight), eyeLights.data());
+    streamStorage(gridBuffer, ClusterGridBinding, grid.size() * sizeof(GLuint), grid.data());
+    streamStorage(indexBuffer, ClusterIndexBinding, indices.size() * sizeof(GLuint), indices.data());
+
+    ClusterData data = {
+        { tilesX, tilesY, slices, (GLint)eyeLights.size() },
+        { ClusterNearDepth, sliceScale, (GLfloat)tileWidth, (GLfloat)tileHeight }
+    };
+    glBindBuffer(GL_UNIFORM_BUFFER, dataBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(ClusterData), &data, GL_STREAM_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, ClusterDataBinding, dataBuffer);
+}
+
+
+void ClusteredLights::release() {
+    if (lightBuffer != 0) {
+        GLuint buffers[4] = { lightBuffer, gridBuffer, indexBuffer, dataBuffer };
+        glDeleteBuffers(4, buffers);
+        lightBuffer = gridBuffer = indexBuffer = dataBuffer = 0;
+    }
+}
+
+
+// Declarations and lookup inserted by clusteredShaderSource(); the slice
+// and tile expressions match ClusteredLights::sliceOf() and tileRect()
+static const char* clusteredLightingSource = R"(
+#define CLUSTERED_LIGHTING 1
+
+struct PointLight {
+    vec4 PositionRadius; // eye space
+    vec4 Color;
+};
+
+layout (std430, binding = 1) readonly buffer PointLights { PointLight Lights[]; };
+layout (std430, binding = 2) readonly buffer ClusterGrid { uvec2 Clusters[]; };
+layout (std430, binding = 3) readonly buffer ClusterIndices { uint LightIndices[]; };
+
+layout (std140, binding = 1) uniform ClusterData {
+    ivec4 ClusterDims;  // tiles across, tiles up, slices, lights
+    vec4 ClusterScale;  // near depth, slices per unit of log depth, tile size in pixels
+};
+
+// Diffuse light reaching an eye-space point from the lights of its cluster
+vec3 clusteredLighting(vec3 position, vec3 normal) {
+    float depth = -position.z;
+    int slice = depth < ClusterScale.x ? 0 : min(ClusterDims.z - 1, 1 + int(log(depth / ClusterScale.x) * ClusterScale.y));
+    ivec2 tile = min(ivec2(gl_FragCoord.xy / ClusterScale.zw), ClusterDims.xy - 1);
+    uvec2 cluster = Clusters[(slice * ClusterDims.y + tile.y) * ClusterDims.x + tile.x];
+
+    vec3 light = vec3(0.0);
+    for (uint i = 0u; i < cluster.y; i++) {
+        PointLight l = Lights[LightIndices[cluster.x + i]];
+        vec3 toLight = l.PositionRadius.xyz - position;
+        float distance = length(toLight);
+        // Falls smoothly to zero at the radius, which is what lights are clustered by
+        float x = min(distance / l.PositionRadius.w, 1.0);
+        float falloff = (1.0 - x * x) * (1.0 - x * x);
+        light += l.Color.rgb * (max(dot(normal, toLight / max(distance, 1e-4)), 0.0) * falloff);
+    }
+    return light;
+}
+)";
+
+
+std::string clusteredShaderSource(const char* source) {
+    const char* version = strstr(source, "#version");
+    const char* body = version ? strchr(version, '\n') : nullptr;
+    if (!body) {
+        return source;
+    }
+    return std::string("#version 430 core\n") + clusteredLightingSource + body;
+}
@@ -0,0 +1,126 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- ClusteredLighting.h ---
+//
+//   Clustered forward shading for many dynamic point lights.  The view
+//   frustum is cut into a grid of clusters: screen tiles across, and depth
+//   slices that grow exponentially with distance (everything closer than
+//   ClusterNearDepth shares the first slice).  Each frame the lights are
+//   moved to eye space and every cluster gets the list of lights whose
+//   range reaches into it, on the job system: lights are binned by slice
+//   first, then each slice fills its own clusters, so no two jobs write
+//   the same list.
+//
+//   The lights, the per-cluster (offset, count) grid and the concatenated
+//   light index lists go to the GPU in three shader storage buffers, the
+//   grid parameters in a small uniform block.  A fragment shader built
+//   with clusteredShaderSource() finds its cluster from gl_FragCoord and
+//   its eye depth and loops over that cluster's lights only.  Needs
+//   OpenGL 4.3.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __CLUSTEREDLIGHTING_H__
+#define __CLUSTEREDLIGHTING_H__
+
+#include <GL/glew.h>
+#include "JobSystem.h"
+#include "SimdMath.h"
+#include <string>
+#include <vector>
+
+// Default grid: 16x9 screen tiles by 24 depth slices
+const int ClusterTilesX = 16, ClusterTilesY = 9, ClusterSlices = 24;
+
+// Eye depth where the exponential slices start
+const float ClusterNearDepth = 1.0f;
+
+// Binding points of the storage buffers and of the ClusterData uniform
+// block; uniform blocks and storage buffers count bindings separately
+const GLuint PointLightBinding = 1, ClusterGridBinding = 2, ClusterIndexBinding = 3;
+const GLuint ClusterDataBinding = 1;
+
+// std430 layout of one light
+struct PointLight {
+    GLfloat position[3];   // world space when handed to assign(), eye space on the GPU
+    GLfloat radius;        // the light fades to nothing here
+    GLfloat color[4];      // rgb scaled by intensity, a unused
+};
+
+// std140 layout of the ClusterData uniform block
+struct ClusterData {
+    GLint dims[4];         // tiles across, tiles up, slices, lights
+    GLfloat scale[4];      // ClusterNearDepth, slices per unit of log depth, tile width and height in pixels
+};
+
+// Counts from the last assign()
+struct ClusterStats {
+    int lights = 0;            // handed in
+    int assigned = 0;          // reaching into at least one cluster
+    int indices = 0;           // light references over every cluster
+    int occupiedClusters = 0;
+    int maxPerCluster = 0;
+    double milliseconds = 0.0; // eye-space transform and assignment
+};
+
+class ClusteredLights {
+public:
+    // Sets the grid for a viewport and projection; cheap, so it can run
+    // every frame.  The tile counts default to the ClusterTiles constants.
+    void configure(int width, int height, float fovyDegrees, float zNear, float zFar,
+        int tilesX = ClusterTilesX, int tilesY = ClusterTilesY, int slices = ClusterSlices);
+
+    // Moves lights to eye space with view and rebuilds every cluster's list
+    void assign(const std::vector<PointLight>& lights, const Simd::Mat4& view, JobSystem& jobs);
+
+    // Streams the lights, grid and index lists into their buffers (created
+    // on first use) and binds them and the ClusterData block
+    void upload();
+
+    void release();
+
+    int clusterCount() const { return tilesX * tilesY * slices; }
+
+    ClusterStats stats;
+
+private:
+    struct TileRect {
+        uint32_t light;
+        int x0, y0, x1, y1;
+    };
+
+    int sliceOf(float depth) const;
+    float sliceNear(int slice) const;
+    float sliceFar(int slice) const;
+    bool tileRect(const PointLight& light, int slice, TileRect& rect) const;
+    void assignSlice(int slice);
+
+    int width = 1, height = 1;
+    int tilesX = ClusterTilesX, tilesY = ClusterTilesY, slices = ClusterSlices;
+    float zNear = 0.1f, zFar = 1000.0f;
+    float projX = 1.0f, projY = 1.0f;   // the projection's x and y scale
+    float sliceScale = 1.0f;
+    int tileWidth = 1, tileHeight = 1;
+
+    std::vector<PointLight> eyeLights;
+    std::vector<unsigned char> firstSlice, lastSlice;   // lastSlice < firstSlice when out of range
+
+    // Lights touching each slice, concatenated; slice s is [sliceStart[s], sliceStart[s + 1])
+    std::vector<uint32_t> sliceStart, sliceLights;
+
+    // Filled per slice in parallel, then joined into grid and indices
+    std::vector<std::vector<GLuint>> sliceIndices;
+    std::vector<std::vector<TileRect>> sliceRects;
+    std::vector<GLuint> grid;      // (offset, count) per cluster, slice by slice, tile row by tile row
+    std::vector<GLuint> indices;
+
+    GLuint lightBuffer = 0, gridBuffer = 0, indexBuffer = 0, dataBuffer = 0;
+};
+
+// Turns a fragment shader for "#version 330 core" into its clustered
+// variant: version 430, CLUSTERED_LIGHTING defined, and the light buffers
+// and vec3 clusteredLighting(vec3 eyePosition, vec3 normal) declared ahead
+// of the rest of the source
+std::string clusteredShaderSource(const char* source);
+
+#endif // __CLUSTEREDLIGHTING_H__
@@ -0,0 +1,332 @@
+#include "Collision.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <random>
+
+static const uint64_t EmptyCell = ~0ull;
+static const uint32_t NoEntry = ~0u;
+
+// Cell coordinates are biased into 21 bits each, about +-1M cells per axis
+static const int CellBias = 1 << 20;
+
+
+static uint64_t cellKey(int x, int y, int z) {
+    return (uint64_t)(x + CellBias) << 42 | (uint64_t)(y + CellBias) << 21 | (uint64_t)(z + CellBias);
+}
+
+
+// splitmix64 finalizer, so neighbouring cells land far apart in the table
+static uint64_t mixKey(uint64_t key) {
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ull;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebull;
+    return key ^ (key >> 31);
+}
+
+
+SpatialHash::SpatialHash(float cellSize) : cellSize(cellSize), inverseCellSize(1.0f / cellSize), freeEntries(NoEntry) {
+    keys.assign(1024, EmptyCell);
+    heads.assign(1024, NoEntry);
+}
+
+
+void SpatialHash::clear() {
+    spheres.clear();
+    ranges.clear();
+    entries.clear();
+    freeEntries = NoEntry;
+    keys.assign(1024, EmptyCell);
+    heads.assign(1024, NoEntry);
+    usedCells = 0;
+    relinks = 0;
+}
+
+
+SpatialHash::CellRange SpatialHash::cellRange(const BoundingSphere& sphere) const {
+    CellRange range;
+    for (int axis = 0; axis < 3; axis++) {
+        range.lo[axis] = (int)std::floor((sphere.center[axis] - sphere.radius) * inverseCellSize);
+        range.hi[axis] = (int)std::floor((sphere.center[axis] + sphere.radius) * inverseCellSize);
+    }
+    return range;
+}
+
+
+size_t SpatialHash::findSlot(uint64_t key) const {
+    size_t mask = keys.size() - 1;
+    for (size_t slot = mixKey(key) & mask;; slot = (slot + 1) & mask) {
+        if (keys[slot] == key || keys[slot] == EmptyCell) {
+            return slot;
+        }
+    }
+}
+
+
+size_t SpatialHash::claimSlot(uint64_t key) {
+    size_t slot = findSlot(key);
+    if (keys[slot] == key) {
+        return slot;
+    }
+    // Cells stay in the table once used; growing drops the empty ones
+    if ((usedCells + 1) * 2 > keys.size()) {
+        grow();
+        slot = findSlot(key);
+    }
+    keys[slot] = key;
+    heads[slot] = NoEntry;
+    usedCells++;
+    return slot;
+}
+
+
+void SpatialHash::grow() {
+    std::vector<uint64_t> oldKeys;
+    std::vector<uint32_t> oldHeads;
+    oldKeys.swap(keys);
+    oldHeads.swap(heads);
+
+    size_t live = 0;
+    for (size_t i = 0; i < oldKeys.size(); i++) {
+        live += oldKeys[i] != EmptyCell && oldHeads[i] != NoEntry;
+    }
+    size_t capacity = 1024;
+    while (capacity < live * 4) {
+        capacity *= 2;
+    }
+    keys.assign(capacity, EmptyCell);
+    heads.assign(capacity, NoEntry);
+    usedCells = 0;
+    for (size_t i = 0; i < oldKeys.size(); i++) {
+        if (oldKeys[i] != EmptyCell && oldHeads[i] != NoEntry) {
+            size_t slot = findSlot(oldKeys[i]);
+            keys[slot] = oldKeys[i];
+            heads[slot] = oldHeads[i];
+            usedCells++;
+        }
+    }
+}
+
+
+void SpatialHash::link(uint32_t id, const CellRange& range) {
+    for (int x = range.lo[0]; x <= range.hi[0]; x++) {
+        for (int y = range.lo[1]; y <= range.hi[1]; y++) {
+            for (int z = range.lo[2]; z <= range.hi[2]; z++) {
+                size_t slot = claimSlot(cellKey(x, y, z));
+                uint32_t entry;
+                if (freeEntries != NoEntry) {
+                    entry = freeEntries;
+                    freeEntries = entries[entry].next;
+                }
+                else {
+                    entry = (uint32_t)entries.size();
+                    entries.push_back(Entry());
+                }
+                entries[entry].body = id;
+                entries[entry].next = heads[slot];
+                heads[slot] = entry;
+            }
+        }
+    }
+}
+
+
+void SpatialHash::unlink(uint32_t id, const CellRange& range) {
+    for (int x = range.lo[0]; x <= range.hi[0]; x++) {
+        for (int y = range.lo[1]; y <= range.hi[1]; y++) {
+            for (int z = range.lo[2]; z <= range.hi[2]; z++) {
+                size_t slot = findSlot(cellKey(x, y, z));
+                uint32_t* link = &heads[slot];
+                while (*link != NoEntry && entries[*link].body != id) {
+                    link = &entries[*link].next;
+                }
+                if (*link != NoEntry) {
+                    uint32_t entry = *link;
+                    *link = entries[entry].next;
+                    entries[entry].next = freeEntries;
+                    freeEntries = entry;
+                }
+            }
+        }
+    }
+}
+
+
+uint32_t SpatialHash::insert(const BoundingSphere& sphere) {
+    uint32_t id = (uint32_t)spheres.size();
+    spheres.push_back(sphere);
+    ranges.push_back(cellRange(sphere));
+    link(id, ranges[id]);
+    return id;
+}
+
+
+void SpatialHash::update(uint32_t id, const BoundingSphere& sphere) {
+    spheres[id] = sphere;
+    CellRange range = cellRange(sphere);
+    const CellRange& old = ranges[id];
+    if (memcmp(&range, &old, sizeof(range)) == 0) {
+        return;
+    }
+    unlink(id, old);
+    link(id, range);
+    ranges[id] = range;
+    relinks++;
+}
+
+
+void SpatialHash::query(const BoundingSphere& sphere, std::vector<uint32_t>& candidates) const {
+    CellRange range = cellRange(sphere);
+    for (int x = range.lo[0]; x <= range.hi[0]; x++) {
+        for (int y = range.lo[1]; y <= range.hi[1]; y++) {
+            for (int z = range.lo[2]; z <= range.hi[2]; z++) {
+                size_t slot = findSlot(cellKey(x, y, z));
+                for (uint32_t entry = heads[slot]; entry != NoEntry; entry = entries[entry].next) {
+                    // Only the first shared cell reports the body
+                    const CellRange& body = ranges[entries[entry].body];
+                    if (x == std::max(body.lo[0], range.lo[0]) && y == std::max(body.lo[1], range.lo[1])
+                        && z == std::max(body.lo[2], range.lo[2])) {
+                        candidates.push_back(entries[entry].body);
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+ShipCollider makeShipCollider(const ShipShape& shape, const vec3& position, const vec3& direction) {
+    // Same heading the renderer applies with RotateZ
+    float angle = std::atan2(direction.y, direction.x);
+    float c = std::cos(angle), s = std::sin(angle);
+    vec3 nose = shape.noseCenter;
+
+    ShipCollider ship;
+    ship.bounds.center = position;
+    ship.bounds.radius = shape.boundsRadius;
+    ship.parts[0].center = position;
+    ship.parts[0].radius = shape.hullRadius;
+    ship.parts[1].center = position + vec3(c * nose.x - s * nose.y, s * nose.x + c * nose.y, nose.z);
+    ship.parts[1].radius = shape.noseRadius;
+    return ship;
+}
+
+
+void CollisionWorld::collide(const ShipCollider* ships, size_t count, std::vector<CollisionEvent>& events,
+    ThreadPool& pool) {
+    auto start = std::chrono::steady_clock::now();
+    size_t firstEvent = events.size();
+    std::mutex merge;
+    size_t candidates = 0;
+
+    pool.parallelFor(count, 64, [&](size_t begin, size_t end) {
+        std::vector<uint32_t> found;
+        std::vector<CollisionEvent> local;
+        size_t localCandidates = 0;
+        for (size_t i = begin; i < end; i++) {
+            found.clear();
+            bodies.query(ships[i].bounds, found);
+            localCandidates += found.size();
+            for (uint32_t id : found) {
+                const BoundingSphere& body = bodies.bounds(id);
+                CollisionEvent contact = { (uint32_t)i, id, vec3(0.0f, 0.0f, 1.0f), 0.0f };
+                for (const BoundingSphere& part : ships[i].parts) {
+                    vec3 offset = part.center - body.center;
+                    float distance = length(offset);
+                    float depth = part.radius + body.radius - distance;
+                    if (depth > contact.depth) {
+                        contact.depth = depth;
+                        contact.normal = distance > 1e-6f ? offset / distance : vec3(0.0f, 0.0f, 1.0f);
+                    }
+                }
+                if (contact.depth > 0.0f) {
+                    local.push_back(contact);
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(merge);
+        events.insert(events.end(), local.begin(), local.end());
+        candidates += localCandidates;
+    });
+
+    // Chunks finish in any order; sort so results don't depend on the thread count
+    std::sort(events.begin() + firstEvent, events.end(), [](const CollisionEvent& a, const CollisionEvent& b) {
+        return a.ship != b.ship ? a.ship < b.ship : a.body < b.body;
+    });
+
+    auto end = std::chrono::steady_clock::now();
+    stats.candidates = candidates;
+    stats.contacts = events.size() - firstEvent;
+    stats.milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+
+void benchmarkCollisions() {
+    const int staticCount = 1000000, movingCount = 10000;
+    const int shipCounts[] = { 1000, 4000, 16000 };
+    const int ticks = 60;
+    ThreadPool& pool = defaultThreadPool();
+
+    // Planet-sized bodies about ten units apart, like the scattered planet field
+    std::mt19937 rng(1969);
+    const float side = 1000.0f;
+    std::uniform_real_distribution<float> coordinate(-side * 0.5f, side * 0.5f);
+    std::uniform_real_distribution<float> radius(0.25f, 1.25f);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    CollisionWorld world;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < staticCount; i++) {
+        BoundingSphere body = { vec3(coordinate(rng), coordinate(rng), coordinate(rng)), radius(rng) };
+        world.bodies.insert(body);
+    }
+    auto end = std::chrono::steady_clock::now();
+    printf("spatial hash: %d bodies in %zu cells, built in %.1f ms, %u threads\n", staticCount,
+        world.bodies.cellCount(), std::chrono::duration<double, std::milli>(end - start).count(), pool.size());
+
+    // The first movingCount bodies drift; everything else stays put
+    std::vector<vec3> drift(movingCount);
+    for (vec3& velocity : drift) {
+        velocity = vec3(unit(rng), unit(rng), unit(rng)) * 0.5f;
+    }
+
+    printf("  ships   relink ms/tick   query ms/tick   us/ship   candidates/ship   contacts/tick\n");
+    for (int shipCount : shipCounts) {
+        std::vector<vec3> positions(shipCount), directions(shipCount);
+        for (int i = 0; i < shipCount; i++) {
+            positions[i] = vec3(coordinate(rng), coordinate(rng), coordinate(rng));
+            directions[i] = normalize(vec3(unit(rng), unit(rng), 0.0f) + vec3(1e-3f, 0.0f, 0.0f));
+        }
+
+        std::vector<ShipCollider> ships(shipCount);
+        std::vector<CollisionEvent> events;
+        double relinkMs = 0.0, queryMs = 0.0;
+        size_t candidates = 0, contacts = 0;
+        for (int tick = 0; tick < ticks; tick++) {
+            start = std::chrono::steady_clock::now();
+            for (int i = 0; i < movingCount; i++) {
+                BoundingSphere body = world.bodies.bounds(i);
+                body.center += drift[i];
+                world.bodies.update(i, body);
+            }
+            end = std::chrono::steady_clock::now();
+            relinkMs += std::chrono::duration<double, std::milli>(end - start).count();
+
+            for (int i = 0; i < shipCount; i++) {
+                positions[i] += directions[i] * 2.0f;
+                ships[i] = makeShipCollider(world.shipShape, positions[i], directions[i]);
+            }
+            events.clear();
+            world.collide(&ships[0], ships.size(), events, pool);
+            queryMs += world.stats.milliseconds;
+            candidates += world.stats.candidates;
+            contacts += world.stats.contacts;
+        }
+        printf("%7d %16.3f %15.3f %9.3f %17.2f %15.1f\n", shipCount, relinkMs / ticks, queryMs / ticks,
+            queryMs * 1000.0 / ticks / shipCount, (double)candidates / ticks / shipCount, (double)contacts / ticks);
+    }
+    printf("%llu relinks of %d moving bodies over %d ticks\n", (unsigned long long)world.bodies.relinks,
+        movingCount, ticks * 3);
+}
@@ -0,0 +1,122 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- Collision.h ---
+//
+//   Ship collisions against planets and the station.  The broad phase is
+//   a uniform grid stored as a spatial hash: each body is linked into
+//   every cell its bounding sphere overlaps, and moving a body only
+//   relinks it when its cell range changes.  A query walks the cells of
+//   the ship's bounds and reports each body once, from the first cell the
+//   two ranges share, so queries need no scratch state and run in
+//   parallel.  The narrow phase tests the ship's part spheres (hull tori
+//   and nose) against the body sphere and turns the deepest overlap into
+//   a contact event for the simulation step.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __COLLISION_H__
+#define __COLLISION_H__
+
+#include "Angel.h"
+#include "Culling.h"
+#include "ThreadPool.h"
+#include <stdint.h>
+#include <vector>
+
+class SpatialHash {
+public:
+    // cellSize should be around the diameter of a typical body
+    explicit SpatialHash(float cellSize = 8.0f);
+
+    void clear();
+
+    // Adds a body and returns its id; ids count up from 0
+    uint32_t insert(const BoundingSphere& sphere);
+
+    // Moves or resizes a body; its cells are only touched when their range changes
+    void update(uint32_t id, const BoundingSphere& sphere);
+
+    // Appends every body whose cells overlap the sphere's cells, each once
+    void query(const BoundingSphere& sphere, std::vector<uint32_t>& candidates) const;
+
+    const BoundingSphere& bounds(uint32_t id) const { return spheres[id]; }
+    size_t size() const { return spheres.size(); }
+    size_t cellCount() const { return usedCells; }
+
+    // Updates that had to relink a body into other cells
+    uint64_t relinks = 0;
+
+private:
+    struct CellRange {
+        int lo[3], hi[3];
+    };
+    struct Entry {
+        uint32_t body;
+        uint32_t next; // next entry in the same cell
+    };
+
+    CellRange cellRange(const BoundingSphere& sphere) const;
+    void link(uint32_t id, const CellRange& range);
+    void unlink(uint32_t id, const CellRange& range);
+
+    // Open-addressing table from cell key to the head of its entry list
+    size_t findSlot(uint64_t key) const;
+    size_t claimSlot(uint64_t key);
+    void grow();
+
+    float cellSize, inverseCellSize;
+    std::vector<BoundingSphere> spheres;
+    std::vector<CellRange> ranges;
+    std::vector<Entry> entries;
+    uint32_t freeEntries;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> heads;
+    size_t usedCells = 0;
+};
+
+// Ship collision parts in ship space (x forward, heading rotates about z)
+struct ShipShape {
+    float hullRadius = 3.2f;           // both tori, centered on the ship
+    vec3 noseCenter = vec3(3.0f, 0.0f, 0.0f);
+    float noseRadius = 1.5f;
+    float boundsRadius = 4.5f;         // encloses every part
+};
+
+struct ShipCollider {
+    BoundingSphere bounds;
+    BoundingSphere parts[2];           // hull, nose
+};
+
+ShipCollider makeShipCollider(const ShipShape& shape, const vec3& position, const vec3& direction);
+
+// Contact between a ship and a body; moving the ship depth along normal separates them
+struct CollisionEvent {
+    uint32_t ship;
+    uint32_t body;
+    vec3 normal;                       // unit, from the body toward the ship
+    float depth;
+};
+
+struct CollisionStats {
+    size_t candidates = 0;             // bodies the broad phase returned
+    size_t contacts = 0;
+    double milliseconds = 0.0;
+};
+
+class CollisionWorld {
+public:
+    SpatialHash bodies;
+    ShipShape shipShape;
+
+    // Appends the contacts of every ship, sorted by ship then body
+    void collide(const ShipCollider* ships, size_t count, std::vector<CollisionEvent>& events,
+        ThreadPool& pool = defaultThreadPool());
+
+    CollisionStats stats;              // of the last collide()
+};
+
+// Times building the hash over a million static bodies, relinking moving
+// ones, and querying thousands of moving ships per tick
+void benchmarkCollisions();
+
+#endif // __COLLISION_H__
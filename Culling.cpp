@@ -0,0 +1,162 @@
+#include "Culling.h"
+#include <algorithm>
+
+// Items per leaf; small leaves keep the per-item tests near the camera cheap
+static const uint32_t LeafSize = 4;
+
+
+Frustum extractFrustum(const mat4& m) {
+    Frustum frustum;
+    frustum.planes[0] = m[3] + m[0]; // left
+    frustum.planes[1] = m[3] - m[0]; // right
+    frustum.planes[2] = m[3] + m[1]; // bottom
+    frustum.planes[3] = m[3] - m[1]; // top
+    frustum.planes[4] = m[3] + m[2]; // near
+    frustum.planes[5] = m[3] - m[2]; // far
+    for (int i = 0; i < 6; i++) {
+        vec4& p = frustum.planes[i];
+        float normal = length(vec3(p.x, p.y, p.z));
+        // An infinite far plane comes out as (0, 0, 0, w): keep everything
+        p = normal > 1e-6f ? p / normal : vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+    return frustum;
+}
+
+
+static float planeDistance(const vec4& plane, const vec3& point) {
+    return plane.x * point.x + plane.y * point.y + plane.z * point.z + plane.w;
+}
+
+
+bool sphereInFrustum(const Frustum& frustum, const BoundingSphere& sphere) {
+    for (int i = 0; i < 6; i++) {
+        if (planeDistance(frustum.planes[i], sphere.center) < -sphere.radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+BoundingSphere transformBounds(const mat4& model, const vec3* points, int count) {
+    BoundingSphere sphere;
+    vec4 c = model * vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    sphere.center = vec3(c.x, c.y, c.z);
+    sphere.radius = 0.0f;
+    for (int i = 0; i < count; i++) {
+        vec4 p = model * vec4(points[i], 1.0f);
+        sphere.radius = std::max(sphere.radius, length(vec3(p.x, p.y, p.z) - sphere.center));
+    }
+    return sphere;
+}
+
+
+void BoundingVolumeHierarchy::build(const std::vector<BoundingSphere>& items) {
+    spheres = items;
+    nodes.clear();
+    order.resize(items.size());
+    for (uint32_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    if (!items.empty()) {
+        nodes.reserve(2 * items.size() / LeafSize + 1);
+        buildNode(0, (uint32_t)items.size());
+    }
+}
+
+
+uint32_t BoundingVolumeHierarchy::buildNode(uint32_t first, uint32_t count) {
+    vec3 lo = vec3(1e30f), hi = vec3(-1e30f);
+    for (uint32_t i = first; i < first + count; i++) {
+        const BoundingSphere& s = spheres[order[i]];
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::min(lo[a], s.center[a] - s.radius);
+            hi[a] = std::max(hi[a], s.center[a] + s.radius);
+        }
+    }
+
+    uint32_t index = (uint32_t)nodes.size();
+    nodes.push_back(Node());
+    nodes[index].center = (lo + hi) * 0.5f;
+    nodes[index].extent = (hi - lo) * 0.5f;
+    nodes[index].first = first;
+    nodes[index].count = count;
+    nodes[index].left = nodes[index].right = 0;
+
+    if (count <= LeafSize) {
+        return index;
+    }
+
+    // Median split along the longest axis of the box
+    vec3 size = hi - lo;
+    int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+    uint32_t half = count / 2;
+    const std::vector<BoundingSphere>& s = spheres;
+    std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+        [&s, axis](uint32_t a, uint32_t b) { return s[a].center[axis] < s[b].center[axis]; });
+
+    uint32_t left = buildNode(first, half);
+    uint32_t right = buildNode(first + half, count - half);
+    nodes[index].left = left;
+    nodes[index].right = right;
+    return index;
+}
+
+
+void BoundingVolumeHierarchy::cull(const Frustum& frustum, std::vector<uint32_t>& visible, CullStats& stats) const {
+    size_t before = visible.size();
+    if (!nodes.empty()) {
+        cullNode(0, frustum, 0x3F, visible, stats);
+    }
+    int accepted = (int)(visible.size() - before);
+    stats.visible += accepted;
+    stats.culled += (int)spheres.size() - accepted;
+}
+
+
+void BoundingVolumeHierarchy::cullNode(uint32_t index, const Frustum& frustum, unsigned planeMask,
+    std::vector<uint32_t>& visible, CullStats& stats) const {
+    const Node& node = nodes[index];
+    stats.nodesVisited++;
+
+    // Box against each plane still straddled by the parent
+    for (int i = 0; i < 6; i++) {
+        if (!(planeMask & (1u << i))) {
+            continue;
+        }
+        const vec4& p = frustum.planes[i];
+        float distance = planeDistance(p, node.center);
+        float reach = node.extent.x * fabs(p.x) + node.extent.y * fabs(p.y) + node.extent.z * fabs(p.z);
+        if (distance < -reach) {
+            return;
+        }
+        if (distance >= reach) {
+            planeMask &= ~(1u << i);
+        }
+    }
+
+    // Entirely inside: take the whole subtree without testing anything else
+    if (planeMask == 0) {
+        visible.insert(visible.end(), order.begin() + node.first, order.begin() + node.first + node.count);
+        return;
+    }
+
+    if (node.left == 0) {
+        for (uint32_t i = node.first; i < node.first + node.count; i++) {
+            const BoundingSphere& s = spheres[order[i]];
+            bool inside = true;
+            for (int p = 0; p < 6 && inside; p++) {
+                if ((planeMask & (1u << p)) && planeDistance(frustum.planes[p], s.center) < -s.radius) {
+                    inside = false;
+                }
+            }
+            if (inside) {
+                visible.push_back(order[i]);
+            }
+        }
+        return;
+    }
+
+    cullNode(node.left, frustum, planeMask, visible, stats);
+    cullNode(node.right, frustum, planeMask, visible, stats);
+}
@@ -0,0 +1,73 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- Culling.h ---
+//
+//   View-frustum culling.  Every object carries a bounding sphere; static
+//   bodies are collected into a bounding volume hierarchy (axis-aligned
+//   boxes, built top-down by median split) that is tested against the six
+//   planes extracted from Projection * View.  Subtrees fully inside the
+//   frustum are accepted without further tests, and planes a parent is
+//   already inside are skipped for its children.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __CULLING_H__
+#define __CULLING_H__
+
+#include "Angel.h"
+#include <vector>
+#include <stdint.h>
+
+struct BoundingSphere {
+    vec3 center;
+    float radius;
+};
+
+// Planes as (a, b, c, d) with a*x + b*y + c*z + d >= 0 inside, normals unit length
+struct Frustum {
+    vec4 planes[6];
+};
+
+// Gribb/Hartmann extraction from a row-major Angel projection * view matrix
+Frustum extractFrustum(const mat4& viewProjection);
+
+bool sphereInFrustum(const Frustum& frustum, const BoundingSphere& sphere);
+
+// Bounding sphere of a set of points after a model transform
+BoundingSphere transformBounds(const mat4& model, const vec3* points, int count);
+
+struct CullStats {
+    int visible = 0;
+    int culled = 0;
+    int nodesVisited = 0;
+    double milliseconds = 0.0;
+};
+
+class BoundingVolumeHierarchy {
+public:
+    // Builds over the given spheres; item ids are their indices
+    void build(const std::vector<BoundingSphere>& items);
+
+    // Appends the ids of every item whose sphere touches the frustum
+    void cull(const Frustum& frustum, std::vector<uint32_t>& visible, CullStats& stats) const;
+
+    size_t itemCount() const { return spheres.size(); }
+
+private:
+    struct Node {
+        vec3 center;          // box center
+        vec3 extent;          // box half size
+        uint32_t first, count; // range of order covered by the subtree
+        uint32_t left, right;  // children; left is 0 for leaves (the root is never a child)
+    };
+
+    uint32_t buildNode(uint32_t first, uint32_t count);
+    void cullNode(uint32_t node, const Frustum& frustum, unsigned planeMask,
+        std::vector<uint32_t>& visible, CullStats& stats) const;
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> order;       // item ids, grouped so every subtree is contiguous
+    std::vector<BoundingSphere> spheres;
+};
+
+#endif // __CULLING_H__
@@ -0,0 +1,316 @@
+#include "Fleet.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+
+void FleetStore::resize(size_t count) {
+    for (std::vector<float>* array : { &px, &py, &pz, &vx, &vy, &vz, &goalX, &goalY, &goalZ, &slotX, &slotY,
+        &avoidX, &avoidY, &avoidZ, &targetX, &targetY, &targetZ, &ax, &ay, &az }) {
+        array->assign(count, 0.0f);
+    }
+    leader.assign(count, -1);
+}
+
+
+// splitmix64, so waypoints depend only on the ship and the tick, never on
+// which worker picked them
+static uint64_t mix(uint64_t value) {
+    value += 0x9e3779b97f4a7c15ull;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+}
+
+static float unitFloat(uint64_t bits) {
+    return (float)(bits >> 40) / (float)(1 << 24);
+}
+
+
+Fleet::Fleet() {
+    auto count = [this] { return ships.size(); };
+    int obstacles = graph.add("sense obstacles", count, 256, [this](size_t b, size_t e) { senseObstacles(b, e); });
+    int formation = graph.add("sense formation", count, 1024, [this](size_t b, size_t e) { senseFormation(b, e); });
+    int decision = graph.add("decide", count, 1024, [this](size_t b, size_t e) { decide(b, e); });
+    int integration = graph.add("integrate", count, 2048, [this](size_t b, size_t e) { integrate(b, e); });
+    int instances = graph.add("build instances", count, 512, [this](size_t b, size_t e) { buildInstances(b, e); });
+    graph.depends(decision, obstacles);
+    graph.depends(decision, formation);
+    graph.depends(integration, decision);
+    graph.depends(instances, integration);
+}
+
+
+void Fleet::spawn(int count, const vec3& center, float spread, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> offset(-spread, spread);
+    areaMin = center - vec3(spread, spread, spread * 0.25f);
+    areaMax = center + vec3(spread, spread, spread * 0.25f);
+
+    ships.resize(count);
+    int32_t squadLeader = -1;
+    for (int i = 0; i < count; i++) {
+        int wing = i % FleetSquadronSize;
+        if (wing == 0) {
+            squadLeader = i;
+            ships.px[i] = center.x + offset(rng);
+            ships.py[i] = center.y + offset(rng);
+            ships.pz[i] = center.z + offset(rng) * 0.25f;
+            ships.goalX[i] = ships.px[i];
+            ships.goalY[i] = ships.py[i];
+            ships.goalZ[i] = ships.pz[i];
+            ships.leader[i] = -1;
+            continue;
+        }
+        // V formation: alternate sides, one rank further back every pair
+        int rank = (wing + 1) / 2;
+        ships.leader[i] = squadLeader;
+        ships.slotX[i] = -6.0f * rank;
+        ships.slotY[i] = (wing % 2 ? 5.0f : -5.0f) * rank;
+        ships.px[i] = ships.px[squadLeader] + ships.slotX[i];
+        ships.py[i] = ships.py[squadLeader] + ships.slotY[i];
+        ships.pz[i] = ships.pz[squadLeader];
+    }
+    tick = 0;
+}
+
+
+void Fleet::step(JobSystem& jobs) {
+    hullInstances.resize(ships.size() * 2);
+    noseInstances.resize(ships.size());
+    graph.run(jobs);
+    tick++;
+}
+
+
+void Fleet::senseObstacles(size_t begin, size_t end) {
+    FleetStore& s = ships;
+    std::vector<uint32_t> found;
+    for (size_t i = begin; i < end; i++) {
+        float avoid[3] = { 0.0f, 0.0f, 0.0f };
+        if (obstacles) {
+            vec3 position(s.px[i], s.py[i], s.pz[i]);
+            BoundingSphere range = { position, senseRadius };
+            found.clear();
+            obstacles->query(range, found);
+            // Push away from every body in range, harder the closer its surface
+            for (uint32_t id : found) {
+                const BoundingSphere& body = obstacles->bounds(id);
+                vec3 away = position - body.center;
+                float distance = length(away);
+                float clearance = distance - body.radius;
+                if (clearance < senseRadius && distance > 1e-4f) {
+                    float weight = std::min(1.0f, (senseRadius - clearance) / senseRadius);
+                    for (int axis = 0; axis < 3; axis++) {
+                        avoid[axis] += away[axis] / distance * weight;
+                    }
+                }
+            }
+        }
+        s.avoidX[i] = avoid[0];
+        s.avoidY[i] = avoid[1];
+        s.avoidZ[i] = avoid[2];
+    }
+}
+
+
+void Fleet::senseFormation(size_t begin, size_t end) {
+    FleetStore& s = ships;
+    for (size_t i = begin; i < end; i++) {
+        int32_t lead = s.leader[i];
+        if (lead < 0) {
+            s.targetX[i] = s.goalX[i];
+            s.targetY[i] = s.goalY[i];
+            s.targetZ[i] = s.goalZ[i];
+            continue;
+        }
+        // Slot turned by the leader's heading, like the ship transform's RotateZ
+        float speed = std::hypot(s.vx[lead], s.vy[lead]);
+        float c = speed > 1e-5f ? s.vx[lead] / speed : 1.0f;
+        float n = speed > 1e-5f ? s.vy[lead] / speed : 0.0f;
+        s.targetX[i] = s.px[lead] + c * s.slotX[i] - n * s.slotY[i];
+        s.targetY[i] = s.py[lead] + n * s.slotX[i] + c * s.slotY[i];
+        s.targetZ[i] = s.pz[lead];
+    }
+}
+
+
+void Fleet::decide(size_t begin, size_t end) {
+    FleetStore& s = ships;
+    for (size_t i = begin; i < end; i++) {
+        float to[3] = { s.targetX[i] - s.px[i], s.targetY[i] - s.py[i], s.targetZ[i] - s.pz[i] };
+        float distance = std::sqrt(to[0] * to[0] + to[1] * to[1] + to[2] * to[2]);
+        float desired[3];
+        int32_t lead = s.leader[i];
+        if (lead < 0) {
+            // Seek the waypoint, slowing down on arrival, and pick the next one there
+            float speed = maxSpeed * std::min(1.0f, distance / 20.0f);
+            for (int axis = 0; axis < 3; axis++) {
+                desired[axis] = distance > 1e-4f ? to[axis] / distance * speed : 0.0f;
+            }
+            if (distance < 5.0f) {
+                uint64_t bits = mix((uint64_t)i << 32 ^ tick);
+                s.goalX[i] = areaMin.x + (areaMax.x - areaMin.x) * unitFloat(bits);
+                s.goalY[i] = areaMin.y + (areaMax.y - areaMin.y) * unitFloat(mix(bits));
+                s.goalZ[i] = areaMin.z + (areaMax.z - areaMin.z) * unitFloat(mix(bits + 1));
+            }
+        }
+        else {
+            // Match the leader and close the gap to the slot
+            desired[0] = s.vx[lead] + to[0] * 0.05f;
+            desired[1] = s.vy[lead] + to[1] * 0.05f;
+            desired[2] = s.vz[lead] + to[2] * 0.05f;
+        }
+
+        float steer[3] = {
+            desired[0] - s.vx[i] + s.avoidX[i] * maxAccel * 2.0f,
+            desired[1] - s.vy[i] + s.avoidY[i] * maxAccel * 2.0f,
+            desired[2] - s.vz[i] + s.avoidZ[i] * maxAccel * 2.0f
+        };
+        float magnitude = std::sqrt(steer[0] * steer[0] + steer[1] * steer[1] + steer[2] * steer[2]);
+        float scale = magnitude > maxAccel ? maxAccel / magnitude : 1.0f;
+        s.ax[i] = steer[0] * scale;
+        s.ay[i] = steer[1] * scale;
+        s.az[i] = steer[2] * scale;
+    }
+}
+
+
+void Fleet::integrate(size_t begin, size_t end) {
+    FleetStore& s = ships;
+    // Wingmen may outrun the leader a little to catch up with their slots
+    const float limit = maxSpeed * 1.5f;
+    for (size_t i = begin; i < end; i++) {
+        s.vx[i] += s.ax[i];
+        s.vy[i] += s.ay[i];
+        s.vz[i] += s.az[i];
+        float speed = std::sqrt(s.vx[i] * s.vx[i] + s.vy[i] * s.vy[i] + s.vz[i] * s.vz[i]);
+        if (speed > limit) {
+            float scale = limit / speed;
+            s.vx[i] *= scale;
+            s.vy[i] *= scale;
+            s.vz[i] *= scale;
+        }
+        s.px[i] += s.vx[i];
+        s.py[i] += s.vy[i];
+        s.pz[i] += s.vz[i];
+    }
+}
+
+
+static void storeInstance(FleetInstance& instance, const Simd::Mat4& model, const vec3& color) {
+    Simd::storeAffineRows(model, instance.model);
+    instance.color[0] = color.x;
+    instance.color[1] = color.y;
+    instance.color[2] = color.z;
+    instance.color[3] = 1.0f;
+}
+
+
+void Fleet::buildInstances(size_t begin, size_t end) {
+    // The player ship's parts, in ship space
+    static const Simd::Mat4 hullA = Simd::RotateX(90), hullB = Simd::RotateY(90);
+    static const Simd::Mat4 nose = Simd::Translate(3.0f, 0.0f, 0.0f) * Simd::Scale(2.5f, 2.5f, 2.5f);
+    const vec3 leaderColor(1.0f, 0.8f, 0.1f), wingColor(0.3f, 0.6f, 1.0f), noseColor(1.0f, 0.0f, 0.0f);
+    const size_t BatchSize = 64;
+    Simd::Mat4 transforms[BatchSize], parts[BatchSize];
+
+    FleetStore& s = ships;
+    for (size_t first = begin; first < end; first += BatchSize) {
+        size_t count = std::min(BatchSize, end - first);
+        for (size_t k = 0; k < count; k++) {
+            size_t i = first + k;
+            float heading = std::atan2(s.vy[i], s.vx[i]) * 180.0f / (float)M_PI;
+            transforms[k] = Simd::Translate(s.px[i], s.py[i], s.pz[i]) * Simd::RotateZ(heading);
+        }
+
+        // Each part is one batched product over the whole run of ships
+        Simd::multiply(transforms, hullA, parts, count);
+        for (size_t k = 0; k < count; k++) {
+            size_t i = first + k;
+            storeInstance(hullInstances[2 * i], parts[k], s.leader[i] < 0 ? leaderColor : wingColor);
+        }
+        Simd::multiply(transforms, hullB, parts, count);
+        for (size_t k = 0; k < count; k++) {
+            size_t i = first + k;
+            storeInstance(hullInstances[2 * i + 1], parts[k], s.leader[i] < 0 ? leaderColor : wingColor);
+        }
+        Simd::multiply(transforms, nose, parts, count);
+        for (size_t k = 0; k < count; k++) {
+            storeInstance(noseInstances[first + k], parts[k], noseColor);
+        }
+    }
+}
+
+
+void benchmarkFleet() {
+    const int shipCount = 20000, planetCount = 20000;
+    const int warmup = 10, ticks = 100;
+    const float spread = 1500.0f;
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+
+    // Planet-sized obstacles spread through the same volume as the fleet
+    SpatialHash planets;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> coordinate(-spread, spread);
+    std::uniform_real_distribution<float> height(-spread * 0.25f, spread * 0.25f);
+    std::uniform_real_distribution<float> radius(0.25f, 2.5f);
+    for (int i = 0; i < planetCount; i++) {
+        BoundingSphere body = { vec3(coordinate(rng), coordinate(rng), height(rng)), radius(rng) };
+        planets.insert(body);
+    }
+
+    std::vector<unsigned> threadCounts;
+    for (unsigned t = 1; t < cores; t *= 2) {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(cores);
+
+    printf("fleet: %d ships, %d obstacles, %d ticks, %u hardware threads\n", shipCount, planetCount, ticks, cores);
+    double baseline = 0.0;
+    for (unsigned threads : threadCounts) {
+        JobSystem jobs(threads);
+        Fleet fleet;
+        fleet.obstacles = &planets;
+        fleet.spawn(shipCount, vec3(0.0f, 0.0f, 0.0f), spread);
+        for (int t = 0; t < warmup; t++) {
+            fleet.step(jobs);
+        }
+
+        jobs.resetStats();
+        std::vector<double> phaseMs(fleet.graph.phaseCount(), 0.0);
+        auto start = std::chrono::steady_clock::now();
+        for (int t = 0; t < ticks; t++) {
+            fleet.step(jobs);
+            for (size_t p = 0; p < phaseMs.size(); p++) {
+                phaseMs[p] += fleet.graph.endMs((int)p) - fleet.graph.startMs((int)p);
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        double wallMs = std::chrono::duration<double, std::milli>(end - start).count();
+        if (threads == 1) {
+            baseline = wallMs;
+        }
+
+        // Same ships, same ticks: every thread count must land on the same state
+        double checksum = 0.0;
+        for (size_t i = 0; i < fleet.ships.size(); i++) {
+            checksum += fleet.ships.px[i] + fleet.ships.py[i] + fleet.ships.pz[i];
+        }
+
+        printf("\n%2u workers: %.2f ms/tick, %.0f ship-ticks/s, speedup %.2fx (%.0f%% efficiency), checksum %.3f\n",
+            threads, wallMs / ticks, (double)shipCount * ticks / (wallMs / 1000.0), baseline / wallMs,
+            100.0 * baseline / wallMs / threads, checksum);
+        printf("   phases ms/tick:");
+        for (size_t p = 0; p < phaseMs.size(); p++) {
+            printf(" %s %.2f%s", fleet.graph.name((int)p).c_str(), phaseMs[p] / ticks, p + 1 < phaseMs.size() ? "," : "\n");
+        }
+        std::vector<WorkerStats> stats = jobs.stats();
+        for (size_t w = 0; w < stats.size(); w++) {
+            printf("   %s %2zu: %5.1f%% busy, %6llu jobs, %6llu stolen\n", stats[w].outside ? "caller" : "worker", w,
+                100.0 * stats[w].busyMs / wallMs, (unsigned long long)stats[w].jobs, (unsigned long long)stats[w].steals);
+        }
+    }
+}
@@ -0,0 +1,88 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- Fleet.h ---
+//
+//   Autonomous ships.  The fleet is a structure of arrays flown in
+//   squadrons: a leader seeks waypoints and its wingmen keep slots of a
+//   V formation behind it, and every ship steers around nearby planets.
+//   One tick is a phase graph on the job system:
+//
+//       sense obstacles --+
+//                         +--> decide --> integrate --> build instances
+//       sense formation --+
+//
+//   Each phase is split into batches of ships; the two sense phases only
+//   read positions, so they run side by side.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __FLEET_H__
+#define __FLEET_H__
+
+#include "Angel.h"
+#include "Collision.h"
+#include "JobSystem.h"
+#include "SimdMath.h"
+#include <stdint.h>
+#include <vector>
+
+const int FleetSquadronSize = 8;
+
+// Same layout as the scene's indirect-draw instance records
+struct FleetInstance {
+    GLfloat model[12]; // first three rows of the row-major model matrix
+    GLfloat color[4];  // rgb, and a = 1 when lit
+};
+
+struct FleetStore {
+    std::vector<float> px, py, pz;       // position
+    std::vector<float> vx, vy, vz;       // velocity, units per tick
+    std::vector<float> goalX, goalY, goalZ;  // leaders: current waypoint
+    std::vector<int32_t> leader;         // -1 for leaders
+    std::vector<float> slotX, slotY;     // wingmen: offset in the leader's frame
+    // Written by the sense phases
+    std::vector<float> avoidX, avoidY, avoidZ;
+    std::vector<float> targetX, targetY, targetZ;
+    // Written by decide
+    std::vector<float> ax, ay, az;
+
+    size_t size() const { return px.size(); }
+    void resize(size_t count);
+};
+
+class Fleet {
+public:
+    Fleet();
+
+    // Replaces the fleet with count ships in squadrons around center
+    void spawn(int count, const vec3& center, float spread, uint32_t seed = 1969);
+
+    // One tick of every phase
+    void step(JobSystem& jobs = defaultJobSystem());
+
+    FleetStore ships;
+    const SpatialHash* obstacles = nullptr; // planets to steer around, may be null
+    float maxSpeed = 0.25f;                 // units per tick
+    float maxAccel = 0.01f;                 // units per tick^2
+    float senseRadius = 12.0f;
+    vec3 areaMin, areaMax;                  // box waypoints are picked from
+
+    // Two hull tori and one nose per ship, rebuilt by the last phase
+    std::vector<FleetInstance> hullInstances, noseInstances;
+
+    PhaseGraph graph;
+    uint64_t tick = 0;
+
+private:
+    void senseObstacles(size_t begin, size_t end);
+    void senseFormation(size_t begin, size_t end);
+    void decide(size_t begin, size_t end);
+    void integrate(size_t begin, size_t end);
+    void buildInstances(size_t begin, size_t end);
+};
+
+// Runs a large fleet on 1..N workers and prints ticks/sec, speedup, phase
+// times and per-worker utilization
+void benchmarkFleet();
+
+#endif // __FLEET_H__
@@ -0,0 +1,388 @@
+#include "Gravity.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+#include <random>
+
+// Bodies per leaf cell, and the depth at which identical Morton codes stop splitting
+static const uint32_t GravityLeafSize = 8;
+static const int MortonLevels = 10;
+
+
+void GravityBodies::add(const vec3& position, const vec3& velocity, float bodyMass) {
+    x.push_back(position.x); y.push_back(position.y); z.push_back(position.z);
+    vx.push_back(velocity.x); vy.push_back(velocity.y); vz.push_back(velocity.z);
+    ax.push_back(0.0f); ay.push_back(0.0f); az.push_back(0.0f);
+    mass.push_back(bodyMass);
+    lastX.push_back(position.x); lastY.push_back(position.y); lastZ.push_back(position.z);
+}
+
+
+void GravityBodies::clear() {
+    for (std::vector<float>* array : { &x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &mass, &lastX, &lastY, &lastZ }) {
+        array->clear();
+    }
+}
+
+
+vec3 GravityBodies::position(size_t i, float alpha) const {
+    return vec3(lastX[i] + (x[i] - lastX[i]) * alpha,
+        lastY[i] + (y[i] - lastY[i]) * alpha,
+        lastZ[i] + (z[i] - lastZ[i]) * alpha);
+}
+
+
+// Spreads the low 10 bits of v so two zero bits follow each one
+static uint32_t expandBits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+
+void GravitySimulation::start(ThreadPool& pool) {
+    buildTree(pool);
+    computeForces(pool);
+}
+
+
+void GravitySimulation::step(float dt, ThreadPool& pool) {
+    GravityBodies& b = bodies;
+    float halfDt = dt * 0.5f;
+
+    // Kick with the accelerations of the last step, then drift
+    pool.parallelFor(b.size(), 4096, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            b.vx[i] += b.ax[i] * halfDt;
+            b.vy[i] += b.ay[i] * halfDt;
+            b.vz[i] += b.az[i] * halfDt;
+            b.lastX[i] = b.x[i];
+            b.lastY[i] = b.y[i];
+            b.lastZ[i] = b.z[i];
+            b.x[i] += b.vx[i] * dt;
+            b.y[i] += b.vy[i] * dt;
+            b.z[i] += b.vz[i] * dt;
+        }
+    });
+
+    buildTree(pool);
+    computeForces(pool);
+
+    // Second half kick with the accelerations at the new positions
+    pool.parallelFor(b.size(), 4096, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            b.vx[i] += b.ax[i] * halfDt;
+            b.vy[i] += b.ay[i] * halfDt;
+            b.vz[i] += b.az[i] * halfDt;
+        }
+    });
+}
+
+
+void GravitySimulation::buildTree(ThreadPool& pool) {
+    auto start = std::chrono::steady_clock::now();
+    const GravityBodies& b = bodies;
+    size_t count = b.size();
+    nodes.clear();
+    if (count == 0) {
+        buildMs = 0.0;
+        return;
+    }
+
+    // Cube around every body; the tree cells subdivide it
+    float lo[3] = { b.x[0], b.y[0], b.z[0] }, hi[3] = { b.x[0], b.y[0], b.z[0] };
+    for (size_t i = 1; i < count; i++) {
+        lo[0] = std::min(lo[0], b.x[i]); hi[0] = std::max(hi[0], b.x[i]);
+        lo[1] = std::min(lo[1], b.y[i]); hi[1] = std::max(hi[1], b.y[i]);
+        lo[2] = std::min(lo[2], b.z[i]); hi[2] = std::max(hi[2], b.z[i]);
+    }
+    float side = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+    side = std::max(side * 1.0001f, 1e-3f);
+    float cells = (float)(1 << MortonLevels) / side;
+
+    keys.resize(count);
+    pool.parallelFor(count, 4096, [&](size_t begin, size_t end) {
+        const uint32_t maxCell = (1u << MortonLevels) - 1;
+        for (size_t i = begin; i < end; i++) {
+            uint32_t cx = std::min(maxCell, (uint32_t)((b.x[i] - lo[0]) * cells));
+            uint32_t cy = std::min(maxCell, (uint32_t)((b.y[i] - lo[1]) * cells));
+            uint32_t cz = std::min(maxCell, (uint32_t)((b.z[i] - lo[2]) * cells));
+            uint64_t code = (expandBits(cx) << 2) | (expandBits(cy) << 1) | expandBits(cz);
+            keys[i] = code << 32 | (uint64_t)i;
+        }
+    });
+    std::sort(keys.begin(), keys.end());
+
+    sx.resize(count); sy.resize(count); sz.resize(count); sm.resize(count);
+    for (size_t k = 0; k < count; k++) {
+        uint32_t i = (uint32_t)keys[k];
+        sx[k] = b.x[i]; sy[k] = b.y[i]; sz[k] = b.z[i]; sm[k] = b.mass[i];
+    }
+
+    nodes.reserve(count / 2 + 1);
+    buildNode(0, (uint32_t)count, 0, side);
+
+    auto end = std::chrono::steady_clock::now();
+    buildMs = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+
+uint32_t GravitySimulation::buildNode(uint32_t first, uint32_t count, int level, float size) {
+    uint32_t index = (uint32_t)nodes.size();
+    nodes.push_back(Node());
+
+    bool leaf = count <= GravityLeafSize || level == MortonLevels;
+    double mass = 0.0, mx = 0.0, my = 0.0, mz = 0.0;
+    if (leaf) {
+        for (uint32_t k = first; k < first + count; k++) {
+            mass += sm[k];
+            mx += (double)sx[k] * sm[k];
+            my += (double)sy[k] * sm[k];
+            mz += (double)sz[k] * sm[k];
+        }
+    }
+    else {
+        // Children are the runs sharing the next three Morton bits
+        int shift = 32 + 3 * (MortonLevels - 1 - level);
+        uint32_t begin = first, last = first + count;
+        for (uint64_t octant = 0; octant < 8 && begin < last; octant++) {
+            uint32_t end = (uint32_t)(std::partition_point(keys.begin() + begin, keys.begin() + last,
+                [=](uint64_t key) { return ((key >> shift) & 7) <= octant; }) - keys.begin());
+            if (end > begin) {
+                uint32_t child = buildNode(begin, end - begin, level + 1, size * 0.5f);
+                const Node& node = nodes[child];
+                mass += node.mass;
+                mx += (double)node.cx * node.mass;
+                my += (double)node.cy * node.mass;
+                mz += (double)node.cz * node.mass;
+            }
+            begin = end;
+        }
+    }
+
+    Node& node = nodes[index];
+    node.mass = (float)mass;
+    if (mass > 0.0) {
+        node.cx = (float)(mx / mass); node.cy = (float)(my / mass); node.cz = (float)(mz / mass);
+    }
+    else {
+        node.cx = sx[first]; node.cy = sy[first]; node.cz = sz[first];
+    }
+    node.size = size;
+    node.first = first;
+    node.count = count;
+    node.next = (uint32_t)nodes.size();
+    node.leaf = leaf;
+    return index;
+}
+
+
+void GravitySimulation::accelerationAt(float px, float py, float pz, float& ax, float& ay, float& az) const {
+    const float eps2 = softening * softening;
+    const float theta2 = theta * theta;
+    float fx = 0.0f, fy = 0.0f, fz = 0.0f;
+
+    uint32_t i = 0, nodeTotal = (uint32_t)nodes.size();
+    while (i < nodeTotal) {
+        const Node& node = nodes[i];
+        float dx = node.cx - px, dy = node.cy - py, dz = node.cz - pz;
+        float d2 = dx * dx + dy * dy + dz * dz;
+        if (node.leaf) {
+            // A body's pull on itself is zero: dx = dy = dz = 0
+            for (uint32_t k = node.first; k < node.first + node.count; k++) {
+                float bx = sx[k] - px, by = sy[k] - py, bz = sz[k] - pz;
+                float inv = 1.0f / std::sqrt(bx * bx + by * by + bz * bz + eps2);
+                float f = sm[k] * inv * inv * inv;
+                fx += bx * f; fy += by * f; fz += bz * f;
+            }
+            i = node.next;
+        }
+        else if (node.size * node.size < theta2 * d2) {
+            float inv = 1.0f / std::sqrt(d2 + eps2);
+            float f = node.mass * inv * inv * inv;
+            fx += dx * f; fy += dy * f; fz += dz * f;
+            i = node.next;
+        }
+        else {
+            i++; // open the cell: its first child follows it
+        }
+    }
+    ax = fx * G; ay = fy * G; az = fz * G;
+}
+
+
+vec3 GravitySimulation::accelerationAt(const vec3& point) const {
+    float ax, ay, az;
+    accelerationAt(point.x, point.y, point.z, ax, ay, az);
+    return vec3(ax, ay, az);
+}
+
+
+void GravitySimulation::computeForces(ThreadPool& pool) {
+    auto start = std::chrono::steady_clock::now();
+    GravityBodies& b = bodies;
+
+    // Walked in Morton order, so neighbouring bodies in a chunk open the same cells
+    pool.parallelFor(b.size(), 64, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+            uint32_t i = (uint32_t)keys[k];
+            accelerationAt(sx[k], sy[k], sz[k], b.ax[i], b.ay[i], b.az[i]);
+        }
+    });
+
+    auto end = std::chrono::steady_clock::now();
+    forceMs = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+
+double GravitySimulation::energy() const {
+    const GravityBodies& b = bodies;
+    double kinetic = 0.0, potential = 0.0;
+    for (size_t i = 0; i < b.size(); i++) {
+        kinetic += 0.5 * b.mass[i] * ((double)b.vx[i] * b.vx[i] + (double)b.vy[i] * b.vy[i] + (double)b.vz[i] * b.vz[i]);
+        for (size_t j = i + 1; j < b.size(); j++) {
+            double dx = b.x[j] - b.x[i], dy = b.y[j] - b.y[i], dz = b.z[j] - b.z[i];
+            potential -= (double)G * b.mass[i] * b.mass[j] / std::sqrt(dx * dx + dy * dy + dz * dz + softening * softening);
+        }
+    }
+    return kinetic + potential;
+}
+
+
+void directAccelerations(const GravityBodies& bodies, float G, float softening, size_t first, size_t count,
+    float* ax, float* ay, float* az, ThreadPool& pool) {
+    const float eps2 = softening * softening;
+    const size_t n = bodies.size();
+    const float* x = bodies.x.data();
+    const float* y = bodies.y.data();
+    const float* z = bodies.z.data();
+    const float* m = bodies.mass.data();
+    pool.parallelFor(count, 64, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            float px = x[first + i], py = y[first + i], pz = z[first + i];
+            float fx = 0.0f, fy = 0.0f, fz = 0.0f;
+            for (size_t j = 0; j < n; j++) {
+                float dx = x[j] - px, dy = y[j] - py, dz = z[j] - pz;
+                float inv = 1.0f / std::sqrt(dx * dx + dy * dy + dz * dz + eps2);
+                float f = m[j] * inv * inv * inv;
+                fx += dx * f; fy += dy * f; fz += dz * f;
+            }
+            ax[i] = fx * G; ay[i] = fy * G; az[i] = fz * G;
+        }
+    });
+}
+
+
+void setCircularVelocities(GravityBodies& bodies, float G) {
+    size_t n = bodies.size();
+    double total = 0.0, cx = 0.0, cy = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        total += bodies.mass[i];
+        cx += (double)bodies.x[i] * bodies.mass[i];
+        cy += (double)bodies.y[i] * bodies.mass[i];
+    }
+    if (total <= 0.0) {
+        return;
+    }
+    cx /= total;
+    cy /= total;
+
+    std::vector<float> radius(n);
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; i++) {
+        radius[i] = (float)std::hypot(bodies.x[i] - cx, bodies.y[i] - cy);
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return radius[a] < radius[b]; });
+
+    // Each body orbits the mass inside its radius, treated as a point at the center
+    double enclosed = 0.0;
+    for (size_t i : order) {
+        float r = radius[i];
+        if (r > 1e-4f) {
+            float speed = (float)std::sqrt(G * enclosed / r);
+            bodies.vx[i] = (float)-(bodies.y[i] - cy) / r * speed;
+            bodies.vy[i] = (float)(bodies.x[i] - cx) / r * speed;
+            bodies.vz[i] = 0.0f;
+        }
+        enclosed += bodies.mass[i];
+    }
+}
+
+
+// Field laid out like generatePlanetField's extra bodies: a slab whose side
+// grows with the cube root of the count, masses from the cube of the scale
+static void makeBenchmarkField(GravityBodies& bodies, int count) {
+    std::mt19937 rng(1969);
+    float side = 40.0f * std::cbrt((float)count);
+    std::uniform_real_distribution<float> xy(-side * 0.5f, side * 0.5f);
+    std::uniform_real_distribution<float> height(0.0f, side * 0.25f);
+    std::uniform_real_distribution<float> scale(0.5f, 2.5f);
+    bodies.clear();
+    for (int i = 0; i < count; i++) {
+        float s = scale(rng);
+        bodies.add(vec3(xy(rng), xy(rng), height(rng)), vec3(0.0f, 0.0f, 0.0f), s * s * s);
+    }
+}
+
+
+void benchmarkGravity() {
+    const int counts[] = { 1000, 10000, 100000 };
+    // Direct summation of larger fields runs on this many bodies and is scaled up
+    const size_t directSample = 2000;
+    ThreadPool& pool = defaultThreadPool();
+
+    printf("Barnes-Hut (theta 0.5) vs direct summation, %u threads\n", pool.size());
+    printf(" bodies    nodes   build ms   tree force ms   direct ms   speedup   rms error   max error\n");
+    for (int count : counts) {
+        GravitySimulation sim;
+        makeBenchmarkField(sim.bodies, count);
+
+        double build = 1e30, force = 1e30;
+        for (int r = 0; r < 3; r++) {
+            sim.start(pool);
+            build = std::min(build, sim.buildMs);
+            force = std::min(force, sim.forceMs);
+        }
+
+        size_t sample = std::min((size_t)count, (size_t)count > 10000 ? directSample : (size_t)count);
+        std::vector<float> ax(sample), ay(sample), az(sample);
+        auto start = std::chrono::steady_clock::now();
+        directAccelerations(sim.bodies, sim.G, sim.softening, 0, sample, &ax[0], &ay[0], &az[0], pool);
+        auto end = std::chrono::steady_clock::now();
+        double direct = std::chrono::duration<double, std::milli>(end - start).count() * count / sample;
+
+        // Relative error of each body's acceleration against the exact sum
+        double sumSquared = 0.0, worst = 0.0;
+        for (size_t i = 0; i < sample; i++) {
+            double ex = sim.bodies.ax[i] - ax[i], ey = sim.bodies.ay[i] - ay[i], ez = sim.bodies.az[i] - az[i];
+            double exact = std::sqrt((double)ax[i] * ax[i] + (double)ay[i] * ay[i] + (double)az[i] * az[i]);
+            double error = std::sqrt(ex * ex + ey * ey + ez * ez) / std::max(exact, 1e-30);
+            sumSquared += error * error;
+            worst = std::max(worst, error);
+        }
+        printf("%7d %8zu %10.2f %15.2f %10.1f%s %8.1fx %10.2e %11.2e\n", count, sim.nodeCount(), build, force,
+            direct, sample < (size_t)count ? "*" : " ", direct / (build + force), std::sqrt(sumSquared / sample), worst);
+    }
+    printf("* extrapolated from %zu bodies\n", directSample);
+
+    // Leapfrog is symplectic: energy oscillates but does not drift
+    GravitySimulation sim;
+    makeBenchmarkField(sim.bodies, 1000);
+    setCircularVelocities(sim.bodies, sim.G);
+    sim.start(pool);
+    double before = sim.energy();
+    const int steps = 2000;
+    auto start = std::chrono::steady_clock::now();
+    for (int s = 0; s < steps; s++) {
+        sim.step(1.0f, pool);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double after = sim.energy();
+    printf("1000 bodies, %d leapfrog steps: %.3f ms/step, energy drift %.2e\n", steps,
+        std::chrono::duration<double, std::milli>(end - start).count() / steps, std::fabs((after - before) / before));
+}
@@ -0,0 +1,99 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- Gravity.h ---
+//
+//   Barnes-Hut N-body gravity.  Bodies live in a structure of arrays.
+//   Every step rebuilds an octree over them: bodies are sorted by the
+//   Morton code of their position, so each cell is a contiguous run of
+//   the sorted copy, and the cells are stored depth first with a link
+//   past their subtree, so the force walk needs no stack.  A cell whose
+//   size is small against its distance (size < theta * distance) acts as
+//   one body at its center of mass.  Forces are computed in parallel on a
+//   thread pool and integrated with kick-drift-kick leapfrog, which keeps
+//   orbits from gaining or losing energy over long runs.
+//
+//   Units follow the simulation: lengths in world units, time in ticks.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __GRAVITY_H__
+#define __GRAVITY_H__
+
+#include "Angel.h"
+#include "ThreadPool.h"
+#include <cstdint>
+#include <vector>
+
+struct GravityBodies {
+    std::vector<float> x, y, z;          // position
+    std::vector<float> vx, vy, vz;       // velocity, units per tick
+    std::vector<float> ax, ay, az;       // acceleration at the current position
+    std::vector<float> mass;
+    std::vector<float> lastX, lastY, lastZ; // position before the last step, for interpolation
+
+    size_t size() const { return x.size(); }
+    void add(const vec3& position, const vec3& velocity, float bodyMass);
+    void clear();
+
+    // Position blended between the last two steps; alpha in [0, 1]
+    vec3 position(size_t i, float alpha) const;
+};
+
+class GravitySimulation {
+public:
+    GravityBodies bodies;
+    float G = 2.7e-5f;      // units^3 / (mass * tick^2)
+    float softening = 1.0f; // keeps close encounters finite, about a planet radius
+    float theta = 0.5f;     // opening angle; 0 degenerates to direct summation
+
+    // Builds the tree and the initial accelerations; call after filling bodies
+    void start(ThreadPool& pool = defaultThreadPool());
+
+    // One leapfrog step of dt ticks
+    void step(float dt, ThreadPool& pool = defaultThreadPool());
+
+    // Field at an arbitrary point from the tree of the last step, for
+    // massless test particles such as the ship
+    vec3 accelerationAt(const vec3& point) const;
+
+    // Kinetic plus potential energy by direct summation (O(n^2))
+    double energy() const;
+
+    size_t nodeCount() const { return nodes.size(); }
+
+    // Milliseconds spent on the last tree build and force pass
+    double buildMs = 0.0, forceMs = 0.0;
+
+private:
+    struct Node {
+        float cx, cy, cz, mass; // center of mass
+        float size;             // cell edge length
+        uint32_t first, count;  // run of sorted bodies
+        uint32_t next;          // first node after this subtree
+        bool leaf;
+    };
+
+    void buildTree(ThreadPool& pool);
+    uint32_t buildNode(uint32_t first, uint32_t count, int level, float size);
+    void computeForces(ThreadPool& pool);
+    void accelerationAt(float px, float py, float pz, float& ax, float& ay, float& az) const;
+
+    std::vector<Node> nodes;
+    std::vector<uint64_t> keys;            // Morton code << 32 | body index, sorted
+    std::vector<float> sx, sy, sz, sm;     // bodies in Morton order
+};
+
+// Accelerations of bodies [first, first + count) from every body by direct
+// summation, written to ax/ay/az starting at index 0
+void directAccelerations(const GravityBodies& bodies, float G, float softening, size_t first, size_t count,
+    float* ax, float* ay, float* az, ThreadPool& pool = defaultThreadPool());
+
+// Gives every body the velocity of a circular orbit about the z axis
+// through the center of mass, from the mass enclosed by its radius
+void setCircularVelocities(GravityBodies& bodies, float G);
+
+// Compares Barnes-Hut with direct summation at 1k, 10k and 100k bodies and
+// checks leapfrog energy drift
+void benchmarkGravity();
+
+#endif // __GRAVITY_H__
@@ -0,0 +1,162 @@
+#include "InputLog.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+static const uint8_t SpecialFlag = 1;
+
+
+void InputLog::record(uint64_t tick, const InputEvent& event) {
+    InputRecord record = { tick, event };
+    records.push_back(record);
+}
+
+
+static void writeVarint(std::vector<unsigned char>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((unsigned char)value);
+}
+
+
+static bool readVarint(const unsigned char*& in, const unsigned char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        unsigned char byte = *in++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool InputLog::save(const char* path) const {
+    std::vector<unsigned char> payload;
+    uint64_t lastTick = 0;
+    for (const InputRecord& record : records) {
+        writeVarint(payload, record.tick - lastTick);
+        payload.push_back((unsigned char)record.event.key);
+        payload.push_back(record.event.special ? SpecialFlag : 0);
+        lastTick = record.tick;
+    }
+
+    InputLogHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MTIL", 4);
+    header.version = InputLogVersion;
+    header.planets = config.planets;
+    header.fleet = config.fleet;
+    header.flags = (config.gravity ? InputLogGravity : 0) | (config.collisions ? InputLogCollisions : 0);
+    header.recordCount = (uint32_t)records.size();
+    header.endTick = endTick;
+    header.stateChecksum = stateChecksum;
+    header.recordBytes = payload.size();
+    memcpy(header.worldOffset, config.worldOffset, sizeof(header.worldOffset));
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "input log: cannot write %s\n", path);
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+        && (payload.empty() || fwrite(&payload[0], payload.size(), 1, file) == 1);
+    written = fclose(file) == 0 && written;
+    if (!written) {
+        fprintf(stderr, "input log: cannot write %s\n", path);
+    }
+    return written;
+}
+
+
+bool InputLog::load(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "input log: cannot open %s\n", path);
+        return false;
+    }
+    InputLogHeader header;
+    std::vector<unsigned char> payload;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1
+        && memcmp(header.magic, "MTIL", 4) == 0
+        && header.version == InputLogVersion
+        && header.recordBytes <= 12 * (uint64_t)header.recordCount;   // a 10-byte varint, key and flags at most
+    if (valid && header.recordBytes > 0) {
+        payload.resize((size_t)header.recordBytes);
+        valid = fread(&payload[0], payload.size(), 1, file) == 1;
+    }
+    fclose(file);
+
+    records.clear();
+    const unsigned char* in = payload.data();
+    const unsigned char* end = in + payload.size();
+    uint64_t tick = 0;
+    for (uint32_t i = 0; valid && i < header.recordCount; i++) {
+        uint64_t delta;
+        valid = readVarint(in, end, delta) && end - in >= 2;
+        if (valid) {
+            InputRecord record;
+            tick += delta;
+            record.tick = tick;
+            record.event.key = in[0];
+            record.event.special = (in[1] & SpecialFlag) != 0;
+            records.push_back(record);
+            in += 2;
+        }
+    }
+    if (!valid) {
+        fprintf(stderr, "input log: %s is not a version %u input log or is truncated\n", path, InputLogVersion);
+        records.clear();
+        return false;
+    }
+
+    config.planets = header.planets;
+    config.fleet = header.fleet;
+    config.gravity = (header.flags & InputLogGravity) != 0;
+    config.collisions = (header.flags & InputLogCollisions) != 0;
+    memcpy(config.worldOffset, header.worldOffset, sizeof(config.worldOffset));
+    endTick = header.endTick;
+    stateChecksum = header.stateChecksum;
+    return true;
+}
+
+
+void InputReplay::apply(uint64_t tick) {
+    while (applied < log.records.size() && log.records[applied].tick <= tick) {
+        handler(log.records[applied].event);
+        applied++;
+    }
+}
+
+
+void InputReplay::start() {
+    startTime = lastFrame = std::chrono::steady_clock::now();
+    frameMs.clear();
+}
+
+
+void InputReplay::frameDone() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    frameMs.push_back(std::chrono::duration<double, std::milli>(now - lastFrame).count());
+    lastFrame = now;
+}
+
+
+bool InputReplay::printSummary(uint64_t tick, uint64_t checksum) const {
+    double seconds = std::chrono::duration<double>(lastFrame - startTime).count();
+    printf("replay: %llu of %llu ticks, %zu of %zu keys, %zu frames in %.3f s: %.1f ticks/sec\n",
+        (unsigned long long)tick, (unsigned long long)log.endTick, applied, log.records.size(), frameMs.size(), seconds,
+        seconds > 0.0 ? tick / seconds : 0.0);
+    printf("frame ms: p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n", percentile(frameMs, 0.5), percentile(frameMs, 0.9),
+        percentile(frameMs, 0.99), frameMs.empty() ? 0.0 : *std::max_element(frameMs.begin(), frameMs.end()));
+
+    bool complete = tick == log.endTick && applied == log.records.size();
+    bool match = complete && checksum == log.stateChecksum;
+    printf("state checksum: %016llx, recorded %016llx: %s\n", (unsigned long long)checksum,
+        (unsigned long long)log.stateChecksum, !complete ? "replay stopped early" : (match ? "match" : "MISMATCH"));
+    return match;
+}
@@ -0,0 +1,117 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- InputLog.h ---
+//
+//   Recording and replay of the simulation's input.  Every key applied to
+//   the simulation is logged with the tick it was applied before, so
+//   feeding the log back into a fresh simulation of the same world, tick
+//   by tick, reproduces the run exactly no matter how fast it is replayed
+//   or how the frames fell.  The log also keeps the world setup it was made
+//   with and a checksum of the final state, so a replay can check it ended
+//   where the recording did.
+//
+//   On disk a log is a 72-byte header followed by one record per event:
+//   the tick as a LEB128 varint delta from the previous record, then the
+//   key and a flags byte.  Typical records take three bytes.
+//
+//   Bump InputLogVersion whenever the record layout or anything that
+//   changes how ticks play out (the world setup, the step itself) does,
+//   since old logs would no longer replay to the same state.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __INPUTLOG_H__
+#define __INPUTLOG_H__
+
+#include <chrono>
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+const uint32_t InputLogVersion = 3;
+
+struct InputEvent {
+    int key = 0;
+    bool special = false;   // a GLUT special key (arrows) rather than a character
+    uint32_t id = 0;        // assigned when posted, for latency tracking; not recorded
+};
+
+struct InputRecord {
+    uint64_t tick;          // applied just before this tick ran
+    InputEvent event;
+};
+
+// World setup the simulation started from; a replay recreates it first
+struct ReplayConfig {
+    int32_t planets = 8;
+    int32_t fleet = 0;
+    bool gravity = false;
+    bool collisions = true;
+    double worldOffset[3] = { 0.0, 0.0, 0.0 };   // world position of the scene anchor
+};
+
+// File header; the records follow right after it
+struct InputLogHeader {
+    char magic[4];          // "MTIL"
+    uint32_t version;
+    int32_t planets;
+    int32_t fleet;
+    uint32_t flags;         // InputLogGravity | InputLogCollisions
+    uint32_t recordCount;
+    uint64_t endTick;
+    uint64_t stateChecksum;
+    uint64_t recordBytes;
+    double worldOffset[3];
+};
+
+const uint32_t InputLogGravity = 1, InputLogCollisions = 2;
+
+class InputLog {
+public:
+    // Appends an event; ticks must not decrease
+    void record(uint64_t tick, const InputEvent& event);
+
+    bool save(const char* path) const;
+
+    // False if the file is missing, isn't a log of this version or is truncated
+    bool load(const char* path);
+
+    ReplayConfig config;
+    std::vector<InputRecord> records;
+    uint64_t endTick = 0;          // ticks the recording ran for
+    uint64_t stateChecksum = 0;    // Simulation::checksum() at endTick
+};
+
+// Feeds a log back into the simulation it is attached to, and times the
+// frames drawn meanwhile
+class InputReplay {
+public:
+    typedef std::function<void(const InputEvent&)> Handler;
+
+    InputReplay(const InputLog& log, const Handler& handler) : log(log), handler(handler) {}
+
+    // Applies every record stamped with tick; the simulation calls this
+    // before running each tick, and the driver once more at endTick
+    void apply(uint64_t tick);
+
+    bool finished(uint64_t tick) const { return tick >= log.endTick; }
+
+    // Starts the clock; frameDone() after each frame records its time
+    void start();
+    void frameDone();
+
+    // Frame time percentiles, tick throughput and the final checksum
+    // against the recorded one; true only if the replay reached the end of
+    // the log and the checksums match
+    bool printSummary(uint64_t tick, uint64_t checksum) const;
+
+    const InputLog& log;
+    size_t applied = 0;
+    std::vector<double> frameMs;
+
+private:
+    Handler handler;
+    std::chrono::steady_clock::time_point startTime, lastFrame;
+};
+
+#endif // __INPUTLOG_H__
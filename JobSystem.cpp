@@ -0,0 +1,269 @@
+#include "JobSystem.h"
+#include <algorithm>
+#include <chrono>
+
+// Worker index of the current thread in the job system it belongs to
+static thread_local const JobSystem* threadSystem = nullptr;
+static thread_local unsigned threadWorker = 0;
+
+// Deque of the current outside thread in each job system it has used, by
+// system id (an address could be reused by a later system)
+static thread_local std::vector<std::pair<uint64_t, unsigned>> outsideSlots;
+static std::atomic<uint64_t> nextSystemId{ 1 };
+
+
+JobSystem::JobSystem(unsigned count) : threadCount(std::max(count, 1u)), id(nextSystemId++) {
+    for (unsigned i = 0; i < threadCount + MaxOutsideThreads - 1; i++) {
+        workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+    for (unsigned i = 1; i < threadCount; i++) {
+        threads.push_back(std::thread(&JobSystem::workerLoop, this, i));
+    }
+}
+
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+
+unsigned JobSystem::currentWorker() {
+    if (threadSystem == this) {
+        return threadWorker;
+    }
+    for (const std::pair<uint64_t, unsigned>& slot : outsideSlots) {
+        if (slot.first == id) {
+            return slot.second;
+        }
+    }
+    // First use from this thread: the first outside thread is worker 0, the
+    // next ones take the deques after the pool's
+    unsigned index = outsideThreads++;
+    unsigned worker = index > 0 && index < MaxOutsideThreads ? threadCount + index - 1 : 0;
+    outsideSlots.push_back(std::make_pair(id, worker));
+    return worker;
+}
+
+
+void JobSystem::submit(const std::function<void()>& job, JobCounter* counter) {
+    if (counter) {
+        counter->pending++;
+    }
+    Worker& worker = *workers[currentWorker()];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.jobs.push_back(Job{ job, counter });
+    }
+    queued++;
+    if (!threads.empty()) {
+        // Taking the lock orders this against a worker about to sleep
+        { std::lock_guard<std::mutex> lock(sleepMutex); }
+        wake.notify_one();
+    }
+}
+
+
+void JobSystem::parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body, JobCounter& counter) {
+    grain = std::max(grain, (size_t)1);
+    // Later batches go on the bottom, so thieves start from the front of the range
+    for (size_t begin = 0; begin < count; begin += grain) {
+        size_t end = std::min(begin + grain, count);
+        submit([&body, begin, end] { body(begin, end); }, &counter);
+    }
+}
+
+
+bool JobSystem::takeJob(unsigned self, Job& job, bool steal) {
+    {
+        Worker& own = *workers[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            queued--;
+            return true;
+        }
+    }
+    if (!steal) {
+        return false;
+    }
+    // Victims are tried in order starting after self, so thieves spread out
+    unsigned count = (unsigned)workers.size();
+    for (unsigned i = 1; i < count; i++) {
+        Worker& victim = *workers[(self + i) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            queued--;
+            workers[self]->steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void JobSystem::execute(unsigned self, Job& job) {
+    auto start = std::chrono::steady_clock::now();
+    job.run();
+    auto end = std::chrono::steady_clock::now();
+    Worker& worker = *workers[self];
+    worker.executed++;
+    worker.busyNs += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    if (job.counter) {
+        job.counter->pending--;
+    }
+}
+
+
+void JobSystem::wait(JobCounter& counter) {
+    unsigned self = currentWorker();
+    // Outside threads only help with their own jobs
+    bool steal = threadSystem == this;
+    Job job;
+    while (counter.pending > 0) {
+        if (takeJob(self, job, steal)) {
+            execute(self, job);
+        }
+        else {
+            // The remaining jobs are running elsewhere
+            std::this_thread::yield();
+        }
+    }
+}
+
+
+void JobSystem::workerLoop(unsigned self) {
+    threadSystem = this;
+    threadWorker = self;
+    Job job;
+    for (;;) {
+        if (takeJob(self, job, true)) {
+            execute(self, job);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+
+std::vector<WorkerStats> JobSystem::stats() const {
+    unsigned outside = std::min(outsideThreads.load(), MaxOutsideThreads);
+    std::vector<WorkerStats> result(threadCount + (outside > 1 ? outside - 1 : 0));
+    for (size_t i = 0; i < result.size(); i++) {
+        result[i].jobs = workers[i]->executed;
+        result[i].steals = workers[i]->steals;
+        result[i].busyMs = workers[i]->busyNs / 1e6;
+        result[i].outside = i == 0 || i >= threadCount;
+    }
+    return result;
+}
+
+
+void JobSystem::resetStats() {
+    for (const std::unique_ptr<Worker>& worker : workers) {
+        worker->executed = 0;
+        worker->steals = 0;
+        worker->busyNs = 0;
+    }
+}
+
+
+JobSystem& defaultJobSystem() {
+    static JobSystem system;
+    return system;
+}
+
+
+//----------------------------------------------------------------------------
+//
+//  --- Phase graph ---
+//
+
+int PhaseGraph::add(const std::string& name, const std::function<size_t()>& count, size_t grain,
+    const std::function<void(size_t, size_t)>& body) {
+    Phase phase;
+    phase.name = name;
+    phase.count = count;
+    phase.grain = std::max(grain, (size_t)1);
+    phase.body = body;
+    phases.push_back(phase);
+    return (int)phases.size() - 1;
+}
+
+
+void PhaseGraph::depends(int phase, int prerequisite) {
+    phases[prerequisite].successors.push_back(phase);
+    phases[phase].prerequisites++;
+}
+
+
+void PhaseGraph::run(JobSystem& jobs) {
+    size_t count = phases.size();
+    if (count == 0) {
+        return;
+    }
+    runner = &jobs;
+    waitingOn.reset(new std::atomic<int>[count]);
+    batchesLeft.reset(new std::atomic<int>[count]);
+    for (size_t i = 0; i < count; i++) {
+        waitingOn[i] = phases[i].prerequisites;
+    }
+    phasesLeft.pending = (int)count;
+    runStart = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < count; i++) {
+        if (phases[i].prerequisites == 0) {
+            launch((int)i);
+        }
+    }
+    jobs.wait(phasesLeft);
+}
+
+
+void PhaseGraph::launch(int index) {
+    Phase& phase = phases[index];
+    phase.startMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - runStart).count();
+    size_t count = phase.count();
+    int batches = (int)((count + phase.grain - 1) / phase.grain);
+    if (batches == 0) {
+        finish(index);
+        return;
+    }
+
+    // The last batch to complete finishes the phase and releases its successors
+    batchesLeft[index] = batches;
+    for (size_t begin = 0; begin < count; begin += phase.grain) {
+        size_t end = std::min(begin + phase.grain, count);
+        runner->submit([this, index, begin, end] {
+            phases[index].body(begin, end);
+            if (--batchesLeft[index] == 0) {
+                finish(index);
+            }
+        });
+    }
+}
+
+
+void PhaseGraph::finish(int index) {
+    Phase& phase = phases[index];
+    phase.endMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - runStart).count();
+    for (int next : phase.successors) {
+        if (--waitingOn[next] == 0) {
+            launch(next);
+        }
+    }
+    phasesLeft.pending--;
+}
@@ -0,0 +1,155 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- JobSystem.h ---
+//
+//   Work-stealing job system.  Every worker owns a deque: jobs a worker
+//   submits go on the bottom of its own deque and it takes them back from
+//   the bottom (newest first, still warm in cache), while idle workers
+//   steal from the top of someone else's (oldest first, usually the
+//   biggest remaining piece).  Jobs are coarse batches, so each deque is a
+//   plain mutex-protected std::deque.  Completion is tracked with
+//   counters, and waiting on one runs other jobs instead of blocking.
+//
+//   PhaseGraph runs a set of data-parallel phases with dependencies: a
+//   phase is split into batch jobs as soon as its last prerequisite
+//   finishes, on whichever worker finished it.
+//
+//   The first thread to use it from outside counts as worker 0.  Several
+//   outside threads (the simulation and render threads) may drive one
+//   JobSystem at once: each gets a deque of its own the first time it
+//   submits or waits, and while waiting runs only the jobs on it, never
+//   another outside thread's or a worker's.  So a frame never ends up
+//   running a tick's jobs, or the other way round; the workers serve both.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __JOBSYSTEM_H__
+#define __JOBSYSTEM_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Outside threads that get a deque of their own; any beyond share the first
+const unsigned MaxOutsideThreads = 8;
+
+// Number of jobs (or other work) still outstanding
+struct JobCounter {
+    std::atomic<int> pending{ 0 };
+};
+
+struct WorkerStats {
+    uint64_t jobs = 0;
+    uint64_t steals = 0;        // jobs taken from another worker's deque
+    double busyMs = 0.0;        // time spent inside jobs
+    bool outside = false;       // a thread driving the system (simulation, render) rather than one of its own
+};
+
+class JobSystem {
+public:
+    // threadCount includes the calling thread, so 1 runs everything inline
+    explicit JobSystem(unsigned threadCount = std::thread::hardware_concurrency());
+    ~JobSystem();
+
+    unsigned size() const { return threadCount; }
+
+    // Queues job on the current worker's deque; counter (if any) is
+    // incremented now and decremented once the job has run
+    void submit(const std::function<void()>& job, JobCounter* counter = nullptr);
+
+    // Submits one job per grain-sized batch of [0, count)
+    void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body, JobCounter& counter);
+
+    // Runs queued jobs until counter drops to zero
+    void wait(JobCounter& counter);
+
+    // Per-worker totals since the last reset: the pool's threads, and every
+    // outside thread that has used the system as a row of its own (row 0 is
+    // the first; threads beyond MaxOutsideThreads share it)
+    std::vector<WorkerStats> stats() const;
+    void resetStats();
+
+private:
+    struct Job {
+        std::function<void()> run;
+        JobCounter* counter;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+        std::atomic<uint64_t> executed{ 0 }, steals{ 0 }, busyNs{ 0 };
+    };
+
+    unsigned currentWorker();
+    bool takeJob(unsigned self, Job& job, bool steal);
+    void execute(unsigned self, Job& job);
+    void workerLoop(unsigned self);
+
+    // The threadCount workers (0 for the first outside thread, then the
+    // pool's threads), then the deques of the other outside threads
+    std::vector<std::unique_ptr<Worker>> workers;
+    unsigned threadCount;
+    uint64_t id;                            // tells systems apart in the outside threads' slots
+    std::atomic<unsigned> outsideThreads{ 0 };
+    std::vector<std::thread> threads;
+    std::atomic<int> queued{ 0 };   // jobs sitting in any deque
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+// Process-wide job system sized to the hardware, created on first use
+JobSystem& defaultJobSystem();
+
+class PhaseGraph {
+public:
+    // Adds a phase that runs body over [0, count()) in batches of grain;
+    // count is read when the phase starts.  Returns the phase id.
+    int add(const std::string& name, const std::function<size_t()>& count, size_t grain,
+        const std::function<void(size_t, size_t)>& body);
+
+    // phase starts only after prerequisite has finished
+    void depends(int phase, int prerequisite);
+
+    // Runs every phase once and returns when all have finished
+    void run(JobSystem& jobs);
+
+    size_t phaseCount() const { return phases.size(); }
+    const std::string& name(int phase) const { return phases[phase].name; }
+
+    // Milliseconds from the start of the last run() to each phase's start and end
+    double startMs(int phase) const { return phases[phase].startMs; }
+    double endMs(int phase) const { return phases[phase].endMs; }
+
+private:
+    struct Phase {
+        std::string name;
+        std::function<size_t()> count;
+        size_t grain;
+        std::function<void(size_t, size_t)> body;
+        std::vector<int> successors;
+        int prerequisites = 0;
+        double startMs = 0.0, endMs = 0.0;
+    };
+
+    void launch(int phase);
+    void finish(int phase);
+
+    std::vector<Phase> phases;
+    // Per-run state, indexed like phases
+    std::unique_ptr<std::atomic<int>[]> waitingOn, batchesLeft;
+    JobCounter phasesLeft;
+    JobSystem* runner = nullptr;
+    std::chrono::steady_clock::time_point runStart;
+};
+
+#endif // __JOBSYSTEM_H__
@@ -0,0 +1,89 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- LockFree.h ---
+//
+//   Wait-free channels between exactly one producer thread and one
+//   consumer thread.
+//
+//   TripleBuffer hands the newest value of something large from producer
+//   to consumer.  The producer fills the back slot and swaps it with the
+//   middle one; the consumer swaps its front slot with the middle one when
+//   that holds something newer.  Neither side ever waits for the other, the
+//   consumer always sees the latest complete value, and values the
+//   consumer was too slow to see are simply overwritten.
+//
+//   SpscQueue is a bounded ring of small messages where every one counts
+//   (key presses): push fails rather than overwrite when the ring is full.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __LOCKFREE_H__
+#define __LOCKFREE_H__
+
+#include <atomic>
+#include <cstddef>
+
+template <typename T>
+class TripleBuffer {
+public:
+    // Producer: the slot to fill, then publish() it
+    T& back() { return slots[backIndex]; }
+    void publish() {
+        backIndex = middle.exchange(backIndex | FreshBit, std::memory_order_acq_rel) & IndexMask;
+    }
+
+    // Consumer: takes the newest published value if there is one it hasn't
+    // seen and returns whether it did; front() stays valid until the next call
+    bool update() {
+        if ((middle.load(std::memory_order_relaxed) & FreshBit) == 0) {
+            return false;
+        }
+        frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & IndexMask;
+        return true;
+    }
+    const T& front() const { return slots[frontIndex]; }
+
+private:
+    static const int IndexMask = 3, FreshBit = 4;
+
+    T slots[3];
+    int backIndex = 0, frontIndex = 1;   // each owned by one side
+    std::atomic<int> middle{ 2 };        // slot index, plus FreshBit once published and not yet taken
+};
+
+// Capacity must be a power of two
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+public:
+    // Producer; false when the queue is full
+    bool push(const T& item) {
+        size_t tail = tailIndex.load(std::memory_order_relaxed);
+        if (tail - headIndex.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        items[tail & (Capacity - 1)] = item;
+        tailIndex.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer; false when the queue is empty
+    bool pop(T& item) {
+        size_t head = headIndex.load(std::memory_order_relaxed);
+        if (head == tailIndex.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[head & (Capacity - 1)];
+        headIndex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T items[Capacity];
+    // On separate cache lines so the two sides don't invalidate each other
+    alignas(64) std::atomic<size_t> headIndex{ 0 };
+    alignas(64) std::atomic<size_t> tailIndex{ 0 };
+};
+
+#endif // __LOCKFREE_H__
@@ -0,0 +1,238 @@
+#include "MeshCache.h"
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const size_t MeshCacheAlignment = 64;
+
+
+static size_t alignUp(size_t value) {
+    return (value + MeshCacheAlignment - 1) / MeshCacheAlignment * MeshCacheAlignment;
+}
+
+
+// FNV-1a over the key characters
+static uint64_t hashKey(const std::string& key) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : key) {
+        hash = (hash ^ (unsigned char)c) * 1099511628211ull;
+    }
+    return hash;
+}
+
+
+// FNV-1a over 64-bit words; the payload is padded to the alignment, so its
+// size is always a multiple of eight
+static uint64_t checksum(const unsigned char* data, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    return hash;
+}
+
+
+MeshCache::MeshCache(const std::string& directory) : directory(directory) {
+}
+
+
+MeshCache::~MeshCache() {
+    release();
+}
+
+
+std::string MeshCache::path(const std::string& key, VertexFormat format) const {
+    return directory + "/" + key + (format == VERTEX_PACKED ? ".packed" : ".float") + ".mesh";
+}
+
+
+bool MeshCache::load(const std::string& key, VertexFormat format, EncodedMesh& mesh) {
+    Mapping mapping;
+    if (!map(path(key, format), mapping)) {
+        misses++;
+        return false;
+    }
+
+    const unsigned char* bytes = (const unsigned char*)mapping.data;
+    const MeshCacheHeader* header = (const MeshCacheHeader*)bytes;
+    bool valid = mapping.size >= sizeof(MeshCacheHeader)
+        && memcmp(header->magic, "MTMC", 4) == 0
+        && header->version == MeshCacheVersion
+        && header->format == (uint32_t)format
+        && header->vertexStride == vertexStride(format)
+        && header->keyHash == hashKey(key)
+        && (header->indexType == GL_UNSIGNED_SHORT || header->indexType == GL_UNSIGNED_INT)
+        && header->indexOffset >= sizeof(MeshCacheHeader) + header->vertexCount * header->vertexStride
+        && header->indexOffset + header->indexCount * indexSize(header->indexType) <= mapping.size
+        && header->checksum == checksum(bytes + sizeof(MeshCacheHeader), mapping.size - sizeof(MeshCacheHeader));
+    if (!valid) {
+        fprintf(stderr, "mesh cache: %s is stale or damaged, regenerating\n", path(key, format).c_str());
+        unmap(mapping);
+        misses++;
+        return false;
+    }
+
+    mesh.format = format;
+    mesh.vertices = bytes + sizeof(MeshCacheHeader);
+    mesh.vertexCount = (size_t)header->vertexCount;
+    mesh.indices = bytes + header->indexOffset;
+    mesh.indexCount = (size_t)header->indexCount;
+    mesh.indexType = header->indexType;
+    mappings.push_back(mapping);
+    hits++;
+    return true;
+}
+
+
+bool MeshCache::store(const std::string& key, VertexFormat format, const Mesh& mesh) {
+#ifdef _WIN32
+    _mkdir(directory.c_str());
+#else
+    mkdir(directory.c_str(), 0755);
+#endif
+
+    std::vector<unsigned char> vertexBytes, indexBytes;
+    GLenum indexType = encodeMesh(mesh, format, vertexBytes, indexBytes);
+
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MTMC", 4);
+    header.version = MeshCacheVersion;
+    header.format = format;
+    header.vertexStride = (uint32_t)vertexStride(format);
+    header.keyHash = hashKey(key);
+    header.vertexCount = mesh.vertices.size();
+    header.indexCount = mesh.indices.size();
+    header.indexType = indexType;
+    header.indexOffset = alignUp(sizeof(header) + vertexBytes.size());
+
+    // Payload with zero padding after each block, checksummed as it will be mapped
+    size_t payloadSize = alignUp(header.indexOffset + indexBytes.size()) - sizeof(header);
+    std::vector<unsigned char> payload(payloadSize, 0);
+    if (!vertexBytes.empty()) {
+        memcpy(&payload[0], &vertexBytes[0], vertexBytes.size());
+    }
+    if (!indexBytes.empty()) {
+        memcpy(&payload[header.indexOffset - sizeof(header)], &indexBytes[0], indexBytes.size());
+    }
+    header.checksum = checksum(&payload[0], payload.size());
+
+    // Written beside the final name and renamed into place, so a reader never
+    // maps a half-written file
+    std::string finalPath = path(key, format);
+    std::string tempPath = finalPath + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file) {
+        fprintf(stderr, "mesh cache: cannot write %s\n", tempPath.c_str());
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(&payload[0], payload.size(), 1, file) == 1;
+    written = fclose(file) == 0 && written;
+    if (!written) {
+        fprintf(stderr, "mesh cache: cannot write %s\n", tempPath.c_str());
+        remove(tempPath.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    remove(finalPath.c_str());
+#endif
+    return rename(tempPath.c_str(), finalPath.c_str()) == 0;
+}
+
+
+void MeshCache::erase(const std::string& key, VertexFormat format) {
+    remove(path(key, format).c_str());
+}
+
+
+void MeshCache::release() {
+    for (Mapping& mapping : mappings) {
+        unmap(mapping);
+    }
+    mappings.clear();
+}
+
+
+//----------------------------------------------------------------------------
+//
+//  --- File mapping ---
+//
+
+#ifdef _WIN32
+
+bool MeshCache::map(const std::string& path, Mapping& mapping) {
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    HANDLE section = NULL;
+    void* data = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        section = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    if (section) {
+        data = MapViewOfFile(section, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!data) {
+        if (section) CloseHandle(section);
+        CloseHandle(file);
+        return false;
+    }
+    mapping.data = data;
+    mapping.size = (size_t)size.QuadPart;
+    mapping.file = file;
+    mapping.section = section;
+    return true;
+}
+
+
+void MeshCache::unmap(Mapping& mapping) {
+    UnmapViewOfFile(mapping.data);
+    CloseHandle((HANDLE)mapping.section);
+    CloseHandle((HANDLE)mapping.file);
+}
+
+#else
+
+bool MeshCache::map(const std::string& path, Mapping& mapping) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    // The mapping keeps the file alive on its own
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    // The whole file is read right away by the checksum and the upload
+    madvise(data, (size_t)info.st_size, MADV_WILLNEED);
+    mapping.data = data;
+    mapping.size = (size_t)info.st_size;
+    return true;
+}
+
+
+void MeshCache::unmap(Mapping& mapping) {
+    munmap(mapping.data, mapping.size);
+}
+
+#endif
@@ -0,0 +1,81 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- MeshCache.h ---
+//
+//   On-disk cache of generated meshes, one file per generator key and
+//   vertex format.  A file holds a 64-byte header followed by the mesh
+//   exactly as the arena uploads it: interleaved vertices at offset 64 and
+//   the indices at the next 64-byte boundary.  load() maps the file and
+//   hands out pointers into the mapping, so a warm start goes from disk to
+//   glBufferSubData without parsing or copying.  The header carries a
+//   magic, a version, the key hash and a checksum of the payload; a file
+//   that fails any check is treated as a miss and rewritten.
+//
+//   Bump MeshCacheVersion whenever a generator or the vertex encoding
+//   changes, so stale files are regenerated.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __MESHCACHE_H__
+#define __MESHCACHE_H__
+
+#include "MeshRegistry.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+const uint32_t MeshCacheVersion = 1;
+
+// File header; the payload starts right after it
+struct MeshCacheHeader {
+    char magic[4];          // "MTMC"
+    uint32_t version;
+    uint32_t format;        // VertexFormat
+    uint32_t vertexStride;
+    uint64_t keyHash;       // of the key the file was written for
+    uint64_t vertexCount;
+    uint64_t indexCount;
+    uint32_t indexType;
+    uint32_t reserved;
+    uint64_t indexOffset;   // from the start of the file, 64-byte aligned
+    uint64_t checksum;      // of everything after the header
+};
+
+class MeshCache {
+public:
+    explicit MeshCache(const std::string& directory = "mesh-cache");
+    ~MeshCache();
+
+    // Maps the file for key and format and fills mesh with pointers into it.
+    // The mapping stays valid until release().
+    bool load(const std::string& key, VertexFormat format, EncodedMesh& mesh);
+
+    // Encodes mesh and writes it under key; the directory is created if needed
+    bool store(const std::string& key, VertexFormat format, const Mesh& mesh);
+
+    void erase(const std::string& key, VertexFormat format);
+
+    // Unmaps every loaded file; call once the meshes have been uploaded
+    void release();
+
+    std::string path(const std::string& key, VertexFormat format) const;
+
+    std::string directory;
+    int hits = 0, misses = 0;
+
+private:
+    struct Mapping {
+        void* data;
+        size_t size;
+#ifdef _WIN32
+        void* file;    // HANDLEs
+        void* section;
+#endif
+    };
+    bool map(const std::string& path, Mapping& mapping);
+    void unmap(Mapping& mapping);
+
+    std::vector<Mapping> mappings;
+};
+
+#endif // __MESHCACHE_H__
@@ -0,0 +1,174 @@
+#include "MeshGenerators.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+// Rows handed to one task: enough vertices per chunk to outweigh scheduling
+static size_t rowGrain(int rowLength) {
+    return std::max(1, 4096 / std::max(rowLength, 1));
+}
+
+// cos/sin of steps * i / count of a full or half turn, for i in [0, entries)
+static void sinCosTable(int entries, int count, double turn, std::vector<float>& cosines, std::vector<float>& sines) {
+    cosines.resize(entries);
+    sines.resize(entries);
+    for (int i = 0; i < entries; i++) {
+        double angle = i * turn / count;
+        cosines[i] = (float)cos(angle);
+        sines[i] = (float)sin(angle);
+    }
+}
+
+
+size_t sphereVertexCount(int latitudeBands, int longitudeBands) {
+    return (size_t)(latitudeBands + 1) * (longitudeBands + 1);
+}
+
+size_t sphereIndexCount(int latitudeBands, int longitudeBands) {
+    return (size_t)latitudeBands * longitudeBands * 6;
+}
+
+size_t torusVertexCount(int numMajor, int numMinor) {
+    return (size_t)numMajor * numMinor;
+}
+
+size_t torusIndexCount(int numMajor, int numMinor) {
+    return (size_t)numMajor * numMinor * 6;
+}
+
+
+void writeSphere(float radius, int latitudeBands, int longitudeBands,
+    MeshVertex* vertices, GLuint* indices, ThreadPool& pool) {
+    const int stride = longitudeBands + 1;
+    std::vector<float> cosPhi, sinPhi, cosTheta, sinTheta;
+    sinCosTable(stride, longitudeBands, 2.0 * M_PI, cosPhi, sinPhi);
+    sinCosTable(latitudeBands + 1, latitudeBands, M_PI, cosTheta, sinTheta);
+
+    pool.parallelFor(latitudeBands + 1, rowGrain(stride), [&](size_t begin, size_t end) {
+        const float* c = &cosPhi[0];
+        const float* s = &sinPhi[0];
+        for (size_t lat = begin; lat < end; lat++) {
+            const float y = cosTheta[lat];
+            const float ringRadius = sinTheta[lat];
+            MeshVertex* row = vertices + lat * stride;
+
+            // Plain loads and stores only, so the compiler can vectorize it
+            for (int lon = 0; lon < stride; lon++) {
+                float x = c[lon] * ringRadius;
+                float z = s[lon] * ringRadius;
+                row[lon].position[0] = radius * x;
+                row[lon].position[1] = radius * y;
+                row[lon].position[2] = radius * z;
+                row[lon].normal[0] = x;
+                row[lon].normal[1] = y;
+                row[lon].normal[2] = z;
+            }
+
+            if ((int)lat == latitudeBands) {
+                continue;
+            }
+            GLuint* out = indices + lat * longitudeBands * 6;
+            GLuint first = (GLuint)(lat * stride);
+            for (int lon = 0; lon < longitudeBands; lon++) {
+                GLuint a = first + lon;
+                GLuint b = a + stride;
+                out[lon * 6 + 0] = a;
+                out[lon * 6 + 1] = b;
+                out[lon * 6 + 2] = a + 1;
+                out[lon * 6 + 3] = b;
+                out[lon * 6 + 4] = b + 1;
+                out[lon * 6 + 5] = a + 1;
+            }
+        }
+    });
+}
+
+
+void writeTorus(float R, float r, int numMajor, int numMinor,
+    MeshVertex* vertices, GLuint* indices, ThreadPool& pool) {
+    std::vector<float> cosPhi, sinPhi, cosTheta, sinTheta;
+    sinCosTable(numMinor, numMinor, 2.0 * M_PI, cosPhi, sinPhi);
+    sinCosTable(numMajor, numMajor, 2.0 * M_PI, cosTheta, sinTheta);
+
+    pool.parallelFor(numMajor, rowGrain(numMinor), [&](size_t begin, size_t end) {
+        const float* c = &cosPhi[0];
+        const float* s = &sinPhi[0];
+        for (size_t i = begin; i < end; i++) {
+            const float ct = cosTheta[i];
+            const float st = sinTheta[i];
+            MeshVertex* row = vertices + i * numMinor;
+
+            for (int j = 0; j < numMinor; j++) {
+                float ring = R + r * c[j];
+                row[j].position[0] = ring * ct;
+                row[j].position[1] = ring * st;
+                row[j].position[2] = r * s[j];
+                row[j].normal[0] = c[j] * ct;
+                row[j].normal[1] = c[j] * st;
+                row[j].normal[2] = s[j];
+            }
+
+            // The last ring and the last column wrap around to the first
+            GLuint* out = indices + i * numMinor * 6;
+            GLuint first = (GLuint)(i * numMinor);
+            GLuint second = (GLuint)(((i + 1) % numMajor) * numMinor);
+            for (int j = 0; j < numMinor; j++) {
+                GLuint next = j + 1 < numMinor ? j + 1 : 0;
+                out[j * 6 + 0] = first + j;
+                out[j * 6 + 1] = second + j;
+                out[j * 6 + 2] = first + next;
+                out[j * 6 + 3] = second + j;
+                out[j * 6 + 4] = second + next;
+                out[j * 6 + 5] = first + next;
+            }
+        }
+    });
+}
+
+
+Mesh generateSphere(float radius, int latitudeBands, int longitudeBands, ThreadPool& pool) {
+    Mesh mesh;
+    mesh.vertices.resize(sphereVertexCount(latitudeBands, longitudeBands));
+    mesh.indices.resize(sphereIndexCount(latitudeBands, longitudeBands));
+    writeSphere(radius, latitudeBands, longitudeBands, &mesh.vertices[0], &mesh.indices[0], pool);
+    return mesh;
+}
+
+
+Mesh generateTorus(float R, float r, int numMajor, int numMinor, ThreadPool& pool) {
+    Mesh mesh;
+    mesh.vertices.resize(torusVertexCount(numMajor, numMinor));
+    mesh.indices.resize(torusIndexCount(numMajor, numMinor));
+    writeTorus(R, r, numMajor, numMinor, &mesh.vertices[0], &mesh.indices[0], pool);
+    return mesh;
+}
+
+
+void benchmarkMeshGenerators() {
+    const int sizes[][2] = { { 512, 512 }, { 2048, 2048 } };
+    const int repeats = 5;
+    ThreadPool serial(1);
+    ThreadPool& pool = defaultThreadPool();
+
+    printf("mesh          vertices   1 thread ms   %2u threads ms   speedup\n", pool.size());
+    for (int shape = 0; shape < 2; shape++) {
+        for (const int* size : sizes) {
+            double best[2] = { 1e30, 1e30 };
+            size_t vertexCount = 0;
+            for (int path = 0; path < 2; path++) {
+                ThreadPool& runner = path == 0 ? serial : pool;
+                for (int r = 0; r < repeats; r++) {
+                    auto start = std::chrono::steady_clock::now();
+                    Mesh mesh = shape == 0
+                        ? generateSphere(0.5f, size[0], size[1], runner)
+                        : generateTorus(2.5f, 0.7f, size[0], size[1], runner);
+                    auto end = std::chrono::steady_clock::now();
+                    best[path] = std::min(best[path], std::chrono::duration<double, std::milli>(end - start).count());
+                    vertexCount = mesh.vertices.size();
+                }
+            }
+            printf("%-6s %4dx%-4d %9zu %13.2f %15.2f %8.1fx\n", shape == 0 ? "sphere" : "torus",
+                size[0], size[1], vertexCount, best[0], best[1], best[0] / best[1]);
+        }
+    }
+}
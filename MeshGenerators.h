@@ -0,0 +1,39 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- MeshGenerators.h ---
+//
+//   Procedural sphere and torus generators.  Each ring's sines and cosines
+//   come from a table built once per call, rows are split across a thread
+//   pool, and every row writes interleaved vertices and its indices
+//   straight into its own slice of a preallocated destination, which may
+//   be a mapped GL buffer.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __MESHGENERATORS_H__
+#define __MESHGENERATORS_H__
+
+#include "MeshRegistry.h"
+#include "ThreadPool.h"
+
+// Sizes of the destination arrays the write functions fill
+size_t sphereVertexCount(int latitudeBands, int longitudeBands);
+size_t sphereIndexCount(int latitudeBands, int longitudeBands);
+size_t torusVertexCount(int numMajor, int numMinor);
+size_t torusIndexCount(int numMajor, int numMinor);
+
+// Latitude/longitude sphere centered on the origin; y is the polar axis
+void writeSphere(float radius, int latitudeBands, int longitudeBands,
+    MeshVertex* vertices, GLuint* indices, ThreadPool& pool = defaultThreadPool());
+
+// Torus around the z axis: R is the distance from the center to the tube, r the tube radius
+void writeTorus(float R, float r, int numMajor, int numMinor,
+    MeshVertex* vertices, GLuint* indices, ThreadPool& pool = defaultThreadPool());
+
+Mesh generateSphere(float radius, int latitudeBands, int longitudeBands, ThreadPool& pool = defaultThreadPool());
+Mesh generateTorus(float R, float r, int numMajor, int numMinor, ThreadPool& pool = defaultThreadPool());
+
+// Times high-tessellation generation on one thread and on the default pool
+void benchmarkMeshGenerators();
+
+#endif // __MESHGENERATORS_H__
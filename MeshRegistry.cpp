@@ -0,0 +1,278 @@
+#include "MeshRegistry.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+
+size_t vertexStride(VertexFormat format) {
+    return format == VERTEX_PACKED ? sizeof(PackedMeshVertex) : sizeof(MeshVertex);
+}
+
+
+size_t indexSize(GLenum indexType) {
+    return indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+}
+
+
+GLenum meshIndexType(VertexFormat format, size_t vertexCount) {
+    return format == VERTEX_PACKED && vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+
+static GLuint packNormal(const GLfloat* n) {
+    GLuint packed = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        int value = (int)std::floor(std::max(-1.0f, std::min(1.0f, n[axis])) * 511.0f + 0.5f);
+        packed |= ((GLuint)value & 0x3FF) << (10 * axis);
+    }
+    return packed;
+}
+
+
+static void encodeVertices(const MeshVertex* source, size_t count, VertexFormat format, std::vector<unsigned char>& out) {
+    out.resize(count * vertexStride(format));
+    if (format == VERTEX_FLOAT) {
+        if (count > 0) {
+            memcpy(&out[0], source, out.size());
+        }
+        return;
+    }
+
+    // Per-mesh scale: w is the largest integer that keeps every coordinate in range
+    float extent = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+        const GLfloat* p = source[i].position;
+        extent = std::max(extent, std::max(std::fabs(p[0]), std::max(std::fabs(p[1]), std::fabs(p[2]))));
+    }
+    int w = extent > 1.0f ? (int)(32767.0f / extent) : 32767;
+
+    PackedMeshVertex* packed = (PackedMeshVertex*)(count > 0 ? &out[0] : NULL);
+    for (size_t i = 0; i < count; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            float value = std::floor(source[i].position[axis] * w + 0.5f);
+            packed[i].position[axis] = (GLshort)std::max(-32767.0f, std::min(32767.0f, value));
+        }
+        packed[i].position[3] = (GLshort)w;
+        packed[i].normal = packNormal(source[i].normal);
+    }
+}
+
+
+static void encodeIndices(const GLuint* source, size_t count, GLenum type, std::vector<unsigned char>& out) {
+    out.resize(count * indexSize(type));
+    if (type == GL_UNSIGNED_INT) {
+        if (count > 0) {
+            memcpy(&out[0], source, out.size());
+        }
+        return;
+    }
+    GLushort* narrow = (GLushort*)(count > 0 ? &out[0] : NULL);
+    for (size_t i = 0; i < count; i++) {
+        narrow[i] = (GLushort)source[i];
+    }
+}
+
+
+GLenum encodeMesh(const Mesh& mesh, VertexFormat format,
+    std::vector<unsigned char>& vertexBytes, std::vector<unsigned char>& indexBytes) {
+    GLenum type = meshIndexType(format, mesh.vertices.size());
+    encodeVertices(mesh.vertices.empty() ? NULL : &mesh.vertices[0], mesh.vertices.size(), format, vertexBytes);
+    encodeIndices(mesh.indices.empty() ? NULL : &mesh.indices[0], mesh.indices.size(), type, indexBytes);
+    return type;
+}
+
+
+int MeshRegistry::add(const Mesh& mesh) {
+    Source source;
+    source.firstVertex = vertices.size();
+    source.vertexCount = mesh.vertices.size();
+    source.firstIndex = indices.size();
+    source.indexCount = mesh.indices.size();
+    source.encoded = false;
+
+    vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+    // Indices stay mesh-local; baseVertex offsets them at draw time
+    indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+
+    sources.push_back(source);
+    return (int)sources.size() - 1;
+}
+
+
+int MeshRegistry::add(const std::vector<vec3>& positions, const std::vector<vec3>& normals,
+    const std::vector<GLuint>& meshIndices) {
+    Mesh mesh;
+    mesh.vertices.resize(positions.size());
+    for (size_t i = 0; i < positions.size(); i++) {
+        vec3 normal = i < normals.size() ? normals[i] : vec3(0.0f, 0.0f, 0.0f);
+        MeshVertex v = {
+            { positions[i].x, positions[i].y, positions[i].z },
+            { normal.x, normal.y, normal.z }
+        };
+        mesh.vertices[i] = v;
+    }
+    mesh.indices = meshIndices;
+    return add(mesh);
+}
+
+
+int MeshRegistry::addEncoded(const EncodedMesh& mesh) {
+    Source source;
+    source.firstVertex = source.firstIndex = 0;
+    source.vertexCount = mesh.vertexCount;
+    source.indexCount = mesh.indexCount;
+    source.encoded = true;
+    source.data = mesh;
+    sources.push_back(source);
+    return (int)sources.size() - 1;
+}
+
+
+size_t MeshRegistry::floatBytes() const {
+    size_t bytes = 0;
+    for (const Source& source : sources) {
+        bytes += source.vertexCount * sizeof(MeshVertex) + source.indexCount * sizeof(GLuint);
+    }
+    return bytes;
+}
+
+
+void MeshRegistry::upload(VertexFormat vertexFormat) {
+    format = vertexFormat;
+    ranges.clear();
+
+    // Lay out every range first so both buffers can be allocated once
+    const size_t stride = vertexStride(format);
+    size_t vertexCount = 0, indexBytes = 0;
+    for (const Source& source : sources) {
+        MeshRange range;
+        range.baseVertex = (GLint)vertexCount;
+        range.indexCount = (GLsizei)source.indexCount;
+        range.indexType = source.encoded ? source.data.indexType : meshIndexType(format, source.vertexCount);
+        if (source.encoded && source.data.format != format) {
+            fprintf(stderr, "mesh %d is encoded in another vertex format and is left empty\n", (int)ranges.size());
+            range.indexCount = 0;
+        }
+
+        // Aligned so the range starts on a whole index
+        size_t size = indexSize(range.indexType);
+        indexBytes = (indexBytes + size - 1) / size * size;
+        range.firstIndex = (GLuint)(indexBytes / size);
+        indexBytes += source.indexCount * size;
+        vertexCount += source.vertexCount;
+        ranges.push_back(range);
+    }
+    uploadedVertexBytes = vertexCount * stride;
+    uploadedIndexBytes = indexBytes;
+
+    if (vao == 0) {
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vertexBuffer);
+        glGenBuffers(1, &indexBuffer);
+    }
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, uploadedVertexBytes, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, uploadedIndexBytes, NULL, GL_STATIC_DRAW);
+
+    // Each range goes straight from its source when that is already in the
+    // target format, and through a scratch encoding otherwise
+    std::vector<unsigned char> scratch;
+    for (size_t i = 0; i < sources.size(); i++) {
+        const Source& source = sources[i];
+        const MeshRange& range = ranges[i];
+        if (range.indexCount == 0 && source.indexCount != 0) {
+            continue;
+        }
+
+        const void* vertexData = source.encoded ? source.data.vertices : NULL;
+        if (!source.encoded && source.vertexCount > 0) {
+            if (format == VERTEX_FLOAT) {
+                vertexData = &vertices[source.firstVertex];
+            }
+            else {
+                encodeVertices(&vertices[source.firstVertex], source.vertexCount, format, scratch);
+                vertexData = &scratch[0];
+            }
+        }
+        if (source.vertexCount > 0) {
+            glBufferSubData(GL_ARRAY_BUFFER, range.baseVertex * stride, source.vertexCount * stride, vertexData);
+        }
+
+        const void* indexData = source.encoded ? source.data.indices : NULL;
+        if (!source.encoded && source.indexCount > 0) {
+            if (range.indexType == GL_UNSIGNED_INT) {
+                indexData = &indices[source.firstIndex];
+            }
+            else {
+                encodeIndices(&indices[source.firstIndex], source.indexCount, range.indexType, scratch);
+                indexData = &scratch[0];
+            }
+        }
+        if (source.indexCount > 0) {
+            size_t size = indexSize(range.indexType);
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, range.firstIndex * size, source.indexCount * size, indexData);
+        }
+    }
+
+    if (format == VERTEX_PACKED) {
+        glVertexAttribPointer(0, 4, GL_SHORT, GL_TRUE, sizeof(PackedMeshVertex), (void*)offsetof(PackedMeshVertex, position));
+        glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedMeshVertex), (void*)offsetof(PackedMeshVertex, normal));
+    }
+    else {
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, position));
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, normal));
+    }
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+
+    glBindVertexArray(0);
+}
+
+
+void MeshRegistry::release() {
+    if (vao != 0) {
+        glDeleteVertexArrays(1, &vao);
+        glDeleteBuffers(1, &vertexBuffer);
+        glDeleteBuffers(1, &indexBuffer);
+        vao = vertexBuffer = indexBuffer = 0;
+    }
+}
+
+
+DrawElementsIndirectCommand MeshRegistry::command(int mesh, GLuint instanceCount, GLuint baseInstance) const {
+    const MeshRange& range = ranges[mesh];
+    DrawElementsIndirectCommand command = {
+        (GLuint)range.indexCount, instanceCount, range.firstIndex, range.baseVertex, baseInstance
+    };
+    return command;
+}
+
+
+static size_t indexOffset(const MeshRange& range) {
+    return range.firstIndex * indexSize(range.indexType);
+}
+
+
+void MeshRegistry::draw(int mesh, GLenum mode) const {
+    const MeshRange& range = ranges[mesh];
+    glDrawElementsBaseVertex(mode, range.indexCount, range.indexType,
+        (void*)indexOffset(range), range.baseVertex);
+}
+
+
+void MeshRegistry::drawInstanced(int mesh, GLsizei instanceCount) const {
+    const MeshRange& range = ranges[mesh];
+    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.indexCount, range.indexType,
+        (void*)indexOffset(range), instanceCount, range.baseVertex);
+}
+
+
+void MeshRegistry::drawInstance(int mesh, GLenum mode, GLuint baseInstance) const {
+    const MeshRange& range = ranges[mesh];
+    glDrawElementsInstancedBaseVertexBaseInstance(mode, range.indexCount, range.indexType,
+        (void*)indexOffset(range), 1, range.baseVertex, baseInstance);
+}
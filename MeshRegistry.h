@@ -0,0 +1,146 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- MeshRegistry.h ---
+//
+//   Mesh arena.  Every mesh is appended to one shared vertex buffer and
+//   one shared index buffer and is afterwards known only by the range it
+//   occupies (base vertex, first index, index count).  One VAO describes
+//   the whole arena, so switching meshes never rebinds vertex state, and
+//   the ranges map directly onto indirect draw commands.
+//
+//   Vertices are encoded when the arena is uploaded.  The packed format
+//   stores a position as four snorm16 values (x, y, z, w) read as a
+//   homogeneous point, so a mesh larger than the unit cube keeps full
+//   precision by carrying its scale in w, and the normal as
+//   GL_INT_2_10_10_10_REV.  Each mesh that has at most 65536 vertices also
+//   gets 16-bit indices; larger ones keep 32-bit indices in the same
+//   buffer.  Meshes that are already encoded (e.g. mapped from the mesh
+//   cache) are uploaded straight from the caller's memory.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __MESHREGISTRY_H__
+#define __MESHREGISTRY_H__
+
+#include "Angel.h"
+#include <vector>
+
+enum VertexFormat {
+    VERTEX_FLOAT,  // float position and normal (24 bytes), 32-bit indices
+    VERTEX_PACKED  // snorm16 homogeneous position and 2_10_10_10 normal (12 bytes), 16-bit indices where they fit
+};
+
+// Interleaved arena vertex in each format, read at attribute locations 0 and 1
+struct MeshVertex {
+    GLfloat position[3];
+    GLfloat normal[3];
+};
+
+// Indexed triangle (or line) mesh with interleaved float vertices, as produced
+// by the generators and consumed by MeshRegistry::add
+struct Mesh {
+    std::vector<MeshVertex> vertices;
+    std::vector<GLuint> indices;
+};
+
+struct PackedMeshVertex {
+    GLshort position[4]; // x, y, z scaled by w; divide by w for the object-space point
+    GLuint normal;       // GL_INT_2_10_10_10_REV, w bits unused
+};
+
+// Upload-ready bytes of one mesh in one vertex format; the memory belongs to the caller
+struct EncodedMesh {
+    VertexFormat format;
+    const void* vertices;
+    size_t vertexCount;
+    const void* indices;
+    size_t indexCount;
+    GLenum indexType;
+};
+
+size_t vertexStride(VertexFormat format);
+size_t indexSize(GLenum indexType);
+
+// Index width a mesh of vertexCount vertices gets in format
+GLenum meshIndexType(VertexFormat format, size_t vertexCount);
+
+// Encodes mesh exactly as the arena uploads it; returns the index type
+GLenum encodeMesh(const Mesh& mesh, VertexFormat format,
+    std::vector<unsigned char>& vertexBytes, std::vector<unsigned char>& indexBytes);
+
+struct MeshRange {
+    GLint baseVertex;
+    GLuint firstIndex;   // in units of indexType
+    GLsizei indexCount;
+    GLenum indexType;    // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+};
+
+// Layout glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+class MeshRegistry {
+public:
+    // Appends a copy of a mesh and returns its id.  Nothing reaches GL until upload().
+    int add(const Mesh& mesh);
+    // Same from separate arrays; an empty normals vector stores zero normals
+    int add(const std::vector<vec3>& positions, const std::vector<vec3>& normals,
+        const std::vector<GLuint>& indices);
+    // Appends an already encoded mesh without copying it; its memory must stay
+    // valid until upload(), whose format must match
+    int addEncoded(const EncodedMesh& mesh);
+
+    // Encodes every mesh added so far in the given format, uploads it and
+    // (re)builds the arena VAO; the ranges are valid from here on
+    void upload(VertexFormat format);
+
+    // Deletes the GL buffers and VAO
+    void release();
+
+    const MeshRange& range(int mesh) const { return ranges[mesh]; }
+    GLenum indexType(int mesh) const { return ranges[mesh].indexType; }
+
+    DrawElementsIndirectCommand command(int mesh, GLuint instanceCount, GLuint baseInstance) const;
+
+    // Draws one mesh; the arena VAO must be bound
+    void draw(int mesh, GLenum mode = GL_TRIANGLES) const;
+    void drawInstanced(int mesh, GLsizei instanceCount) const;
+
+    // Draws one instance of mesh whose per-instance attributes come from
+    // record baseInstance; needs OpenGL 4.2 or ARB_base_instance
+    void drawInstance(int mesh, GLenum mode, GLuint baseInstance) const;
+
+    // Uploaded buffer sizes, and what the float format with 32-bit indices would take
+    size_t vertexBytes() const { return uploadedVertexBytes; }
+    size_t indexBytes() const { return uploadedIndexBytes; }
+    size_t floatBytes() const;
+
+    VertexFormat format = VERTEX_FLOAT;
+    GLuint vao = 0;
+    GLuint vertexBuffer = 0;
+    GLuint indexBuffer = 0;
+
+private:
+    struct Source {
+        size_t firstVertex, vertexCount; // into vertices, unless encoded
+        size_t firstIndex, indexCount;   // into indices, unless encoded
+        bool encoded;
+        EncodedMesh data;
+    };
+
+    // Copied source geometry in the float layout, kept so the arena can be re-encoded
+    std::vector<MeshVertex> vertices;
+    std::vector<GLuint> indices;
+    std::vector<Source> sources;
+
+    std::vector<MeshRange> ranges;
+    size_t uploadedVertexBytes = 0;
+    size_t uploadedIndexBytes = 0;
+};
+
+#endif // __MESHREGISTRY_H__
@@ -0,0 +1,435 @@
+#include "Offscreen.h"
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef MAJORTOM_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+
+//----------------------------------------------------------------------------
+//
+//  --- EGL context and framebuffer ---
+//
+
+static GLuint offscreenFBO, offscreenColorRB, offscreenDepthRB;
+
+#ifdef MAJORTOM_EGL
+
+static EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+static EGLSurface eglSurface = EGL_NO_SURFACE;
+static EGLContext eglContext = EGL_NO_CONTEXT;
+
+// Tries a GPU exposed through EGL_EXT_platform_device first, then Mesa's
+// surfaceless platform (llvmpipe on GPU-less nodes), then the default display
+static EGLDisplay openDisplay() {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    PFNEGLQUERYDEVICESEXTPROC queryDevices =
+        (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+
+    if (getPlatformDisplay && queryDevices) {
+        EGLDeviceEXT devices[8];
+        EGLint count = 0;
+        if (queryDevices(8, devices, &count)) {
+            for (EGLint i = 0; i < count; i++) {
+                EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, devices[i], NULL);
+                if (display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL)) {
+                    return display;
+                }
+            }
+        }
+    }
+    if (getPlatformDisplay) {
+        EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL)) {
+            return display;
+        }
+    }
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL)) {
+        return display;
+    }
+    return EGL_NO_DISPLAY;
+}
+
+static bool createEGLContext() {
+    eglDisplay = openDisplay();
+    if (eglDisplay == EGL_NO_DISPLAY) {
+        fprintf(stderr, "offscreen: no usable EGL display\n");
+        return false;
+    }
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(eglDisplay, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+        fprintf(stderr, "offscreen: no pbuffer-capable EGL config\n");
+        return false;
+    }
+
+    // Rendering goes to the FBO; the pbuffer only gives the context a drawable
+    const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+    eglSurface = eglCreatePbufferSurface(eglDisplay, config, pbufferAttribs);
+    if (eglSurface == EGL_NO_SURFACE) {
+        fprintf(stderr, "offscreen: could not create an EGL pbuffer surface\n");
+        return false;
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        fprintf(stderr, "offscreen: EGL implementation has no desktop OpenGL\n");
+        return false;
+    }
+
+    // Compatibility profile like the default GLUT window; drivers hand back
+    // their highest version that satisfies 3.3
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+        EGL_NONE
+    };
+    eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+    if (eglContext == EGL_NO_CONTEXT) {
+        fprintf(stderr, "offscreen: could not create an OpenGL 3.3 context\n");
+        return false;
+    }
+
+    if (!eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext)) {
+        fprintf(stderr, "offscreen: eglMakeCurrent failed\n");
+        return false;
+    }
+    return true;
+}
+
+#endif // MAJORTOM_EGL
+
+
+bool createOffscreenContext(int width, int height) {
+#ifdef MAJORTOM_EGL
+    if (!createEGLContext()) {
+        return false;
+    }
+
+    // Without an X display GLEW reports the missing GLX display after it
+    // has already loaded the core entry points, which is all we need
+    glewExperimental = GL_TRUE;
+    GLenum err = glewInit();
+    if (err != GLEW_OK && err != GLEW_ERROR_NO_GLX_DISPLAY) {
+        fprintf(stderr, "offscreen: glewInit failed: %s\n", glewGetErrorString(err));
+        return false;
+    }
+
+    glGenFramebuffers(1, &offscreenFBO);
+    glGenRenderbuffers(1, &offscreenColorRB);
+    glGenRenderbuffers(1, &offscreenDepthRB);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, offscreenColorRB);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    // Float depth, which reversed-Z spreads evenly over distance
+    glBindRenderbuffer(GL_RENDERBUFFER, offscreenDepthRB);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, offscreenFBO);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreenColorRB);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, offscreenDepthRB);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "offscreen: framebuffer incomplete\n");
+        return false;
+    }
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glViewport(0, 0, width, height);
+
+    fprintf(stderr, "offscreen: %s / %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+    return true;
+#else
+    (void)width;
+    (void)height;
+    fprintf(stderr, "offscreen: built without EGL support (define MAJORTOM_EGL and link EGL)\n");
+    return false;
+#endif
+}
+
+
+void destroyOffscreenContext() {
+#ifdef MAJORTOM_EGL
+    if (offscreenFBO) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &offscreenFBO);
+        glDeleteRenderbuffers(1, &offscreenColorRB);
+        glDeleteRenderbuffers(1, &offscreenDepthRB);
+        offscreenFBO = offscreenColorRB = offscreenDepthRB = 0;
+    }
+    if (eglDisplay != EGL_NO_DISPLAY) {
+        eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (eglContext != EGL_NO_CONTEXT) eglDestroyContext(eglDisplay, eglContext);
+        if (eglSurface != EGL_NO_SURFACE) eglDestroySurface(eglDisplay, eglSurface);
+        eglTerminate(eglDisplay);
+    }
+    eglDisplay = EGL_NO_DISPLAY;
+    eglSurface = EGL_NO_SURFACE;
+    eglContext = EGL_NO_CONTEXT;
+#endif
+}
+
+
+//----------------------------------------------------------------------------
+//
+//  --- Image files ---
+//
+
+bool parseFrameFormat(const char* name, FrameFormat& format) {
+    if (strcmp(name, "ppm") == 0) format = FRAME_PPM;
+    else if (strcmp(name, "png") == 0) format = FRAME_PNG;
+    else if (strcmp(name, "raw") == 0) format = FRAME_RAW;
+    else return false;
+    return true;
+}
+
+// Raw frames go here once reserveStdoutForFrames() has moved them off stdout
+static FILE* rawFrames = nullptr;
+
+static FILE* frameStream() {
+    return rawFrames ? rawFrames : stdout;
+}
+
+bool reserveStdoutForFrames() {
+    fflush(stdout);
+#ifdef _WIN32
+    int frames = _dup(_fileno(stdout));
+    if (frames < 0 || _dup2(_fileno(stderr), _fileno(stdout)) < 0) {
+        fprintf(stderr, "offscreen: could not keep stdout for raw frames\n");
+        return false;
+    }
+    rawFrames = _fdopen(frames, "wb");
+#else
+    int frames = dup(fileno(stdout));
+    if (frames < 0 || dup2(fileno(stderr), fileno(stdout)) < 0) {
+        fprintf(stderr, "offscreen: could not keep stdout for raw frames\n");
+        return false;
+    }
+    rawFrames = fdopen(frames, "wb");
+#endif
+    return rawFrames != nullptr;
+}
+
+static void writePPM(const char* path, int width, int height, const unsigned char* rgba) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "offscreen: cannot write %s\n", path);
+        return;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    std::vector<unsigned char> rgb(width * 3);
+    for (int y = 0; y < height; y++) {
+        const unsigned char* src = rgba + (size_t)y * width * 4;
+        for (int x = 0; x < width; x++) {
+            rgb[x * 3 + 0] = src[x * 4 + 0];
+            rgb[x * 3 + 1] = src[x * 4 + 1];
+            rgb[x * 3 + 2] = src[x * 4 + 2];
+        }
+        fwrite(&rgb[0], 1, rgb.size(), file);
+    }
+    fclose(file);
+}
+
+static uint32_t crcTable[256];
+
+static uint32_t crc32(uint32_t crc, const unsigned char* data, size_t length) {
+    if (crcTable[1] == 0) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            crcTable[n] = c;
+        }
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void putBE32(std::vector<unsigned char>& out, uint32_t v) {
+    out.push_back((unsigned char)(v >> 24));
+    out.push_back((unsigned char)(v >> 16));
+    out.push_back((unsigned char)(v >> 8));
+    out.push_back((unsigned char)v);
+}
+
+static void writeChunk(FILE* file, const char* type, const std::vector<unsigned char>& data) {
+    std::vector<unsigned char> chunk;
+    putBE32(chunk, (uint32_t)data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    putBE32(chunk, crc32(0, &chunk[4], chunk.size() - 4));
+    fwrite(&chunk[0], 1, chunk.size(), file);
+}
+
+// Writes an RGBA8 PNG using stored (uncompressed) deflate blocks: no zlib
+// dependency, and throughput is bound by disk rather than compression
+static void writePNG(const char* path, int width, int height, const unsigned char* rgba) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "offscreen: cannot write %s\n", path);
+        return;
+    }
+    static const unsigned char signature[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+    fwrite(signature, 1, 8, file);
+
+    std::vector<unsigned char> header;
+    putBE32(header, width);
+    putBE32(header, height);
+    header.push_back(8); // bit depth
+    header.push_back(6); // color type RGBA
+    header.push_back(0);
+    header.push_back(0);
+    header.push_back(0);
+    writeChunk(file, "IHDR", header);
+
+    // Scanlines with filter type 0
+    size_t stride = (size_t)width * 4;
+    std::vector<unsigned char> raw((stride + 1) * height);
+    for (int y = 0; y < height; y++) {
+        raw[y * (stride + 1)] = 0;
+        memcpy(&raw[y * (stride + 1) + 1], rgba + y * stride, stride);
+    }
+
+    std::vector<unsigned char> zdata;
+    zdata.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    zdata.push_back(0x78);
+    zdata.push_back(0x01);
+    uint32_t a = 1, b = 0;
+    for (size_t pos = 0; pos < raw.size() || pos == 0; ) {
+        size_t length = raw.size() - pos;
+        if (length > 65535) length = 65535;
+        bool last = pos + length == raw.size();
+        zdata.push_back(last ? 1 : 0);
+        zdata.push_back((unsigned char)length);
+        zdata.push_back((unsigned char)(length >> 8));
+        zdata.push_back((unsigned char)~length);
+        zdata.push_back((unsigned char)(~length >> 8));
+        zdata.insert(zdata.end(), raw.begin() + pos, raw.begin() + pos + length);
+        for (size_t i = pos; i < pos + length; i++) {
+            a = (a + raw[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        pos += length;
+        if (last) break;
+    }
+    putBE32(zdata, (b << 16) | a);
+    writeChunk(file, "IDAT", zdata);
+    writeChunk(file, "IEND", std::vector<unsigned char>());
+    fclose(file);
+}
+
+
+//----------------------------------------------------------------------------
+//
+//  --- FrameCapture ---
+//
+
+void FrameCapture::init(int w, int h, FrameFormat f) {
+    width = w;
+    height = h;
+    format = f;
+    next = 0;
+    pending = false;
+    totalBytes = 0;
+    rows.resize((size_t)width * height * 4);
+
+    glGenBuffers(2, pbo);
+    for (int i = 0; i < 2; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, rows.size(), NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+#ifdef _WIN32
+    if (format == FRAME_RAW) {
+        _setmode(_fileno(frameStream()), _O_BINARY);
+    }
+#endif
+}
+
+
+void FrameCapture::capture(const std::string& path) {
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[next]);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // The other buffer holds the previous frame, which has had a whole
+    // frame of GPU time to arrive
+    next = 1 - next;
+    writePending();
+
+    pending = true;
+    pendingPath = path;
+}
+
+
+void FrameCapture::finish() {
+    next = 1 - next;
+    writePending();
+    next = 1 - next;
+    if (format == FRAME_RAW) {
+        fflush(frameStream());
+    }
+}
+
+
+void FrameCapture::writePending() {
+    if (!pending) {
+        return;
+    }
+    pending = false;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[next]);
+    const unsigned char* pixels = (const unsigned char*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (pixels) {
+        // GL rows are bottom-up; every output format is top-down
+        size_t stride = (size_t)width * 4;
+        for (int y = 0; y < height; y++) {
+            memcpy(&rows[y * stride], pixels + (height - 1 - y) * stride, stride);
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (!pixels) {
+        return;
+    }
+
+    if (format == FRAME_RAW) {
+        fwrite(&rows[0], 1, rows.size(), frameStream());
+    }
+    else if (format == FRAME_PPM) {
+        writePPM(pendingPath.c_str(), width, height, &rows[0]);
+    }
+    else {
+        writePNG(pendingPath.c_str(), width, height, &rows[0]);
+    }
+    totalBytes += rows.size();
+}
+
+
+void FrameCapture::release() {
+    if (pbo[0]) {
+        glDeleteBuffers(2, pbo);
+        pbo[0] = pbo[1] = 0;
+    }
+}
@@ -0,0 +1,74 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- Offscreen.h ---
+//
+//   Headless rendering backend for machines without a display or GPU.
+//   A GL context is created through EGL (a device or Mesa's surfaceless
+//   platform, so llvmpipe works) and the scene is drawn into a framebuffer
+//   object.  FrameCapture reads frames back through a pair of pixel buffer
+//   objects and writes them as PPM, PNG or raw RGBA on stdout.
+//
+//   EGL support is compiled in when MAJORTOM_EGL is defined.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __OFFSCREEN_H__
+#define __OFFSCREEN_H__
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+
+// Creates an EGL context, loads GL entry points and binds a width x height
+// framebuffer object with color and depth attachments.  Returns false (and
+// prints why) when no context could be created.
+bool createOffscreenContext(int width, int height);
+
+void destroyOffscreenContext();
+
+enum FrameFormat {
+    FRAME_PPM,
+    FRAME_PNG,
+    FRAME_RAW   // tightly packed top-down RGBA8 on stdout
+};
+
+// Parses "ppm", "png" or "raw"; returns false for anything else
+bool parseFrameFormat(const char* name, FrameFormat& format);
+
+// Keeps stdout for raw frames alone: the file stdout writes to becomes the
+// frame stream and stdout itself is pointed at stderr, so summaries and
+// notices printed anywhere afterwards can't land among the frames.  Call
+// before anything is printed; false if the descriptors can't be duplicated.
+bool reserveStdoutForFrames();
+
+// Asynchronous readback of the current framebuffer.  capture() starts a
+// transfer into one pixel buffer and writes out the frame captured before
+// it from the other, so the CPU never waits for the frame it just queued.
+class FrameCapture {
+public:
+    void init(int width, int height, FrameFormat format);
+
+    // Queues the current framebuffer contents; path is ignored for FRAME_RAW
+    void capture(const std::string& path);
+
+    // Writes the frame still in flight
+    void finish();
+
+    void release();
+
+    size_t bytesWritten() const { return totalBytes; }
+
+private:
+    void writePending();
+
+    int width = 0, height = 0;
+    FrameFormat format = FRAME_PNG;
+    GLuint pbo[2] = { 0, 0 };
+    int next = 0;
+    bool pending = false;
+    std::string pendingPath;
+    std::vector<unsigned char> rows;
+    size_t totalBytes = 0;
+};
+
+#endif // __OFFSCREEN_H__
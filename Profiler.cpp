@@ -0,0 +1,355 @@
+#include "Profiler.h"
+#include <GL/freeglut.h>
+#include <algorithm>
+#include <cstdio>
+
+
+// Both tables are sized by their entries and checked against the enum: an
+// array declared [PROFILE_SCOPE_COUNT] would zero-fill a missing one
+const char* const profileScopeNames[] = {
+    "culling",
+    "lights",
+    "universe",
+    "ship_tori",
+    "tetrahedron",
+    "ground",
+    "station",
+    "planets",
+    "indirect",
+    "submit",
+    "swap"
+};
+static_assert(sizeof(profileScopeNames) / sizeof(profileScopeNames[0]) == PROFILE_SCOPE_COUNT,
+    "every profile scope needs a name");
+
+// Screen-space colored triangles, positions in pixels from the top-left corner
+static const char* hudVertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec2 vPosition;
+layout (location = 1) in vec3 vColor;
+
+out vec3 interpColor;
+
+uniform vec2 ScreenSize;
+
+void main() {
+    vec2 ndc = vPosition / ScreenSize * 2.0 - 1.0;
+    interpColor = vColor;
+    gl_Position = vec4(ndc.x, -ndc.y, 0.0, 1.0);
+}
+)";
+
+static const char* hudFragmentShaderSource = R"(
+#version 330 core
+in vec3 interpColor;
+out vec4 FragColor;
+
+void main() {
+    FragColor = vec4(interpColor, 1.0);
+}
+)";
+
+static const GLfloat scopeColors[][3] = {
+    { 0.9f, 0.6f, 1.0f },   // culling
+    { 1.0f, 0.9f, 0.6f },   // lights
+    { 0.6f, 1.0f, 0.8f },   // universe
+    { 1.0f, 0.5f, 0.0f },   // ship_tori
+    { 1.0f, 0.2f, 0.2f },   // tetrahedron
+    { 0.8f, 0.8f, 0.8f },   // ground
+    { 0.5f, 0.5f, 1.0f },   // station
+    { 0.3f, 1.0f, 0.3f },   // planets
+    { 0.3f, 0.9f, 0.9f },   // indirect
+    { 1.0f, 0.6f, 0.8f },   // submit
+    { 1.0f, 1.0f, 0.3f }    // swap
+};
+static_assert(sizeof(scopeColors) / sizeof(scopeColors[0]) == PROFILE_SCOPE_COUNT, "every profile scope needs a color");
+
+GLint beginOverlayText() {
+    GLint program = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glUseProgram(0);
+    return program;
+}
+
+
+void endOverlayText(GLint program) {
+    glUseProgram(program);
+}
+
+
+void drawOverlayText(float x, float y, int height, const char* text, const GLfloat* color) {
+    glColor3fv(color);
+    glWindowPos2f(x, height - y - 10.0f);
+    glutBitmapString(GLUT_BITMAP_8_BY_13, (const unsigned char*)text);
+}
+
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    size_t index = (size_t)(p * (values.size() - 1) + 0.5);
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+
+void FrameProfiler::init(int history) {
+    ring.assign(std::max(history, 1), FrameSample());
+    frame = -1;
+
+    // Timer queries are core in 3.3; ARB_timer_query covers older contexts
+    gpuTiming = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    for (QuerySet& set : querySets) {
+        set.issued = 0;
+        set.frame = -1;
+    }
+
+    hudProgram.build(hudVertexShaderSource, hudFragmentShaderSource);
+    glGenVertexArrays(1, &hudVAO);
+    glGenBuffers(1, &hudVBO);
+    glBindVertexArray(hudVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, hudVBO);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void*)(2 * sizeof(GLfloat)));
+    glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
+}
+
+
+FrameSample* FrameProfiler::sampleFor(long long f) {
+    if (f < 0) {
+        return NULL;
+    }
+    FrameSample& sample = ring[f % ring.size()];
+    return sample.frame == f ? &sample : NULL;
+}
+
+
+// Reads back the query set issued two frames ago, skipping any result the
+// GPU hasn't produced yet rather than blocking on it; a scope gets a GPU
+// time only if every one of its queries has arrived
+void FrameProfiler::collectQueries(int index) {
+    QuerySet& set = querySets[index];
+    FrameSample* sample = sampleFor(set.frame);
+    double gpuMs[PROFILE_SCOPE_COUNT] = {};
+    bool entered[PROFILE_SCOPE_COUNT] = {}, missing[PROFILE_SCOPE_COUNT] = {};
+    for (size_t i = 0; i < set.issued; i++) {
+        ProfileScope s = set.scopes[i];
+        entered[s] = true;
+        GLint available = 0;
+        glGetQueryObjectiv(set.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            missing[s] = true;
+            continue;
+        }
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(set.queries[i], GL_QUERY_RESULT, &nanoseconds);
+        gpuMs[s] += nanoseconds / 1e6;
+    }
+    for (int s = 0; s < PROFILE_SCOPE_COUNT; s++) {
+        if (sample && entered[s] && !missing[s]) {
+            sample->gpuMs[s] = gpuMs[s];
+        }
+    }
+    set.issued = 0;
+    set.frame = -1;
+}
+
+
+void FrameProfiler::beginFrame() {
+    Clock::time_point now = Clock::now();
+    FrameSample* previous = sampleFor(frame);
+    if (previous) {
+        previous->frameMs = std::chrono::duration<double, std::milli>(now - frameStart).count();
+    }
+
+    frame++;
+    frameStart = now;
+
+    FrameSample& sample = ring[frame % ring.size()];
+    sample.frame = frame;
+    sample.frameMs = 0.0;
+    for (int s = 0; s < PROFILE_SCOPE_COUNT; s++) {
+        sample.cpuMs[s] = 0.0;
+        sample.gpuMs[s] = -1.0;
+    }
+
+    if (gpuTiming) {
+        int set = (int)(frame % QuerySets);
+        collectQueries(set);
+        querySets[set].frame = frame;
+    }
+}
+
+
+void FrameProfiler::begin(ProfileScope scope) {
+    scopeStart[scope] = Clock::now();
+    if (gpuTiming && frame >= 0) {
+        QuerySet& set = querySets[frame % QuerySets];
+        if (set.issued == set.queries.size()) {
+            GLuint query = 0;
+            glGenQueries(1, &query);
+            set.queries.push_back(query);
+            set.scopes.push_back(scope);
+        }
+        set.scopes[set.issued] = scope;
+        glBeginQuery(GL_TIME_ELAPSED, set.queries[set.issued++]);
+    }
+}
+
+
+void FrameProfiler::end(ProfileScope scope) {
+    if (gpuTiming && frame >= 0) {
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+    FrameSample* sample = sampleFor(frame);
+    if (sample) {
+        sample->cpuMs[scope] += std::chrono::duration<double, std::milli>(Clock::now() - scopeStart[scope]).count();
+    }
+}
+
+
+std::vector<const FrameSample*> FrameProfiler::orderedSamples() const {
+    std::vector<const FrameSample*> samples;
+    long long first = std::max(0LL, frame - (long long)ring.size() + 1);
+    for (long long f = first; f <= frame; f++) {
+        const FrameSample& sample = ring[f % ring.size()];
+        if (sample.frame == f) {
+            samples.push_back(&sample);
+        }
+    }
+    return samples;
+}
+
+
+static void addQuad(std::vector<GLfloat>& v, float x0, float y0, float x1, float y1, const GLfloat* color) {
+    const float corners[6][2] = { { x0, y0 }, { x1, y0 }, { x1, y1 }, { x0, y0 }, { x1, y1 }, { x0, y1 } };
+    for (int i = 0; i < 6; i++) {
+        v.push_back(corners[i][0]);
+        v.push_back(corners[i][1]);
+        v.push_back(color[0]);
+        v.push_back(color[1]);
+        v.push_back(color[2]);
+    }
+}
+
+
+void FrameProfiler::drawHUD(int width, int height) {
+    std::vector<const FrameSample*> samples = orderedSamples();
+
+    // Completed frames only: the current one has no frame time yet
+    std::vector<double> frameTimes, cpu[PROFILE_SCOPE_COUNT], gpu[PROFILE_SCOPE_COUNT];
+    for (size_t i = 0; i < samples.size(); i++) {
+        if (samples[i]->frameMs <= 0.0) continue;
+        frameTimes.push_back(samples[i]->frameMs);
+        for (int s = 0; s < PROFILE_SCOPE_COUNT; s++) {
+            cpu[s].push_back(samples[i]->cpuMs[s]);
+            if (samples[i]->gpuMs[s] >= 0.0) gpu[s].push_back(samples[i]->gpuMs[s]);
+        }
+    }
+
+    // Bars: per-scope p50 GPU (or CPU without timer queries) beside each
+    // text row, and the frame time history along the bottom
+    const float left = 10.0f, lineHeight = 16.0f, barLeft = 330.0f, pixelsPerMs = 40.0f;
+    hudVertices.clear();
+    for (int s = 0; s < PROFILE_SCOPE_COUNT; s++) {
+        double ms = gpu[s].empty() ? percentile(cpu[s], 0.5) : percentile(gpu[s], 0.5);
+        float y = 10.0f + lineHeight * (s + 2);
+        addQuad(hudVertices, barLeft, y - 10.0f, barLeft + std::min((float)ms * pixelsPerMs, width - barLeft - 10.0f), y, scopeColors[s]);
+    }
+    const GLfloat barColor[3] = { 0.3f, 0.9f, 1.0f }, budgetColor[3] = { 1.0f, 0.3f, 0.3f };
+    size_t first = frameTimes.size() > (size_t)(width - 20) / 2 ? frameTimes.size() - (width - 20) / 2 : 0;
+    for (size_t i = first; i < frameTimes.size(); i++) {
+        float x = left + (i - first) * 2.0f;
+        float h = std::min((float)frameTimes[i] * 4.0f, height * 0.5f);
+        addQuad(hudVertices, x, height - 10.0f - h, x + 1.5f, height - 10.0f, barColor);
+    }
+    // 60 Hz budget line
+    addQuad(hudVertices, left, height - 10.0f - 16.7f * 4.0f - 1.0f, width - 10.0f, height - 10.0f - 16.7f * 4.0f, budgetColor);
+
+    GLboolean depthWasOn = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+
+    hudProgram.use();
+    glUniform2f(hudProgram.location("ScreenSize"), (GLfloat)width, (GLfloat)height);
+    glBindVertexArray(hudVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, hudVBO);
+    glBufferData(GL_ARRAY_BUFFER, hudVertices.size() * sizeof(GLfloat), hudVertices.empty() ? NULL : &hudVertices[0], GL_STREAM_DRAW);
+    glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(hudVertices.size() / 5));
+    glBindVertexArray(0);
+
+    char line[128];
+    const GLfloat white[3] = { 1.0f, 1.0f, 1.0f };
+    GLint program = beginOverlayText();
+    snprintf(line, sizeof(line), "frame  p50 %6.2f ms  p99 %6.2f ms  (%d frames)",
+        percentile(frameTimes, 0.5), percentile(frameTimes, 0.99), (int)frameTimes.size());
+    drawOverlayText(left, lineHeight, height, line, white);
+    for (int s = 0; s < PROFILE_SCOPE_COUNT; s++) {
+        if (gpu[s].empty()) {
+            snprintf(line, sizeof(line), "%-12s cpu %6.3f  gpu   n/a", profileScopeNames[s], percentile(cpu[s], 0.5));
+        }
+        else {
+            snprintf(line, sizeof(line), "%-12s cpu %6.3f  gpu %6.3f", profileScopeNames[s], percentile(cpu[s], 0.5), percentile(gpu[s], 0.5));
+        }
+        drawOverlayText(left, lineHeight * (s + 2), height, line, scopeColors[s]);
+    }
+    endOverlayText(program);
+
+    if (depthWasOn) {
+        glEnable(GL_DEPTH_TEST);
+    }
+}
+
+
+bool FrameProfiler::writeCSV(const char* path) const {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "frame,frame_ms");
+    for (int s = 0; s < PROFILE_SCOPE_COUNT; s++) {
+        fprintf(file, ",%s_cpu_ms,%s_gpu_ms", profileScopeNames[s], profileScopeNames[s]);
+    }
+    fprintf(file, "\n");
+
+    std::vector<const FrameSample*> samples = orderedSamples();
+    for (size_t i = 0; i < samples.size(); i++) {
+        const FrameSample& sample = *samples[i];
+        fprintf(file, "%lld,%.4f", sample.frame, sample.frameMs);
+        for (int s = 0; s < PROFILE_SCOPE_COUNT; s++) {
+            // Missing GPU results are left empty rather than written as zero
+            if (sample.gpuMs[s] >= 0.0) {
+                fprintf(file, ",%.4f,%.4f", sample.cpuMs[s], sample.gpuMs[s]);
+            }
+            else {
+                fprintf(file, ",%.4f,", sample.cpuMs[s]);
+            }
+        }
+        fprintf(file, "\n");
+    }
+    return fclose(file) == 0;
+}
+
+
+void FrameProfiler::printSummary() const {
+    std::vector<const FrameSample*> samples = orderedSamples();
+    std::vector<double> frameTimes, cpu[PROFILE_SCOPE_COUNT], gpu[PROFILE_SCOPE_COUNT];
+    for (size_t i = 0; i < samples.size(); i++) {
+        if (samples[i]->frameMs > 0.0) frameTimes.push_back(samples[i]->frameMs);
+        for (int s = 0; s < PROFILE_SCOPE_COUNT; s++) {
+            cpu[s].push_back(samples[i]->cpuMs[s]);
+            if (samples[i]->gpuMs[s] >= 0.0) gpu[s].push_back(samples[i]->gpuMs[s]);
+        }
+    }
+
+    printf("frame time over %d frames: p50 %.3f ms, p99 %.3f ms\n",
+        (int)frameTimes.size(), percentile(frameTimes, 0.5), percentile(frameTimes, 0.99));
+    printf("%-12s %10s %10s %10s %10s\n", "scope", "cpu p50", "cpu p99", "gpu p50", "gpu p99");
+    for (int s = 0; s < PROFILE_SCOPE_COUNT; s++) {
+        printf("%-12s %10.3f %10.3f %10.3f %10.3f\n", profileScopeNames[s],
+            percentile(cpu[s], 0.5), percentile(cpu[s], 0.99),
+            percentile(gpu[s], 0.5), percentile(gpu[s], 0.99));
+    }
+}
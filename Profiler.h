@@ -0,0 +1,118 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- Profiler.h ---
+//
+//   Per-pass frame profiler.  Each named scope records CPU time with a
+//   monotonic clock and GPU time with GL_TIME_ELAPSED queries.  A scope may
+//   be entered several times a frame (a pass records its packets, and the
+//   render queue later issues them in a few runs); every entry gets its own
+//   query and the times add up.  Scopes must not nest, since timer queries
+//   can't.  Queries are double-buffered: a frame's results are collected two
+//   frames later and only if already available, so the CPU never waits on
+//   the GPU.  The last N frames are kept in a ring buffer for the HUD
+//   overlay and CSV export.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <GL/glew.h>
+#include <chrono>
+#include <vector>
+#include "ShaderProgram.h"
+
+enum ProfileScope {
+    PROFILE_CULLING,
+    PROFILE_LIGHTS,
+    PROFILE_UNIVERSE,
+    PROFILE_SHIP_TORI,
+    PROFILE_TETRAHEDRON,
+    PROFILE_GROUND,
+    PROFILE_STATION,
+    PROFILE_PLANETS,
+    PROFILE_INDIRECT,
+    PROFILE_SUBMIT,
+    PROFILE_SWAP,
+    PROFILE_SCOPE_COUNT
+};
+
+// Short names used by the HUD and as CSV column prefixes
+extern const char* const profileScopeNames[];
+
+struct FrameSample {
+    long long frame = -1;
+    double frameMs = 0.0;                    // wall time from this frame's start to the next
+    double cpuMs[PROFILE_SCOPE_COUNT];
+    double gpuMs[PROFILE_SCOPE_COUNT];       // negative until (or unless) the result arrives
+};
+
+// Text goes through the compatibility raster path, which needs no program:
+// beginOverlayText() unbinds the current one, once per pass of text, and
+// returns it for endOverlayText() to bind again
+GLint beginOverlayText();
+void endOverlayText(GLint program);
+
+// Draws one line of GLUT bitmap text with its top-left corner at (x, y)
+// pixels from the top-left of a viewport height pixels tall; only between
+// beginOverlayText() and endOverlayText()
+void drawOverlayText(float x, float y, int height, const char* text, const GLfloat* color);
+
+// The value a fraction p of the way up values, by nearest rank; 0 when empty
+double percentile(std::vector<double> values, double p);
+
+class FrameProfiler {
+public:
+    // Needs a current GL context; history is the ring buffer length in frames
+    void init(int history);
+
+    // Starts a frame; the previous frame's time runs until this call
+    void beginFrame();
+
+    // Entered again in the same frame, a scope adds to its times
+    void begin(ProfileScope scope);
+    void end(ProfileScope scope);
+
+    bool hudVisible = false;
+
+    // Draws text and bars over the current framebuffer; uses GLUT bitmap
+    // fonts, so only call it from the windowed path
+    void drawHUD(int width, int height);
+
+    // Writes every frame in the ring buffer, oldest first; returns false on I/O failure
+    bool writeCSV(const char* path) const;
+
+    // Prints p50/p99 of the frame time and of each scope to stdout
+    void printSummary() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    static const int QuerySets = 2;
+
+    FrameSample* sampleFor(long long frame);
+    void collectQueries(int set);
+    std::vector<const FrameSample*> orderedSamples() const;
+
+    std::vector<FrameSample> ring;
+    long long frame = -1;
+    Clock::time_point frameStart;
+    Clock::time_point scopeStart[PROFILE_SCOPE_COUNT];
+
+    // One frame's queries, one per scope entry, in the order issued; the
+    // pool only grows
+    struct QuerySet {
+        std::vector<GLuint> queries;
+        std::vector<ProfileScope> scopes;
+        size_t issued = 0;
+        long long frame = -1;
+    };
+
+    bool gpuTiming = false;
+    QuerySet querySets[QuerySets];
+
+    ShaderProgram hudProgram;
+    GLuint hudVAO = 0, hudVBO = 0;
+    std::vector<GLfloat> hudVertices;
+};
+
+#endif // __PROFILER_H__
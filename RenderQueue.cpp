@@ -0,0 +1,256 @@
+#include "RenderQueue.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+// Key fields, see RenderQueue.h
+static const int LayerShift = 62, ProgramShift = 58, ArenaShift = 54, PassShift = 50, ColorShift = 30, MeshShift = 14;
+static_assert(PROFILE_SCOPE_COUNT <= 16, "profile scopes must fit the key's pass field");
+
+// Equal colors get equal bits; the backend compares the actual values, so
+// a collision only costs sort quality
+static uint64_t colorBits(const GLfloat color[3]) {
+    uint32_t hash = 2166136261u;
+    const unsigned char* bytes = (const unsigned char*)color;
+    for (int i = 0; i < 3 * (int)sizeof(GLfloat); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return (hash ^ (hash >> 20)) & 0xFFFFF;
+}
+
+
+void RenderBucket::submit(int program, int arena, int mesh, const Material& material, const Simd::Mat4& transform,
+    RenderLayer layer, GLenum mode) {
+    DrawPacket packet;
+    packet.key = ((uint64_t)layer << LayerShift) | ((uint64_t)program << ProgramShift) | ((uint64_t)arena << ArenaShift) |
+        ((uint64_t)pass << PassShift) | (colorBits(material.color) << ColorShift) | ((uint64_t)(mesh & 0xFFFF) << MeshShift);
+    packet.transform = (uint32_t)transforms.size();
+    packet.mesh = (uint16_t)mesh;
+    packet.mode = (uint16_t)mode;
+    memcpy(packet.color, material.color, sizeof(packet.color));
+    packets.push_back(packet);
+    transforms.push_back(transform);
+}
+
+
+void bindInstanceRecords(GLuint buffer, GLintptr offset) {
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (int row = 0; row < 3; row++) {
+        glVertexAttribPointer(4 + row, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceRecord),
+            (void*)(offset + offsetof(InstanceRecord, model) + row * 4 * sizeof(GLfloat)));
+        glEnableVertexAttribArray(4 + row);
+        glVertexAttribDivisor(4 + row, 1);
+    }
+    glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceRecord), (void*)(offset + offsetof(InstanceRecord, color)));
+    glEnableVertexAttribArray(7);
+    glVertexAttribDivisor(7, 1);
+}
+
+
+RenderStats& RenderStats::operator+=(const RenderStats& s) {
+    programs += s.programs;
+    arenas += s.arenas;
+    colors += s.colors;
+    draws += s.draws;
+    uniforms += s.uniforms;
+    return *this;
+}
+
+
+const unsigned RenderQueue::MaxBuckets;
+
+
+RenderQueue::RenderQueue(unsigned bucketCount)
+    : buckets(std::max(1u, std::min(bucketCount, MaxBuckets))) {
+}
+
+
+void RenderQueue::clear() {
+    for (RenderBucket& bucket : buckets) {
+        bucket.clear();
+    }
+}
+
+
+void RenderQueue::setPass(ProfileScope pass) {
+    for (RenderBucket& bucket : buckets) {
+        bucket.pass = pass;
+    }
+}
+
+
+void RenderQueue::sort() {
+    auto start = std::chrono::steady_clock::now();
+    recorded.clear();
+    for (uint32_t b = 0; b < buckets.size(); b++) {
+        const std::vector<DrawPacket>& packets = buckets[b].packets;
+        for (uint32_t i = 0; i < packets.size(); i++) {
+            recorded.push_back(Entry{ packets[i].key, b, i });
+        }
+    }
+
+    // LSD radix sort, a byte per pass; passes where every key has the same
+    // byte (the unused low bits, often the layer and program) are skipped
+    order = recorded;
+    scratch.resize(order.size());
+    for (int shift = 0; shift < 64; shift += 8) {
+        size_t counts[256] = { 0 };
+        for (const Entry& e : order) {
+            counts[(e.key >> shift) & 0xFF]++;
+        }
+        if (order.empty() || counts[(order[0].key >> shift) & 0xFF] == order.size()) {
+            continue;
+        }
+        size_t offsets[256], total = 0;
+        for (int d = 0; d < 256; d++) {
+            offsets[d] = total;
+            total += counts[d];
+        }
+        for (const Entry& e : order) {
+            scratch[offsets[(e.key >> shift) & 0xFF]++] = e;
+        }
+        order.swap(scratch);
+    }
+    sortMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// Counts the state changes and draws for entries in the given order, and
+// issues them when asked to; with records, entry i draws record i
+RenderStats RenderQueue::walk(const RenderBackend& backend, const std::vector<Entry>& entries, bool issue,
+    const StreamAllocation* records) const {
+    RenderStats stats;
+    const int MaxPrograms = 16;
+    int program = -1, arena = -1;
+    // Uniforms belong to a program, so each keeps its own last color
+    bool colorKnown[MaxPrograms];
+    GLfloat color[MaxPrograms][3];
+    for (int p = 0; p < MaxPrograms; p++) {
+        colorKnown[p] = false;
+    }
+    bool lineWidthSet = false;
+    GLuint record = 0;
+    FrameProfiler* profiler = issue ? backend.profiler : nullptr;
+    int pass = -1;
+
+    for (const Entry& e : entries) {
+        const RenderBucket& bucket = buckets[e.bucket];
+        const DrawPacket& packet = bucket.packets[e.index];
+        int p = (int)(packet.key >> ProgramShift) & 15;
+        int a = (int)(packet.key >> ArenaShift) & 15;
+        ShaderProgram* shader = backend.programs[p];
+
+        int t = (int)(packet.key >> PassShift) & 15;
+        if (profiler && t != pass) {
+            if (pass >= 0) {
+                profiler->end((ProfileScope)pass);
+            }
+            pass = t;
+            profiler->begin((ProfileScope)pass);
+        }
+
+        if (p != program) {
+            program = p;
+            stats.programs++;
+            if (issue) {
+                shader->use();
+            }
+        }
+        if (a != arena) {
+            arena = a;
+            stats.arenas++;
+            if (issue) {
+                glBindVertexArray(backend.arenas[a]->vao);
+                if (records) {
+                    bindInstanceRecords(records->buffer, records->offset);
+                }
+            }
+        }
+        if (records) {
+            if (issue) {
+                if (packet.mode == GL_LINES && !lineWidthSet) {
+                    glLineWidth(backend.lineWidth);
+                    lineWidthSet = true;
+                }
+                backend.arenas[a]->drawInstance(packet.mesh, packet.mode, record++);
+            }
+            stats.draws++;
+            continue;
+        }
+        if (!colorKnown[p] || memcmp(color[p], packet.color, sizeof(packet.color)) != 0) {
+            colorKnown[p] = true;
+            memcpy(color[p], packet.color, sizeof(packet.color));
+            stats.colors++;
+            stats.uniforms++;
+            if (issue) {
+                glUniform3fv(shader->objectColorLoc, 1, packet.color);
+            }
+        }
+
+        if (issue) {
+            if (packet.mode == GL_LINES && !lineWidthSet) {
+                glLineWidth(backend.lineWidth);
+                lineWidthSet = true;
+            }
+            glUniformMatrix4fv(shader->modelLoc, 1, GL_FALSE, bucket.transforms[packet.transform]);
+            backend.arenas[a]->draw(packet.mesh, packet.mode);
+        }
+        stats.draws++;
+        stats.uniforms++;
+    }
+    if (profiler && pass >= 0) {
+        profiler->end((ProfileScope)pass);
+    }
+    return stats;
+}
+
+
+void RenderQueue::execute(const RenderBackend& backend) {
+    if (backend.profiler) {
+        backend.profiler->begin(PROFILE_SUBMIT);
+    }
+    StreamAllocation records;
+    const StreamAllocation* streamed = nullptr;
+    if (backend.stream && !order.empty()) {
+        // Written front to back, in the order they are drawn
+        InstanceRecord* record = backend.stream->allocate<InstanceRecord>(order.size(), records);
+        for (const Entry& e : order) {
+            const RenderBucket& bucket = buckets[e.bucket];
+            const DrawPacket& packet = bucket.packets[e.index];
+            Simd::storeAffineRows(bucket.transforms[packet.transform], record->model);
+            memcpy(record->color, packet.color, sizeof(packet.color));
+            record->color[3] = 1.0f;
+            record++;
+        }
+        backend.stream->unmap();
+        streamed = &records;
+    }
+    unsorted = walk(backend, recorded, false, streamed);
+    if (backend.profiler) {
+        backend.profiler->end(PROFILE_SUBMIT);
+    }
+    sorted = walk(backend, order, true, streamed);
+    glBindVertexArray(0);
+
+    unsortedTotal += unsorted;
+    sortedTotal += sorted;
+    sortMsTotal += sortMs;
+    frames++;
+}
+
+
+void RenderQueue::printSummary() const {
+    if (frames == 0) {
+        return;
+    }
+    double n = (double)frames;
+    printf("render queue: %llu frames, per frame %.1f draws, %.1f uniform uploads, sort %.3f ms\n",
+        (unsigned long long)frames, sortedTotal.draws / n, sortedTotal.uniforms / n, sortMsTotal / n);
+    printf("  state changes   recorded order   sorted\n");
+    printf("  programs        %14.1f %8.1f\n", unsortedTotal.programs / n, sortedTotal.programs / n);
+    printf("  vertex arrays   %14.1f %8.1f\n", unsortedTotal.arenas / n, sortedTotal.arenas / n);
+    printf("  colors          %14.1f %8.1f\n", unsortedTotal.colors / n, sortedTotal.colors / n);
+    printf("  total           %14.1f %8.1f\n", unsortedTotal.changes() / n, sortedTotal.changes() / n);
+}
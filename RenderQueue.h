@@ -0,0 +1,163 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- RenderQueue.h ---
+//
+//   Render command queue for the per-object path.  Scene code records
+//   compact draw packets (mesh, program, material, transform) without
+//   touching GL; each packet carries a 64-bit key whose fields run from
+//   the most expensive state to the cheapest:
+//
+//       layer 2 | program 4 | arena 4 | pass 4 | color 20 | mesh 16 | 0 14
+//
+//   so an LSD radix sort over the keys groups packets by program, then
+//   vertex array, then color.  Lit and unlit draws use different program
+//   variants, so lighting sorts with the program.  The pass is the profiler
+//   scope that recorded the packet; sorting on it ahead of the color costs
+//   at most a color change where two passes share one, and keeps each
+//   pass in one run per program and vertex array, so the backend can time
+//   the GPU work of every pass with a handful of queries.  The backend walks
+//   the sorted packets and issues only the GL calls whose state actually
+//   changes.
+//
+//   Given a stream buffer, the backend writes every packet's transform and
+//   color straight into it as an InstanceRecord, in sorted order, and each
+//   draw picks its record by baseInstance, so no per-draw uniform is set.
+//
+//   Recording goes into buckets, one per recording thread, so threads
+//   never share a vector; sort() merges them in bucket order, and the sort
+//   is stable, so equal keys keep their recording order.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __RENDERQUEUE_H__
+#define __RENDERQUEUE_H__
+
+#include "MeshRegistry.h"
+#include "Profiler.h"
+#include "ShaderProgram.h"
+#include "SimdMath.h"
+#include "StreamBuffer.h"
+#include <stdint.h>
+#include <vector>
+
+// Layers are drawn in order; outlines go after the solids they trace
+enum RenderLayer {
+    RENDER_OPAQUE,
+    RENDER_OUTLINE
+};
+
+struct Material {
+    GLfloat color[3];
+
+    Material(const vec3& c) : color{ c.x, c.y, c.z } {}
+};
+
+// Per-draw transform and color, read at locations 4-7 by programs built
+// with INDIRECT
+struct InstanceRecord {
+    GLfloat model[12]; // first three rows of the row-major model matrix
+    GLfloat color[4];  // rgb, and a = 1 when lit
+};
+
+// Points locations 4-7 of the bound vertex array at the records in buffer
+// from offset on, one per instance
+void bindInstanceRecords(GLuint buffer, GLintptr offset);
+
+struct DrawPacket {
+    uint64_t key;
+    uint32_t transform;    // index into the bucket's transforms
+    uint16_t mesh;
+    uint16_t mode;         // GL_TRIANGLES or GL_LINES
+    GLfloat color[3];
+};
+
+class RenderBucket {
+public:
+    // program indexes the backend's programs and arena its mesh registries
+    void submit(int program, int arena, int mesh, const Material& material, const Simd::Mat4& transform,
+        RenderLayer layer = RENDER_OPAQUE, GLenum mode = GL_TRIANGLES);
+
+    void clear() { packets.clear(); transforms.clear(); }
+
+    // Tags the packets submitted from now on
+    ProfileScope pass = PROFILE_SUBMIT;
+
+    std::vector<DrawPacket> packets;
+    std::vector<Simd::Mat4> transforms;
+};
+
+// State changes and draws issued for one frame's packets
+struct RenderStats {
+    uint64_t programs = 0;
+    uint64_t arenas = 0;       // vertex array binds
+    uint64_t colors = 0;
+    uint64_t draws = 0;
+    uint64_t uniforms = 0;     // per-draw uniform uploads
+
+    uint64_t changes() const { return programs + arenas + colors; }
+    RenderStats& operator+=(const RenderStats& s);
+};
+
+// What the packet fields refer to
+struct RenderBackend {
+    // Each with Model and ObjectColor, or built with INDIRECT when streaming
+    std::vector<ShaderProgram*> programs;
+    std::vector<const MeshRegistry*> arenas;
+    GLfloat lineWidth = 1.0f;
+    StreamBuffer* stream = nullptr;          // for instance records instead of uniforms
+    // Times each pass's draws under its scope, and the rest of execute()
+    // under PROFILE_SUBMIT; no scope may be open when execute() is called
+    FrameProfiler* profiler = nullptr;
+};
+
+class RenderQueue {
+public:
+    static const unsigned MaxBuckets = 64;
+
+    // Where a packet was recorded, and its key
+    struct Entry {
+        uint64_t key;
+        uint32_t bucket;
+        uint32_t index;
+    };
+
+    explicit RenderQueue(unsigned bucketCount = 1);
+
+    // Bucket i may only be recorded into by one thread at a time
+    RenderBucket& bucket(unsigned i) { return buckets[i]; }
+    unsigned bucketCount() const { return (unsigned)buckets.size(); }
+
+    void clear();
+
+    // Tags what every bucket records from now on; not while recording
+    void setPass(ProfileScope pass);
+
+    // Merges the buckets and orders their packets by key
+    void sort();
+
+    // Issues the sorted packets; stats counts what was actually changed,
+    // alongside what recording order would have changed
+    void execute(const RenderBackend& backend);
+
+    size_t packetCount() const { return order.size(); }
+
+    // The packets as sort() left them
+    const std::vector<Entry>& sortedEntries() const { return order; }
+
+    RenderStats sorted, unsorted;    // last frame
+    RenderStats sortedTotal, unsortedTotal;
+    uint64_t frames = 0;
+    double sortMs = 0.0, sortMsTotal = 0.0;
+
+    // Average packets, state changes before and after sorting and sort time per frame
+    void printSummary() const;
+
+private:
+    RenderStats walk(const RenderBackend& backend, const std::vector<Entry>& entries, bool issue,
+        const StreamAllocation* records = nullptr) const;
+
+    std::vector<RenderBucket> buckets;
+    std::vector<Entry> recorded, order, scratch;
+};
+
+#endif // __RENDERQUEUE_H__
@@ -0,0 +1,61 @@
+#include "SceneGraph.h"
+#include <cstring>
+
+
+int SceneGraph::add(int parent, const Simd::Mat4& local) {
+    int parentSlot = parent == Root ? Root : slots[parent];
+    int depth = parent == Root ? 0 : depths[parentSlot] + 1;
+
+    // Insert after the last node at this depth or above, so the arrays stay
+    // depth sorted; the slots behind it move down by one
+    int slot = (int)parents.size();
+    while (slot > 0 && depths[slot - 1] > depth) {
+        slot--;
+    }
+    for (int& p : parents) {
+        if (p >= slot) {
+            p++;
+        }
+    }
+    for (int& s : slots) {
+        if (s >= slot) {
+            s++;
+        }
+    }
+
+    int id = (int)slots.size();
+    slots.push_back(slot);
+    parents.insert(parents.begin() + slot, parentSlot);
+    depths.insert(depths.begin() + slot, depth);
+    locals.insert(locals.begin() + slot, local);
+    worlds.insert(worlds.begin() + slot, local);
+    dirtyFlags.insert(dirtyFlags.begin() + slot, 1);
+    changedFlags.insert(changedFlags.begin() + slot, 0);
+    return id;
+}
+
+
+void SceneGraph::setLocal(int node, const Simd::Mat4& local) {
+    int slot = slots[node];
+    if (memcmp(&locals[slot], &local, sizeof(Simd::Mat4)) != 0) {
+        locals[slot] = local;
+        dirtyFlags[slot] = 1;
+    }
+}
+
+
+void SceneGraph::update() {
+    recomputed = 0;
+    for (size_t i = 0; i < parents.size(); i++) {
+        int parent = parents[i];
+        // Parents sit in earlier slots, so their flags are already final
+        bool stale = dirtyFlags[i] || (parent != Root && changedFlags[parent]);
+        changedFlags[i] = stale;
+        if (!stale) {
+            continue;
+        }
+        worlds[i] = parent == Root ? locals[i] : worlds[parent] * locals[i];
+        dirtyFlags[i] = 0;
+        recomputed++;
+    }
+}
@@ -0,0 +1,64 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- SceneGraph.h ---
+//
+//   Transform hierarchy for the scene's moving objects (the ship and its
+//   hull and nose, the station and its nose).  Each node has a local
+//   transform relative to its parent and a cached world transform.
+//   Setting a local transform to a new value marks the node dirty, and
+//   update() recomputes the world transforms of dirty nodes and everything
+//   below them, leaving the rest untouched.  A paused scene costs one
+//   compare per node and no products.
+//
+//   Nodes live in flat arrays sorted by depth, so every parent comes
+//   before its children and update() is a single forward pass.  Node ids
+//   stay valid while nodes are added; they map to array slots.
+//
+//   The planets aren't nodes: their transforms are static instance data
+//   uploaded once.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __SCENEGRAPH_H__
+#define __SCENEGRAPH_H__
+
+#include "SimdMath.h"
+#include <stdint.h>
+#include <vector>
+
+class SceneGraph {
+public:
+    static const int Root = -1;
+
+    // Adds a node under parent (Root for a top-level node) and returns its id
+    int add(int parent, const Simd::Mat4& local = Simd::Mat4());
+
+    // Marks the node dirty only if local differs from its current transform
+    void setLocal(int node, const Simd::Mat4& local);
+    const Simd::Mat4& local(int node) const { return locals[slots[node]]; }
+
+    // Recomputes the world transforms of dirty subtrees
+    void update();
+
+    // World transform as of the last update()
+    const Simd::Mat4& world(int node) const { return worlds[slots[node]]; }
+
+    // Whether the node's world transform changed in the last update()
+    bool changed(int node) const { return changedFlags[slots[node]] != 0; }
+
+    size_t size() const { return parents.size(); }
+
+    // World transforms recomputed by the last update()
+    size_t recomputed = 0;
+
+private:
+    // Indexed by slot, in depth order
+    std::vector<int> parents;          // parent slot, or Root
+    std::vector<int> depths;
+    std::vector<Simd::Mat4> locals, worlds;
+    std::vector<uint8_t> dirtyFlags, changedFlags;
+    // Indexed by node id
+    std::vector<int> slots;
+};
+
+#endif // __SCENEGRAPH_H__
@@ -0,0 +1,207 @@
+#include "ShaderCache.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+
+// FNV-1a over the text, continuing from hash
+static uint64_t hashText(const std::string& text, uint64_t hash = 14695981039346656037ull) {
+    for (char c : text) {
+        hash = (hash ^ (unsigned char)c) * 1099511628211ull;
+    }
+    return hash;
+}
+
+
+// FNV-1a over the binary's bytes
+static uint64_t checksum(const unsigned char* data, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+
+std::string defineVariant(const std::string& source, const ShaderDefines& defines) {
+    std::string lines;
+    for (const std::string& name : defines) {
+        lines += "#define " + name + " 1\n";
+    }
+    // The sources are raw strings, so #version usually follows a newline
+    size_t at = source.find("#version");
+    if (at == std::string::npos || source.find_first_not_of(" \t\r\n") != at) {
+        at = 0;
+    }
+    else {
+        at = source.find('\n', at);
+        at = at == std::string::npos ? source.size() : at + 1;
+    }
+    std::string result = source.substr(0, at);
+    if (at > 0 && result[at - 1] != '\n') {
+        result += '\n';
+    }
+    return result + lines + source.substr(at);
+}
+
+
+ShaderCache::ShaderCache(const std::string& directory) : directory(directory) {
+}
+
+
+std::string ShaderCache::path(uint64_t keyHash) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)keyHash);
+    return directory + "/" + name;
+}
+
+
+bool ShaderCache::binarySupported() {
+    if (supported < 0) {
+        GLint formats = 0;
+        if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary) {
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        }
+        supported = formats > 0;
+
+        const char* strings[] = {
+            (const char*)glGetString(GL_VENDOR),
+            (const char*)glGetString(GL_RENDERER),
+            (const char*)glGetString(GL_VERSION)
+        };
+        for (const char* s : strings) {
+            driver += s ? s : "";
+            driver += '\n';
+        }
+    }
+    return supported != 0;
+}
+
+
+bool ShaderCache::build(ShaderProgram& program, const char* vertexSource, const char* fragmentSource,
+    const ShaderDefines& defines) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string vertex = defineVariant(vertexSource, defines);
+    std::string fragment = defineVariant(fragmentSource, defines);
+
+    bool useCache = enabled && binarySupported();
+    uint64_t keyHash = 0;
+    bool built = false;
+    if (useCache) {
+        keyHash = hashText(fragment, hashText(vertex, hashText(driver)));
+    }
+    if (useCache && !overwrite) {
+        built = load(keyHash, program);
+    }
+    else {
+        misses++;
+    }
+    if (!built) {
+        built = program.build(vertex.c_str(), fragment.c_str(), useCache);
+        if (built && useCache) {
+            store(keyHash, program);
+        }
+    }
+
+    milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return built;
+}
+
+
+bool ShaderCache::load(uint64_t keyHash, ShaderProgram& program) {
+    FILE* file = fopen(path(keyHash).c_str(), "rb");
+    if (!file) {
+        misses++;
+        return false;
+    }
+    ShaderCacheHeader header;
+    std::vector<unsigned char> binary;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1
+        && memcmp(header.magic, "MTSC", 4) == 0
+        && header.version == ShaderCacheVersion
+        && header.keyHash == keyHash
+        && header.binaryLength > 0;
+    if (valid) {
+        binary.resize(header.binaryLength);
+        valid = fread(&binary[0], binary.size(), 1, file) == 1
+            && header.checksum == checksum(&binary[0], binary.size());
+    }
+    fclose(file);
+
+    // A driver update may refuse a binary even when the strings still match
+    GLuint id = 0;
+    if (valid) {
+        id = glCreateProgram();
+        glProgramBinary(id, header.binaryFormat, &binary[0], (GLsizei)binary.size());
+        GLint status = GL_FALSE;
+        glGetProgramiv(id, GL_LINK_STATUS, &status);
+        if (status != GL_TRUE) {
+            glDeleteProgram(id);
+            valid = false;
+        }
+    }
+    if (!valid) {
+        fprintf(stderr, "shader cache: %s is stale or damaged, rebuilding\n", path(keyHash).c_str());
+        misses++;
+        return false;
+    }
+
+    program.adopt(id);
+    hits++;
+    return true;
+}
+
+
+bool ShaderCache::store(uint64_t keyHash, const ShaderProgram& program) {
+#ifdef _WIN32
+    _mkdir(directory.c_str());
+#else
+    mkdir(directory.c_str(), 0755);
+#endif
+
+    GLint length = 0;
+    glGetProgramiv(program.id, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return false;
+    }
+    std::vector<unsigned char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program.id, length, &length, &format, &binary[0]);
+    binary.resize(length);
+
+    ShaderCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MTSC", 4);
+    header.version = ShaderCacheVersion;
+    header.keyHash = keyHash;
+    header.binaryFormat = format;
+    header.binaryLength = (uint32_t)binary.size();
+    header.checksum = checksum(&binary[0], binary.size());
+
+    // Written beside the final name and renamed into place, like the mesh cache
+    std::string finalPath = path(keyHash);
+    std::string tempPath = finalPath + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file) {
+        fprintf(stderr, "shader cache: cannot write %s\n", tempPath.c_str());
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(&binary[0], binary.size(), 1, file) == 1;
+    written = fclose(file) == 0 && written;
+    if (!written) {
+        fprintf(stderr, "shader cache: cannot write %s\n", tempPath.c_str());
+        remove(tempPath.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    remove(finalPath.c_str());
+#endif
+    return rename(tempPath.c_str(), finalPath.c_str()) == 0;
+}
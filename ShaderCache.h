@@ -0,0 +1,76 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- ShaderCache.h ---
+//
+//   Builds shader variants and keeps their linked binaries on disk.  A
+//   variant is one pair of sources with a list of preprocessor symbols
+//   (LIT, INSTANCED, ...) defined right after the #version line, so one
+//   source covers every combination and no shader branches on a uniform
+//   for something fixed per draw.
+//
+//   Linked programs are saved with glGetProgramBinary, one file per
+//   variant named after a hash of both final sources and the driver's
+//   vendor, renderer and version strings; a warm start hands the file to
+//   glProgramBinary and skips compiling and linking.  As in the mesh
+//   cache, the header carries a magic, a version, the key hash and a
+//   checksum, and a file that fails any check, or that the driver
+//   refuses, is treated as a miss and rewritten.  Without binary support
+//   (GL 4.1 or ARB_get_program_binary and at least one binary format)
+//   every variant is simply compiled.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __SHADERCACHE_H__
+#define __SHADERCACHE_H__
+
+#include "ShaderProgram.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+const uint32_t ShaderCacheVersion = 1;
+
+// File header; the program binary follows it
+struct ShaderCacheHeader {
+    char magic[4];          // "MTSC"
+    uint32_t version;
+    uint64_t keyHash;       // of the sources and driver the file was written for
+    uint32_t binaryFormat;  // as returned by glGetProgramBinary
+    uint32_t binaryLength;
+    uint64_t checksum;      // of the binary
+};
+
+typedef std::vector<std::string> ShaderDefines;
+
+// source with "#define NAME 1" for every name inserted after its #version
+// line (or at the top without one); leading blank lines are allowed
+std::string defineVariant(const std::string& source, const ShaderDefines& defines);
+
+class ShaderCache {
+public:
+    explicit ShaderCache(const std::string& directory = "shader-cache");
+
+    // Builds program from the sources with defines applied, from the cache
+    // when a matching binary is there.  False, with the log on stderr, if
+    // the variant doesn't compile or link.
+    bool build(ShaderProgram& program, const char* vertexSource, const char* fragmentSource,
+        const ShaderDefines& defines = ShaderDefines());
+
+    std::string path(uint64_t keyHash) const;
+
+    std::string directory;
+    bool enabled = true;
+    bool overwrite = false;      // compile and rewrite even when a binary is cached
+    int hits = 0, misses = 0;    // variants loaded from the cache and compiled
+    double milliseconds = 0.0;   // spent in build(), cached or not
+
+private:
+    bool load(uint64_t keyHash, ShaderProgram& program);
+    bool store(uint64_t keyHash, const ShaderProgram& program);
+    bool binarySupported();
+
+    std::string driver;     // vendor, renderer and version, read on first use
+    int supported = -1;     // binarySupported(), -1 until asked
+};
+
+#endif // __SHADERCACHE_H__
@@ -0,0 +1,111 @@
+#include "ShaderProgram.h"
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+
+// Prints the info log of a shader or program that failed
+static void printLog(GLuint object, bool isProgram, const char* what) {
+    GLint length = 0;
+    if (isProgram) {
+        glGetProgramiv(object, GL_INFO_LOG_LENGTH, &length);
+    }
+    else {
+        glGetShaderiv(object, GL_INFO_LOG_LENGTH, &length);
+    }
+    std::vector<GLchar> log(std::max(length, 1), '\0');
+    if (isProgram) {
+        glGetProgramInfoLog(object, (GLsizei)log.size(), NULL, &log[0]);
+    }
+    else {
+        glGetShaderInfoLog(object, (GLsizei)log.size(), NULL, &log[0]);
+    }
+    fprintf(stderr, "%s failed:\n%s\n", what, &log[0]);
+}
+
+
+// 0 if the source doesn't compile
+static GLuint compileShader(GLenum type, const char* source) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+
+    GLint status = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+        printLog(shader, false, type == GL_VERTEX_SHADER ? "vertex shader compile" : "fragment shader compile");
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+
+bool ShaderProgram::build(const char* vertexSource, const char* fragmentSource, bool retrievable) {
+    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
+    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+
+    GLuint program = 0;
+    if (vertexShader != 0 && fragmentShader != 0) {
+        program = glCreateProgram();
+        if (retrievable) {
+            glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+        glAttachShader(program, vertexShader);
+        glAttachShader(program, fragmentShader);
+        glLinkProgram(program);
+
+        GLint status = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if (status != GL_TRUE) {
+            printLog(program, true, "program link");
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+
+    // Deleting 0 is ignored; attached shaders go once the program does
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    return adopt(program);
+}
+
+
+bool ShaderProgram::adopt(GLuint program) {
+    id = program;
+    locations.clear();
+    modelLoc = objectColorLoc = -1;
+    if (id == 0) {
+        return false;
+    }
+
+    // Walk the active uniforms once; uniforms inside blocks report -1 and are skipped
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    std::vector<GLchar> name(maxLength > 0 ? maxLength : 1);
+    for (GLint i = 0; i < count; i++) {
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(id, i, (GLsizei)name.size(), NULL, &size, &type, &name[0]);
+        GLint loc = glGetUniformLocation(id, &name[0]);
+        if (loc >= 0) {
+            locations[&name[0]] = loc;
+        }
+    }
+
+    modelLoc = location("Model");
+    objectColorLoc = location("ObjectColor");
+
+    GLuint blockIndex = glGetUniformBlockIndex(id, "FrameData");
+    if (blockIndex != GL_INVALID_INDEX) {
+        glUniformBlockBinding(id, blockIndex, FrameDataBinding);
+    }
+    return true;
+}
+
+
+GLint ShaderProgram::location(const char* name) const {
+    std::map<std::string, GLint>::const_iterator it = locations.find(name);
+    return it == locations.end() ? -1 : it->second;
+}
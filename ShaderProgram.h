@@ -0,0 +1,56 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- ShaderProgram.h ---
+//
+//   Thin wrapper around a linked GL program.  Every active uniform location
+//   is resolved once at link time so per-frame code never looks anything up
+//   by name.  Lighting is chosen per program rather than per draw: the
+//   shader cache builds a lit and an unlit variant of the same sources.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __SHADERPROGRAM_H__
+#define __SHADERPROGRAM_H__
+
+#include <GL/glew.h>
+#include <map>
+#include <string>
+
+// Uniform block binding point shared by every program for per-frame data
+const GLuint FrameDataBinding = 0;
+
+// std140 layout of the FrameData uniform block; matrices are column-major
+struct FrameData {
+    GLfloat projection[16];
+    GLfloat view[16];
+    GLfloat lightPos[4];   // xyz used, w is padding
+    GLfloat lightColor[4]; // xyz used, w is padding
+    GLfloat sceneOffset[4]; // scene anchor relative to the eye, see WorldSpace.h; w is padding
+};
+
+struct ShaderProgram {
+    GLuint id = 0;
+
+    // Locations of the per-object uniforms, -1 when the program lacks them
+    GLint modelLoc = -1;
+    GLint objectColorLoc = -1;
+
+    // Compiles and links the sources, then adopts the program.  False, with
+    // the compiler's or linker's log on stderr, if either step fails.
+    // retrievable asks the driver to keep the binary for glGetProgramBinary.
+    bool build(const char* vertexSource, const char* fragmentSource, bool retrievable = false);
+
+    // Takes over a linked program (0 for none): caches all uniform
+    // locations and attaches the FrameData block to FrameDataBinding
+    bool adopt(GLuint program);
+
+    // Location of any active uniform, resolved at link time
+    GLint location(const char* name) const;
+
+    void use() const { glUseProgram(id); }
+
+private:
+    std::map<std::string, GLint> locations;
+};
+
+#endif // __SHADERPROGRAM_H__
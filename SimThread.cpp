@@ -0,0 +1,227 @@
+#include "SimThread.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cstdio>
+
+typedef std::chrono::steady_clock Clock;
+
+static double milliseconds(Clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+
+float SimSnapshot::alpha(Clock::time_point now) const {
+    double elapsed = accumulator + std::chrono::duration<double>(now - captured).count();
+    return (float)std::min(1.0, elapsed / SimTimestep);
+}
+
+
+vec3 SimSnapshot::bodyPosition(size_t i, float alpha) const {
+    return vec3(lastX[i] + (bodyX[i] - lastX[i]) * alpha,
+        lastY[i] + (bodyY[i] - lastY[i]) * alpha,
+        lastZ[i] + (bodyZ[i] - lastZ[i]) * alpha);
+}
+
+
+void captureSnapshot(const Simulation& sim, int camera, SimSnapshot& snapshot) {
+    snapshot.previous = sim.previous;
+    snapshot.current = sim.current;
+    snapshot.accumulator = sim.accumulator;
+    snapshot.tick = sim.tick;
+    snapshot.camera = camera;
+
+    if (sim.gravity) {
+        const GravityBodies& bodies = sim.gravity->bodies;
+        snapshot.bodyX = bodies.x; snapshot.bodyY = bodies.y; snapshot.bodyZ = bodies.z;
+        snapshot.lastX = bodies.lastX; snapshot.lastY = bodies.lastY; snapshot.lastZ = bodies.lastZ;
+    }
+    if (sim.fleet) {
+        snapshot.hullInstances = sim.fleet->hullInstances;
+        snapshot.noseInstances = sim.fleet->noseInstances;
+    }
+}
+
+
+void SimThread::start(Simulation& sim, const InputHandler& handler, int initialCamera) {
+    stop();
+    simulation = &sim;
+    handleInput = handler;
+    camera = initialCamera;
+
+    // Publish the starting state so the first frame has something to draw
+    SimSnapshot& first = published.back();
+    captureSnapshot(sim, camera, first);
+    first.inputId = nextInputId - 1;
+    first.captured = Clock::now();
+    published.publish();
+    published.update();
+
+    quit = false;
+    startTime = Clock::now();
+    thread = std::thread(&SimThread::run, this);
+}
+
+
+void SimThread::stop() {
+    if (!thread.joinable()) {
+        return;
+    }
+    quit = true;
+    thread.join();
+    runSeconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+}
+
+
+void SimThread::run() {
+    Clock::time_point last = startTime, lastTick = startTime;
+    uint32_t applied = nextInputId - 1;
+    while (!quit.load(std::memory_order_relaxed)) {
+        bool changed = false;
+        InputEvent event;
+        while (inputs.pop(event)) {
+            handleInput(event, simulation->current, camera);
+            applied = event.id;
+            changed = true;
+        }
+
+        Clock::time_point now = Clock::now();
+        int ran = simulation->advance(std::chrono::duration<double>(now - last).count());
+        last = now;
+        if (ran > 0) {
+            longestTickGapMs = std::max(longestTickGapMs, milliseconds(now - lastTick));
+            lastTick = now;
+            ticks += ran;
+        }
+
+        if (ran > 0 || changed) {
+            SimSnapshot& snapshot = published.back();
+            captureSnapshot(*simulation, camera, snapshot);
+            snapshot.inputId = applied;
+            snapshot.captured = now;
+            published.publish();
+            snapshots++;
+        }
+
+        // Sleep until the next tick is due, but wake at least every
+        // millisecond so queued input isn't held for a whole tick
+        double untilTick = SimTimestep - simulation->accumulator;
+        std::this_thread::sleep_for(std::chrono::duration<double>(std::min(untilTick, 0.001)));
+    }
+}
+
+
+bool SimThread::post(int key, bool special) {
+    InputEvent event;
+    event.key = key;
+    event.special = special;
+    event.id = nextInputId;
+    Clock::time_point now = Clock::now();
+    if (!inputs.push(event)) {
+        droppedInputs++;
+        return false;
+    }
+    pendingInputs.push_back(std::make_pair(nextInputId++, now));
+    return true;
+}
+
+
+const SimSnapshot& SimThread::latest() {
+    published.update();
+    return published.front();
+}
+
+
+void SimThread::frameShown(const SimSnapshot& shown) {
+    Clock::time_point now = Clock::now();
+    while (!pendingInputs.empty() && pendingInputs.front().first <= shown.inputId) {
+        latenciesMs.push_back(milliseconds(now - pendingInputs.front().second));
+        pendingInputs.pop_front();
+    }
+}
+
+
+static void printRun(const char* label, uint64_t ticks, double seconds, double longestGapMs,
+    const std::vector<double>& latencies, uint64_t dropped) {
+    printf("%-12s %6llu ticks %7.1f ticks/s   longest gap %7.2f ms\n", label,
+        (unsigned long long)ticks, seconds > 0.0 ? ticks / seconds : 0.0, longestGapMs);
+    printf("%-12s %6d keys   latency p50 %6.2f  p90 %6.2f  p99 %6.2f  max %6.2f ms   dropped %llu\n", "",
+        (int)latencies.size(), percentile(latencies, 0.5), percentile(latencies, 0.9), percentile(latencies, 0.99),
+        latencies.empty() ? 0.0 : *std::max_element(latencies.begin(), latencies.end()), (unsigned long long)dropped);
+}
+
+
+void SimThread::printSummary() const {
+    printRun("sim thread", ticks, runSeconds, longestTickGapMs, latenciesMs, droppedInputs);
+}
+
+
+void benchmarkSimThread() {
+    const int frames = 180, keyEvery = 5, stallEvery = 45;
+    const double frameMs = 16.0, stallMs = 120.0;
+    SimThread::InputHandler handler = [](const InputEvent& event, SimState& state, int& camera) {
+        if (event.key == 'a') {
+            state.shipSpeed += 0.02f;
+        }
+        else {
+            camera = event.key;
+        }
+    };
+    auto frameTime = [&](int frame) {
+        double ms = frame % stallEvery == stallEvery - 1 ? stallMs : frameMs;
+        return std::chrono::duration<double, std::milli>(ms);
+    };
+    printf("%d frames of %.0f ms, every %dth takes %.0f ms; a key every %d frames\n",
+        frames, frameMs, stallEvery, stallMs, keyEvery);
+
+    // Threaded: the render loop only reads snapshots and posts keys
+    {
+        Simulation sim;
+        SimThread simThread;
+        simThread.start(sim, handler, 0);
+        for (int frame = 0; frame < frames; frame++) {
+            const SimSnapshot& snapshot = simThread.latest();
+            std::this_thread::sleep_for(frameTime(frame));   // drawing
+            simThread.frameShown(snapshot);
+            if (frame % keyEvery == 0) {
+                simThread.post(frame % (2 * keyEvery) == 0 ? 'a' : 'c', false);
+            }
+        }
+        simThread.stop();
+        simThread.printSummary();
+    }
+
+    // Lockstep: the same loop advancing the simulation itself, as the idle callback does
+    {
+        Simulation sim;
+        int camera = 0;
+        uint64_t ticks = 0;
+        double longestGapMs = 0.0;
+        std::vector<double> latencies;
+        std::vector<Clock::time_point> pending;
+        Clock::time_point start = Clock::now(), last = start, lastTick = start;
+        for (int frame = 0; frame < frames; frame++) {
+            Clock::time_point now = Clock::now();
+            int ran = sim.advance(std::chrono::duration<double>(now - last).count());
+            last = now;
+            if (ran > 0) {
+                longestGapMs = std::max(longestGapMs, milliseconds(now - lastTick));
+                lastTick = now;
+                ticks += ran;
+            }
+            std::this_thread::sleep_for(frameTime(frame));
+            Clock::time_point shown = Clock::now();
+            for (Clock::time_point pressed : pending) {
+                latencies.push_back(milliseconds(shown - pressed));
+            }
+            pending.clear();
+            if (frame % keyEvery == 0) {
+                InputEvent event;
+                event.key = frame % (2 * keyEvery) == 0 ? 'a' : 'c';
+                pending.push_back(Clock::now());
+                handler(event, sim.current, camera);
+            }
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        printRun("lockstep", ticks, seconds, longestGapMs, latencies, 0);
+    }
+}
@@ -0,0 +1,121 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- SimThread.h ---
+//
+//   Runs the fixed-timestep simulation on its own thread, so a slow frame
+//   no longer delays physics and a slow tick no longer delays drawing.
+//
+//   After every batch of ticks (or input) the simulation thread copies
+//   what the renderer needs (the last two ship and station states, the
+//   camera, the gravity bodies and the fleet's instance records) into an
+//   immutable snapshot and publishes it through a triple buffer.  The
+//   render thread takes the newest snapshot at the start of each frame
+//   without ever waiting, and nothing it draws from is touched by the
+//   simulation afterwards.
+//
+//   Key presses travel the other way through a single-producer,
+//   single-consumer queue and are applied on the simulation thread, in
+//   order, before its next tick.  Each one gets an id; snapshots carry the
+//   id of the last one applied, so the render thread can time every key
+//   from the press to the first frame shown that reflects it.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __SIMTHREAD_H__
+#define __SIMTHREAD_H__
+
+#include "Simulation.h"
+#include "LockFree.h"
+#include "InputLog.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Everything the renderer reads from the simulation for one frame
+struct SimSnapshot {
+    SimState previous, current;
+    double accumulator = 0.0;   // seconds into the next tick when captured
+    uint64_t tick = 0;
+    int camera = 0;             // current camera view, owned by the input handler
+    uint32_t inputId = 0;       // last input event applied
+    std::chrono::steady_clock::time_point captured;
+
+    // Gravity bodies before and after the last tick, empty without gravity
+    std::vector<float> bodyX, bodyY, bodyZ, lastX, lastY, lastZ;
+    std::vector<FleetInstance> hullInstances, noseInstances;
+
+    // Fraction of a tick to blend by: the accumulator at capture plus the
+    // time since, when the caller runs on real time
+    float alpha(std::chrono::steady_clock::time_point now) const;
+    float alpha() const { return (float)(accumulator / SimTimestep); }
+
+    SimState renderState(float alpha) const { return interpolateStates(previous, current, alpha); }
+    vec3 bodyPosition(size_t i, float alpha) const;
+    size_t bodyCount() const { return bodyX.size(); }
+};
+
+// Copies the parts of sim the renderer draws into snapshot, reusing its storage
+void captureSnapshot(const Simulation& sim, int camera, SimSnapshot& snapshot);
+
+class SimThread {
+public:
+    // Applies one input event to the authoritative state and camera, on the simulation thread
+    typedef std::function<void(const InputEvent&, SimState&, int&)> InputHandler;
+
+    ~SimThread() { stop(); }
+
+    // Takes over sim until stop(); nothing else may touch it meanwhile
+    void start(Simulation& sim, const InputHandler& handler, int camera);
+    void stop();
+    bool running() const { return thread.joinable(); }
+
+    // Render thread only.  Queues a key for the simulation; false (and
+    // counted in droppedInputs) when the queue is full
+    bool post(int key, bool special);
+
+    // Render thread only.  Newest published snapshot; never blocks, and
+    // stays valid until the next call
+    const SimSnapshot& latest();
+
+    // Render thread only, right after the frame drawn from shown was
+    // presented: records the latency of every input it shows for the first time
+    void frameShown(const SimSnapshot& shown);
+
+    // Latency percentiles and tick rate
+    void printSummary() const;
+
+    std::vector<double> latenciesMs;   // press to first frame showing it
+    uint64_t droppedInputs = 0;
+    std::atomic<uint64_t> ticks{ 0 }, snapshots{ 0 };
+    double longestTickGapMs = 0.0;     // longest real time between two ticks, written by the simulation thread
+
+private:
+    void run();
+
+    Simulation* simulation = nullptr;
+    InputHandler handleInput;
+    int camera = 0;                    // simulation thread's copy
+    std::thread thread;
+    std::atomic<bool> quit{ false };
+    std::chrono::steady_clock::time_point startTime;
+    double runSeconds = 0.0;
+
+    TripleBuffer<SimSnapshot> published;
+    SpscQueue<InputEvent, 256> inputs;
+
+    // Render thread's bookkeeping for latency
+    uint32_t nextInputId = 1;
+    std::deque<std::pair<uint32_t, std::chrono::steady_clock::time_point>> pendingInputs;
+};
+
+// Headless: renders nothing, but runs a fake render loop with the occasional
+// long frame against the simulation thread, feeding it key presses, and
+// prints input latency and how evenly ticks were spaced; then does the same
+// with the simulation stepped on the render loop for comparison
+void benchmarkSimThread();
+
+#endif // __SIMTHREAD_H__
@@ -0,0 +1,296 @@
+#include "SimdMath.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <vector>
+
+namespace Simd {
+
+const char* instructionSet() {
+#if defined(SIMD_SSE)
+    return "SSE";
+#elif defined(SIMD_NEON)
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
+
+
+Angel::vec4 toAngel(const Vec4& a) {
+    return Angel::vec4(a[0], a[1], a[2], a[3]);
+}
+
+
+Mat4::Mat4(float d)
+    : col{ Vec4(d, 0.0f, 0.0f, 0.0f), Vec4(0.0f, d, 0.0f, 0.0f), Vec4(0.0f, 0.0f, d, 0.0f), Vec4(0.0f, 0.0f, 0.0f, d) } {
+}
+
+
+// Angel's mat4 is row-major: m[r] is row r
+Mat4::Mat4(const Angel::mat4& m) {
+    for (int c = 0; c < 4; c++) {
+        col[c] = Vec4(m[0][c], m[1][c], m[2][c], m[3][c]);
+    }
+}
+
+
+Mat4 transpose(const Mat4& m) {
+#if defined(SIMD_SSE)
+    __m128 c0 = m.col[0].v, c1 = m.col[1].v, c2 = m.col[2].v, c3 = m.col[3].v;
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    return Mat4(Vec4(c0), Vec4(c1), Vec4(c2), Vec4(c3));
+#else
+    return Mat4(Vec4(m.at(0, 0), m.at(0, 1), m.at(0, 2), m.at(0, 3)),
+        Vec4(m.at(1, 0), m.at(1, 1), m.at(1, 2), m.at(1, 3)),
+        Vec4(m.at(2, 0), m.at(2, 1), m.at(2, 2), m.at(2, 3)),
+        Vec4(m.at(3, 0), m.at(3, 1), m.at(3, 2), m.at(3, 3)));
+#endif
+}
+
+
+Angel::mat4 toAngel(const Mat4& m) {
+    Mat4 rows = transpose(m);
+    return Angel::mat4(toAngel(rows.col[0]), toAngel(rows.col[1]), toAngel(rows.col[2]), toAngel(rows.col[3]));
+}
+
+
+void storeAffineRows(const Mat4& m, GLfloat rows[12]) {
+    Mat4 t = transpose(m);
+    t.col[0].store(rows);
+    t.col[1].store(rows + 4);
+    t.col[2].store(rows + 8);
+}
+
+
+//----------------------------------------------------------------------------
+//
+//  --- Builders ---
+//
+//   Entry for entry the same expressions as Angel's, so angles round the
+//   same way
+//
+
+Mat4 Translate(float x, float y, float z) {
+    Mat4 c;
+    c.col[3] = Vec4(x, y, z, 1.0f);
+    return c;
+}
+
+
+Mat4 Scale(float x, float y, float z) {
+    return Mat4(Vec4(x, 0.0f, 0.0f, 0.0f), Vec4(0.0f, y, 0.0f, 0.0f), Vec4(0.0f, 0.0f, z, 0.0f), Vec4(0.0f, 0.0f, 0.0f, 1.0f));
+}
+
+
+Mat4 RotateX(float degrees) {
+    GLfloat angle = DegreesToRadians * degrees;
+    GLfloat c = cos(angle), s = sin(angle);
+    return Mat4(Vec4(1.0f, 0.0f, 0.0f, 0.0f), Vec4(0.0f, c, s, 0.0f), Vec4(0.0f, -s, c, 0.0f), Vec4(0.0f, 0.0f, 0.0f, 1.0f));
+}
+
+
+Mat4 RotateY(float degrees) {
+    GLfloat angle = DegreesToRadians * degrees;
+    GLfloat c = cos(angle), s = sin(angle);
+    return Mat4(Vec4(c, 0.0f, -s, 0.0f), Vec4(0.0f, 1.0f, 0.0f, 0.0f), Vec4(s, 0.0f, c, 0.0f), Vec4(0.0f, 0.0f, 0.0f, 1.0f));
+}
+
+
+Mat4 RotateZ(float degrees) {
+    GLfloat angle = DegreesToRadians * degrees;
+    GLfloat c = cos(angle), s = sin(angle);
+    return Mat4(Vec4(c, s, 0.0f, 0.0f), Vec4(-s, c, 0.0f, 0.0f), Vec4(0.0f, 0.0f, 1.0f, 0.0f), Vec4(0.0f, 0.0f, 0.0f, 1.0f));
+}
+
+
+// The camera matrices are built once per frame, so Angel builds them and
+// they are only turned around
+Mat4 Perspective(float fovy, float aspect, float zNear, float zFar) {
+    return Mat4(Angel::Perspective(fovy, aspect, zNear, zFar));
+}
+
+
+Mat4 PerspectiveInfinite(float fovy, float aspect, float zNear, bool reversed) {
+    GLfloat top = tan(fovy * DegreesToRadians / 2) * zNear;
+    GLfloat right = top * aspect;
+    return Mat4(Vec4(zNear / right, 0.0f, 0.0f, 0.0f), Vec4(0.0f, zNear / top, 0.0f, 0.0f),
+        Vec4(0.0f, 0.0f, reversed ? 0.0f : -1.0f, -1.0f), Vec4(0.0f, 0.0f, reversed ? zNear : -2.0f * zNear, 0.0f));
+}
+
+
+Mat4 LookAt(const Angel::vec4& eye, const Angel::vec4& at, const Angel::vec4& up) {
+    return Mat4(Angel::LookAt(eye, at, up));
+}
+
+
+//----------------------------------------------------------------------------
+//
+//  --- Batched transforms ---
+//
+
+void multiply(const Mat4& left, const Mat4* right, Mat4* out, size_t count) {
+    // left stays in registers for the whole batch
+    Vec4 c0 = left.col[0], c1 = left.col[1], c2 = left.col[2], c3 = left.col[3];
+    for (size_t i = 0; i < count; i++) {
+        Mat4 product;
+        for (int c = 0; c < 4; c++) {
+            const Vec4& b = right[i].col[c];
+            product.col[c] = c0 * splat<0>(b) + c1 * splat<1>(b) + c2 * splat<2>(b) + c3 * splat<3>(b);
+        }
+        out[i] = product;
+    }
+}
+
+
+void multiply(const Mat4* left, const Mat4& right, Mat4* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = left[i] * right;
+    }
+}
+
+
+void transform(const Mat4& m, const Vec4* points, Vec4* out, size_t count) {
+    Vec4 c0 = m.col[0], c1 = m.col[1], c2 = m.col[2], c3 = m.col[3];
+    for (size_t i = 0; i < count; i++) {
+        const Vec4& p = points[i];
+        out[i] = c0 * splat<0>(p) + c1 * splat<1>(p) + c2 * splat<2>(p) + c3 * splat<3>(p);
+    }
+}
+
+
+//----------------------------------------------------------------------------
+//
+//  --- Benchmark ---
+//
+
+// Best of a few runs, in nanoseconds per item
+static double timeBest(size_t items, const std::function<void()>& run) {
+    double best = 1e30;
+    for (int r = 0; r < 5; r++) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::nano>(end - start).count() / items);
+    }
+    return best;
+}
+
+
+static float maxDifference(const std::vector<Angel::mat4>& angel, const std::vector<Mat4>& simd) {
+    float worst = 0.0f;
+    for (size_t i = 0; i < angel.size(); i++) {
+        for (int r = 0; r < 4; r++) {
+            for (int c = 0; c < 4; c++) {
+                worst = std::max(worst, std::fabs(angel[i][r][c] - simd[i].at(r, c)));
+            }
+        }
+    }
+    return worst;
+}
+
+
+static void report(const char* name, double angelNs, double simdNs, float difference) {
+    printf("%-28s %10.2f %10.2f %8.1fx %10.2g\n", name, angelNs, simdNs, angelNs / simdNs, difference);
+}
+
+
+void benchmarkMatrices() {
+    const size_t count = 100000, pointCount = 1000000;
+    std::mt19937 rng(1969);
+    std::uniform_real_distribution<float> coordinate(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> degrees(-180.0f, 180.0f);
+    std::uniform_real_distribution<float> scale(0.5f, 2.5f);
+
+    // Scene-like inputs: a camera and placed, rotated, scaled objects
+    std::vector<float> px(count), py(count), pz(count), heading(count), size(count);
+    for (size_t i = 0; i < count; i++) {
+        px[i] = coordinate(rng);
+        py[i] = coordinate(rng);
+        pz[i] = coordinate(rng);
+        heading[i] = degrees(rng);
+        size[i] = scale(rng);
+    }
+    Angel::mat4 angelView = Angel::LookAt(Angel::vec4(0.0f, -20.0f, 15.0f, 1.0f), Angel::vec4(0.0f, 0.0f, 0.0f, 1.0f),
+        Angel::vec4(0.0f, 0.0f, 1.0f, 0.0f));
+    Angel::mat4 angelPart = Angel::Translate(3.0f, 0.0f, 0.0f) * Angel::Scale(2.5f, 2.5f, 2.5f);
+    Mat4 view(angelView), part(angelPart);
+
+    std::vector<Angel::mat4> angelModels(count), angelOut(count);
+    std::vector<Mat4> models(count), out(count);
+
+    printf("matrices: %s lanes, %zu matrices, %zu points, best of 5 runs\n\n", instructionSet(), count, pointCount);
+    printf("%-28s %10s %10s %9s %10s\n", "operation", "Angel ns", "SIMD ns", "speedup", "max diff");
+
+    double angelNs = timeBest(count, [&] {
+        for (size_t i = 0; i < count; i++) {
+            angelModels[i] = Angel::Translate(px[i], py[i], pz[i]) * Angel::RotateZ(heading[i]) * Angel::Scale(size[i], size[i], size[i]);
+        }
+    });
+    double simdNs = timeBest(count, [&] {
+        for (size_t i = 0; i < count; i++) {
+            models[i] = Translate(px[i], py[i], pz[i]) * RotateZ(heading[i]) * Scale(size[i], size[i], size[i]);
+        }
+    });
+    report("build T * Rz * S", angelNs, simdNs, maxDifference(angelModels, models));
+
+    angelNs = timeBest(count, [&] {
+        for (size_t i = 0; i < count; i++) {
+            angelOut[i] = angelView * angelModels[i];
+        }
+    });
+    simdNs = timeBest(count, [&] { multiply(view, &models[0], &out[0], count); });
+    report("view * model[i]", angelNs, simdNs, maxDifference(angelOut, out));
+
+    angelNs = timeBest(count, [&] {
+        for (size_t i = 0; i < count; i++) {
+            angelOut[i] = angelModels[i] * angelPart;
+        }
+    });
+    simdNs = timeBest(count, [&] { multiply(&models[0], part, &out[0], count); });
+    report("model[i] * part", angelNs, simdNs, maxDifference(angelOut, out));
+
+    // The per-object draw path uploads with transpose = GL_TRUE; the
+    // indirect path needs the first three rows of each matrix
+    std::vector<GLfloat> angelRows(count * 12), rows(count * 12);
+    angelNs = timeBest(count, [&] {
+        for (size_t i = 0; i < count; i++) {
+            memcpy(&angelRows[i * 12], (const GLfloat*)angelOut[i], 12 * sizeof(GLfloat));
+        }
+    });
+    simdNs = timeBest(count, [&] {
+        for (size_t i = 0; i < count; i++) {
+            storeAffineRows(out[i], &rows[i * 12]);
+        }
+    });
+    float rowDifference = 0.0f;
+    for (size_t i = 0; i < rows.size(); i++) {
+        rowDifference = std::max(rowDifference, std::fabs(rows[i] - angelRows[i]));
+    }
+    report("affine rows (copy/transpose)", angelNs, simdNs, rowDifference);
+
+    std::vector<Angel::vec4> angelPoints(pointCount), angelTransformed(pointCount);
+    std::vector<Vec4> points(pointCount), transformed(pointCount);
+    for (size_t i = 0; i < pointCount; i++) {
+        angelPoints[i] = Angel::vec4(coordinate(rng), coordinate(rng), coordinate(rng), 1.0f);
+        points[i] = Vec4(angelPoints[i]);
+    }
+    angelNs = timeBest(pointCount, [&] {
+        for (size_t i = 0; i < pointCount; i++) {
+            angelTransformed[i] = angelView * angelPoints[i];
+        }
+    });
+    simdNs = timeBest(pointCount, [&] { transform(view, &points[0], &transformed[0], pointCount); });
+    float pointDifference = 0.0f;
+    for (size_t i = 0; i < pointCount; i++) {
+        for (int k = 0; k < 4; k++) {
+            pointDifference = std::max(pointDifference, std::fabs(angelTransformed[i][k] - transformed[i][k]));
+        }
+    }
+    report("view * point[i]", angelNs, simdNs, pointDifference);
+}
+
+} // namespace Simd
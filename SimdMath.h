@@ -0,0 +1,185 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- SimdMath.h ---
+//
+//   Aligned 4-wide vector and 4x4 matrix types for the per-frame and
+//   per-object transform code.  Matrices are column-major, the layout GL
+//   expects, so they upload with transpose = GL_FALSE, and a product is
+//   four column updates of four multiply-adds each.  The lanes map onto
+//   SSE on x86, NEON on ARM and a plain float array elsewhere.
+//
+//   The builders mirror Angel's (Translate, Scale, RotateX/Y/Z, LookAt,
+//   Perspective) and products add in the same order as Angel's mat4, so
+//   both give the same values.  Convert with Mat4(angelMatrix) and
+//   toAngel() where code still takes Angel types.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __SIMDMATH_H__
+#define __SIMDMATH_H__
+
+#include "Angel.h"
+#include <cstddef>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#  define SIMD_SSE 1
+#  include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#  define SIMD_NEON 1
+#  include <arm_neon.h>
+#endif
+
+namespace Simd {
+
+#if defined(SIMD_SSE)
+typedef __m128 Lanes;
+#elif defined(SIMD_NEON)
+typedef float32x4_t Lanes;
+#else
+struct Lanes { float v[4]; };
+#endif
+
+// Name of the instruction set the lanes compile to
+const char* instructionSet();
+
+struct alignas(16) Vec4 {
+    Lanes v;
+
+    Vec4() : Vec4(0.0f) {}
+    Vec4(Lanes lanes) : v(lanes) {}
+    explicit Vec4(float s);
+    Vec4(float x, float y, float z, float w);
+    explicit Vec4(const Angel::vec4& a) : Vec4(a.x, a.y, a.z, a.w) {}
+    Vec4(const Angel::vec3& a, float w) : Vec4(a.x, a.y, a.z, w) {}
+
+    // Four floats from or to p, which needs no particular alignment
+    static Vec4 load(const float* p);
+    void store(float* p) const;
+
+    float operator[](int i) const { return ((const float*)&v)[i]; }
+};
+
+inline Vec4 operator+(const Vec4& a, const Vec4& b);
+inline Vec4 operator-(const Vec4& a, const Vec4& b);
+inline Vec4 operator*(const Vec4& a, const Vec4& b);
+inline Vec4 operator*(const Vec4& a, float s) { return a * Vec4(s); }
+
+Angel::vec4 toAngel(const Vec4& a);
+
+// Column-major 4x4: col[c][r] is row r of column c
+struct alignas(16) Mat4 {
+    Vec4 col[4];
+
+    // Identity times d, like Angel's mat4(d)
+    explicit Mat4(float d = 1.0f);
+    Mat4(const Vec4& c0, const Vec4& c1, const Vec4& c2, const Vec4& c3) : col{ c0, c1, c2, c3 } {}
+    explicit Mat4(const Angel::mat4& m);
+
+    float at(int row, int column) const { return col[column][row]; }
+
+    // Sixteen floats, column by column, ready for glUniformMatrix4fv(..., GL_FALSE, ...)
+    const GLfloat* data() const { return (const GLfloat*)col; }
+    operator const GLfloat*() const { return data(); }
+};
+
+inline Vec4 operator*(const Mat4& m, const Vec4& v);
+inline Mat4 operator*(const Mat4& a, const Mat4& b);
+Mat4 transpose(const Mat4& m);
+Angel::mat4 toAngel(const Mat4& m);
+
+// First three rows of m, row by row: the 3x4 affine records of the
+// instanced and indirect draws
+void storeAffineRows(const Mat4& m, GLfloat rows[12]);
+
+// Same transforms as Angel's, in column-major form
+Mat4 Translate(float x, float y, float z);
+inline Mat4 Translate(const Angel::vec3& v) { return Translate(v.x, v.y, v.z); }
+Mat4 Scale(float x, float y, float z);
+inline Mat4 Scale(const Angel::vec3& v) { return Scale(v.x, v.y, v.z); }
+Mat4 RotateX(float degrees);
+Mat4 RotateY(float degrees);
+Mat4 RotateZ(float degrees);
+Mat4 Perspective(float fovy, float aspect, float zNear, float zFar);
+// Perspective with the far plane at infinity.  Reversed maps zNear to depth
+// 1 and infinity to 0 for GL_ZERO_TO_ONE clip control and GL_GREATER;
+// otherwise depth runs from -1 at zNear towards 1 as with Perspective.
+Mat4 PerspectiveInfinite(float fovy, float aspect, float zNear, bool reversed);
+Mat4 LookAt(const Angel::vec4& eye, const Angel::vec4& at, const Angel::vec4& up);
+
+//----------------------------------------------------------------------------
+//
+//  --- Batched transforms ---
+//
+//   out may alias the matrix array it is computed from
+//
+
+// out[i] = left * right[i], e.g. one view over many models
+void multiply(const Mat4& left, const Mat4* right, Mat4* out, size_t count);
+
+// out[i] = left[i] * right, e.g. many placements of one local part
+void multiply(const Mat4* left, const Mat4& right, Mat4* out, size_t count);
+
+// out[i] = m * points[i]
+void transform(const Mat4& m, const Vec4* points, Vec4* out, size_t count);
+
+// Times composition, batched products and point transforms against
+// Angel's scalar mat4 and prints the speedups, then checks the results agree
+void benchmarkMatrices();
+
+//----------------------------------------------------------------------------
+//
+//  --- Inline lane operations ---
+//
+
+#if defined(SIMD_SSE)
+
+inline Vec4::Vec4(float s) : v(_mm_set1_ps(s)) {}
+inline Vec4::Vec4(float x, float y, float z, float w) : v(_mm_setr_ps(x, y, z, w)) {}
+inline Vec4 Vec4::load(const float* p) { return Vec4(_mm_loadu_ps(p)); }
+inline void Vec4::store(float* p) const { _mm_storeu_ps(p, v); }
+inline Vec4 operator+(const Vec4& a, const Vec4& b) { return Vec4(_mm_add_ps(a.v, b.v)); }
+inline Vec4 operator-(const Vec4& a, const Vec4& b) { return Vec4(_mm_sub_ps(a.v, b.v)); }
+inline Vec4 operator*(const Vec4& a, const Vec4& b) { return Vec4(_mm_mul_ps(a.v, b.v)); }
+// Lane i of a copied to all four lanes
+template <int i> inline Vec4 splat(const Vec4& a) { return Vec4(_mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(i, i, i, i))); }
+
+#elif defined(SIMD_NEON)
+
+inline Vec4::Vec4(float s) : v(vdupq_n_f32(s)) {}
+inline Vec4::Vec4(float x, float y, float z, float w) {
+    const float lanes[4] = { x, y, z, w };
+    v = vld1q_f32(lanes);
+}
+inline Vec4 Vec4::load(const float* p) { return Vec4(vld1q_f32(p)); }
+inline void Vec4::store(float* p) const { vst1q_f32(p, v); }
+inline Vec4 operator+(const Vec4& a, const Vec4& b) { return Vec4(vaddq_f32(a.v, b.v)); }
+inline Vec4 operator-(const Vec4& a, const Vec4& b) { return Vec4(vsubq_f32(a.v, b.v)); }
+// vmulq rather than a fused multiply-add, which would round differently from Angel
+inline Vec4 operator*(const Vec4& a, const Vec4& b) { return Vec4(vmulq_f32(a.v, b.v)); }
+template <int i> inline Vec4 splat(const Vec4& a) { return Vec4(vdupq_n_f32(vgetq_lane_f32(a.v, i))); }
+
+#else
+
+inline Vec4::Vec4(float s) : v{ { s, s, s, s } } {}
+inline Vec4::Vec4(float x, float y, float z, float w) : v{ { x, y, z, w } } {}
+inline Vec4 Vec4::load(const float* p) { return Vec4(p[0], p[1], p[2], p[3]); }
+inline void Vec4::store(float* p) const { for (int i = 0; i < 4; i++) p[i] = v.v[i]; }
+inline Vec4 operator+(const Vec4& a, const Vec4& b) { return Vec4(a[0] + b[0], a[1] + b[1], a[2] + b[2], a[3] + b[3]); }
+inline Vec4 operator-(const Vec4& a, const Vec4& b) { return Vec4(a[0] - b[0], a[1] - b[1], a[2] - b[2], a[3] - b[3]); }
+inline Vec4 operator*(const Vec4& a, const Vec4& b) { return Vec4(a[0] * b[0], a[1] * b[1], a[2] * b[2], a[3] * b[3]); }
+template <int i> inline Vec4 splat(const Vec4& a) { return Vec4(a[i]); }
+
+#endif
+
+// Sums in the order Angel's scalar loops do: x, then y, z and w
+inline Vec4 operator*(const Mat4& m, const Vec4& v) {
+    return m.col[0] * splat<0>(v) + m.col[1] * splat<1>(v) + m.col[2] * splat<2>(v) + m.col[3] * splat<3>(v);
+}
+
+inline Mat4 operator*(const Mat4& a, const Mat4& b) {
+    return Mat4(a * b.col[0], a * b.col[1], a * b.col[2], a * b.col[3]);
+}
+
+} // namespace Simd
+
+#endif // __SIMDMATH_H__
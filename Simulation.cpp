@@ -0,0 +1,159 @@
+#include "Simulation.h"
+#include "InputLog.h"
+#include <chrono>
+#include <cstdio>
+
+
+void simulationStep(SimState& state) {
+    if (state.isPaused) {
+        return;
+    }
+    state.shipPosition += dvec3(state.shipDirection * state.shipSpeed + state.shipDrift);
+    state.stationRotationAngle += state.stationRotationSpeed;
+}
+
+
+SimState interpolateStates(const SimState& previous, const SimState& current, float alpha) {
+    SimState state = current;
+    state.shipPosition = previous.shipPosition + (current.shipPosition - previous.shipPosition) * (double)alpha;
+    vec3 direction = previous.shipDirection + (current.shipDirection - previous.shipDirection) * alpha;
+    // Opposite directions blend to zero halfway through; keep the newer one then
+    if (length(direction) > 1e-4f) {
+        state.shipDirection = normalize(direction);
+    }
+    state.stationRotationAngle = previous.stationRotationAngle
+        + (current.stationRotationAngle - previous.stationRotationAngle) * alpha;
+    return state;
+}
+
+
+// Moves the ship out of every body it overlaps and stops any drift into
+// them; the bodies are relative to anchor
+static void resolveShipCollisions(SimState& state, const dvec3& anchor, CollisionWorld& world, std::vector<CollisionEvent>& events) {
+    ShipCollider ship = makeShipCollider(world.shipShape, toFloat(state.shipPosition - anchor), state.shipDirection);
+    world.collide(&ship, 1, events);
+    for (const CollisionEvent& contact : events) {
+        state.shipPosition += dvec3(contact.normal * contact.depth);
+        float inward = dot(state.shipDrift, contact.normal);
+        if (inward < 0.0f) {
+            state.shipDrift -= contact.normal * inward;
+        }
+    }
+}
+
+
+void Simulation::step() {
+    if (replay) {
+        replay->apply(tick);
+    }
+    previous = current;
+    if (gravity && !current.isPaused) {
+        // Leapfrog for the ship too: half a kick with the field from the end of
+        // the last tick, the drift, then half a kick with the field of this one
+        current.shipDrift += current.shipGravity * 0.5f;
+        simulationStep(current);
+        gravity->step(1.0f);
+        current.shipGravity = gravity->accelerationAt(toFloat(current.shipPosition - sceneAnchor));
+        current.shipDrift += current.shipGravity * 0.5f;
+    }
+    else {
+        simulationStep(current);
+    }
+
+    events.clear();
+    if (collisions && !current.isPaused) {
+        if (gravity) {
+            const GravityBodies& bodies = gravity->bodies;
+            for (size_t i = 0; i < bodies.size() && i < collisions->bodies.size(); i++) {
+                BoundingSphere sphere = collisions->bodies.bounds((uint32_t)i);
+                sphere.center = vec3(bodies.x[i], bodies.y[i], bodies.z[i]);
+                collisions->bodies.update((uint32_t)i, sphere);
+            }
+        }
+        resolveShipCollisions(current, sceneAnchor, *collisions, events);
+        contactTicks += !events.empty();
+    }
+
+    if (fleet && !current.isPaused) {
+        fleet->step();
+    }
+    tick++;
+}
+
+
+// Hashes the bytes of values, whose type has no padding
+template <typename T>
+static void hashValues(uint64_t& hash, const T* values, size_t count) {
+    const unsigned char* bytes = (const unsigned char*)values;
+    for (size_t i = 0; i < count * sizeof(T); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+}
+
+
+uint64_t Simulation::checksum() const {
+    uint64_t hash = 14695981039346656037ull;
+    hashValues(hash, &tick, 1);
+    const double position[] = { current.shipPosition.x, current.shipPosition.y, current.shipPosition.z };
+    hashValues(hash, position, 3);
+    const vec3* vectors[] = { &current.shipDirection, &current.shipDrift, &current.shipGravity };
+    for (const vec3* v : vectors) {
+        hashValues(hash, &v->x, 1);
+        hashValues(hash, &v->y, 1);
+        hashValues(hash, &v->z, 1);
+    }
+    const float scalars[] = { current.shipSpeed, current.savedShipSpeed, current.stationRotationAngle, current.stationRotationSpeed,
+        current.isPaused ? 1.0f : 0.0f };
+    hashValues(hash, scalars, 5);
+
+    if (gravity) {
+        const GravityBodies& b = gravity->bodies;
+        for (const std::vector<float>* array : { &b.x, &b.y, &b.z, &b.vx, &b.vy, &b.vz }) {
+            hashValues(hash, array->data(), array->size());
+        }
+    }
+    if (fleet) {
+        const FleetStore& s = fleet->ships;
+        for (const std::vector<float>* array : { &s.px, &s.py, &s.pz, &s.vx, &s.vy, &s.vz }) {
+            hashValues(hash, array->data(), array->size());
+        }
+    }
+    return hash;
+}
+
+
+int Simulation::advance(double elapsedSeconds, uint64_t stopTick) {
+    if (elapsedSeconds > SimMaxFrameTime) {
+        elapsedSeconds = SimMaxFrameTime;
+    }
+    accumulator += elapsedSeconds;
+
+    int ticks = 0;
+    while (accumulator >= SimTimestep && tick < stopTick) {
+        step();
+        accumulator -= SimTimestep;
+        ticks++;
+    }
+    return ticks;
+}
+
+
+void benchmarkSimulation(uint64_t ticks) {
+    if (ticks == 0) {
+        return;
+    }
+    Simulation sim;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < ticks; i++) {
+        sim.step();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    printf("%llu ticks in %.3f s: %.0f ticks/sec (%.1f ns/tick)\n",
+        (unsigned long long)ticks, seconds, ticks / seconds, seconds * 1e9 / ticks);
+    // Printing the final state keeps the loop from being optimized away
+    printf("final ship position: %.3f %.3f %.3f\n",
+        sim.current.shipPosition.x, sim.current.shipPosition.y, sim.current.shipPosition.z);
+}
@@ -0,0 +1,97 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- Simulation.h ---
+//
+//   Fixed-timestep simulation core.  All motion happens in simulationStep(),
+//   which advances the state by exactly one tick; Simulation feeds it from
+//   an accumulator of real time and keeps the last two states around so the
+//   renderer can interpolate between them without ever modifying them.
+//   When a gravity field is attached it is stepped once per tick and the
+//   ship moves through it as a massless test particle.  With a collision
+//   world attached, every tick ends by pushing the ship out of whatever it
+//   ran into and recording the contacts.  An attached fleet is stepped
+//   last, on the job system.  An attached input replay applies the keys
+//   recorded for a tick before the tick runs.
+//
+//   The ship's position is a double in world space; gravity bodies,
+//   collision bodies and the fleet are floats relative to sceneAnchor (see
+//   WorldSpace.h), and the ship is taken into that frame to meet them.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __SIMULATION_H__
+#define __SIMULATION_H__
+
+#include "Angel.h"
+#include "Gravity.h"
+#include "Collision.h"
+#include "Fleet.h"
+#include "WorldSpace.h"
+#include <cstdint>
+#include <vector>
+
+class InputReplay;
+
+// Length of one simulation tick in seconds.  Speeds are expressed per tick,
+// matching the 16 ms timers the simulation used to run on.
+const double SimTimestep = 1.0 / 60.0;
+
+// Never simulate more than this much real time per advance() call, so a long
+// stall (debugger, window drag) doesn't trigger a burst of catch-up ticks
+const double SimMaxFrameTime = 0.25;
+
+struct SimState {
+    dvec3 shipPosition = dvec3(1.0, 10.0, 5.0);   // world space
+    vec3 shipDirection = vec3(1.0f, 0.0f, 0.0f);
+    float shipSpeed = 0.02f;          // units per tick
+    float savedShipSpeed = 0.0f;      // speed to restore when unpausing
+    float stationRotationAngle = 0.0f;
+    float stationRotationSpeed = 0.0f; // degrees per tick
+    bool isPaused = false;
+    vec3 shipDrift = vec3(0.0f, 0.0f, 0.0f);   // velocity picked up from gravity, units per tick
+    vec3 shipGravity = vec3(0.0f, 0.0f, 0.0f); // field at shipPosition, units per tick^2
+};
+
+// Advances the state by one fixed tick
+void simulationStep(SimState& state);
+
+// Blends two consecutive states for rendering; alpha in [0, 1]
+SimState interpolateStates(const SimState& previous, const SimState& current, float alpha);
+
+struct Simulation {
+    SimState previous;
+    SimState current;   // authoritative state, input is applied here
+    double accumulator = 0.0;
+    uint64_t tick = 0;
+    GravitySimulation* gravity = nullptr; // optional N-body field, stepped with every tick
+    // Optional collision world; with gravity, its bodies 0..n-1 are the gravity bodies
+    CollisionWorld* collisions = nullptr;
+    std::vector<CollisionEvent> events;   // contacts resolved during the last tick
+    uint64_t contactTicks = 0;            // ticks that ended with the ship touching something
+    Fleet* fleet = nullptr;               // optional autonomous ships
+    InputReplay* replay = nullptr;        // optional recorded input, applied to current
+    dvec3 sceneAnchor;                    // world position of the bodies' and the fleet's float frame
+
+    // Consumes elapsed real time in whole ticks and returns how many ran;
+    // stops early rather than run tick stopTick
+    int advance(double elapsedSeconds, uint64_t stopTick = UINT64_MAX);
+
+    // Runs exactly one tick, independent of real time
+    void step();
+
+    // Fraction of a tick left in the accumulator, used to interpolate
+    float alpha() const { return (float)(accumulator / SimTimestep); }
+
+    // State to draw this frame
+    SimState renderState() const { return interpolateStates(previous, current, alpha()); }
+
+    // FNV-1a over the tick, the current state and every gravity body and
+    // fleet ship; equal checksums mean a replay ended bit for bit where the
+    // recording did
+    uint64_t checksum() const;
+};
+
+// Runs the given number of ticks as fast as possible and prints ticks/sec
+void benchmarkSimulation(uint64_t ticks);
+
+#endif // __SIMULATION_H__
@@ -0,0 +1,145 @@
+#include "SphereLOD.h"
+
+
+float pixelsPerUnit(float fovyDegrees, int viewportHeight) {
+    return viewportHeight * 0.5f / tan(fovyDegrees * DegreesToRadians * 0.5f);
+}
+
+
+float projectedRadius(float radius, float distance, float pixelScale) {
+    // Inside (or touching) the sphere it covers the whole view
+    if (distance <= radius) {
+        return 1e9f;
+    }
+    return radius * pixelScale / distance;
+}
+
+
+int selectSphereLOD(float radiusPixels, int previousLevel) {
+    if (previousLevel < 0 || previousLevel > SphereImpostorLevel) {
+        int level = 0;
+        while (level < SphereImpostorLevel && radiusPixels < SphereLODMinRadius[level]) {
+            level++;
+        }
+        return level;
+    }
+
+    int level = previousLevel;
+    while (level > 0 && radiusPixels >= SphereLODMinRadius[level - 1] * (1.0f + SphereLODHysteresis)) {
+        level--;
+    }
+    while (level < SphereImpostorLevel && radiusPixels < SphereLODMinRadius[level] * (1.0f - SphereLODHysteresis)) {
+        level++;
+    }
+    return level;
+}
+
+
+// Expands each instance into a view-space quad perpendicular to the ray
+// through the sphere center, sized to the sphere's silhouette
+const char* impostorVertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec2 vCorner;
+layout (location = 2) in vec4 iPosScale;
+layout (location = 3) in vec3 iColor;
+
+out vec3 quadPoint;
+flat out vec3 sphereCenter;
+flat out float sphereRadius;
+flat out vec3 sphereColor;
+
+layout (std140) uniform FrameData {
+    mat4 Projection;
+    mat4 View;
+    vec4 LightPos;
+    vec4 LightColor;
+    vec4 SceneOffset;
+};
+
+void main() {
+    // Planets are relative to the scene anchor, which is SceneOffset from the eye
+    vec3 center = vec3(View * vec4(iPosScale.xyz + SceneOffset.xyz, 1.0));
+    float radius = iPosScale.w * 0.5; // sphere meshes have radius 0.5
+    float dist = length(center);
+    vec3 forward = center / dist;
+    vec3 right = normalize(cross(forward, abs(forward.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0)));
+    vec3 up = cross(right, forward);
+
+    // The silhouette seen from the eye is slightly wider than the radius
+    float extent = radius * dist / sqrt(max(dist * dist - radius * radius, 1e-6));
+    quadPoint = center + (right * vCorner.x + up * vCorner.y) * extent;
+
+    sphereCenter = center;
+    sphereRadius = radius;
+    sphereColor = iColor;
+    gl_Position = Projection * vec4(quadPoint, 1.0);
+}
+)";
+
+// Intersects the eye ray with the sphere, then lights and depth-writes the hit
+const char* impostorFragmentShaderSource = R"(
+#version 330 core
+in vec3 quadPoint;
+flat in vec3 sphereCenter;
+flat in float sphereRadius;
+flat in vec3 sphereColor;
+
+out vec4 FragColor;
+
+layout (std140) uniform FrameData {
+    mat4 Projection;
+    mat4 View;
+    vec4 LightPos;
+    vec4 LightColor;
+    vec4 SceneOffset;
+};
+
+void main() {
+    vec3 dir = normalize(quadPoint);
+    float b = dot(dir, sphereCenter);
+    float c = dot(sphereCenter, sphereCenter) - sphereRadius * sphereRadius;
+    float disc = b * b - c;
+    if (disc < 0.0) {
+        discard;
+    }
+    vec3 hit = dir * (b - sqrt(disc));
+    vec3 Normal = (hit - sphereCenter) / sphereRadius;
+
+    vec3 LightDir = normalize(LightPos.xyz - hit);
+    vec3 diffuse = max(dot(Normal, LightDir), 0.0) * LightColor.rgb;
+#ifdef CLUSTERED_LIGHTING
+    diffuse += clusteredLighting(hit, Normal);
+#endif
+    FragColor = vec4(sphereColor * diffuse, 1.0);
+
+    vec4 clip = Projection * vec4(hit, 1.0);
+#ifdef REVERSED_Z
+    gl_FragDepth = clip.z / clip.w;   // clip control maps [0, 1] straight to depth
+#else
+    gl_FragDepth = (clip.z / clip.w) * 0.5 + 0.5;
+#endif
+}
+)";
+
+
+GLuint createImpostorQuad() {
+    static const GLfloat corners[] = {
+        -1.0f, -1.0f,
+         1.0f, -1.0f,
+        -1.0f,  1.0f,
+         1.0f,  1.0f
+    };
+
+    GLuint vao, vbo;
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
+
+    return vao;
+}
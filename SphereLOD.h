@@ -0,0 +1,57 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- SphereLOD.h ---
+//
+//   Level-of-detail selection for spheres.  Each object picks a mesh from
+//   a chain of decreasing band counts based on its projected radius in
+//   pixels, with hysteresis so it doesn't flicker at a threshold.  Below
+//   the coarsest mesh a sphere is drawn as a ray-traced impostor: a
+//   camera-facing quad whose fragments compute the exact sphere surface,
+//   normal and depth.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __SPHERELOD_H__
+#define __SPHERELOD_H__
+
+#include "Angel.h"
+
+const int SphereLODCount = 4;
+
+// Latitude/longitude bands of each mesh level, finest first
+const int SphereLODBands[SphereLODCount] = { 64, 30, 14, 6 };
+
+// Smallest projected radius, in pixels, at which each mesh level is used
+const float SphereLODMinRadius[SphereLODCount] = { 120.0f, 30.0f, 8.0f, 2.5f };
+
+// Level index meaning "draw as an impostor"
+const int SphereImpostorLevel = SphereLODCount;
+
+// Level index meaning "no previous selection", which disables hysteresis
+const int SphereLODUnset = 255;
+
+// Fraction a radius must move past a threshold before the level changes
+const float SphereLODHysteresis = 0.2f;
+
+// Pixels covered by one world unit at distance one, for a vertical field of
+// view in degrees and a viewport height in pixels
+float pixelsPerUnit(float fovyDegrees, int viewportHeight);
+
+// Projected radius in pixels of a sphere at the given eye distance
+float projectedRadius(float radius, float distance, float pixelScale);
+
+// Picks a level for a projected radius, staying at previousLevel unless the
+// radius is clearly past the neighbouring threshold
+int selectSphereLOD(float radiusPixels, int previousLevel);
+
+// Shaders for the impostor tier; the fragment stage shares the
+// std140 FrameData block with the mesh shaders, and its clustered
+// variant the point lights.  Build them with REVERSED_Z defined when
+// depth is reversed with GL_ZERO_TO_ONE clip control.
+extern const char* impostorVertexShaderSource;
+extern const char* impostorFragmentShaderSource;
+
+// Creates a VAO holding a unit quad (corners in [-1, 1]) at location 0
+GLuint createImpostorQuad();
+
+#endif // __SPHERELOD_H__
@@ -0,0 +1,194 @@
+#include "StreamBuffer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+static size_t roundUp(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+
+void StreamBuffer::init(size_t bytes, bool persistentMap) {
+    release();
+    persistent = persistentMap && (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage);
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    if (alignment > 0) {
+        uniformOffsetAlignment = (size_t)alignment;
+    }
+    // Regions start where any allocation could
+    create(roundUp(std::max(bytes, (size_t)1), std::max(uniformOffsetAlignment, (size_t)256)));
+}
+
+
+void StreamBuffer::create(size_t bytes) {
+    regionBytes = bytes;
+    size_t total = regionBytes * StreamFrames;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    if (persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, total, NULL, flags);
+        mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, total, flags);
+        if (!mapped) {
+            fprintf(stderr, "stream buffer: persistent mapping failed, mapping per allocation\n");
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            glDeleteBuffers(1, &buffer);
+            persistent = false;
+            create(bytes);
+            return;
+        }
+    }
+    else {
+        glBufferData(GL_COPY_WRITE_BUFFER, total, NULL, GL_STREAM_DRAW);
+        mapped = nullptr;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    region = 0;
+    head = 0;
+}
+
+
+void StreamBuffer::release() {
+    unmap();
+    for (GLsync& fence : fences) {
+        if (fence) {
+            glDeleteSync(fence);
+            fence = 0;
+        }
+    }
+    if (!retired.empty()) {
+        glDeleteBuffers((GLsizei)retired.size(), &retired[0]);
+        retired.clear();
+    }
+    if (buffer != 0) {
+        // Deleting a buffer unmaps it
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+    mapped = nullptr;
+    begun = false;
+}
+
+
+void StreamBuffer::waitFor(GLsync fence) {
+    auto start = std::chrono::steady_clock::now();
+    // Polled first: a region StreamFrames frames old is almost always free by now
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        stats.waits++;
+        status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, StreamWaitTimeoutNs);
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    stats.lastWaitMs = ms;
+    stats.worstWaitMs = std::max(stats.worstWaitMs, ms);
+    stats.totalWaitMs += ms;
+    if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) {
+        stats.timeouts++;
+        fprintf(stderr, "stream buffer: gave up waiting for the GPU after %.0f ms\n", ms);
+    }
+}
+
+
+void StreamBuffer::beginFrame() {
+    unmap();
+    // Draws still in flight keep these alive until they are done
+    if (!retired.empty()) {
+        glDeleteBuffers((GLsizei)retired.size(), &retired[0]);
+        retired.clear();
+    }
+
+    if (begun) {
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        stats.lastFrameBytes = stats.frameBytes;
+        stats.peakFrameBytes = std::max(stats.peakFrameBytes, stats.frameBytes);
+        stats.totalBytes += stats.frameBytes;
+        stats.frames++;
+        region = (region + 1) % StreamFrames;
+    }
+    begun = true;
+    stats.frameBytes = 0;
+    stats.lastWaitMs = 0.0;
+    head = 0;
+
+    if (fences[region]) {
+        waitFor(fences[region]);
+        glDeleteSync(fences[region]);
+        fences[region] = 0;
+    }
+}
+
+
+void StreamBuffer::grow(size_t needed) {
+    size_t bytes = regionBytes * 2;
+    while (bytes < needed) {
+        bytes *= 2;
+    }
+    // This frame's earlier allocations are still to be drawn from the old
+    // buffer, and the fences only guard its regions
+    retired.push_back(buffer);
+    for (GLsync& fence : fences) {
+        if (fence) {
+            glDeleteSync(fence);
+            fence = 0;
+        }
+    }
+    create(bytes);
+    stats.grows++;
+}
+
+
+StreamAllocation StreamBuffer::allocate(size_t bytes, size_t alignment) {
+    unmap();
+    size_t start = roundUp(head, alignment);
+    if (start + bytes > regionBytes) {
+        grow(stats.frameBytes + bytes + alignment);
+        start = 0;
+    }
+    stats.frameBytes += start - head + bytes;
+    stats.allocations++;
+    head = start + bytes;
+
+    StreamAllocation allocation;
+    allocation.buffer = buffer;
+    allocation.offset = (GLintptr)(region * regionBytes + start);
+    if (persistent) {
+        allocation.data = mapped + allocation.offset;
+    }
+    else if (bytes > 0) {
+        // The fence on this region already passed, so nothing can be reading it
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        allocation.data = glMapBufferRange(GL_COPY_WRITE_BUFFER, allocation.offset, bytes,
+            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        mappedRange = true;
+    }
+    return allocation;
+}
+
+
+void StreamBuffer::unmap() {
+    if (!mappedRange) {
+        return;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    mappedRange = false;
+}
+
+
+void StreamBuffer::printSummary() const {
+    if (stats.frames == 0) {
+        return;
+    }
+    double n = (double)stats.frames;
+    printf("stream buffer: %s, %d regions of %.0f KB, grown %llu times\n",
+        persistent ? "persistent mapping" : "mapped per allocation", StreamFrames, regionBytes / 1024.0,
+        (unsigned long long)stats.grows);
+    printf("  per frame %.1f KB in %.1f allocations, peak %.1f KB\n",
+        stats.totalBytes / n / 1024.0, stats.allocations / n, stats.peakFrameBytes / 1024.0);
+    printf("  fence waits %llu of %llu frames, %.4f ms per frame, worst %.3f ms, %llu timed out\n",
+        (unsigned long long)stats.waits, (unsigned long long)stats.frames, stats.totalWaitMs / n, stats.worstWaitMs,
+        (unsigned long long)stats.timeouts);
+}
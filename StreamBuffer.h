@@ -0,0 +1,122 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- StreamBuffer.h ---
+//
+//   One buffer for everything the CPU writes fresh every frame: the frame
+//   uniforms, instance records, indirect commands and line outlines.  It
+//   is created with glBufferStorage and mapped once, persistent and
+//   coherent, so allocate() hands out a pointer straight into GPU-visible
+//   memory; the caller writes its records there and draws from the
+//   returned buffer and offset, with no glBufferData copy or driver-side
+//   orphaning in between.
+//
+//   The buffer is cut into StreamFrames regions, one per frame in flight.
+//   beginFrame() puts a fence behind the frame just recorded and moves on
+//   to the next region, waiting on that region's fence only if the GPU is
+//   still reading what was written there StreamFrames frames ago; the
+//   wait is timed, and normally zero.  A frame that outgrows its region
+//   gets a bigger buffer on the spot: allocations already made stay valid
+//   in the old one, which is deleted at the next beginFrame().
+//
+//   Without OpenGL 4.4 or ARB_buffer_storage (or with persistent mapping
+//   turned off) the same regions and fences are kept, but every
+//   allocation is mapped on its own, unsynchronized, and must be unmapped
+//   with unmap() before it is drawn from.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __STREAMBUFFER_H__
+#define __STREAMBUFFER_H__
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Regions, so frames the CPU may be ahead of the GPU
+const int StreamFrames = 3;
+
+// Starting size of each region; it doubles whenever a frame needs more
+const size_t StreamRegionBytes = 1 << 20;
+
+// Fences are waited on for at most this long before the wait is abandoned
+const GLuint64 StreamWaitTimeoutNs = 1000000000;
+
+struct StreamAllocation {
+    void* data = nullptr;     // write-only, and written in order where possible
+    GLuint buffer = 0;
+    GLintptr offset = 0;      // of data in buffer
+};
+
+struct StreamStats {
+    size_t frameBytes = 0;          // allocated so far this frame, alignment included
+    size_t lastFrameBytes = 0, peakFrameBytes = 0;
+    uint64_t totalBytes = 0;
+    uint64_t allocations = 0;
+    double lastWaitMs = 0.0, worstWaitMs = 0.0, totalWaitMs = 0.0;   // on fences
+    uint64_t frames = 0;
+    uint64_t waits = 0;             // frames whose region the GPU still held
+    uint64_t timeouts = 0;
+    uint64_t grows = 0;
+};
+
+class StreamBuffer {
+public:
+    // Creates the buffer, persistently mapped when asked and supported;
+    // needs the GL context
+    void init(size_t regionBytes = StreamRegionBytes, bool persistent = true);
+
+    // Deletes the buffer and fences
+    void release();
+
+    bool ready() const { return buffer != 0; }
+    bool persistentlyMapped() const { return persistent; }
+    size_t regionSize() const { return regionBytes; }
+
+    // Once per frame before the first allocation: fences the previous
+    // frame's writes and waits until the next region is free
+    void beginFrame();
+
+    // bytes from the current region at an offset that is a multiple of
+    // alignment (a power of two).  Without persistent mapping the data is
+    // mapped until the next allocate() or unmap().
+    StreamAllocation allocate(size_t bytes, size_t alignment = 16);
+
+    // Typed shorthand for count records of T
+    template <typename T>
+    T* allocate(size_t count, StreamAllocation& allocation) {
+        allocation = allocate(count * sizeof(T), alignof(T) < 16 ? 16 : alignof(T));
+        return (T*)allocation.data;
+    }
+
+    // Ends the writes to the last allocation; a no-op when persistently mapped
+    void unmap();
+
+    // Offset alignment glBindBufferRange needs for uniform blocks
+    size_t uniformAlignment() const { return uniformOffsetAlignment; }
+
+    // Bytes streamed per frame, fence waits and growth
+    void printSummary() const;
+
+    StreamStats stats;
+
+private:
+    void create(size_t bytes);
+    void grow(size_t needed);
+    void waitFor(GLsync fence);
+
+    GLuint buffer = 0;
+    unsigned char* mapped = nullptr;    // the whole buffer, when persistent
+    bool persistent = false;
+    bool mappedRange = false;           // an allocation is mapped on its own
+    size_t regionBytes = 0;
+    size_t uniformOffsetAlignment = 256;
+
+    bool begun = false;                 // a frame is being recorded
+    int region = 0;
+    size_t head = 0;                    // next free byte in the current region
+    GLsync fences[StreamFrames] = {};
+    std::vector<GLuint> retired;        // outgrown buffers, deleted next frame
+};
+
+#endif // __STREAMBUFFER_H__
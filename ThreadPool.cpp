@@ -0,0 +1,34 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+
+ThreadPool::ThreadPool(unsigned threadCount) : owned(new JobSystem(threadCount)), jobs(owned.get()) {
+}
+
+
+ThreadPool::ThreadPool(JobSystem& jobs) : jobs(&jobs) {
+}
+
+
+void ThreadPool::parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body) {
+    if (count == 0) {
+        return;
+    }
+    grain = std::max(grain, (size_t)1);
+
+    // Not worth queueing anything for a single chunk
+    if (jobs->size() == 1 || count <= grain) {
+        body(0, count);
+        return;
+    }
+
+    JobCounter counter;
+    jobs->parallelFor(count, grain, body, counter);
+    jobs->wait(counter);
+}
+
+
+ThreadPool& defaultThreadPool() {
+    static ThreadPool pool(defaultJobSystem());
+    return pool;
+}
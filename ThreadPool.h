@@ -0,0 +1,44 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- ThreadPool.h ---
+//
+//   Data-parallel loops on top of the job system.  parallelFor() cuts an
+//   index range into grain-sized jobs, helps run them and returns once
+//   every one has.  The default pool shares defaultJobSystem()'s workers,
+//   so gravity, collisions and mesh generation draw on the same threads as
+//   the fleet and the light clustering instead of a second set sized to
+//   the hardware.  Any thread may call parallelFor(), several at once.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include "JobSystem.h"
+#include <functional>
+#include <memory>
+#include <thread>
+
+class ThreadPool {
+public:
+    // A job system of its own; threadCount includes the calling thread, so
+    // 1 runs everything inline
+    explicit ThreadPool(unsigned threadCount = std::thread::hardware_concurrency());
+
+    // Runs on jobs, which must outlive the pool
+    explicit ThreadPool(JobSystem& jobs);
+
+    unsigned size() const { return jobs->size(); }
+
+    // Runs body(begin, end) over [0, count) in chunks of grain indices
+    void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+private:
+    std::unique_ptr<JobSystem> owned;
+    JobSystem* jobs;
+};
+
+// Process-wide pool over defaultJobSystem(), created on first use
+ThreadPool& defaultThreadPool();
+
+#endif // __THREADPOOL_H__
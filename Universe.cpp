@@ -0,0 +1,391 @@
+#include "Universe.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+typedef std::chrono::steady_clock Clock;
+
+// Sectors in flight per worker; keeps the queues short so a request made
+// for a ship that has since turned away doesn't hold up the ones it needs now
+const int MaxPendingPerWorker = 4;
+
+static double milliseconds(Clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+
+static uint64_t splitmix64(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1) from the top 24 bits, exact in a float on every platform
+static float unitFloat(uint64_t& state) {
+    return (float)(splitmix64(state) >> 40) * (1.0f / 16777216.0f);
+}
+
+static uint64_t keyBits(const SectorKey& key) {
+    return (uint64_t)key.x * 0x9E3779B97F4A7C15ull ^ (uint64_t)key.y * 0xC2B2AE3D27D4EB4Full
+        ^ (uint64_t)key.z * 0x165667B19E3779F9ull;
+}
+
+
+size_t SectorKeyHash::operator()(const SectorKey& key) const {
+    uint64_t state = keyBits(key);
+    return (size_t)splitmix64(state);
+}
+
+
+size_t Sector::bytes() const {
+    return sizeof(Sector) + bodies.capacity() * sizeof(SectorBody) + (buffer ? count * sizeof(SectorBody) : 0);
+}
+
+
+void generateSector(uint64_t seed, const SectorKey& key, std::vector<SectorBody>& bodies) {
+    bodies.clear();
+    if (key.x == 0 && key.y == 0 && key.z == 0) {
+        return;   // the hand-placed scene
+    }
+    uint64_t state = seed ^ keyBits(key);
+    splitmix64(state);
+    int count = (int)(unitFloat(state) * 2 * SectorBodies);
+    bodies.resize(count);
+
+    // Diameters from 2 to 16, mostly small; every body stays inside its sector
+    const float extent = (float)SectorSize * 0.5f - 8.0f;
+    for (SectorBody& body : bodies) {
+        body.posScale[0] = (unitFloat(state) * 2.0f - 1.0f) * extent;
+        body.posScale[1] = (unitFloat(state) * 2.0f - 1.0f) * extent;
+        body.posScale[2] = (unitFloat(state) * 2.0f - 1.0f) * extent;
+        float size = unitFloat(state);
+        body.posScale[3] = 2.0f + 14.0f * size * size;
+        for (int c = 0; c < 3; c++) {
+            body.color[c] = 0.25f + 0.75f * unitFloat(state);
+        }
+    }
+}
+
+// Generates sector's bodies and its bounds; runs on a worker, or inline without workers
+static void fillSector(uint64_t seed, Sector& sector) {
+    Clock::time_point start = Clock::now();
+    generateSector(seed, sector.key, sector.bodies);
+    float bounds = 0.0f, largest = 0.0f;
+    for (const SectorBody& body : sector.bodies) {
+        float radius = body.posScale[3] * 0.5f;
+        float reach = length(vec3(body.posScale[0], body.posScale[1], body.posScale[2])) + radius;
+        bounds = std::max(bounds, reach);
+        largest = std::max(largest, radius);
+    }
+    sector.boundingRadius = bounds;
+    sector.bodyRadius = largest;
+    sector.generateMs = milliseconds(Clock::now() - start);
+}
+
+
+// Offsets of the cube of sectors within radius, nearest first
+static std::vector<SectorKey> cubeOffsets(int radius) {
+    std::vector<SectorKey> offsets;
+    for (int z = -radius; z <= radius; z++) {
+        for (int y = -radius; y <= radius; y++) {
+            for (int x = -radius; x <= radius; x++) {
+                offsets.push_back({ x, y, z });
+            }
+        }
+    }
+    std::stable_sort(offsets.begin(), offsets.end(), [](const SectorKey& a, const SectorKey& b) {
+        return a.x * a.x + a.y * a.y + a.z * a.z < b.x * b.x + b.y * b.y + b.z * b.z;
+    });
+    return offsets;
+}
+
+static const std::vector<SectorKey> viewOffsets = cubeOffsets(SectorViewRadius);
+static const std::vector<SectorKey> prefetchOffsets = cubeOffsets(PrefetchRadius);
+
+static SectorKey offsetKey(const SectorKey& key, const SectorKey& offset) {
+    return { key.x + offset.x, key.y + offset.y, key.z + offset.z };
+}
+
+
+void Universe::start(uint64_t universeSeed, const dvec3& sceneAnchor, int workerCount, size_t budgetBytes) {
+    stop();
+    seed = universeSeed;
+    anchor = sceneAnchor;
+    budget = budgetBytes;
+    stats = UniverseStats();
+    refresh = true;
+    quit = false;
+    for (int i = 0; i < workerCount; i++) {
+        workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+    for (std::unique_ptr<Worker>& worker : workers) {
+        worker->thread = std::thread(&Universe::runWorker, this, std::ref(*worker));
+    }
+    started = true;
+}
+
+
+void Universe::stop() {
+    quit = true;
+    for (std::unique_ptr<Worker>& worker : workers) {
+        worker->thread.join();
+    }
+    workers.clear();
+    pending = 0;
+    sectors.clear();
+    lru.clear();
+    uploads.clear();
+    drawn.clear();
+    missing.clear();
+    started = false;
+}
+
+
+void Universe::release() {
+    for (auto& entry : sectors) {
+        Sector& sector = *entry.second;
+        if (sector.buffer) {
+            glDeleteBuffers(1, &sector.buffer);
+            sector.buffer = 0;
+        }
+    }
+}
+
+
+void Universe::runWorker(Worker& worker) {
+    while (!quit.load(std::memory_order_relaxed)) {
+        Sector* sector;
+        if (!worker.requests.pop(sector)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        fillSector(seed, *sector);
+        // Never more in flight than the ring holds, so this doesn't spin in practice
+        while (!worker.results.push(sector)) {
+            if (quit.load(std::memory_order_relaxed)) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+    }
+}
+
+
+SectorKey Universe::sectorAt(const dvec3& world) const {
+    dvec3 local = (world - anchor) * (1.0 / SectorSize);
+    return { (int64_t)std::floor(local.x + 0.5), (int64_t)std::floor(local.y + 0.5), (int64_t)std::floor(local.z + 0.5) };
+}
+
+
+void Universe::update(const SimState& state) {
+    Clock::time_point start = Clock::now();
+    UniverseStats before = stats;
+
+    for (std::unique_ptr<Worker>& worker : workers) {
+        Sector* sector;
+        while (worker->results.pop(sector)) {
+            pending--;
+            finished(sector);
+        }
+    }
+
+    // Prefetch around where the ship will be at its current speed
+    const dvec3& ship = state.shipPosition;
+    vec3 heading = state.isPaused ? vec3(0.0f, 0.0f, 0.0f) : state.shipDirection;
+    dvec3 ahead = ship + dvec3(heading * (float)(state.shipSpeed * PrefetchSeconds / SimTimestep));
+    SectorKey shipKey = sectorAt(ship), aheadKey = sectorAt(ahead);
+    if (refresh || !(shipKey == lastShip) || !(aheadKey == lastAhead)) {
+        refreshWanted(ship, heading, shipKey, aheadKey);
+    }
+
+    size_t requested = 0;
+    int capacity = (int)workers.size() * MaxPendingPerWorker;
+    while (requested < missing.size() && (workers.empty() || pending < capacity)) {
+        request(missing[requested++].second);
+    }
+    missing.erase(missing.begin(), missing.begin() + requested);
+
+    // Nearest first, a few per frame
+    std::sort(uploads.begin(), uploads.end(), [&ship](const Sector* a, const Sector* b) {
+        return length(a->center - ship) < length(b->center - ship);
+    });
+    size_t uploadBytes = 0, uploaded = 0;
+    while (uploaded < uploads.size() && uploaded < (size_t)SectorUploadsPerFrame && uploadBytes < SectorUploadBytesPerFrame) {
+        Sector* sector = uploads[uploaded++];
+        uploadBytes += sector->bodies.size() * sizeof(SectorBody);
+        upload(sector);
+    }
+    uploads.erase(uploads.begin(), uploads.begin() + uploaded);
+
+    evict();
+
+    drawn.clear();
+    for (const SectorKey& offset : viewOffsets) {
+        auto found = sectors.find(offsetKey(shipKey, offset));
+        if (found != sectors.end() && found->second->state == SECTOR_UPLOADED && found->second->count > 0) {
+            drawn.push_back(found->second.get());
+        }
+    }
+
+    stats.resident = (int)lru.size();
+    stats.generating = pending;
+    stats.drawable = (int)drawn.size();
+    stats.peakBytes = std::max(stats.peakBytes, stats.bytes);
+    double ms = milliseconds(Clock::now() - start);
+    stats.lastUpdateMs = ms;
+    stats.worstUpdateMs = std::max(stats.worstUpdateMs, ms);
+    stats.totalUpdateMs += ms;
+    stats.updates++;
+    if (ms > StreamHitchMs) {
+        stats.hitches++;
+        if (reportHitches) {
+            fprintf(stderr, "universe: streaming took %.2f ms in frame %llu (%d generated, %d uploaded, %d evicted)\n",
+                ms, (unsigned long long)stats.updates, (int)(stats.generated - before.generated),
+                (int)(stats.uploaded - before.uploaded), (int)(stats.evicted - before.evicted));
+        }
+    }
+}
+
+
+// Marks every sector in view or in the prefetch cube as wanted now, moves
+// the resident ones to the front of the cache and lists the rest in the
+// order to request them
+void Universe::refreshWanted(const dvec3& ship, const vec3& heading, const SectorKey& shipKey, const SectorKey& aheadKey) {
+    epoch++;
+    missing.clear();
+    for (const SectorKey& offset : viewOffsets) {
+        want(offsetKey(shipKey, offset), ship, heading);
+    }
+    for (const SectorKey& offset : prefetchOffsets) {
+        SectorKey key = offsetKey(aheadKey, offset);
+        if (std::max({ std::llabs(key.x - shipKey.x), std::llabs(key.y - shipKey.y), std::llabs(key.z - shipKey.z) }) > SectorViewRadius) {
+            want(key, ship, heading);
+        }
+    }
+    std::stable_sort(missing.begin(), missing.end(),
+        [](const std::pair<double, SectorKey>& a, const std::pair<double, SectorKey>& b) { return a.first < b.first; });
+    lastShip = shipKey;
+    lastAhead = aheadKey;
+    refresh = false;
+}
+
+
+void Universe::want(const SectorKey& key, const dvec3& ship, const vec3& heading) {
+    auto found = sectors.find(key);
+    if (found != sectors.end()) {
+        Sector* sector = found->second.get();
+        sector->wanted = epoch;
+        if (sector->state != SECTOR_GENERATING) {
+            lru.splice(lru.begin(), lru, sector->lru);
+        }
+        return;
+    }
+    // Sectors ahead of the ship count as nearer than those behind it
+    dvec3 toSector = anchor + dvec3(key.x * SectorSize, key.y * SectorSize, key.z * SectorSize) - ship;
+    double priority = length(toSector) - 0.5 * (toSector.x * heading.x + toSector.y * heading.y + toSector.z * heading.z);
+    missing.push_back(std::make_pair(priority, key));
+}
+
+
+void Universe::request(const SectorKey& key) {
+    Sector* sector = new Sector();
+    sectors[key].reset(sector);
+    sector->key = key;
+    sector->center = anchor + dvec3(key.x * SectorSize, key.y * SectorSize, key.z * SectorSize);
+    sector->wanted = epoch;
+    stats.requested++;
+
+    if (workers.empty()) {
+        fillSector(seed, *sector);
+        finished(sector);
+        return;
+    }
+    for (size_t tries = 0; tries < workers.size(); tries++) {
+        Worker& worker = *workers[nextWorker];
+        nextWorker = (nextWorker + 1) % workers.size();
+        if (worker.requests.push(sector)) {
+            pending++;
+            return;
+        }
+    }
+    // Every ring full (more in flight than they hold); forget it and ask again later
+    sectors.erase(key);
+    refresh = true;
+}
+
+
+void Universe::finished(Sector* sector) {
+    sector->state = SECTOR_GENERATED;
+    lru.push_front(sector);
+    sector->lru = lru.begin();
+    uploads.push_back(sector);
+    stats.generated++;
+    stats.workerMs += sector->generateMs;
+    stats.bytes += sector->bytes();
+}
+
+
+// Copies the bodies into a buffer of their own
+void Universe::upload(Sector* sector) {
+    size_t before = sector->bytes();
+    sector->count = (GLsizei)sector->bodies.size();
+    if (sector->count > 0) {
+        glGenBuffers(1, &sector->buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, sector->buffer);
+        glBufferData(GL_ARRAY_BUFFER, sector->count * sizeof(SectorBody), &sector->bodies[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    sector->state = SECTOR_UPLOADED;
+    stats.bytes = stats.bytes - before + sector->bytes();
+    stats.uploaded++;
+}
+
+
+// Drops the least recently wanted sectors until the cache fits the budget;
+// sectors wanted right now stay even when they alone exceed it
+void Universe::evict() {
+    for (auto it = lru.end(); it != lru.begin() && stats.bytes > budget;) {
+        --it;
+        Sector* sector = *it;
+        if (sector->wanted == epoch) {
+            continue;
+        }
+        // Counted before the buffer goes, while bytes() still includes it
+        size_t freed = sector->bytes();
+        if (sector->buffer) {
+            glDeleteBuffers(1, &sector->buffer);
+            sector->buffer = 0;
+        }
+        if (sector->state == SECTOR_GENERATED) {
+            uploads.erase(std::find(uploads.begin(), uploads.end(), sector));
+        }
+        stats.bytes -= freed;
+        stats.evicted++;
+        it = lru.erase(it);
+        SectorKey key = sector->key;
+        sectors.erase(key);
+    }
+}
+
+
+void Universe::printSummary() const {
+    if (!started) {
+        return;
+    }
+    char where[32];
+    if (workers.empty()) {
+        snprintf(where, sizeof(where), "the render thread");
+    }
+    else {
+        snprintf(where, sizeof(where), "%d worker%s", (int)workers.size(), workers.size() == 1 ? "" : "s");
+    }
+    printf("universe: %llu sectors generated (%.3f ms each on %s), %llu uploaded, %llu evicted; %.2f MB peak of a %.2f MB budget\n",
+        (unsigned long long)stats.generated, stats.generated ? stats.workerMs / stats.generated : 0.0, where,
+        (unsigned long long)stats.uploaded, (unsigned long long)stats.evicted, stats.peakBytes / 1048576.0, budget / 1048576.0);
+    printf("universe: streaming on the render thread %.3f ms per frame, worst %.3f ms, %llu frames over %.0f ms\n",
+        stats.updates ? stats.totalUpdateMs / stats.updates : 0.0, stats.worstUpdateMs,
+        (unsigned long long)stats.hitches, StreamHitchMs);
+}
@@ -0,0 +1,190 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- Universe.h ---
+//
+//   A seeded procedural universe streamed in around the ship.  Space is cut
+//   into cubic sectors on a grid centered on the scene anchor; the bodies
+//   of a sector are a pure function of the seed and the sector's
+//   coordinates, so a sector can be dropped and regenerated at will and
+//   always comes back the same.  The anchor's own sector is left to the
+//   hand-placed scene.
+//
+//   Each frame the render thread asks for the sectors within
+//   SectorViewRadius of the ship and, for prefetch, those around where the
+//   ship will be PrefetchSeconds from now at its current heading and speed.
+//   Missing sectors are queued to background workers, nearest and most
+//   ahead first; finished ones come back through lock-free queues, are
+//   uploaded into their own instance buffers a few at a time per frame,
+//   and sit in an LRU cache that drops the least recently wanted
+//   sectors once over the memory budget.  The render thread never waits on
+//   a worker; update() times itself and reports any frame where streaming
+//   took longer than StreamHitchMs.
+//
+//   Bodies are floats relative to their sector's center, a double world
+//   position, so a whole sector is drawn with one camera-relative offset
+//   (see WorldSpace.h) however far out it is.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __UNIVERSE_H__
+#define __UNIVERSE_H__
+
+#include <GL/glew.h>
+#include "Angel.h"
+#include "LockFree.h"
+#include "Simulation.h"
+#include "SphereLOD.h"
+#include "WorldSpace.h"
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Edge of a sector in world units
+const double SectorSize = 500.0;
+
+// Sectors drawn around the ship's, in each direction
+const int SectorViewRadius = 2;
+
+// How far ahead prefetch looks, and how many sectors around that point it keeps
+const double PrefetchSeconds = 4.0;
+const int PrefetchRadius = 1;
+
+// Average bodies per sector
+const int SectorBodies = 24;
+
+// Sector uploads per frame stop after this many sectors or bytes (but always do one)
+const int SectorUploadsPerFrame = 8;
+const size_t SectorUploadBytesPerFrame = 256 * 1024;
+
+// Frames whose streaming work on the render thread took longer are reported
+const double StreamHitchMs = 1.0;
+
+// Same layout as the scene's planet instances, so the same attributes read it
+struct SectorBody {
+    GLfloat posScale[4];   // center relative to the sector's, and diameter
+    GLfloat color[3];
+};
+
+struct SectorKey {
+    int64_t x, y, z;
+
+    bool operator==(const SectorKey& other) const { return x == other.x && y == other.y && z == other.z; }
+};
+
+struct SectorKeyHash {
+    size_t operator()(const SectorKey& key) const;
+};
+
+enum SectorState {
+    SECTOR_GENERATING,   // queued to or being filled by a worker
+    SECTOR_GENERATED,    // bodies ready, waiting for an upload slot
+    SECTOR_UPLOADED      // drawable
+};
+
+struct Sector {
+    SectorKey key;
+    dvec3 center;                       // world space
+    std::vector<SectorBody> bodies;     // written by the worker, then read-only
+    float boundingRadius = 0.0f;        // around center, covering every body
+    float bodyRadius = 0.0f;            // of the largest body
+    double generateMs = 0.0;
+    SectorState state = SECTOR_GENERATING;   // only the render thread reads or writes it
+    GLuint buffer = 0;
+    GLsizei count = 0;                  // bodies in buffer
+    unsigned char level = SphereLODUnset;   // last level of detail drawn, for hysteresis
+    std::vector<unsigned char> bodyLevels;  // the same per body, when drawn body by body
+    uint64_t wanted = 0;                // last wanted set this sector was in
+    std::list<Sector*>::iterator lru;   // position in the cache, once generated
+
+    size_t bytes() const;               // CPU and GPU memory held
+};
+
+struct UniverseStats {
+    int resident = 0;               // sectors generated or uploaded
+    int generating = 0;
+    int drawable = 0;               // uploaded and within the view radius
+    uint64_t requested = 0, generated = 0, uploaded = 0, evicted = 0;
+    size_t bytes = 0, peakBytes = 0;
+    double workerMs = 0.0;          // generation time summed over sectors
+    double lastUpdateMs = 0.0, worstUpdateMs = 0.0, totalUpdateMs = 0.0;
+    uint64_t updates = 0, hitches = 0;
+};
+
+// Fills bodies with the sector's contents for seed; pure, so any thread may call it
+void generateSector(uint64_t seed, const SectorKey& key, std::vector<SectorBody>& bodies);
+
+class Universe {
+public:
+    ~Universe() { stop(); }
+
+    // Starts streaming sectors for seed around anchor on the given number
+    // of worker threads, keeping at most budgetBytes of them cached; with
+    // no workers, missing sectors are generated inside update(), on the
+    // render thread, for comparison
+    void start(uint64_t seed, const dvec3& anchor, int workers, size_t budgetBytes);
+
+    // Joins the workers and forgets every sector; release() first to free their buffers
+    void stop();
+
+    // Deletes every sector's buffer; needs the GL context
+    void release();
+
+    bool running() const { return started; }
+
+    // Render thread, once per frame before drawing: collects finished
+    // sectors, requests missing ones, uploads and evicts.  Never waits on
+    // a worker.
+    void update(const SimState& state);
+
+    // Uploaded sectors within the view radius of the ship, nearest first;
+    // their bodies stay readable for per-body level of detail up close
+    const std::vector<Sector*>& drawable() const { return drawn; }
+
+    SectorKey sectorAt(const dvec3& world) const;
+
+    // Sectors, memory, worker time and hitches
+    void printSummary() const;
+
+    UniverseStats stats;
+    bool reportHitches = true;      // print every hitch to stderr as it happens
+
+private:
+    struct Worker {
+        SpscQueue<Sector*, 64> requests, results;
+        std::thread thread;
+    };
+
+    void runWorker(Worker& worker);
+    void refreshWanted(const dvec3& ship, const vec3& heading, const SectorKey& shipKey, const SectorKey& aheadKey);
+    void want(const SectorKey& key, const dvec3& ship, const vec3& heading);
+    void request(const SectorKey& key);
+    void finished(Sector* sector);
+    void upload(Sector* sector);
+    void evict();
+
+    uint64_t seed = 0;
+    dvec3 anchor;
+    size_t budget = 0;
+    bool started = false;
+    std::atomic<bool> quit{ false };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    size_t nextWorker = 0;
+    int pending = 0;                // requests not yet back
+
+    std::unordered_map<SectorKey, std::unique_ptr<Sector>, SectorKeyHash> sectors;
+    std::list<Sector*> lru;         // generated sectors, most recently wanted first
+    std::vector<Sector*> uploads;   // generated, waiting for upload, nearest first
+    std::vector<Sector*> drawn;
+
+    uint64_t epoch = 0;             // bumped whenever the wanted set is recomputed
+    SectorKey lastShip = { 0, 0, 0 }, lastAhead = { 0, 0, 0 };
+    bool refresh = true;            // the wanted set needs recomputing
+    std::vector<std::pair<double, SectorKey>> missing;   // wanted but not requested yet, by priority
+};
+
+#endif // __UNIVERSE_H__
@@ -0,0 +1,60 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- WorldSpace.h ---
+//
+//   Double-precision world positions and the float frames they are drawn
+//   in.  Whatever may be anywhere in a solar-system-sized world (the ship,
+//   the camera, the anchor of the scene) is a dvec3.  Whatever comes in
+//   batches (planets, gravity bodies, fleet ships, collision bodies, point
+//   lights) stays in floats relative to the scene anchor, near which it
+//   all lives, so the hot loops never touch a double.
+//
+//   Every frame the renderer rebases around the camera: the camera sits at
+//   the float origin, a world position becomes float(position - eye) with
+//   the subtraction done in double, and a whole batch moves by a single
+//   offset, float(anchor - eye).  What is near the camera then has small
+//   float coordinates, precise however far from the world origin the
+//   camera has gone.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __WORLDSPACE_H__
+#define __WORLDSPACE_H__
+
+#include "Angel.h"
+#include <cmath>
+
+struct dvec3 {
+    double x, y, z;
+
+    dvec3(double s = 0.0) : x(s), y(s), z(s) {}
+    dvec3(double x, double y, double z) : x(x), y(y), z(z) {}
+    explicit dvec3(const vec3& v) : x(v.x), y(v.y), z(v.z) {}
+
+    dvec3 operator+(const dvec3& v) const { return dvec3(x + v.x, y + v.y, z + v.z); }
+    dvec3 operator-(const dvec3& v) const { return dvec3(x - v.x, y - v.y, z - v.z); }
+    dvec3 operator*(double s) const { return dvec3(x * s, y * s, z * s); }
+    dvec3& operator+=(const dvec3& v) { x += v.x; y += v.y; z += v.z; return *this; }
+};
+
+inline vec3 toFloat(const dvec3& v) {
+    return vec3((GLfloat)v.x, (GLfloat)v.y, (GLfloat)v.z);
+}
+
+inline double length(const dvec3& v) {
+    return std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+}
+
+// One frame's rebase around the camera
+struct CameraOrigin {
+    dvec3 eye;          // the camera in world space
+    vec3 sceneOffset;   // the scene anchor relative to the camera
+
+    CameraOrigin() {}
+    CameraOrigin(const dvec3& eye, const dvec3& sceneAnchor) : eye(eye), sceneOffset(toFloat(sceneAnchor - eye)) {}
+
+    // A world position relative to the camera
+    vec3 relative(const dvec3& world) const { return toFloat(world - eye); }
+};
+
+#endif // __WORLDSPACE_H__
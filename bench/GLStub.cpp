@@ -0,0 +1,36 @@
+#include "GLStub.h"
+
+GLStubCounts glStubCounts;
+
+
+// One no-op per signature, found from the type of GLEW's function pointer,
+// so GLEW versions that disagree about const in a prototype still match
+template <uint64_t GLStubCounts::*Counter, typename... Args>
+static void GLAPIENTRY countCall(Args...) {
+    (glStubCounts.*Counter)++;
+}
+
+template <uint64_t GLStubCounts::*Counter, typename... Args>
+static void install(void (GLAPIENTRY*& entry)(Args...)) {
+    entry = countCall<Counter, Args...>;
+}
+
+
+void installGLStubs() {
+    install<&GLStubCounts::programs>(__glewUseProgram);
+    install<&GLStubCounts::vertexArrays>(__glewBindVertexArray);
+    install<&GLStubCounts::uniforms>(__glewUniform1i);
+    install<&GLStubCounts::uniforms>(__glewUniform3fv);
+    install<&GLStubCounts::uniforms>(__glewUniformMatrix4fv);
+    install<&GLStubCounts::draws>(__glewDrawElementsBaseVertex);
+    install<&GLStubCounts::draws>(__glewDrawElementsInstancedBaseVertex);
+    install<&GLStubCounts::buffers>(__glewGenVertexArrays);
+    install<&GLStubCounts::buffers>(__glewGenBuffers);
+    install<&GLStubCounts::buffers>(__glewBindBuffer);
+    install<&GLStubCounts::buffers>(__glewBufferData);
+    install<&GLStubCounts::buffers>(__glewBufferSubData);
+    install<&GLStubCounts::buffers>(__glewVertexAttribPointer);
+    install<&GLStubCounts::buffers>(__glewEnableVertexAttribArray);
+    install<&GLStubCounts::buffers>(__glewDeleteVertexArrays);
+    install<&GLStubCounts::buffers>(__glewDeleteBuffers);
+}
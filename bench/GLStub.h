@@ -0,0 +1,34 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- GLStub.h ---
+//
+//   Stubbed GL layer for the benchmarks.  installGLStubs() points GLEW's
+//   entry points for everything the mesh upload and the render queue's
+//   backend call at no-op functions that only count, so the engine's own
+//   draw code runs unchanged without a context and the benchmark measures
+//   the CPU side alone.  glLineWidth isn't a GLEW pointer (it is GL 1.0);
+//   the GL library drops it, like any call made without a current context.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef __GLSTUB_H__
+#define __GLSTUB_H__
+
+#include <GL/glew.h>
+#include <stdint.h>
+
+struct GLStubCounts {
+    uint64_t programs = 0;       // glUseProgram
+    uint64_t vertexArrays = 0;   // glBindVertexArray
+    uint64_t uniforms = 0;       // glUniform*
+    uint64_t draws = 0;          // glDrawElements*
+    uint64_t buffers = 0;        // buffer and vertex format setup
+
+    uint64_t calls() const { return programs + vertexArrays + uniforms + draws + buffers; }
+};
+
+extern GLStubCounts glStubCounts;
+
+void installGLStubs();
+
+#endif // __GLSTUB_H__
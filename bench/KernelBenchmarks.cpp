@@ -0,0 +1,278 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- KernelBenchmarks.cpp ---
+//
+//   Microbenchmarks of the engine's per-frame and startup kernels, run
+//   without a window or GL context:
+//
+//       mesh generation    generateSphere/generateTorus by tessellation,
+//                          on one thread and on the default pool
+//       vertex encoding    interleaving and packing a mesh for the arena
+//       frame matrices     the view, projection and per-object chain of
+//                          renderScene, Angel's mat4 against Simd::Mat4
+//       scene graph        the ship and station moving every frame
+//       camera             cameraLookAt plus LookAt for every view
+//       draw list          recording, sorting and issuing the scene
+//                          through the render queue into the GL stub
+//
+//   Write JSON for tracking with
+//       majortom_bench --benchmark_out=benchmarks.json --benchmark_out_format=json
+//   or build the run_benchmarks target.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <benchmark/benchmark.h>
+#include "GLStub.h"
+#include "Camera.h"
+#include "MeshGenerators.h"
+#include "MeshRegistry.h"
+#include "RenderQueue.h"
+#include "SceneGraph.h"
+#include "ShaderProgram.h"
+#include "SimdMath.h"
+#include "ThreadPool.h"
+#include <random>
+#include <vector>
+
+
+// Arg 0: bands (both directions); arg 1: threads, 0 for the default pool
+static void BM_GenerateSphere(benchmark::State& state) {
+    int bands = (int)state.range(0);
+    ThreadPool single(1);
+    ThreadPool& pool = state.range(1) == 1 ? single : defaultThreadPool();
+    for (auto _ : state) {
+        Mesh mesh = generateSphere(0.5f, bands, bands, pool);
+        benchmark::DoNotOptimize(mesh.vertices.data());
+    }
+    state.SetItemsProcessed(state.iterations() * (int64_t)sphereVertexCount(bands, bands));
+}
+BENCHMARK(BM_GenerateSphere)->ArgsProduct({ { 16, 64, 256, 1024 }, { 1, 0 } })->Unit(benchmark::kMicrosecond);
+
+// Arg 0: major segments, minor is half of it; arg 1 as above
+static void BM_GenerateTorus(benchmark::State& state) {
+    int major = (int)state.range(0), minor = major / 2;
+    ThreadPool single(1);
+    ThreadPool& pool = state.range(1) == 1 ? single : defaultThreadPool();
+    for (auto _ : state) {
+        Mesh mesh = generateTorus(2.5f, 0.7f, major, minor, pool);
+        benchmark::DoNotOptimize(mesh.vertices.data());
+    }
+    state.SetItemsProcessed(state.iterations() * (int64_t)torusVertexCount(major, minor));
+}
+BENCHMARK(BM_GenerateTorus)->ArgsProduct({ { 32, 128, 512, 2048 }, { 1, 0 } })->Unit(benchmark::kMicrosecond);
+
+
+// Arg 0: sphere bands; arg 1: VertexFormat
+static void BM_EncodeMesh(benchmark::State& state) {
+    int bands = (int)state.range(0);
+    VertexFormat format = (VertexFormat)state.range(1);
+    Mesh mesh = generateSphere(0.5f, bands, bands);
+    std::vector<unsigned char> vertexBytes, indexBytes;
+    for (auto _ : state) {
+        encodeMesh(mesh, format, vertexBytes, indexBytes);
+        benchmark::DoNotOptimize(vertexBytes.data());
+        benchmark::DoNotOptimize(indexBytes.data());
+    }
+    state.SetBytesProcessed(state.iterations() * (int64_t)(vertexBytes.size() + indexBytes.size()));
+    state.SetLabel(format == VERTEX_PACKED ? "packed" : "float");
+}
+BENCHMARK(BM_EncodeMesh)->ArgsProduct({ { 30, 256, 1024 }, { VERTEX_FLOAT, VERTEX_PACKED } })->Unit(benchmark::kMicrosecond);
+
+
+// The ship and station poses renderScene sees, turning a little every frame
+struct FramePose {
+    vec3 shipPosition = vec3(1.0f, 10.0f, 5.0f);
+    float shipAngle = 0.0f, stationAngle = 0.0f;
+
+    void advance() {
+        shipAngle += 0.7f;
+        stationAngle += 2.0f;
+        shipPosition += vec3(0.02f, 0.01f, 0.0f);
+    }
+};
+
+// Per frame: view, projection, their product for culling, then the ship
+// hull, nose, station body and nose model matrices, each times the view
+static void BM_FrameMatricesAngel(benchmark::State& state) {
+    FramePose pose;
+    vec4 eye(0.0f, -5.0f, 6.0f, 1.0f), at(1.0f, 10.0f, 5.0f, 1.0f), up(0.0f, 0.0f, 1.0f, 0.0f);
+    for (auto _ : state) {
+        pose.advance();
+        mat4 view = LookAt(eye, at, up);
+        mat4 projection = Perspective(45.0f, 800.0f / 600.0f, 0.1f, 5000.0f);
+        mat4 viewProjection = projection * view;
+        mat4 ship = Translate(pose.shipPosition) * RotateZ(pose.shipAngle);
+        mat4 station = Translate(100.0f, 10.0f, 10.0f) * RotateZ(pose.stationAngle);
+        mat4 models[5] = { ship * RotateX(90), ship * RotateY(90), ship * Translate(3.0f, 0.0f, 0.0f) * Scale(2.5f, 2.5f, 2.5f),
+            station * Scale(20.0f, 20.0f, 20.0f), station * Translate(0.0f, 20.0f, 0.0f) * Scale(4.0f, 4.0f, 4.0f) };
+        for (mat4& model : models) {
+            model = view * model;
+        }
+        benchmark::DoNotOptimize(viewProjection);
+        benchmark::DoNotOptimize(models);
+    }
+}
+BENCHMARK(BM_FrameMatricesAngel);
+
+static void BM_FrameMatricesSimd(benchmark::State& state) {
+    FramePose pose;
+    vec4 eye(0.0f, -5.0f, 6.0f, 1.0f), at(1.0f, 10.0f, 5.0f, 1.0f), up(0.0f, 0.0f, 1.0f, 0.0f);
+    for (auto _ : state) {
+        pose.advance();
+        Simd::Mat4 view = Simd::LookAt(eye, at, up);
+        Simd::Mat4 projection = Simd::Perspective(45.0f, 800.0f / 600.0f, 0.1f, 5000.0f);
+        Simd::Mat4 viewProjection = projection * view;
+        Simd::Mat4 ship = Simd::Translate(pose.shipPosition.x, pose.shipPosition.y, pose.shipPosition.z) * Simd::RotateZ(pose.shipAngle);
+        Simd::Mat4 station = Simd::Translate(100.0f, 10.0f, 10.0f) * Simd::RotateZ(pose.stationAngle);
+        Simd::Mat4 models[5] = { ship * Simd::RotateX(90), ship * Simd::RotateY(90),
+            ship * Simd::Translate(3.0f, 0.0f, 0.0f) * Simd::Scale(2.5f, 2.5f, 2.5f),
+            station * Simd::Scale(20.0f, 20.0f, 20.0f), station * Simd::Translate(0.0f, 20.0f, 0.0f) * Simd::Scale(4.0f, 4.0f, 4.0f) };
+        for (Simd::Mat4& model : models) {
+            model = view * model;
+        }
+        benchmark::DoNotOptimize(viewProjection);
+        benchmark::DoNotOptimize(models);
+    }
+}
+BENCHMARK(BM_FrameMatricesSimd);
+
+
+// The scene's hierarchy as main.cpp builds it
+struct SceneNodes {
+    SceneGraph graph;
+    int ship, hulls[2], nose, station, body, stationNose, ground;
+
+    SceneNodes() {
+        ship = graph.add(SceneGraph::Root);
+        hulls[0] = graph.add(ship, Simd::RotateX(90));
+        hulls[1] = graph.add(ship, Simd::RotateY(90));
+        nose = graph.add(ship, Simd::Translate(3.0f, 0.0f, 0.0f) * Simd::Scale(2.5f, 2.5f, 2.5f));
+        station = graph.add(SceneGraph::Root);
+        body = graph.add(station, Simd::Scale(20.0f, 20.0f, 20.0f));
+        stationNose = graph.add(station, Simd::Translate(0.0f, 20.0f, 0.0f) * Simd::Scale(4.0f, 4.0f, 4.0f));
+        ground = graph.add(SceneGraph::Root, Simd::Translate(0.0f, 0.0f, -5.0f) * Simd::RotateX(-90) * Simd::Scale(200.0f, 200.0f, 1.0f));
+        graph.update();
+    }
+
+    void move(const FramePose& pose) {
+        graph.setLocal(ship, Simd::Translate(pose.shipPosition.x, pose.shipPosition.y, pose.shipPosition.z) * Simd::RotateZ(pose.shipAngle));
+        graph.setLocal(station, Simd::Translate(100.0f, 10.0f, 10.0f) * Simd::RotateZ(pose.stationAngle));
+        graph.update();
+    }
+};
+
+// Arg 0: 1 when the ship and station move every frame, 0 when paused
+static void BM_SceneGraphUpdate(benchmark::State& state) {
+    SceneNodes scene;
+    FramePose pose;
+    bool moving = state.range(0) != 0;
+    for (auto _ : state) {
+        if (moving) {
+            pose.advance();
+        }
+        scene.move(pose);
+        benchmark::DoNotOptimize(scene.graph.world(scene.nose));
+    }
+    state.SetLabel(moving ? "moving" : "paused");
+}
+BENCHMARK(BM_SceneGraphUpdate)->Arg(1)->Arg(0);
+
+
+// Arg 0: CameraView.  Interpolates the state the way the renderer does,
+// places the camera, rebases around it and builds the view matrix.
+static void BM_UpdateCamera(benchmark::State& state) {
+    CameraView view = (CameraView)state.range(0);
+    SimState previous, current;
+    simulationStep(current);
+    previous = current;
+    dvec3 sceneAnchor;
+    float alpha = 0.0f;
+    for (auto _ : state) {
+        alpha = alpha >= 1.0f ? 0.0f : alpha + 0.01f;
+        SimState blended = interpolateStates(previous, current, alpha);
+        dvec3 eye, at;
+        vec3 up;
+        cameraLookAt(view, blended, sceneAnchor, eye, at, up);
+        CameraOrigin origin(eye, sceneAnchor);
+        Simd::Mat4 matrix = Simd::LookAt(vec4(0.0f, 0.0f, 0.0f, 1.0f), vec4(origin.relative(at), 1.0f), vec4(up, 0.0f))
+            * Simd::Translate(origin.sceneOffset);
+        benchmark::DoNotOptimize(matrix);
+    }
+    const char* names[] = { "control desk", "front station", "behind ship", "top view" };
+    state.SetLabel(names[view]);
+}
+BENCHMARK(BM_UpdateCamera)->DenseRange(CONTROL_DESK, TOP_VIEW);
+
+
+// Arg 0: planets drawn per object.  Per frame: moves the ship and station,
+// records the ship, station, ground and planets into the render queue as
+// renderScene's per-object path does, sorts the packets and issues them
+// into the GL stub.  Counters are per frame.
+static void BM_DrawList(benchmark::State& state) {
+    installGLStubs();
+    size_t planets = (size_t)state.range(0);
+
+    // Only the mesh ranges matter to the queue, so small spheres stand in
+    // for the tetrahedron and the ground square that main.cpp builds inline
+    MeshRegistry meshes;
+    int torus = meshes.add(generateTorus(2.5f, 0.7f, 40, 20));
+    int tetra = meshes.add(generateSphere(0.5f, 2, 3));
+    int sphere = meshes.add(generateSphere(0.5f, 30, 30));
+    int ground = meshes.add(generateSphere(0.5f, 1, 4));
+    meshes.upload(VERTEX_PACKED);
+
+    // Lit and unlit variants, as main.cpp has
+    ShaderProgram program, unlitProgram;
+    program.modelLoc = unlitProgram.modelLoc = 0;
+    program.objectColorLoc = unlitProgram.objectColorLoc = 1;
+    RenderBackend backend;
+    backend.programs.push_back(&program);
+    backend.programs.push_back(&unlitProgram);
+    backend.arenas.push_back(&meshes);
+    backend.lineWidth = 4.0f;
+
+    std::mt19937 rng(1969);
+    std::uniform_real_distribution<float> coordinate(0.0f, 200.0f), size(2.0f, 30.0f), channel(0.0f, 1.0f);
+    std::vector<Simd::Mat4> planetModels;
+    std::vector<vec3> planetColors;
+    for (size_t i = 0; i < planets; i++) {
+        float scale = size(rng);
+        planetModels.push_back(Simd::Translate(coordinate(rng), coordinate(rng), coordinate(rng) * 0.2f) * Simd::Scale(scale, scale, scale));
+        planetColors.push_back(vec3(channel(rng), channel(rng), channel(rng)));
+    }
+
+    SceneNodes scene;
+    FramePose pose;
+    RenderQueue queue;
+    GLStubCounts before = glStubCounts;
+    for (auto _ : state) {
+        pose.advance();
+        scene.move(pose);
+
+        queue.clear();
+        RenderBucket& bucket = queue.bucket(0);
+        bucket.submit(0, 0, torus, Material(vec3(1.0f, 0.5f, 0.0f)), scene.graph.world(scene.hulls[0]));
+        bucket.submit(0, 0, torus, Material(vec3(0.5f, 1.0f, 0.0f)), scene.graph.world(scene.hulls[1]));
+        bucket.submit(0, 0, tetra, Material(vec3(1.0f, 0.0f, 0.0f)), scene.graph.world(scene.nose));
+        bucket.submit(1, 0, tetra, Material(vec3(0.0f, 0.0f, 0.0f)), scene.graph.world(scene.nose), RENDER_OUTLINE, GL_LINES);
+        bucket.submit(1, 0, ground, Material(vec3(1.0f, 1.0f, 1.0f)), scene.graph.world(scene.ground));
+        bucket.submit(0, 0, sphere, Material(vec3(0.6f, 0.6f, 0.6f)), scene.graph.world(scene.body));
+        bucket.submit(0, 0, tetra, Material(vec3(1.0f, 0.0f, 0.0f)), scene.graph.world(scene.stationNose));
+        for (size_t i = 0; i < planets; i++) {
+            bucket.submit(0, 0, sphere, Material(planetColors[i]), planetModels[i]);
+        }
+        queue.sort();
+        queue.execute(backend);
+    }
+
+    double frames = (double)state.iterations();
+    state.counters["packets"] = (double)queue.packetCount();
+    state.counters["gl_calls"] = (glStubCounts.calls() - before.calls()) / frames;
+    state.counters["state_changes"] = (double)queue.sorted.changes();
+    state.counters["unsorted_changes"] = (double)queue.unsorted.changes();
+    state.SetItemsProcessed(state.iterations() * (int64_t)queue.packetCount());
+}
+BENCHMARK(BM_DrawList)->Arg(8)->Arg(1000)->Arg(10000)->Unit(benchmark::kMicrosecond);
+
+
+BENCHMARK_MAIN();
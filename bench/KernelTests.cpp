@@ -0,0 +1,413 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- KernelTests.cpp ---
+//
+//   Correctness checks for the kernels the benchmarks time, run without a
+//   window or GL context:
+//
+//       input log          save then load gives back the setup, every
+//                          record and the end checksum
+//       mesh cache         a stored mesh loads back byte for byte as the
+//                          arena would upload it; a wrong key misses
+//       lock-free channels TripleBuffer never goes backwards and ends on
+//                          the last value; SpscQueue delivers every
+//                          message in order across two threads
+//       spatial hash       overlapping pairs found through query() match
+//                          the brute-force pairs, before and after moves
+//       gravity            Barnes-Hut accelerations and a few leapfrog
+//                          steps against direct summation
+//       render queue       the radix sort of packets recorded from four
+//                          threads matches std::stable_sort over the
+//                          buckets merged in order
+//
+//   Prints each failed check and exits nonzero if there was one; ctest
+//   runs it as kernel_tests.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "Collision.h"
+#include "Gravity.h"
+#include "InputLog.h"
+#include "LockFree.h"
+#include "MeshCache.h"
+#include "MeshGenerators.h"
+#include "MeshRegistry.h"
+#include "RenderQueue.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool passed, const char* condition, const char* file, int line) {
+    if (!passed) {
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, condition);
+        failures++;
+    }
+}
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+
+static void testInputLogRoundTrip() {
+    const char* path = "kernel-tests.mtil";
+    InputLog log;
+    log.config.planets = 2000;
+    log.config.fleet = 40;
+    log.config.gravity = true;
+    log.config.collisions = false;
+    log.config.worldOffset[0] = 1e9;
+    log.config.worldOffset[2] = -2.5;
+    // Ticks far apart and repeated, so the varint deltas take several widths
+    const uint64_t ticks[] = { 0, 0, 1, 127, 128, 300, 70000, 70000, 1ull << 40 };
+    int key = 'a';
+    for (uint64_t tick : ticks) {
+        InputEvent event;
+        event.key = key++;
+        event.special = tick % 2 == 1;
+        log.record(tick, event);
+    }
+    log.endTick = (1ull << 40) + 5;
+    log.stateChecksum = 0x7c68c3020e882af6ull;
+    CHECK(log.save(path));
+
+    InputLog loaded;
+    CHECK(loaded.load(path));
+    std::remove(path);
+    CHECK(loaded.config.planets == log.config.planets);
+    CHECK(loaded.config.fleet == log.config.fleet);
+    CHECK(loaded.config.gravity == log.config.gravity);
+    CHECK(loaded.config.collisions == log.config.collisions);
+    CHECK(std::memcmp(loaded.config.worldOffset, log.config.worldOffset, sizeof(log.config.worldOffset)) == 0);
+    CHECK(loaded.endTick == log.endTick);
+    CHECK(loaded.stateChecksum == log.stateChecksum);
+    CHECK(loaded.records.size() == log.records.size());
+    for (size_t i = 0; i < std::min(loaded.records.size(), log.records.size()); i++) {
+        CHECK(loaded.records[i].tick == log.records[i].tick);
+        CHECK(loaded.records[i].event.key == log.records[i].event.key);
+        CHECK(loaded.records[i].event.special == log.records[i].event.special);
+    }
+
+    // A missing file is a failed load (which it reports), not a crash
+    InputLog missing;
+    CHECK(!missing.load(path));
+}
+
+
+static void testMeshCacheStoreLoad() {
+    MeshCache cache("kernel-tests-mesh-cache");
+    Mesh sphere = generateSphere(0.5f, 24, 32);
+    for (VertexFormat format : { VERTEX_FLOAT, VERTEX_PACKED }) {
+        std::vector<unsigned char> vertexBytes, indexBytes;
+        GLenum indexType = encodeMesh(sphere, format, vertexBytes, indexBytes);
+
+        CHECK(cache.store("sphere_test", format, sphere));
+        EncodedMesh loaded;
+        CHECK(cache.load("sphere_test", format, loaded));
+        CHECK(loaded.format == format);
+        CHECK(loaded.indexType == indexType);
+        CHECK(loaded.vertexCount * vertexStride(format) == vertexBytes.size());
+        CHECK(loaded.indexCount * indexSize(indexType) == indexBytes.size());
+        if (loaded.vertexCount * vertexStride(format) == vertexBytes.size()) {
+            CHECK(std::memcmp(loaded.vertices, vertexBytes.data(), vertexBytes.size()) == 0);
+        }
+        if (loaded.indexCount * indexSize(indexType) == indexBytes.size()) {
+            CHECK(std::memcmp(loaded.indices, indexBytes.data(), indexBytes.size()) == 0);
+        }
+
+        EncodedMesh other;
+        CHECK(!cache.load("torus_test", format, other));
+    }
+    CHECK(cache.hits == 2);
+    cache.release();
+    for (VertexFormat format : { VERTEX_FLOAT, VERTEX_PACKED }) {
+        cache.erase("sphere_test", format);
+    }
+    std::remove(cache.directory.c_str());
+}
+
+
+static void testTripleBuffer() {
+    struct Value {
+        int sequence;
+        int payload[64];
+    };
+    const int count = 200000;
+    TripleBuffer<Value> buffer;
+    std::thread producer([&] {
+        for (int i = 1; i <= count; i++) {
+            Value& value = buffer.back();
+            value.sequence = i;
+            std::fill(value.payload, value.payload + 64, i);
+            buffer.publish();
+        }
+    });
+    // Every value taken is complete and newer than the one before it
+    int last = 0;
+    bool torn = false, backwards = false;
+    while (last < count) {
+        if (buffer.update()) {
+            const Value& value = buffer.front();
+            backwards = backwards || value.sequence <= last;
+            torn = torn || value.payload[0] != value.sequence || value.payload[63] != value.sequence;
+            last = value.sequence;
+        }
+    }
+    producer.join();
+    CHECK(!backwards);
+    CHECK(!torn);
+    CHECK(last == count);
+    CHECK(!buffer.update());
+}
+
+
+static void testSpscQueue() {
+    const uint32_t count = 200000;
+    SpscQueue<uint32_t, 64> queue;
+    std::thread producer([&] {
+        for (uint32_t i = 0; i < count; i++) {
+            while (!queue.push(i)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    uint32_t expected = 0, item = 0;
+    bool ordered = true;
+    while (expected < count) {
+        if (queue.pop(item)) {
+            ordered = ordered && item == expected;
+            expected++;
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    CHECK(ordered);
+    CHECK(!queue.pop(item));
+
+    // Full at capacity and usable again once drained
+    SpscQueue<uint32_t, 4> small;
+    for (uint32_t i = 0; i < 4; i++) {
+        CHECK(small.push(i));
+    }
+    CHECK(!small.push(4));
+    CHECK(small.pop(item) && item == 0);
+    CHECK(small.push(4));
+}
+
+
+static bool overlaps(const BoundingSphere& a, const BoundingSphere& b) {
+    vec3 d = a.center - b.center;
+    float r = a.radius + b.radius;
+    return dot(d, d) <= r * r;
+}
+
+typedef std::vector<std::pair<uint32_t, uint32_t>> PairList;
+
+// Overlapping pairs (i < j) from the hash's candidates
+static PairList hashedPairs(const SpatialHash& hash) {
+    PairList pairs;
+    std::vector<uint32_t> candidates;
+    for (uint32_t i = 0; i < hash.size(); i++) {
+        candidates.clear();
+        hash.query(hash.bounds(i), candidates);
+        for (uint32_t j : candidates) {
+            if (j > i && overlaps(hash.bounds(i), hash.bounds(j))) {
+                pairs.push_back(std::make_pair(i, j));
+            }
+        }
+    }
+    std::sort(pairs.begin(), pairs.end());
+    return pairs;
+}
+
+static PairList bruteForcePairs(const std::vector<BoundingSphere>& spheres) {
+    PairList pairs;
+    for (uint32_t i = 0; i < spheres.size(); i++) {
+        for (uint32_t j = i + 1; j < spheres.size(); j++) {
+            if (overlaps(spheres[i], spheres[j])) {
+                pairs.push_back(std::make_pair(i, j));
+            }
+        }
+    }
+    return pairs;
+}
+
+static void testSpatialHashPairs() {
+    std::mt19937 rng(1969);
+    std::uniform_real_distribution<float> position(-60.0f, 60.0f);
+    std::uniform_real_distribution<float> radius(0.2f, 6.0f);   // some span many cells
+    std::uniform_real_distribution<float> step(-5.0f, 5.0f);
+
+    SpatialHash hash(8.0f);
+    std::vector<BoundingSphere> spheres(1500);
+    for (BoundingSphere& sphere : spheres) {
+        sphere.center = vec3(position(rng), position(rng), position(rng));
+        sphere.radius = radius(rng);
+        hash.insert(sphere);
+    }
+    PairList expected = bruteForcePairs(spheres);
+    CHECK(!expected.empty());
+    CHECK(hashedPairs(hash) == expected);
+
+    // Move and resize a third of them, relinking some, and check again
+    for (uint32_t i = 0; i < spheres.size(); i += 3) {
+        spheres[i].center += vec3(step(rng), step(rng), step(rng));
+        spheres[i].radius = radius(rng);
+        hash.update(i, spheres[i]);
+    }
+    CHECK(hash.relinks > 0);
+    CHECK(hashedPairs(hash) == bruteForcePairs(spheres));
+}
+
+
+// RMS and largest acceleration error relative to the exact value from
+// direct summation, like benchmarkGravity reports
+static void accelerationErrors(const GravitySimulation& sim, double& rms, double& worst) {
+    const GravityBodies& b = sim.bodies;
+    std::vector<float> ax(b.size()), ay(b.size()), az(b.size());
+    directAccelerations(b, sim.G, sim.softening, 0, b.size(), &ax[0], &ay[0], &az[0]);
+    double sumSquared = 0.0;
+    worst = 0.0;
+    for (size_t i = 0; i < b.size(); i++) {
+        double ex = b.ax[i] - ax[i], ey = b.ay[i] - ay[i], ez = b.az[i] - az[i];
+        double exact = std::sqrt((double)ax[i] * ax[i] + (double)ay[i] * ay[i] + (double)az[i] * az[i]);
+        double error = std::sqrt(ex * ex + ey * ey + ez * ez) / std::max(exact, 1e-30);
+        sumSquared += error * error;
+        worst = std::max(worst, error);
+    }
+    rms = std::sqrt(sumSquared / std::max(b.size(), (size_t)1));
+}
+
+static void fillField(GravityBodies& bodies, int count) {
+    std::mt19937 rng(2001);
+    std::uniform_real_distribution<float> xy(-200.0f, 200.0f);
+    std::uniform_real_distribution<float> height(0.0f, 50.0f);
+    std::uniform_real_distribution<float> mass(0.5f, 15.0f);
+    bodies.clear();
+    for (int i = 0; i < count; i++) {
+        bodies.add(vec3(xy(rng), xy(rng), height(rng)), vec3(0.0f, 0.0f, 0.0f), mass(rng));
+    }
+    setCircularVelocities(bodies, 2.7e-5f);
+}
+
+static void testBarnesHut() {
+    const int count = 2000, steps = 20;
+    double rms = 0.0, worst = 0.0;
+
+    // theta 0 opens every cell, so the tree walk is direct summation
+    GravitySimulation exact;
+    fillField(exact.bodies, count);
+    exact.theta = 0.0f;
+    exact.start();
+    accelerationErrors(exact, rms, worst);
+    CHECK(worst < 1e-4);
+
+    GravitySimulation tree;
+    fillField(tree.bodies, count);
+    tree.start();
+    accelerationErrors(tree, rms, worst);
+    CHECK(rms < 0.02);
+    CHECK(worst < 0.2);
+
+    // Leapfrog on the tree keeps within a sliver of leapfrog on the exact
+    // field: no body strays by more than 2% of the way it moved
+    GravityBodies start = exact.bodies;
+    for (int s = 0; s < steps; s++) {
+        exact.step(1.0f);
+        tree.step(1.0f);
+    }
+    accelerationErrors(tree, rms, worst);
+    CHECK(rms < 0.02);
+    CHECK(worst < 0.2);
+    double worstStray = 0.0;
+    for (size_t i = 0; i < start.size(); i++) {
+        vec3 from(start.x[i], start.y[i], start.z[i]);
+        vec3 to(exact.bodies.x[i], exact.bodies.y[i], exact.bodies.z[i]);
+        vec3 stray = vec3(tree.bodies.x[i], tree.bodies.y[i], tree.bodies.z[i]) - to;
+        worstStray = std::max(worstStray, (double)length(stray) / std::max((double)length(to - from), 1e-30));
+    }
+    CHECK(worstStray < 0.02);
+}
+
+
+// Few distinct programs, arenas, passes, colors and meshes, so most keys
+// collide and only a stable sort that merges the buckets in order passes
+static void testRenderQueueSort() {
+    const unsigned threadCount = 4;
+    const int perThread = 25000;
+    const GLfloat palette[5][3] = {
+        { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 1.0f, 1.0f, 0.0f }, { 0.5f, 0.5f, 0.5f }
+    };
+    const ProfileScope passes[3] = { PROFILE_SHIP_TORI, PROFILE_PLANETS, PROFILE_SUBMIT };
+
+    RenderQueue queue(threadCount);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < threadCount; t++) {
+        threads.emplace_back([&queue, &palette, &passes, t] {
+            std::mt19937 rng(100 + t);
+            RenderBucket& bucket = queue.bucket(t);
+            for (int i = 0; i < perThread; i++) {
+                bucket.pass = passes[rng() % 3];
+                const GLfloat* c = palette[rng() % 5];
+                bucket.submit(rng() % 4, rng() % 3, rng() % 8, Material(vec3(c[0], c[1], c[2])), Simd::Mat4(),
+                    rng() % 8 == 0 ? RENDER_OUTLINE : RENDER_OPAQUE, GL_TRIANGLES);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    queue.sort();
+
+    std::vector<RenderQueue::Entry> expected;
+    for (unsigned b = 0; b < threadCount; b++) {
+        const std::vector<DrawPacket>& packets = queue.bucket(b).packets;
+        for (uint32_t i = 0; i < packets.size(); i++) {
+            expected.push_back(RenderQueue::Entry{ packets[i].key, b, i });
+        }
+    }
+    std::stable_sort(expected.begin(), expected.end(),
+        [](const RenderQueue::Entry& a, const RenderQueue::Entry& b) { return a.key < b.key; });
+
+    const std::vector<RenderQueue::Entry>& sorted = queue.sortedEntries();
+    CHECK(sorted.size() == threadCount * (size_t)perThread);
+    CHECK(sorted.size() == expected.size());
+    size_t mismatched = 0, unordered = 0;
+    for (size_t i = 0; i < std::min(sorted.size(), expected.size()); i++) {
+        const RenderQueue::Entry& e = sorted[i];
+        if (e.key != expected[i].key || e.bucket != expected[i].bucket || e.index != expected[i].index) {
+            mismatched++;
+        }
+        // Equal keys go bucket by bucket, each in recording order
+        if (i > 0 && sorted[i - 1].key == e.key &&
+            std::make_pair(sorted[i - 1].bucket, sorted[i - 1].index) >= std::make_pair(e.bucket, e.index)) {
+            unordered++;
+        }
+    }
+    CHECK(mismatched == 0);
+    CHECK(unordered == 0);
+}
+
+
+int main() {
+    testInputLogRoundTrip();
+    testMeshCacheStoreLoad();
+    testTripleBuffer();
+    testSpscQueue();
+    testSpatialHashPairs();
+    testBarnesHut();
+    testRenderQueueSort();
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all kernel checks passed\n");
+    return 0;
+}
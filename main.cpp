@@ -1,77 +1,192 @@
 ﻿#include "Angel.h"
 #include "mat.h"
 #include "vec.h"
+#include "ShaderProgram.h"
+#include "Simulation.h"
+#include "Offscreen.h"
+#include "Profiler.h"
+#include "SphereLOD.h"
+#include "Culling.h"
+#include "MeshRegistry.h"
+#include "MeshGenerators.h"
+#include "MeshCache.h"
+#include "Gravity.h"
+#include "Collision.h"
+#include "Fleet.h"
+#include "SimdMath.h"
+#include "SceneGraph.h"
+#include "RenderQueue.h"
+#include "SimThread.h"
+#include "InputLog.h"
+#include "Camera.h"
+#include "ClusteredLighting.h"
+#include "ShaderCache.h"
+#include "Universe.h"
+#include "StreamBuffer.h"
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <iostream>
 #include <vector>
-
-
-
+#include <chrono>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cstddef>
+#include <algorithm>
+#include <string>
+#include <functional>
+
+
+
+// Shared by every mesh program and built in variants (see ShaderCache.h).
+// INSTANCED reads translation, scale and color from a per-planet instance
+// buffer, so one draw covers every body; INDIRECT reads a model matrix and
+// color from the multi-draw-indirect record selected by the command's
+// baseInstance, so one call can draw every mesh in the arena.  Otherwise
+// Model and ObjectColor are per-draw uniforms.  LIT passes the eye-space
+// position and normal on to be lit in the fragment shader.
 const char* vertexShaderSource = R"(
 #version 330 core
-layout (location = 0) in vec3 vPosition;
+layout (location = 0) in vec4 vPosition; // homogeneous: packed meshes carry their scale in w
 layout (location = 1) in vec3 vNormal;
+#if defined(INSTANCED)
+layout (location = 2) in vec4 iPosScale;
+layout (location = 3) in vec3 iColor;
+#elif defined(INDIRECT)
+layout (location = 4) in vec4 iModelRow0;
+layout (location = 5) in vec4 iModelRow1;
+layout (location = 6) in vec4 iModelRow2;
+layout (location = 7) in vec4 iColor; // rgb, a = 1 when lit
+#else
+uniform mat4 Model;
+uniform vec3 ObjectColor;
+#endif
 
 out vec3 interpColor;
-
-uniform mat4 ModelView;
-uniform mat4 Projection;
-uniform vec3 LightPos;
-uniform vec3 LightColor;
-uniform vec3 ObjectColor;
-uniform bool UseLighting;
+#ifdef LIT
+out vec3 eyePosition;
+out vec3 eyeNormal;
+#ifdef INDIRECT
+flat out float litFactor;
+#endif
+#endif
+
+layout (std140) uniform FrameData {
+    mat4 Projection;
+    mat4 View;
+    vec4 LightPos;
+    vec4 LightColor;
+    vec4 SceneOffset;
+};
 
 void main() {
-    if (UseLighting) {
-       
-        vec3 Normal = normalize(mat3(ModelView) * vNormal);
-
-        
-        vec3 LightDir = normalize(LightPos - vec3(ModelView * vec4(vPosition, 1.0)));
-
-        // Compute diffuse lighting
-        float diff = max(dot(Normal, LightDir), 0.0);
-        vec3 diffuse = diff * LightColor;
-
-        // Final color = Diffuse * Object color
-        interpColor = ObjectColor * diffuse;
-    } else {
-        interpColor = ObjectColor; // No lighting for unlit objects (e.g., white square)
-    }
-
-    gl_Position = Projection * ModelView * vec4(vPosition, 1.0);
+#ifdef INSTANCED
+    // Planets are relative to the scene anchor, which is SceneOffset from the eye
+    vec4 eyePos = View * vec4(iPosScale.xyz + SceneOffset.xyz + vPosition.xyz / vPosition.w * iPosScale.w, 1.0);
+    // Scale is uniform, so the view rotation alone transforms the normal
+    mat3 normalMatrix = mat3(View);
+    interpColor = iColor;
+#else
+#ifdef INDIRECT
+    mat4 Model = transpose(mat4(iModelRow0, iModelRow1, iModelRow2, vec4(0.0, 0.0, 0.0, 1.0)));
+    interpColor = iColor.rgb;
+#else
+    interpColor = ObjectColor;
+#endif
+    mat4 ModelView = View * Model;
+    vec4 eyePos = ModelView * vec4(vPosition.xyz / vPosition.w, 1.0);
+    mat3 normalMatrix = mat3(ModelView);
+#endif
+
+#ifdef LIT
+    // Lit in the fragment shader
+    eyePosition = eyePos.xyz;
+    eyeNormal = normalMatrix * vNormal;
+#ifdef INDIRECT
+    litFactor = iColor.a;
+#endif
+#endif
+
+    gl_Position = Projection * eyePos;
 }
 )";
 
 
+// Shared by every mesh program.  With LIT it shades with the key light,
+// and through clusteredShaderSource() adds the point lights of the
+// fragment's cluster; without, the color is flat (e.g. the white square).
 const char* fragmentShaderSource = R"(
 #version 330 core
 in vec3 interpColor;
+#ifdef LIT
+in vec3 eyePosition;
+in vec3 eyeNormal;
+#ifdef INDIRECT
+flat in float litFactor;
+#endif
+#endif
 out vec4 FragColor;
 
+layout (std140) uniform FrameData {
+    mat4 Projection;
+    mat4 View;
+    vec4 LightPos;
+    vec4 LightColor;
+    vec4 SceneOffset;
+};
+
 void main() {
+#ifdef LIT
+    vec3 Normal = normalize(eyeNormal);
+    vec3 LightDir = normalize(LightPos.xyz - eyePosition);
+
+    // Compute diffuse lighting
+    vec3 diffuse = max(dot(Normal, LightDir), 0.0) * LightColor.rgb;
+#ifdef CLUSTERED_LIGHTING
+    diffuse += clusteredLighting(eyePosition, Normal);
+#endif
+
+    // Final color = Diffuse * Object color
+    vec3 color = interpColor * diffuse;
+#ifdef INDIRECT
+    // One multi-draw covers the unlit ground as well; its record has a = 0
+    color = mix(interpColor, color, litFactor);
+#endif
+    FragColor = vec4(color, 1.0);
+#else
     FragColor = vec4(interpColor, 1.0);
+#endif
 }
 )";
 
-std::vector<vec3> sphereVertices;
-std::vector<GLuint> sphereIndices;
-std::vector<vec3> sphereNormals;
-GLuint sphereVAO, sphereVBO, sphereEBO;
-vec4 eye, at, up;  
-vec3 shipPosition = vec3(1.0f, 10.0f, 5.0f); 
-vec3 shipDirection = vec3(1.0f, 0.0f, 0.0f); 
-float shipSpeed = 0.02f; 
-bool isPaused = false;
-
-
-enum CameraView {
-    CONTROL_DESK,  
-    FRONT_STATION, 
-    BEHIND_SHIP,   
-    TOP_VIEW       
-};
+// The camera in world space; each frame the scene is drawn around it (see WorldSpace.h)
+dvec3 eye, at;
+vec3 up;
+CameraOrigin cameraOrigin;
+// World position of the scene's float frame: planets, station, ground and
+// fleet are placed relative to it.  --world-offset moves it far from the origin.
+dvec3 sceneAnchor;
+Simulation simulation;
+// Windowed runs step the simulation on its own thread (--no-sim-thread keeps
+// it on this one); either way renderScene draws from a snapshot of it
+SimThread simThread;
+bool useSimThread = true;
+SimSnapshot lockstepSnapshot;
+const SimSnapshot* drawnSnapshot = nullptr;   // what the last renderScene drew
+
+// --record writes every key applied to the simulation to a log; --replay
+// feeds one back, tick for tick, into a fresh simulation of the same world
+InputLog inputLog;
+InputReplay* inputReplay = nullptr;
+std::string recordPath, replayPath;
+bool replayFast = false;   // one tick per frame, as fast as frames come
+std::chrono::steady_clock::time_point lastFrameTime;
+int windowWidth = 800, windowHeight = 600;
+
+FrameProfiler profiler;
+int profileHistory = 1000;
+std::string profileCsvPath = "profile.csv";
 
 
 CameraView currentView = CONTROL_DESK;
@@ -115,9 +230,6 @@ std::vector<GLuint> tetrahedronEdges = {
 };
 
 
-GLuint tetraEdgeVAO, tetraEdgeVBO, tetraEdgeEBO;
-
-GLuint tetraVAO, tetraVBO, tetraEBO;
 
 
 
@@ -134,8 +246,152 @@ GLfloat planet_colors[][3] = {
 };
 
 
-GLuint VAO, VBO, EBO, shaderProgram;
-GLuint ModelViewLoc, ProjectionLoc;
+GLuint VAO, VBO, EBO;
+// Lit and unlit variants of the per-object program (the unlit one draws
+// the ground and outlines); they and the other programs come from the
+// shader cache, which skips compiling on later runs
+ShaderProgram shaderProgram, unlitProgram;
+ShaderCache shaderCache;
+
+// Taken during static initialization, as close to launch as the program gets
+const std::chrono::steady_clock::time_point launchTime = std::chrono::steady_clock::now();
+bool firstFrameReported = false;
+
+// Per-frame uniform block shared by every program; this frame's values,
+// streamed and bound by range whenever they change
+FrameData frameData;
+vec3 lightPos = vec3(1.0f, 1.0f, 2.0f); // eye space
+vec3 lightColor = vec3(1.0f, 1.0f, 1.0f);
+
+// Point lights (--lights N): the ship's engine glow, blinking beacons
+// around the station, one glow per fleet ship, then lamps circling the
+// planets, up to N in all.  They are clustered every frame and shaded per
+// fragment, which needs OpenGL 4.3; without it only the key light shines.
+ClusteredLights clusteredLights;
+std::vector<PointLight> sceneLights;
+int pointLightCount = 64;
+int clusterGrid[3] = { ClusterTilesX, ClusterTilesY, ClusterSlices };
+bool clusteredSupported = false;
+bool usePointLights = true;
+const int StationBeacons = 8;
+
+// Everything written fresh every frame (the frame uniforms, instance
+// records, indirect commands and the ship's outline) goes through one
+// persistently mapped ring and is drawn from where it was written;
+// --no-persistent-map maps each allocation on its own instead
+StreamBuffer streamBuffer;
+bool usePersistentMap = true;
+
+// Per-instance planet data, laid out to match locations 2 and 3 of the instanced shader
+struct PlanetInstance {
+    GLfloat posScale[4]; // world translation (xyz) and uniform scale (w)
+    GLfloat color[3];
+};
+
+std::vector<PlanetInstance> planetInstances;
+static_assert(sizeof(PlanetInstance) == sizeof(SectorBody), "sector bodies are drawn as planet instances");
+
+// With --universe SEED, procedural sectors streamed in around the ship by
+// background workers, drawn after everything else with one offset each
+Universe universe;
+uint64_t universeSeed = 0;
+bool useUniverse = false;
+int universeWorkers = 2;
+double universeBudgetMB = 16.0;
+Frustum cameraFrustum;   // camera-relative, from the last cullScene
+std::vector<std::pair<Sector*, vec3>> sectorImpostors;
+// Bodies of the sectors near the camera, camera-relative, and their levels
+std::vector<SectorBody> nearBodies;
+std::vector<unsigned char> nearLevels;
+
+// With --gravity the planets become N-body bodies (same order as planetInstances)
+GravitySimulation gravity;
+bool useGravity = false;
+
+// Planets (same ids as planetInstances) and the station, for ship collisions
+CollisionWorld collisionWorld;
+bool useCollisions = true;
+
+// Autonomous squadrons (--fleet N), stepped with the simulation
+Fleet fleet;
+int fleetSize = 0;
+ShaderProgram instancedProgram;
+GLuint planetInstanceVBO;
+int planetCount = 8;
+bool useInstancing = true;
+
+// Every mesh lives in one shared vertex and index buffer, packed where GL can read it
+MeshRegistry meshes;
+VertexFormat meshFormat = VERTEX_PACKED;
+int torusMesh, tetraMesh, tetraEdgeMesh, groundMesh;
+
+// Generated meshes are mapped from here on later runs instead of being rebuilt
+MeshCache meshCache;
+bool useMeshCache = true;
+
+// Sphere mesh per level of detail, plus the impostor tier below the coarsest one
+int sphereMeshes[SphereLODCount];
+const int SphereDefaultLevel = 1; // the original 30-band sphere
+GLuint impostorQuadVAO;
+ShaderProgram impostorProgram;
+bool useSphereLOD = true;
+
+// Per-object level from the previous frame, for hysteresis
+std::vector<unsigned char> planetLOD;
+int stationLOD = SphereLODUnset;
+
+// Planets regrouped by level each frame for the indirect path's records
+std::vector<PlanetInstance> lodInstances;
+
+const float fieldOfView = 45.0f;
+const float nearPlane = 0.1f;
+const float lightRange = 5000.0f;   // lights are clustered out to here; the projection has no far plane
+
+// Reversed-Z: the near plane maps to depth 1 and infinity to 0 in a [0, 1]
+// depth range, which spreads float depth precision evenly over distance.
+// Needs glClipControl; --no-reversed-z keeps the classic mapping.
+bool useReversedZ = true, reversedZ = false;
+
+// GLUT's window depth buffer is 24-bit fixed point, which would throw away
+// what reversed-Z gains, so the window draws into float depth here and the
+// color is blitted to the window before each swap
+GLuint windowFBO = 0, windowColorRB = 0, windowDepthRB = 0;
+
+// Static bodies (planets, then the station, then the ground) in one hierarchy;
+// the ship moves every tick and is tested on its own
+BoundingVolumeHierarchy staticBVH;
+std::vector<uint32_t> visibleStatics;
+std::vector<uint32_t> visiblePlanets;
+float shipBoundsRadius;
+bool shipVisible = true, stationVisible = true, groundVisible = true;
+
+// The ship, the station and their parts; world transforms are only
+// recomputed when the ship or station actually moved
+SceneGraph sceneGraph;
+int shipNode, shipHullNodes[2], shipNoseNode, stationNode, stationBodyNode, stationNoseNode, groundNode;
+bool useCulling = true;
+CullStats cullStats;
+
+// Multi-draw-indirect path: one command per mesh, each instance reading its
+// transform and color from a record written into the stream buffer
+typedef InstanceRecord SceneInstance;
+static_assert(sizeof(SceneInstance) == sizeof(FleetInstance), "fleet instances are copied into scene records");
+std::vector<DrawElementsIndirectCommand> sceneCommands[2]; // meshes with 16-bit, then 32-bit indices
+// Lit and unlit (the ground's kind, for outlines) programs reading records
+ShaderProgram indirectProgram, indirectUnlitProgram;
+bool indirectSupported = false;
+// Drawing one record by baseInstance, which the per-object path does when it can
+bool baseInstanceSupported = false;
+bool useIndirect = true;
+
+// Per-object path: scene code records draw packets (bucket 0 on this thread,
+// the others for parallel recording), the queue sorts them by state and the
+// backend issues them.  Packets refer to programs and arenas by index.  With
+// base instances the transforms and colors are streamed as records, drawn by
+// the indirect programs; otherwise they are uniforms.
+RenderQueue renderQueue(RenderQueue::MaxBuckets);
+RenderBackend renderBackend;
+const int SceneProgram = 0, SceneUnlitProgram = 1, SceneArena = 0;
 
 
 vec3 vertices[] = {
@@ -152,354 +408,953 @@ GLuint indices[] = {
     2, 3, 0   
 };
 
-std::vector<vec3> torusVertices;
-std::vector<vec3> torusNormals;
-std::vector<GLuint> torusIndices;
-GLuint torusVAO, torusVBO, torusEBO;
-GLuint squareVAO, squareVBO, squareEBO;
 
-float stationRotationAngle = 0.0f;
-float stationRotationSpeed = 0.0f;
-float savedShipSpeed = 0.0f;
+// Runs the ticks of a replay due before the next frame: exactly one when
+// running as fast as possible, otherwise as many as real time calls for.
+// False once the recording's last tick has run.
+bool advanceReplay() {
+    if (inputReplay->finished(simulation.tick)) {
+        return false;
+    }
+    if (replayFast) {
+        simulation.step();
+    }
+    else {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        simulation.advance(std::chrono::duration<double>(now - lastFrameTime).count(), inputReplay->log.endTick);
+        lastFrameTime = now;
+    }
+    return true;
+}
 
 
-// Updates spaceship position if simulation is not paused
-void update(int value) {
-    if (!isPaused) {
-        shipPosition += shipDirection * shipSpeed;
+// Feeds elapsed real time to the fixed-timestep simulation (or a replay),
+// unless its own thread does, and requests one redraw
+void idle() {
+    if (inputReplay) {
+        if (!advanceReplay()) {
+            glutLeaveMainLoop();
+        }
+    }
+    else if (!simThread.running()) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        simulation.advance(std::chrono::duration<double>(now - lastFrameTime).count());
+        lastFrameTime = now;
     }
     glutPostRedisplay();
-    glutTimerFunc(16, update, 0); 
 }
 
-// Updates station rotation angle if simulation is not paused
-void timer(int value) {
-    if (!isPaused) { 
-        stationRotationAngle += stationRotationSpeed;
-    }
-    glutPostRedisplay();
-    glutTimerFunc(16, timer, 0);  
+
+void updateCamera(const SimState& state) {
+    cameraLookAt(currentView, state, sceneAnchor, eye, at, up);
 }
 
 
-void updateCamera() {
-    if (currentView == CONTROL_DESK) {
-        //Position the camera slightly behind and above the spaceship looking forward
-        vec3 offset = -normalize(shipDirection) * 3.0f + vec3(0.0f, 0.0f, 1.5f); 
-        eye = vec4(shipPosition + offset, 1.0f);
-        at = vec4(shipPosition + normalize(shipDirection) * 10.0f, 1.0f); 
-        up = vec4(0.0, 0.0, 1.0, 0.0);
+// Adds a generated mesh to registry, mapped from the mesh cache when a valid
+// file exists and generated (and stored for the next run) otherwise
+int addGeneratedMesh(MeshRegistry& registry, VertexFormat format, const std::string& key,
+    const std::function<Mesh()>& generate) {
+    EncodedMesh encoded;
+    if (useMeshCache && meshCache.load(key, format, encoded)) {
+        return registry.addEncoded(encoded);
     }
-    else if (currentView == FRONT_STATION) {
-        // Camera is placed in front of the station looking at it
-        vec3 stationPos = vec3(100.0f, 10.0f, 10.0f);
-        vec3 stationFront = vec3(1.0f, 0.0f, 0.0f);
-        eye = vec4(stationPos - stationFront * 30.0f, 1.0f);
-        at = vec4(stationPos, 1.0f);
-        up = vec4(0.0, 0.0, 1.0, 0.0);
+    Mesh mesh = generate();
+    if (useMeshCache) {
+        meshCache.store(key, format, mesh);
     }
-    else if (currentView == BEHIND_SHIP) {
-        //Camera is behind and above the spaceship looking in its movement direction
-        vec3 offset = -normalize(shipDirection) * 15.0f + vec3(0.0f, 0.0f, 10.0f); 
-        eye = vec4(shipPosition + offset, 1.0f);
-        at = vec4(shipPosition + normalize(shipDirection) * 5.0f, 1.0f); 
-        up = vec4(0.0, 0.0, 1.0, 0.0);
+    return registry.add(mesh);
+}
+
+// Cache keys name the generator and every parameter it was called with
+std::string torusKey(float R, float r, int numMajor, int numMinor) {
+    char key[64];
+    snprintf(key, sizeof(key), "torus_%g_%g_%dx%d", R, r, numMajor, numMinor);
+    return key;
+}
+
+std::string sphereKey(float radius, int latitudeBands, int longitudeBands) {
+    char key[64];
+    snprintf(key, sizeof(key), "sphere_%g_%dx%d", radius, latitudeBands, longitudeBands);
+    return key;
+}
+
+int addTorus(MeshRegistry& registry, VertexFormat format, float R, float r, int numMajor, int numMinor) {
+    return addGeneratedMesh(registry, format, torusKey(R, r, numMajor, numMinor),
+        [=] { return generateTorus(R, r, numMajor, numMinor); });
+}
+
+int addSphere(MeshRegistry& registry, VertexFormat format, float radius, int latitudeBands, int longitudeBands) {
+    return addGeneratedMesh(registry, format, sphereKey(radius, latitudeBands, longitudeBands),
+        [=] { return generateSphere(radius, latitudeBands, longitudeBands); });
+}
+
+// Packs every mesh into the shared arena: the torus, the tetrahedron and its
+// edge outline, the ground square and one sphere per level of detail
+void setupMeshes() {
+    torusMesh = addTorus(meshes, meshFormat, 2.5f, 0.7f, 40, 40);
+
+    std::vector<vec3> tetraUnitNormals;
+    for (const vec3& normal : tetraNormals) {
+        tetraUnitNormals.push_back(normalize(normal));
     }
-    else if (currentView == TOP_VIEW) {
-        //High above looking down to see the whole scene
-        eye = vec4(100.0, 100.0, 400.0, 1.0);  
-        at = vec4(100.0, 10.0, 10.0, 1.0);     
-        up = vec4(0.0, 1.0, 0.0, 0.0);
+    tetraMesh = meshes.add(tetrahedronVertices, tetraUnitNormals, tetrahedronIndices);
+    tetraEdgeMesh = meshes.add(tetrahedronVertices, std::vector<vec3>(), tetrahedronEdges);
+
+    // The ground is drawn unlit, so it carries no normals
+    groundMesh = meshes.add(std::vector<vec3>(vertices, vertices + 4), std::vector<vec3>(),
+        std::vector<GLuint>(indices, indices + 6));
+
+    for (int level = 0; level < SphereLODCount; level++) {
+        sphereMeshes[level] = addSphere(meshes, meshFormat, 0.5f, SphereLODBands[level], SphereLODBands[level]);
     }
+
+    meshes.upload(meshFormat);
+    // The mapped files were only needed for the upload
+    meshCache.release();
 }
 
+// Streamed records for the per-object path where base instances allow,
+// per-draw uniforms otherwise
+void configureRenderBackend(bool streamRecords) {
+    renderBackend.programs.clear();
+    if (streamRecords) {
+        renderBackend.programs.push_back(&indirectProgram);
+        renderBackend.programs.push_back(&indirectUnlitProgram);
+        renderBackend.stream = &streamBuffer;
+    }
+    else {
+        renderBackend.programs.push_back(&shaderProgram);
+        renderBackend.programs.push_back(&unlitProgram);
+        renderBackend.stream = nullptr;
+    }
+}
 
-// Setup functions to render tetrahedrons used in spaceship and station
-void setupTetrahedronEdges() {
-    glGenVertexArrays(1, &tetraEdgeVAO);
-    glGenBuffers(1, &tetraEdgeVBO);
-    glGenBuffers(1, &tetraEdgeEBO);
 
-    glBindVertexArray(tetraEdgeVAO);
+// Fills planetInstances with the eight hand-placed planets followed by extra
+// randomly scattered bodies, so the planet path can be stressed at large counts.
+void generatePlanetField(int count) {
+    planetInstances.clear();
+    planetInstances.reserve(count);
 
-    glBindBuffer(GL_ARRAY_BUFFER, tetraEdgeVBO);
-    glBufferData(GL_ARRAY_BUFFER, tetrahedronVertices.size() * sizeof(vec3), &tetrahedronVertices[0], GL_STATIC_DRAW);
+    for (int i = 0; i < count && i < 8; i++) {
+        PlanetInstance p = {
+            { planet_coords[i][0], planet_coords[i][1], planet_coords[i][2], 5.0f },
+            { planet_colors[i][0], planet_colors[i][1], planet_colors[i][2] }
+        };
+        planetInstances.push_back(p);
+    }
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tetraEdgeEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, tetrahedronEdges.size() * sizeof(GLuint), &tetrahedronEdges[0], GL_STATIC_DRAW);
+    // Extra bodies fill a cube whose side grows with the cube root of the count,
+    // keeping the average spacing roughly constant
+    std::mt19937 rng(1969);
+    float side = 40.0f * std::cbrt((float)count);
+    std::uniform_real_distribution<float> xy(-side * 0.5f, side * 0.5f);
+    std::uniform_real_distribution<float> height(0.0f, side * 0.25f);
+    std::uniform_real_distribution<float> scale(0.5f, 2.5f);
+    std::uniform_real_distribution<float> channel(0.2f, 1.0f);
+    for (int i = 8; i < count; i++) {
+        PlanetInstance p = {
+            { 100.0f + xy(rng), 100.0f + xy(rng), height(rng), scale(rng) },
+            { channel(rng), channel(rng), channel(rng) }
+        };
+        planetInstances.push_back(p);
+    }
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void*)0);
-    glEnableVertexAttribArray(0);
+    planetLOD.assign(planetInstances.size(), SphereLODUnset);
+}
 
-    glBindVertexArray(0);
+Simd::Mat4 groundTransform() {
+    return Simd::Translate(0.0f, 0.0f, -5.0f) * Simd::RotateX(-90) * Simd::Scale(200.0f, 200.0f, 1.0f);
 }
-void setupTetrahedronBuffers() {
-    glGenVertexArrays(1, &tetraVAO);
-    glGenBuffers(1, &tetraVBO);
-    glGenBuffers(1, &tetraEBO);
 
-    glBindVertexArray(tetraVAO);
+// The station spins about its own center, so a sphere reaching its nose covers every angle
+BoundingSphere stationBounds() {
+    BoundingSphere nose = transformBounds(Translate(0.0f, 20.0f, 0.0f) * Scale(4.0f, 4.0f, 4.0f),
+        &tetrahedronVertices[0], (int)tetrahedronVertices.size());
+    BoundingSphere station = { vec3(100.0f, 10.0f, 10.0f), std::max(10.0f, length(nose.center) + nose.radius) };
+    return station;
+}
 
-    
-    std::vector<vec3> tetraNormals = {
-        normalize(vec3(0.0f, 1.0f, 0.0f)),
-        normalize(vec3(-0.707f, -0.5f, 0.5f)),
-        normalize(vec3(0.707f, -0.5f, 0.5f)),
-        normalize(vec3(0.0f, -0.5f, -1.0f))
-    };
+// Nose tetrahedron of the ship in ship space
+BoundingSphere shipNoseBounds() {
+    return transformBounds(Translate(3.0f, 0.0f, 0.0f) * Scale(2.5f, 2.5f, 2.5f),
+        &tetrahedronVertices[0], (int)tetrahedronVertices.size());
+}
 
-  
-    std::vector<float> tetraData;
-    for (size_t i = 0; i < tetrahedronVertices.size(); i++) {
-        tetraData.push_back(tetrahedronVertices[i].x);
-        tetraData.push_back(tetrahedronVertices[i].y);
-        tetraData.push_back(tetrahedronVertices[i].z);
-        tetraData.push_back(tetraNormals[i].x);
-        tetraData.push_back(tetraNormals[i].y);
-        tetraData.push_back(tetraNormals[i].z);
+// Builds the static hierarchy from planetInstances and the fixed station and
+// ground transforms; ids below planetInstances.size() are planets
+void buildStaticBVH() {
+    std::vector<BoundingSphere> items(planetInstances.size() + 2);
+    for (size_t i = 0; i < planetInstances.size(); i++) {
+        const GLfloat* posScale = planetInstances[i].posScale;
+        items[i].center = vec3(posScale[0], posScale[1], posScale[2]);
+        items[i].radius = posScale[3] * 0.5f; // sphere meshes have radius 0.5
     }
 
-   
-    glBindBuffer(GL_ARRAY_BUFFER, tetraVBO);
-    glBufferData(GL_ARRAY_BUFFER, tetraData.size() * sizeof(float), &tetraData[0], GL_STATIC_DRAW);
+    items[planetInstances.size()] = stationBounds();
 
-  
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tetraEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, tetrahedronIndices.size() * sizeof(GLuint), &tetrahedronIndices[0], GL_STATIC_DRAW);
+    items[planetInstances.size() + 1] = transformBounds(Simd::toAngel(groundTransform()), vertices, 4);
+    staticBVH.build(items);
 
-    
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+    // Ship space: both tori (R + r) and the nose tetrahedron
+    BoundingSphere shipNose = shipNoseBounds();
+    shipBoundsRadius = std::max(2.5f + 0.7f, length(shipNose.center) + shipNose.radius);
+}
 
-  
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+// Turns planetInstances into gravitating bodies on circular orbits, with a
+// mass from the cube of their scale, and attaches them to the simulation
+void startGravity() {
+    gravity.bodies.clear();
+    for (const PlanetInstance& p : planetInstances) {
+        float scale = p.posScale[3];
+        gravity.bodies.add(vec3(p.posScale[0], p.posScale[1], p.posScale[2]), vec3(0.0f, 0.0f, 0.0f),
+            scale * scale * scale);
+    }
+    setCircularVelocities(gravity.bodies, gravity.G);
+    gravity.start();
 
-    glBindVertexArray(0);
+    simulation.gravity = &gravity;
+    simulation.current.shipGravity = gravity.accelerationAt(toFloat(simulation.current.shipPosition - sceneAnchor));
+    simulation.previous = simulation.current;
 }
 
+// Fills the collision world with the planets and the station and describes
+// the ship as its hull tori plus the nose tetrahedron
+void setupCollisions() {
+    collisionWorld.bodies.clear();
+    for (const PlanetInstance& p : planetInstances) {
+        BoundingSphere planet = { vec3(p.posScale[0], p.posScale[1], p.posScale[2]), p.posScale[3] * 0.5f };
+        collisionWorld.bodies.insert(planet);
+    }
+    collisionWorld.bodies.insert(stationBounds());
+
+    BoundingSphere nose = shipNoseBounds();
+    ShipShape& shape = collisionWorld.shipShape;
+    shape.hullRadius = 2.5f + 0.7f;
+    shape.noseCenter = nose.center;
+    shape.noseRadius = nose.radius;
+    shape.boundsRadius = std::max(shape.hullRadius, length(nose.center) + nose.radius);
+    simulation.collisions = &collisionWorld;
+}
 
-void generateTorus(float R, float r, int numMajor, int numMinor) {
-// It calculates positions and normals for each vertex by using two angles:
-// theta for the major circle and phi for the minor circle.
-// The positions are stored in torusVertices, and the normals in torusNormals.
-// Triangle indices are generated to connect the vertices in a mesh using torusIndices.
-    torusVertices.clear();
-    torusNormals.clear();
-    torusIndices.clear();
+// Spawns the fleet between the planets and the station; the first tick
+// runs right away so there are instances to draw before the simulation starts
+void setupFleet() {
+    fleet.obstacles = useCollisions ? &collisionWorld.bodies : nullptr;
+    fleet.spawn(fleetSize, vec3(60.0f, 60.0f, 15.0f), 60.0f);
+    fleet.step();
+    simulation.fleet = &fleet;
+}
 
-    for (int i = 0; i < numMajor; i++) {
-        float theta = (float)i / numMajor * 2.0f * M_PI;
-        float cosTheta = cos(theta);
-        float sinTheta = sin(theta);
+// Tests every object against the view frustum and fills the visibility
+// flags and visiblePlanets before anything is drawn.  The static bodies are
+// tested in the scene's frame, the ship relative to the camera.
+void cullScene(const mat4& sceneViewProjection, const mat4& viewProjection, const SimState& state) {
+    auto start = std::chrono::steady_clock::now();
+    size_t planets = planetInstances.size();
+    cullStats = CullStats();
+    visibleStatics.clear();
+    visiblePlanets.clear();
+
+    if (!useCulling) {
+        for (size_t i = 0; i < planets; i++) {
+            visiblePlanets.push_back((uint32_t)i);
+        }
+        shipVisible = stationVisible = groundVisible = true;
+        cullStats.visible = (int)planets + 3;
+        return;
+    }
 
-        for (int j = 0; j < numMinor; j++) {
-            float phi = (float)j / numMinor * 2.0f * M_PI;
-            float cosPhi = cos(phi);
-            float sinPhi = sin(phi);
+    Frustum sceneFrustum = extractFrustum(sceneViewProjection);
+    staticBVH.cull(sceneFrustum, visibleStatics, cullStats);
+    stationVisible = groundVisible = false;
+    for (uint32_t id : visibleStatics) {
+        if (id < planets) {
+            visiblePlanets.push_back(id);
+        }
+        else if (id == planets) {
+            stationVisible = true;
+        }
+        else {
+            groundVisible = true;
+        }
+    }
 
-            float x = (R + r * cosPhi) * cosTheta;
-            float y = (R + r * cosPhi) * sinTheta;
-            float z = r * sinPhi;
+    cameraFrustum = extractFrustum(viewProjection);
+    BoundingSphere ship = { cameraOrigin.relative(state.shipPosition), shipBoundsRadius };
+    shipVisible = sphereInFrustum(cameraFrustum, ship);
+    if (shipVisible) {
+        cullStats.visible++;
+    }
+    else {
+        cullStats.culled++;
+    }
 
-            vec3 normal = normalize(vec3(cosPhi * cosTheta, cosPhi * sinTheta, sinPhi));
-            torusVertices.push_back(vec3(x, y, z));
-            torusNormals.push_back(normal);
-        }
+    auto end = std::chrono::steady_clock::now();
+    cullStats.milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Uploads planetInstances in their original order for the unculled, non-LOD instanced path
+void setupPlanetInstanceBuffer() {
+    if (planetInstanceVBO == 0) {
+        glGenBuffers(1, &planetInstanceVBO);
     }
 
-    for (int i = 0; i < numMajor; i++) {
-        for (int j = 0; j < numMinor; j++) {
-            int first = (i * numMinor) + j;
-            int second = ((i + 1) % numMajor) * numMinor + j;
-            int next = (j + 1) % numMinor;
+    glBindBuffer(GL_ARRAY_BUFFER, planetInstanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, planetInstances.size() * sizeof(PlanetInstance),
+        planetInstances.empty() ? NULL : &planetInstances[0], GL_STATIC_DRAW);
+}
 
-            torusIndices.push_back(first);
-            torusIndices.push_back(second);
-            torusIndices.push_back(first + next);
+// Moves the planets to the bodies' positions blended like the ship's, then
+// rebuilds the hierarchy; the instanced path streams them from here on
+void syncPlanetBodies(const SimSnapshot& snapshot, float alpha) {
+    if (snapshot.bodyCount() != planetInstances.size()) {
+        return; // a benchmark swapped in another planet field
+    }
+    for (size_t i = 0; i < planetInstances.size(); i++) {
+        vec3 position = snapshot.bodyPosition(i, alpha);
+        planetInstances[i].posScale[0] = position.x;
+        planetInstances[i].posScale[1] = position.y;
+        planetInstances[i].posScale[2] = position.z;
+    }
+    buildStaticBVH();
+}
 
-            torusIndices.push_back(second);
-            torusIndices.push_back(second + next);
-            torusIndices.push_back(first + next);
-        }
+// Binds vao with per-instance attributes reading buffer from firstInstance
+// on, counting from offset bytes in
+void bindPlanetInstances(GLuint vao, GLuint buffer, size_t firstInstance, GLintptr offset = 0) {
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+    size_t base = offset + firstInstance * sizeof(PlanetInstance);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(PlanetInstance), (void*)(base + offsetof(PlanetInstance, posScale)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(PlanetInstance), (void*)(base + offsetof(PlanetInstance, color)));
+    glEnableVertexAttribArray(3);
+    glVertexAttribDivisor(3, 1);
+}
+
+// Records [0, count) into the render queue as one contiguous chunk per
+// worker, each chunk into its own bucket; small ranges stay on this thread
+void recordParallel(size_t count, const std::function<void(RenderBucket&, size_t, size_t)>& record) {
+    JobSystem& jobs = defaultJobSystem();
+    size_t chunks = std::min((size_t)jobs.size(), (size_t)renderQueue.bucketCount() - 1);
+    if (count < 256 || chunks < 2) {
+        record(renderQueue.bucket(0), 0, count);
+        return;
     }
+    size_t chunkSize = (count + chunks - 1) / chunks;
+    JobCounter counter;
+    for (size_t c = 0; c < chunks && c * chunkSize < count; c++) {
+        size_t begin = c * chunkSize, end = std::min(count, begin + chunkSize);
+        jobs.submit([&record, c, begin, end] { record(renderQueue.bucket(1 + (unsigned)c), begin, end); }, &counter);
+    }
+    jobs.wait(counter);
 }
 
-void setupTorusBuffers() {
-// It creates and binds VAO, VBO, and EBO for the torus.
-// Then it interleaves position and normal data in a single array and uploads it to the GPU.
-// Finally it sets up the vertex attribute pointers so that the shader can access the data correctly.
-    glGenVertexArrays(1, &torusVAO);
-    glGenBuffers(1, &torusVBO);
-    glGenBuffers(1, &torusEBO);
-    glBindVertexArray(torusVAO);
+// Original path: one packet, so one matrix upload and one draw, per visible planet
+void recordPlanetsPerObject() {
+    recordParallel(visiblePlanets.size(), [](RenderBucket& bucket, size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+            const PlanetInstance& p = planetInstances[visiblePlanets[k]];
+            Simd::Mat4 sphereModel = Simd::Translate(vec3(p.posScale[0], p.posScale[1], p.posScale[2]) + cameraOrigin.sceneOffset)
+                * Simd::Scale(p.posScale[3], p.posScale[3], p.posScale[3]);
+            bucket.submit(SceneProgram, SceneArena, sphereMeshes[SphereDefaultLevel],
+                Material(vec3(p.color[0], p.color[1], p.color[2])), sphereModel);
+        }
+    });
+}
 
-    std::vector<float> torusData;
-    for (size_t i = 0; i < torusVertices.size(); i++) {
-        torusData.push_back(torusVertices[i].x);
-        torusData.push_back(torusVertices[i].y);
-        torusData.push_back(torusVertices[i].z);
-        torusData.push_back(torusNormals[i].x);
-        torusData.push_back(torusNormals[i].y);
-        torusData.push_back(torusNormals[i].z);
+// Picks each visible planet's level from its projected radius (the default
+// mesh with LOD off) and groups them into grouped, which has room for every
+// visible planet, so each level is one contiguous range starting at offsets[level]
+void groupPlanetsByLevel(size_t counts[], size_t offsets[], PlanetInstance* grouped) {
+    float pixelScale = pixelsPerUnit(fieldOfView, windowHeight);
+    const vec3& sceneOffset = cameraOrigin.sceneOffset;
+    for (int level = 0; level <= SphereImpostorLevel; level++) {
+        counts[level] = 0;
+    }
+    for (uint32_t i : visiblePlanets) {
+        int level = SphereDefaultLevel;
+        if (useSphereLOD) {
+            const GLfloat* posScale = planetInstances[i].posScale;
+            float distance = length(vec3(posScale[0], posScale[1], posScale[2]) + sceneOffset);
+            float radius = projectedRadius(posScale[3] * 0.5f, distance, pixelScale);
+            level = selectSphereLOD(radius, planetLOD[i]);
+        }
+        planetLOD[i] = (unsigned char)level;
+        counts[level]++;
     }
 
-    glBindBuffer(GL_ARRAY_BUFFER, torusVBO);
-    glBufferData(GL_ARRAY_BUFFER, torusData.size() * sizeof(float), &torusData[0], GL_STATIC_DRAW);
+    size_t next[SphereImpostorLevel + 1];
+    size_t total = 0;
+    for (int level = 0; level <= SphereImpostorLevel; level++) {
+        offsets[level] = next[level] = total;
+        total += counts[level];
+    }
+    for (uint32_t i : visiblePlanets) {
+        grouped[next[planetLOD[i]]++] = planetInstances[i];
+    }
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, torusEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, torusIndices.size() * sizeof(GLuint), &torusIndices[0], GL_STATIC_DRAW);
+// Farthest tier: one ray-traced quad per planet, read from streamed instances
+void drawPlanetImpostors(const StreamAllocation& instances, size_t firstInstance, size_t count) {
+    impostorProgram.use();
+    bindPlanetInstances(impostorQuadVAO, instances.buffer, firstInstance, instances.offset);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)count);
+}
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+// Instanced path: one draw call per level of detail, or a single one with LOD off
+void drawPlanetsInstanced() {
+    instancedProgram.use();
+
+    // Nothing to select or cull: draw the static buffer as is, or the
+    // planets where gravity has moved them
+    if (!useSphereLOD && !useCulling) {
+        if (useGravity) {
+            StreamAllocation instances;
+            PlanetInstance* moved = streamBuffer.allocate<PlanetInstance>(planetInstances.size(), instances);
+            std::copy(planetInstances.begin(), planetInstances.end(), moved);
+            streamBuffer.unmap();
+            bindPlanetInstances(meshes.vao, instances.buffer, 0, instances.offset);
+        }
+        else {
+            bindPlanetInstances(meshes.vao, planetInstanceVBO, 0);
+        }
+        meshes.drawInstanced(sphereMeshes[SphereDefaultLevel], (GLsizei)planetInstances.size());
+        glBindVertexArray(0);
+        shaderProgram.use();
+        return;
+    }
+
+    // Grouped straight into the stream buffer
+    size_t counts[SphereImpostorLevel + 1], offsets[SphereImpostorLevel + 1];
+    StreamAllocation instances;
+    groupPlanetsByLevel(counts, offsets, streamBuffer.allocate<PlanetInstance>(visiblePlanets.size(), instances));
+    streamBuffer.unmap();
 
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+    for (int level = 0; level < SphereLODCount; level++) {
+        if (counts[level] == 0) {
+            continue;
+        }
+        bindPlanetInstances(meshes.vao, instances.buffer, offsets[level], instances.offset);
+        meshes.drawInstanced(sphereMeshes[level], (GLsizei)counts[level]);
+    }
 
+    if (counts[SphereImpostorLevel] > 0) {
+        drawPlanetImpostors(instances, offsets[SphereImpostorLevel], counts[SphereImpostorLevel]);
+    }
     glBindVertexArray(0);
+
+    shaderProgram.use();
 }
 
 
-void setupSquareBuffers() {
-    // Set up VAO and buffers for drawing a square (ground)
-    glGenVertexArrays(1, &squareVAO);
-    glGenBuffers(1, &squareVBO);
-    glGenBuffers(1, &squareEBO);
+// Streams a copy of frameData and binds it as the FrameData block; draws
+// already issued keep reading the copy they were issued with
+void bindFrameData() {
+    StreamAllocation block = streamBuffer.allocate(sizeof(FrameData), streamBuffer.uniformAlignment());
+    memcpy(block.data, &frameData, sizeof(FrameData));
+    streamBuffer.unmap();
+    glBindBufferRange(GL_UNIFORM_BUFFER, FrameDataBinding, block.buffer, block.offset, sizeof(FrameData));
+}
 
-    glBindVertexArray(squareVAO);
+// Moves the scene's float frame for the programs that read SceneOffset
+void setSceneOffset(const vec3& offset) {
+    memcpy(frameData.sceneOffset, (const GLfloat*)vec4(offset, 0.0f), sizeof(frameData.sceneOffset));
+    bindFrameData();
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, squareVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+// Sector bodies closer than a sector's edge span too many levels to share
+// one, so those sectors are drawn body by body like the planets: each
+// picks its own level and all of them are grouped by level straight into
+// the stream buffer, already camera-relative
+void drawNearSectorBodies() {
+    size_t counts[SphereImpostorLevel + 1] = {}, offsets[SphereImpostorLevel + 1];
+    for (unsigned char level : nearLevels) {
+        counts[level]++;
+    }
+    size_t total = 0;
+    for (int level = 0; level <= SphereImpostorLevel; level++) {
+        offsets[level] = total;
+        total += counts[level];
+    }
+    size_t next[SphereImpostorLevel + 1];
+    std::copy(offsets, offsets + SphereImpostorLevel + 1, next);
+    StreamAllocation bodies;
+    SectorBody* grouped = streamBuffer.allocate<SectorBody>(total, bodies);
+    for (size_t i = 0; i < nearBodies.size(); i++) {
+        grouped[next[nearLevels[i]]++] = nearBodies[i];
+    }
+    streamBuffer.unmap();
+
+    setSceneOffset(vec3(0.0f, 0.0f, 0.0f));
+    instancedProgram.use();
+    for (int level = 0; level < SphereLODCount; level++) {
+        if (counts[level] > 0) {
+            bindPlanetInstances(meshes.vao, bodies.buffer, offsets[level], bodies.offset);
+            meshes.drawInstanced(sphereMeshes[level], (GLsizei)counts[level]);
+        }
+    }
+    if (counts[SphereImpostorLevel] > 0) {
+        impostorProgram.use();
+        bindPlanetInstances(impostorQuadVAO, bodies.buffer, offsets[SphereImpostorLevel], bodies.offset);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)counts[SphereImpostorLevel]);
+    }
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, squareEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+// Streamed sectors: each visible one farther than its own size is a single
+// instanced draw from its own buffer, at one level of detail picked for its
+// nearest possible body, with SceneOffset moved to the sector's center for
+// the draw; nearer ones are drawn body by body
+void drawUniverse() {
+    const std::vector<Sector*>& sectors = universe.drawable();
+    if (sectors.empty()) {
+        return;
+    }
+    float pixelScale = pixelsPerUnit(fieldOfView, windowHeight);
+    sectorImpostors.clear();
+    nearBodies.clear();
+    nearLevels.clear();
+    instancedProgram.use();
+    for (Sector* sector : sectors) {
+        vec3 offset = cameraOrigin.relative(sector->center);
+        BoundingSphere bounds = { offset, sector->boundingRadius };
+        if (useCulling && !sphereInFrustum(cameraFrustum, bounds)) {
+            continue;
+        }
+        float nearest = std::max(length(offset) - sector->boundingRadius, nearPlane);
+        if (useSphereLOD && nearest < SectorSize) {
+            sector->bodyLevels.resize(sector->bodies.size(), SphereLODUnset);
+            for (size_t i = 0; i < sector->bodies.size(); i++) {
+                SectorBody body = sector->bodies[i];
+                vec3 center = vec3(body.posScale[0], body.posScale[1], body.posScale[2]) + offset;
+                float radius = projectedRadius(body.posScale[3] * 0.5f, length(center), pixelScale);
+                sector->bodyLevels[i] = (unsigned char)selectSphereLOD(radius, sector->bodyLevels[i]);
+                body.posScale[0] = center.x;
+                body.posScale[1] = center.y;
+                body.posScale[2] = center.z;
+                nearBodies.push_back(body);
+                nearLevels.push_back(sector->bodyLevels[i]);
+            }
+            sector->level = SphereLODUnset;
+            continue;
+        }
+        int level = SphereDefaultLevel;
+        if (useSphereLOD) {
+            level = selectSphereLOD(projectedRadius(sector->bodyRadius, nearest, pixelScale), sector->level);
+        }
+        sector->level = (unsigned char)level;
+        if (level == SphereImpostorLevel) {
+            sectorImpostors.push_back(std::make_pair(sector, offset));
+            continue;
+        }
+        setSceneOffset(offset);
+        bindPlanetInstances(meshes.vao, sector->buffer, 0);
+        meshes.drawInstanced(sphereMeshes[level], sector->count);
+    }
+    if (!sectorImpostors.empty()) {
+        impostorProgram.use();
+        for (const std::pair<Sector*, vec3>& impostor : sectorImpostors) {
+            setSceneOffset(impostor.second);
+            bindPlanetInstances(impostorQuadVAO, impostor.first->buffer, 0);
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, impostor.first->count);
+        }
+    }
+    if (!nearBodies.empty()) {
+        drawNearSectorBodies();
+    }
+    glBindVertexArray(0);
+    setSceneOffset(cameraOrigin.sceneOffset);
+    shaderProgram.use();
+}
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void*)0);
-    glEnableVertexAttribArray(0);
 
-    glBindVertexArray(0);
+Simd::Mat4 stationTransform(const SimState& state) {
+    return Simd::Translate(100.0f, 10.0f, 10.0f) * Simd::RotateZ(state.stationRotationAngle);
 }
 
+// Builds the hierarchy once; renderScene only moves the ship and station roots
+void setupSceneGraph() {
+    shipNode = sceneGraph.add(SceneGraph::Root);
+    shipHullNodes[0] = sceneGraph.add(shipNode, Simd::RotateX(90));
+    shipHullNodes[1] = sceneGraph.add(shipNode, Simd::RotateY(90));
+    shipNoseNode = sceneGraph.add(shipNode, Simd::Translate(3.0f, 0.0f, 0.0f) * Simd::Scale(2.5f, 2.5f, 2.5f));
+
+    stationNode = sceneGraph.add(SceneGraph::Root);
+    stationBodyNode = sceneGraph.add(stationNode, Simd::Scale(20.0f, 20.0f, 20.0f));
+    stationNoseNode = sceneGraph.add(stationNode, Simd::Translate(0.0f, 20.0f, 0.0f) * Simd::Scale(4.0f, 4.0f, 4.0f));
 
-// Generates a sphere by computing vertex positions and normals over latitude/longitude bands
-// and builds an index buffer to form triangles for rendering the sphere used for station and planets
-void generateSphere(float radius, int latitudeBands, int longitudeBands) {
-    sphereVertices.clear();
-    sphereIndices.clear();
-    sphereNormals.clear();
+    groundNode = sceneGraph.add(SceneGraph::Root, groundTransform());
+}
 
-    for (int lat = 0; lat <= latitudeBands; lat++) {
-        float theta = lat * M_PI / latitudeBands;
-        float sinTheta = sin(theta);
-        float cosTheta = cos(theta);
+// The station keeps a mesh at every distance; only planets become impostors
+int selectStationLevel() {
+    if (!useSphereLOD) {
+        return SphereDefaultLevel;
+    }
+    float distance = length(vec3(100.0f, 10.0f, 10.0f) + cameraOrigin.sceneOffset);
+    stationLOD = selectSphereLOD(projectedRadius(10.0f, distance, pixelsPerUnit(fieldOfView, windowHeight)), stationLOD);
+    return std::min(stationLOD, SphereLODCount - 1);
+}
 
-        for (int lon = 0; lon <= longitudeBands; lon++) {
-            float phi = lon * 2.0f * M_PI / longitudeBands;
-            float sinPhi = sin(phi);
-            float cosPhi = cos(phi);
+SceneInstance sceneInstance(const Simd::Mat4& model, const vec3& color, bool lit) {
+    SceneInstance instance;
+    Simd::storeAffineRows(model, instance.model);
+    instance.color[0] = color.x;
+    instance.color[1] = color.y;
+    instance.color[2] = color.z;
+    instance.color[3] = lit ? 1.0f : 0.0f;
+    return instance;
+}
 
-            float x = cosPhi * sinTheta;
-            float y = cosTheta;
-            float z = sinPhi * sinTheta;
+// Copies a fleet record moved by the scene offset; the fleet works in the scene's frame
+SceneInstance rebasedInstance(const FleetInstance& instance, const vec3& offset) {
+    SceneInstance rebased;
+    memcpy(&rebased, &instance, sizeof(rebased));
+    rebased.model[3] += offset.x;
+    rebased.model[7] += offset.y;
+    rebased.model[11] += offset.z;
+    return rebased;
+}
 
-            vec3 vertex = vec3(radius * x, radius * y, radius * z);
-            vec3 normal = normalize(vec3(x, y, z)); // Normalize for lighting
+// Per-object fallback for the fleet: one packet per instance record
+void recordFleet(const std::vector<FleetInstance>& instances, int mesh) {
+    recordParallel(instances.size(), [&instances, mesh](RenderBucket& bucket, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const FleetInstance& instance = instances[i];
+            SceneInstance rebased = rebasedInstance(instance, cameraOrigin.sceneOffset);
+            const GLfloat* m = rebased.model;
+            Simd::Mat4 rows(Simd::Vec4::load(m), Simd::Vec4::load(m + 4), Simd::Vec4::load(m + 8), Simd::Vec4(0.0f, 0.0f, 0.0f, 1.0f));
+            bucket.submit(SceneProgram, SceneArena, mesh,
+                Material(vec3(instance.color[0], instance.color[1], instance.color[2])), Simd::transpose(rows));
+        }
+    });
+}
 
-            sphereVertices.push_back(vertex);
-            sphereNormals.push_back(normal);
+// Indirect path: the ship, station, ground and meshed planets go out in a
+// single glMultiDrawElementsIndirect with one command per mesh, whose
+// instances are every visible object using it.  Only the ship's line outline
+// and the planet impostors, which aren't indexed triangles, are drawn apart.
+// Records, commands and impostors are all written into the stream buffer.
+void drawSceneIndirect() {
+    sceneCommands[0].clear();
+    sceneCommands[1].clear();
+    size_t counts[SphereImpostorLevel + 1], offsets[SphereImpostorLevel + 1];
+    lodInstances.resize(visiblePlanets.size());
+    groupPlanetsByLevel(counts, offsets, lodInstances.data());
+
+    // The ship's and station's six parts at most, the fleet, the planets and the outline
+    const std::vector<FleetInstance>& hulls = drawnSnapshot->hullInstances;
+    const std::vector<FleetInstance>& noses = drawnSnapshot->noseInstances;
+    StreamAllocation records;
+    SceneInstance* record = streamBuffer.allocate<SceneInstance>(6 + hulls.size() + noses.size() + lodInstances.size() + 1, records);
+    GLuint written = 0;
+    auto add = [record, &written](const SceneInstance& instance) { record[written++] = instance; };
+
+    // Closes the run of records added since the last command as one command for mesh
+    GLuint first = 0;
+    auto emit = [&first, &written](int mesh) {
+        GLuint count = written - first;
+        if (count > 0) {
+            sceneCommands[meshes.indexType(mesh) == GL_UNSIGNED_SHORT ? 0 : 1].push_back(meshes.command(mesh, count, first));
         }
+        first = written;
+    };
+
+    if (shipVisible) {
+        add(sceneInstance(sceneGraph.world(shipHullNodes[0]), vec3(1.0f, 0.5f, 0.0f), true));
+        add(sceneInstance(sceneGraph.world(shipHullNodes[1]), vec3(0.5f, 1.0f, 0.0f), true));
+    }
+    // Fleet ships aren't culled; the fleet builds their records in its last phase
+    const vec3& sceneOffset = cameraOrigin.sceneOffset;
+    for (const FleetInstance& hull : hulls) {
+        add(rebasedInstance(hull, sceneOffset));
     }
+    emit(torusMesh);
 
-    // Generate indices for rendering
-    for (int lat = 0; lat < latitudeBands; lat++) {
-        for (int lon = 0; lon < longitudeBands; lon++) {
-            int first = (lat * (longitudeBands + 1)) + lon;
-            int second = first + longitudeBands + 1;
+    if (shipVisible) {
+        add(sceneInstance(sceneGraph.world(shipNoseNode), vec3(1.0f, 0.0f, 0.0f), true));
+    }
+    if (stationVisible) {
+        add(sceneInstance(sceneGraph.world(stationNoseNode), vec3(1.0f, 0.0f, 0.0f), true));
+    }
+    for (const FleetInstance& nose : noses) {
+        add(rebasedInstance(nose, sceneOffset));
+    }
+    emit(tetraMesh);
 
-            sphereIndices.push_back(first);
-            sphereIndices.push_back(second);
-            sphereIndices.push_back(first + 1);
+    if (groundVisible) {
+        add(sceneInstance(sceneGraph.world(groundNode), vec3(1.0f, 1.0f, 1.0f), false));
+    }
+    emit(groundMesh);
 
-            sphereIndices.push_back(second);
-            sphereIndices.push_back(second + 1);
-            sphereIndices.push_back(first + 1);
+    int stationLevel = stationVisible ? selectStationLevel() : -1;
+    for (int level = 0; level < SphereLODCount; level++) {
+        if (level == stationLevel) {
+            add(sceneInstance(sceneGraph.world(stationBodyNode), vec3(0.6f, 0.6f, 0.6f), true));
+        }
+        for (size_t i = offsets[level]; i < offsets[level] + counts[level]; i++) {
+            const PlanetInstance& p = lodInstances[i];
+            SceneInstance instance = {
+                { p.posScale[3], 0.0f, 0.0f, p.posScale[0] + sceneOffset.x,
+                  0.0f, p.posScale[3], 0.0f, p.posScale[1] + sceneOffset.y,
+                  0.0f, 0.0f, p.posScale[3], p.posScale[2] + sceneOffset.z },
+                { p.color[0], p.color[1], p.color[2], 1.0f }
+            };
+            add(instance);
         }
+        emit(sphereMeshes[level]);
+    }
+
+    // The outline is drawn on its own, from the record after the last command's
+    GLuint outline = written;
+    if (shipVisible) {
+        add(sceneInstance(sceneGraph.world(shipNoseNode), vec3(0.0f, 0.0f, 0.0f), false));
+    }
+    streamBuffer.unmap();
+
+    // The index type is per call, so 32-bit meshes (none unless the vertex
+    // format is float) follow the 16-bit ones as a second call
+    StreamAllocation commands;
+    DrawElementsIndirectCommand* command = streamBuffer.allocate<DrawElementsIndirectCommand>(
+        sceneCommands[0].size() + sceneCommands[1].size(), commands);
+    for (int width = 0; width < 2; width++) {
+        command = std::copy(sceneCommands[width].begin(), sceneCommands[width].end(), command);
     }
+    streamBuffer.unmap();
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands.buffer);
+    indirectProgram.use();
+    glBindVertexArray(meshes.vao);
+    bindInstanceRecords(records.buffer, records.offset);
+    size_t offset = commands.offset;
+    for (int width = 0; width < 2; width++) {
+        if (sceneCommands[width].empty()) {
+            continue;
+        }
+        glMultiDrawElementsIndirect(GL_TRIANGLES, width == 0 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+            (void*)offset, (GLsizei)sceneCommands[width].size(), 0);
+        offset += sceneCommands[width].size() * sizeof(DrawElementsIndirectCommand);
+    }
+
+    if (shipVisible) {
+        indirectUnlitProgram.use();
+        glLineWidth(4.0f);
+        meshes.drawInstance(tetraEdgeMesh, GL_LINES, outline);
+    }
+    shaderProgram.use();
+
+    if (counts[SphereImpostorLevel] > 0) {
+        StreamAllocation impostors;
+        const PlanetInstance* farthest = &lodInstances[offsets[SphereImpostorLevel]];
+        std::copy(farthest, farthest + counts[SphereImpostorLevel],
+            streamBuffer.allocate<PlanetInstance>(counts[SphereImpostorLevel], impostors));
+        streamBuffer.unmap();
+        drawPlanetImpostors(impostors, 0, counts[SphereImpostorLevel]);
+        shaderProgram.use();
+    }
+    glBindVertexArray(0);
+}
+
+
+PointLight pointLight(const vec3& position, float radius, const vec3& color) {
+    PointLight light = {
+        { position.x, position.y, position.z }, radius,
+        { color.x, color.y, color.z, 0.0f }
+    };
+    return light;
 }
-void setupSphereBuffers() {
-    glGenVertexArrays(1, &sphereVAO);
-    glGenBuffers(1, &sphereVBO);
-    glGenBuffers(1, &sphereEBO);
 
-    glBindVertexArray(sphereVAO);
+// Fills sceneLights for the blended state, relative to the camera; everything
+// moves with the simulation's clock, so a given tick always lights the same way
+void buildSceneLights(const SimSnapshot& snapshot, const SimState& state, float alpha) {
+    sceneLights.clear();
+    if (!usePointLights) {
+        return;
+    }
+    size_t budget = (size_t)pointLightCount;
+    float seconds = (float)((snapshot.tick + alpha) * SimTimestep);
+    const vec3& sceneOffset = cameraOrigin.sceneOffset;
+
+    // Engine glow just behind the ship
+    if (sceneLights.size() < budget) {
+        sceneLights.push_back(pointLight(cameraOrigin.relative(state.shipPosition) - state.shipDirection * 3.0f, 15.0f, vec3(1.0f, 0.55f, 0.15f)));
+    }
+
+    // Navigation beacons on the station's rim, turning with it: red and green, blinking out of step
+    for (int k = 0; k < StationBeacons && sceneLights.size() < budget; k++) {
+        float angle = (state.stationRotationAngle + k * 360.0f / StationBeacons) * DegreesToRadians;
+        vec3 position(100.0f + 11.0f * cos(angle), 10.0f + 11.0f * sin(angle), 10.0f);
+        vec3 color = k % 2 == 0 ? vec3(1.0f, 0.1f, 0.1f) : vec3(0.1f, 1.0f, 0.2f);
+        sceneLights.push_back(pointLight(position + sceneOffset, 14.0f, color * (1.0f + sin(seconds * 4.0f + k))));
+    }
 
-    std::vector<float> sphereData;
-    for (size_t i = 0; i < sphereVertices.size(); i++) {
-        sphereData.push_back(sphereVertices[i].x);
-        sphereData.push_back(sphereVertices[i].y);
-        sphereData.push_back(sphereVertices[i].z);
-        sphereData.push_back(sphereNormals[i].x);
-        sphereData.push_back(sphereNormals[i].y);
-        sphereData.push_back(sphereNormals[i].z);
+    // Fleet engines: the nose sits 3 units ahead of the ship scaled by 2.5,
+    // so its first column is 2.5 times the heading
+    for (const FleetInstance& nose : snapshot.noseInstances) {
+        if (sceneLights.size() >= budget) {
+            break;
+        }
+        const GLfloat* m = nose.model;
+        vec3 engine = vec3(m[3], m[7], m[11]) - vec3(m[0], m[4], m[8]) * 2.4f;
+        sceneLights.push_back(pointLight(engine + sceneOffset, 8.0f, vec3(0.5f, 0.7f, 1.0f)));
     }
 
-    glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
-    glBufferData(GL_ARRAY_BUFFER, sphereData.size() * sizeof(float), &sphereData[0], GL_STATIC_DRAW);
+    // The rest circle the planets in turn, each on its own orbit and color
+    static const vec3 lampColors[6] = {
+        vec3(1.0f, 0.8f, 0.5f), vec3(0.5f, 0.8f, 1.0f), vec3(1.0f, 0.4f, 0.8f),
+        vec3(0.6f, 1.0f, 0.5f), vec3(1.0f, 1.0f, 0.9f), vec3(0.8f, 0.5f, 1.0f)
+    };
+    for (size_t k = 0; sceneLights.size() < budget && !planetInstances.empty(); k++) {
+        const GLfloat* posScale = planetInstances[k % planetInstances.size()].posScale;
+        float planetRadius = posScale[3] * 0.5f;
+        float orbit = planetRadius + 2.0f + (k % 3) * 1.5f;
+        float angle = k * 2.3999632f + seconds * (0.3f + (k % 7) * 0.1f);   // golden angle apart
+        float height = ((int)(k / 3 % 5) - 2) * 0.4f * orbit;
+        vec3 position(posScale[0] + orbit * cos(angle), posScale[1] + orbit * sin(angle), posScale[2] + height);
+        sceneLights.push_back(pointLight(position + sceneOffset, planetRadius + 10.0f, lampColors[k % 6] * 0.5f));
+    }
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sphereIndices.size() * sizeof(GLuint), &sphereIndices[0], GL_STATIC_DRAW);
+// Builds this frame's lights, clusters them for the camera and uploads them
+void updatePointLights(const SimSnapshot& snapshot, const SimState& state, float alpha, const Simd::Mat4& view) {
+    buildSceneLights(snapshot, state, alpha);
+    clusteredLights.configure(windowWidth, windowHeight, fieldOfView, nearPlane, lightRange,
+        clusterGrid[0], clusterGrid[1], clusterGrid[2]);
+    clusteredLights.assign(sceneLights, view, defaultJobSystem());
+    clusteredLights.upload();
+}
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
 
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+// Sets the camera matrices and light of the FrameData block, once per frame
+void uploadFrameData(const Simd::Mat4& view, const Simd::Mat4& projection) {
+    FrameData& frame = frameData;
+    memcpy(frame.projection, projection.data(), sizeof(frame.projection));
+    memcpy(frame.view, view.data(), sizeof(frame.view));
+    memcpy(frame.lightPos, (const GLfloat*)vec4(lightPos, 1.0f), sizeof(frame.lightPos));
+    memcpy(frame.lightColor, (const GLfloat*)vec4(lightColor, 1.0f), sizeof(frame.lightColor));
+    memcpy(frame.sceneOffset, (const GLfloat*)vec4(cameraOrigin.sceneOffset, 0.0f), sizeof(frame.sceneOffset));
+    bindFrameData();
+}
 
-    glBindVertexArray(0);
+
+// Every program the scene draws with, from the shader cache; the lit
+// variants get the point lights when clustering is supported
+bool buildPrograms() {
+    std::string fragmentSource = clusteredSupported ? clusteredShaderSource(fragmentShaderSource) : fragmentShaderSource;
+    std::string impostorFragmentSource = clusteredSupported ?
+        clusteredShaderSource(impostorFragmentShaderSource) : impostorFragmentShaderSource;
+    return shaderCache.build(shaderProgram, vertexShaderSource, fragmentSource.c_str(), { "LIT" })
+        && shaderCache.build(unlitProgram, vertexShaderSource, fragmentShaderSource)
+        && shaderCache.build(instancedProgram, vertexShaderSource, fragmentSource.c_str(), { "LIT", "INSTANCED" })
+        && shaderCache.build(indirectProgram, vertexShaderSource, fragmentSource.c_str(), { "LIT", "INDIRECT" })
+        && shaderCache.build(indirectUnlitProgram, vertexShaderSource, fragmentShaderSource, { "INDIRECT" })
+        && shaderCache.build(impostorProgram, impostorVertexShaderSource, impostorFragmentSource.c_str(),
+            reversedZ ? ShaderDefines{ "REVERSED_Z" } : ShaderDefines());
 }
 
+void deletePrograms() {
+    ShaderProgram* programs[] = { &shaderProgram, &unlitProgram, &instancedProgram, &indirectProgram, &indirectUnlitProgram,
+        &impostorProgram };
+    for (ShaderProgram* program : programs) {
+        glDeleteProgram(program->id);
+        program->adopt(0);
+    }
+}
 
-void init() {
+// False if a shader failed to build; the log is already on stderr
+bool init() {
     glewExperimental = GL_TRUE;
     glewInit();
 
-    // Compile shaders
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-    glCompileShader(vertexShader);
-
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-    glCompileShader(fragmentShader);
-
-    shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-
-    // Get uniform locations
-    glUseProgram(shaderProgram);
-    ModelViewLoc = glGetUniformLocation(shaderProgram, "ModelView");
-    ProjectionLoc = glGetUniformLocation(shaderProgram, "Projection");
-    // Set light and object colors
-    glUniform3f(glGetUniformLocation(shaderProgram, "LightPos"), 1.0f, 1.0f, 2.0f); 
-    glUniform3f(glGetUniformLocation(shaderProgram, "LightColor"), 1.0f, 1.0f, 1.0f); 
-    glUniform3f(glGetUniformLocation(shaderProgram, "ObjectColor"), 1.0f, 0.0f, 1.0f); 
-    setupSquareBuffers();
-    generateSphere(0.5f, 30, 30);
-    setupSphereBuffers();
-    generateTorus(2.5f, 0.7f, 40, 40);
-    setupTetrahedronBuffers();
-    setupTetrahedronEdges();
-    setupTorusBuffers();
+    // Indirect commands read their per-draw data through baseInstance
+    indirectSupported = GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+    baseInstanceSupported = GLEW_VERSION_4_2 || GLEW_ARB_base_instance;
+    // Point lights come in storage buffers with bindings set in the shader
+    clusteredSupported = GLEW_VERSION_4_3 != 0;
+    if (!clusteredSupported && pointLightCount > 0) {
+        std::cout << "Clustered lighting needs OpenGL 4.3; point lights are off" << std::endl;
+    }
+
+    reversedZ = useReversedZ && (GLEW_VERSION_4_5 || GLEW_ARB_clip_control);
+
+    // Build shaders and resolve their uniform locations once
+    if (!buildPrograms()) {
+        return false;
+    }
+
+    useIndirect = useIndirect && indirectSupported;
+    if (!GLEW_VERSION_3_3 && !GLEW_ARB_vertex_type_2_10_10_10_rev) {
+        meshFormat = VERTEX_FLOAT;
+    }
+
+    streamBuffer.init(StreamRegionBytes, usePersistentMap);
+    if (usePersistentMap && !streamBuffer.persistentlyMapped()) {
+        std::cout << "Persistent mapping needs OpenGL 4.4; streamed data is mapped per allocation" << std::endl;
+    }
+
+    // Set object color
+    shaderProgram.use();
+    glUniform3f(shaderProgram.objectColorLoc, 1.0f, 0.0f, 1.0f);
+    setupMeshes();
+    setupSceneGraph();
+    configureRenderBackend(baseInstanceSupported);
+    renderBackend.arenas.push_back(&meshes);
+    renderBackend.lineWidth = 4.0f;
+    renderBackend.profiler = &profiler;
+    impostorQuadVAO = createImpostorQuad();
+    simulation.sceneAnchor = sceneAnchor;
+    simulation.current.shipPosition += sceneAnchor;
+    simulation.previous = simulation.current;
+    generatePlanetField(planetCount);
+    if (useGravity) {
+        startGravity();
+    }
+    setupPlanetInstanceBuffer();
+    buildStaticBVH();
+    if (useCollisions) {
+        setupCollisions();
+    }
+    if (fleetSize > 0) {
+        setupFleet();
+    }
+    if (useUniverse) {
+        universe.start(universeSeed, sceneAnchor, universeWorkers, (size_t)(universeBudgetMB * 1048576.0));
+    }
+    profiler.init(profileHistory);
     glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
+    if (reversedZ) {
+        glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+        glClearDepth(0.0);
+        glDepthFunc(GL_GREATER);
+    }
+    else {
+        glDepthFunc(GL_LESS);
+    }
+    return true;
 }
 
-void keyboard(unsigned char key, int x, int y) {
+// Once, after the first frame is out: time since launch and how much of
+// it went to shaders
+void reportFirstFrame() {
+    if (firstFrameReported) {
+        return;
+    }
+    firstFrameReported = true;
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - launchTime).count();
+    fprintf(stderr, "startup: first frame after %.1f ms; shaders %.1f ms (%d cached, %d compiled)\n",
+        ms, shaderCache.milliseconds, shaderCache.hits, shaderCache.misses);
+}
+
+// Speed, pause and station keys; run on whichever thread owns the simulation,
+// and show up from the next tick on
+void applySimulationKey(SimState& state, unsigned char key) {
+    float& shipSpeed = state.shipSpeed;
+    float& stationRotationSpeed = state.stationRotationSpeed;
+    bool& isPaused = state.isPaused;
     switch (key) {
     case 'a': //speed it up
         if (!isPaused) shipSpeed += 0.02f;
@@ -516,32 +1371,19 @@ void keyboard(unsigned char key, int x, int y) {
     case 'p':
         isPaused = !isPaused; 
         if (isPaused) {
-            savedShipSpeed = shipSpeed; // save speed
+            state.savedShipSpeed = shipSpeed; // save speed
             shipSpeed = 0.0f;          
         }
         else {
-            shipSpeed = savedShipSpeed; 
+            shipSpeed = state.savedShipSpeed; 
         }
         break;
-        //camera views
-        case 'c':
-            currentView = CONTROL_DESK;
-            break;
-        case 's':
-            currentView = FRONT_STATION;
-            break;
-        case 't':
-            currentView = BEHIND_SHIP;
-            break;
-        case 'w':
-            currentView = TOP_VIEW;
-            break;
-        }
-        glutPostRedisplay();
+    }
 }
 
 
-void specialKeyboard(int key, int x, int y) {//to rotate spaceship left right
+void applySimulationSpecialKey(SimState& state, int key) {//to rotate spaceship left right
+    vec3& shipDirection = state.shipDirection;
     vec3 zAxis = vec3(0.0f, 0.0f, 1.0f); //rotation axis (Z-axis)
     float turnAmount = 0.2f; 
 
@@ -553,138 +1395,1075 @@ void specialKeyboard(int key, int x, int y) {//to rotate spaceship left right
         // Rotate the ship direction to the right
         shipDirection = normalize(shipDirection - cross(shipDirection, zAxis) * turnAmount);
     }
+}
+
+
+// Input handler of the simulation thread: camera keys pick the view that
+// goes out with the snapshots, the rest steer
+void applyInput(const InputEvent& event, SimState& state, int& camera) {
+    if (!recordPath.empty() && !inputReplay) {
+        inputLog.record(simulation.tick, event);
+    }
+    CameraView view;
+    if (event.special) {
+        applySimulationSpecialKey(state, event.key);
+    }
+    else if (cameraViewForKey((char)event.key, view)) {
+        camera = view;
+    }
+    else {
+        applySimulationKey(state, (unsigned char)event.key);
+    }
+}
+
+
+// Applies an input event here, when the simulation runs on this thread
+void applyInputDirectly(const InputEvent& event) {
+    int camera = currentView;
+    applyInput(event, simulation.current, camera);
+    currentView = (CameraView)camera;
+}
+
+
+// Queues a simulation or camera key for the simulation thread, or applies it
+// right away when the simulation runs on this thread.  A replay owns the
+// simulation's input, so live keys are ignored during one.
+void postInput(int key, bool special) {
+    if (inputReplay) {
+        return;
+    }
+    if (simThread.running()) {
+        simThread.post(key, special);
+        return;
+    }
+    InputEvent event;
+    event.key = key;
+    event.special = special;
+    applyInputDirectly(event);
+}
+
 
+void keyboard(unsigned char key, int x, int y) {
+    switch (key) {
+        // Speed, station and camera keys belong to the simulation
+        case 'a': case 'd': case 'j': case 'k': case 'p':
+        case 'c': case 's': case 't': case 'w':
+            postInput(key, false);
+            break;
+        case 'h': // toggle the profiler overlay
+            profiler.hudVisible = !profiler.hudVisible;
+            break;
+        case 27: // Esc: leave the main loop so the profile gets written
+            glutLeaveMainLoop();
+            break;
+        case 'l': // toggle sphere level of detail
+            useSphereLOD = !useSphereLOD;
+            std::cout << "Sphere LOD: " << (useSphereLOD ? "on" : "off") << std::endl;
+            break;
+        case 'f': // toggle frustum culling
+            useCulling = !useCulling;
+            std::cout << "Frustum culling: " << (useCulling ? "on" : "off") << std::endl;
+            break;
+        case 'm': // toggle multi-draw-indirect submission of the whole scene
+            if (indirectSupported) {
+                useIndirect = !useIndirect;
+                std::cout << "Scene submission: " << (useIndirect ? "multi-draw indirect" : "per object") << std::endl;
+            }
+            else {
+                std::cout << "Multi-draw indirect needs OpenGL 4.3" << std::endl;
+            }
+            break;
+        case 'b': // toggle the point lights
+            if (clusteredSupported) {
+                usePointLights = !usePointLights;
+                std::cout << "Point lights: " << (usePointLights ? "on" : "off") << std::endl;
+            }
+            else {
+                std::cout << "Clustered lighting needs OpenGL 4.3" << std::endl;
+            }
+            break;
+        case 'i': // toggle instanced planet rendering
+            useInstancing = !useInstancing;
+            std::cout << "Planet rendering: " << (useInstancing ? "instanced" : "per-object") << std::endl;
+            break;
+        }
+        glutPostRedisplay();
+}
+
+
+void specialKeyboard(int key, int x, int y) {
+    if (key == GLUT_KEY_LEFT || key == GLUT_KEY_RIGHT) {
+        postInput(key, true);
+    }
     glutPostRedisplay();
 }
 
 
-void display() {
+// Newest snapshot published by the simulation thread, or one taken from the
+// simulation here when it runs on this thread
+const SimSnapshot& takeSnapshot() {
+    if (simThread.running()) {
+        return simThread.latest();
+    }
+    captureSnapshot(simulation, currentView, lockstepSnapshot);
+    return lockstepSnapshot;
+}
+
+
+// Draws the whole scene into the current framebuffer; shared by the window and the offscreen backend
+void renderScene() {
+    profiler.beginFrame();
+    streamBuffer.beginFrame();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glUseProgram(shaderProgram);
-    updateCamera();
-    // Set up view and projection matrices
-    mat4 view = LookAt(eye, at, up);
-    mat4 projection = Perspective(45.0, 800.0 / 600.0, 0.1, 5000.0);
+    shaderProgram.use();
+    // Draw a blend of the last two ticks from a snapshot; rendering never
+    // touches the simulation itself, which may be stepping on its own thread
+    const SimSnapshot& snapshot = takeSnapshot();
+    drawnSnapshot = &snapshot;
+    float alpha = simThread.running() ? snapshot.alpha(std::chrono::steady_clock::now()) : snapshot.alpha();
+    SimState state = snapshot.renderState(alpha);
+    currentView = (CameraView)snapshot.camera;
+    if (snapshot.bodyCount() > 0) {
+        syncPlanetBodies(snapshot, alpha);
+    }
+    updateCamera(state);
+    // Rebase around the camera: it sits at the origin, and the scene's float
+    // frame is moved by sceneOffset in sceneView
+    cameraOrigin = CameraOrigin(eye, sceneAnchor);
+    Simd::Mat4 view = Simd::LookAt(vec4(0.0f, 0.0f, 0.0f, 1.0f), vec4(toFloat(at - eye), 1.0f), vec4(up, 0.0f));
+    Simd::Mat4 sceneView = view * Simd::Translate(cameraOrigin.sceneOffset);
+    Simd::Mat4 projection = Simd::PerspectiveInfinite(fieldOfView, (float)windowWidth / windowHeight, nearPlane, reversedZ);
+
+    uploadFrameData(view, projection);
+    if (clusteredSupported) {
+        profiler.begin(PROFILE_LIGHTS);
+        updatePointLights(snapshot, state, alpha, view);
+        profiler.end(PROFILE_LIGHTS);
+    }
 
-    glUniformMatrix4fv(ModelViewLoc, 1, GL_TRUE, view);
-    glUniformMatrix4fv(ProjectionLoc, 1, GL_TRUE, projection);
+    profiler.begin(PROFILE_CULLING);
+    cullScene(Simd::toAngel(projection * sceneView), Simd::toAngel(projection * view), state);
+    profiler.end(PROFILE_CULLING);
 
-    // Update ship position
-    shipPosition += shipDirection * shipSpeed; // Move the ship forward
+    const vec3& shipDirection = state.shipDirection;
 
     float rotationAngle = atan2(shipDirection.y, shipDirection.x) * 180.0 / M_PI;
-    mat4 shipTransform = Translate(shipPosition.x, shipPosition.y, shipPosition.z) * RotateZ(rotationAngle);
+    sceneGraph.setLocal(shipNode, Simd::Translate(cameraOrigin.relative(state.shipPosition)) * Simd::RotateZ(rotationAngle));
+    sceneGraph.setLocal(stationNode, Simd::Translate(cameraOrigin.sceneOffset) * stationTransform(state));
+    sceneGraph.setLocal(groundNode, Simd::Translate(cameraOrigin.sceneOffset) * groundTransform());
+    sceneGraph.update();
+
+    if (universe.running()) {
+        profiler.begin(PROFILE_UNIVERSE);
+        universe.update(state);
+        drawUniverse();
+        profiler.end(PROFILE_UNIVERSE);
+    }
 
+    if (useIndirect) {
+        profiler.begin(PROFILE_INDIRECT);
+        drawSceneIndirect();
+        profiler.end(PROFILE_INDIRECT);
+        return;
+    }
 
+    // Nothing below touches GL until the queue is executed, except the
+    // instanced planets, which are a few draws with their own program.
+    // Packets carry the scope that recorded them, and execute() times their
+    // draws under it, so each pass's GPU time is where it belongs.
+    renderQueue.clear();
+    RenderBucket& scene = renderQueue.bucket(0);
 
     //spaceship
-    // First Torus (Orange - XZ plane) 
-    glUniform3f(glGetUniformLocation(shaderProgram, "ObjectColor"), 1.0f, 0.5f, 0.0f);
-    glUniformMatrix4fv(ModelViewLoc, 1, GL_TRUE, view * shipTransform * RotateX(90));
-    glBindVertexArray(torusVAO);
-    glDrawElements(GL_TRIANGLES, torusIndices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
-
-    //Second Torus (Green - YZ plane)
-    glUniform3f(glGetUniformLocation(shaderProgram, "ObjectColor"), 0.5f, 1.0f, 0.0f);
-    glUniformMatrix4fv(ModelViewLoc, 1, GL_TRUE, view * shipTransform * RotateY(90));
-    glBindVertexArray(torusVAO);
-    glDrawElements(GL_TRIANGLES, torusIndices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    profiler.begin(PROFILE_SHIP_TORI);
+    renderQueue.setPass(PROFILE_SHIP_TORI);
+    if (shipVisible) {
+        // First Torus (Orange - XZ plane)
+        scene.submit(SceneProgram, SceneArena, torusMesh, Material(vec3(1.0f, 0.5f, 0.0f)), sceneGraph.world(shipHullNodes[0]));
+
+        //Second Torus (Green - YZ plane)
+        scene.submit(SceneProgram, SceneArena, torusMesh, Material(vec3(0.5f, 1.0f, 0.0f)), sceneGraph.world(shipHullNodes[1]));
+    }
+    recordFleet(snapshot.hullInstances, torusMesh);
+    profiler.end(PROFILE_SHIP_TORI);
 
     //Tetrahedron (Front of the ship)
-    glUniform1i(glGetUniformLocation(shaderProgram, "UseLighting"), true);
+    profiler.begin(PROFILE_TETRAHEDRON);
+    renderQueue.setPass(PROFILE_TETRAHEDRON);
+    if (shipVisible) {
+        // Draw solid tetrahedron
+        scene.submit(SceneProgram, SceneArena, tetraMesh, Material(vec3(1.0f, 0.0f, 0.0f)), sceneGraph.world(shipNoseNode));
+
+        // Draw edges with a thick black outline (it was hard to see thats why i used this)
+        scene.submit(SceneUnlitProgram, SceneArena, tetraEdgeMesh, Material(vec3(0.0f, 0.0f, 0.0f)), sceneGraph.world(shipNoseNode),
+            RENDER_OUTLINE, GL_LINES);
+    }
+    recordFleet(snapshot.noseInstances, tetraMesh);
+    profiler.end(PROFILE_TETRAHEDRON);
+
+    //Ground
+    profiler.begin(PROFILE_GROUND);
+    renderQueue.setPass(PROFILE_GROUND);
+    if (groundVisible) {
+        scene.submit(SceneUnlitProgram, SceneArena, groundMesh, Material(vec3(1.0f, 1.0f, 1.0f)), sceneGraph.world(groundNode));
+    }
+    profiler.end(PROFILE_GROUND);
 
-    // Draw solid tetrahedron
-    glUniform3f(glGetUniformLocation(shaderProgram, "ObjectColor"), 1.0f, 0.0f, 0.0f); 
-    glUniformMatrix4fv(ModelViewLoc, 1, GL_TRUE, view * shipTransform * Translate(3.0f, 0.0f, 0.0f) * Scale(2.5f, 2.5f, 2.5f));
-    glBindVertexArray(tetraVAO);
-    glDrawElements(GL_TRIANGLES, tetrahedronIndices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    //Space Station (Large Gray Sphere)
+    profiler.begin(PROFILE_STATION);
+    renderQueue.setPass(PROFILE_STATION);
+    if (stationVisible) {
+        scene.submit(SceneProgram, SceneArena, sphereMeshes[selectStationLevel()], Material(vec3(0.6f, 0.6f, 0.6f)),
+            sceneGraph.world(stationBodyNode));
+
+        //Attach a red tetrahedron to the front of the space station
+        scene.submit(SceneProgram, SceneArena, tetraMesh, Material(vec3(1.0f, 0.0f, 0.0f)), sceneGraph.world(stationNoseNode));
+    }
+    profiler.end(PROFILE_STATION);
 
-    // Draw edges with a thick black outline (it was hard to see thats why i used this)
-    glUniform3f(glGetUniformLocation(shaderProgram, "ObjectColor"), 0.0f, 0.0f, 0.0f); 
-    glLineWidth(4.0f);  
-    glBindVertexArray(tetraEdgeVAO);
-    glDrawElements(GL_LINES, tetrahedronEdges.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    //Render planets
+    profiler.begin(PROFILE_PLANETS);
+    renderQueue.setPass(PROFILE_PLANETS);
+    if (useInstancing) {
+        drawPlanetsInstanced();
+    }
+    else {
+        recordPlanetsPerObject();
+    }
+    profiler.end(PROFILE_PLANETS);
+
+    profiler.begin(PROFILE_SUBMIT);
+    renderQueue.sort();
+    profiler.end(PROFILE_SUBMIT);
+    renderQueue.execute(renderBackend);
+}
+
+
+void display() {
+    renderScene();
+    if (profiler.hudVisible) {
+        profiler.drawHUD(windowWidth, windowHeight);
+    }
+    // The cockpit sees a small slice of the scene, so that is where culling is reported
+    if (currentView == CONTROL_DESK) {
+        char line[96];
+        const GLfloat color[3] = { 0.9f, 0.6f, 1.0f };
+        GLint program = beginOverlayText();
+        // Rows stack down from the top, each one line below the last drawn
+        const float lineHeight = 16.0f;
+        float y = 10.0f;
+        int length = snprintf(line, sizeof(line), "visible %d  culled %d  cull %.3f ms",
+            cullStats.visible, cullStats.culled, cullStats.milliseconds);
+        drawOverlayText(windowWidth - 8.0f * length - 10.0f, y, windowHeight, line, color);
+        y += lineHeight;
+        if (clusteredSupported) {
+            const ClusterStats& lights = clusteredLights.stats;
+            length = snprintf(line, sizeof(line), "lights %d/%d  max %d per cluster  %.3f ms",
+                lights.assigned, lights.lights, lights.maxPerCluster, lights.milliseconds);
+            drawOverlayText(windowWidth - 8.0f * length - 10.0f, y, windowHeight, line, color);
+            y += lineHeight;
+        }
+        if (universe.running()) {
+            const UniverseStats& sectors = universe.stats;
+            length = snprintf(line, sizeof(line), "sectors %d drawn %d cached %d queued  %.2f MB  hitches %llu",
+                sectors.drawable, sectors.resident, sectors.generating, sectors.bytes / 1048576.0,
+                (unsigned long long)sectors.hitches);
+            drawOverlayText(windowWidth - 8.0f * length - 10.0f, y, windowHeight, line, color);
+            y += lineHeight;
+        }
+        const StreamStats& stream = streamBuffer.stats;
+        length = snprintf(line, sizeof(line), "streamed %.1f KB  fence wait %.3f ms  %s",
+            stream.lastFrameBytes / 1024.0, stream.lastWaitMs, streamBuffer.persistentlyMapped() ? "persistent" : "mapped");
+        drawOverlayText(windowWidth - 8.0f * length - 10.0f, y, windowHeight, line, color);
+        endOverlayText(program);
+    }
+    profiler.begin(PROFILE_SWAP);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, windowWidth, windowHeight, 0, 0, windowWidth, windowHeight,
+        GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glutSwapBuffers();
+    glBindFramebuffer(GL_FRAMEBUFFER, windowFBO);
+    profiler.end(PROFILE_SWAP);
+    reportFirstFrame();
+    if (simThread.running()) {
+        simThread.frameShown(*drawnSnapshot);
+    }
+    if (inputReplay) {
+        inputReplay->frameDone();
+    }
+}
 
-    //Ground 
-    GLint wasLightingOn;
-    glGetUniformiv(shaderProgram, glGetUniformLocation(shaderProgram, "UseLighting"), &wasLightingOn); 
 
-    glUniform1i(glGetUniformLocation(shaderProgram, "UseLighting"), false); 
+// Exports the profiler ring buffer and prints its percentiles
+void finishProfiling() {
+    if (!profiler.writeCSV(profileCsvPath.c_str())) {
+        fprintf(stderr, "could not write %s\n", profileCsvPath.c_str());
+    }
+    profiler.printSummary();
+    renderQueue.printSummary();
+    universe.printSummary();
+    streamBuffer.printSummary();
+}
 
-    glUniform3f(glGetUniformLocation(shaderProgram, "ObjectColor"), 1.0f, 1.0f, 1.0f);
-    mat4 squareModel = Translate(0.0f, 0.0f, -5.0f) * RotateX(-90) * Scale(200.0f, 200.0f, 1.0f);
-    glUniformMatrix4fv(ModelViewLoc, 1, GL_TRUE, view * squareModel);
 
-    glBindVertexArray(squareVAO);
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+// (Re)allocates the window's render target at the current window size
+bool resizeWindowTarget() {
+    if (!windowFBO) {
+        glGenFramebuffers(1, &windowFBO);
+        glGenRenderbuffers(1, &windowColorRB);
+        glGenRenderbuffers(1, &windowDepthRB);
+    }
+    glBindRenderbuffer(GL_RENDERBUFFER, windowColorRB);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, windowWidth, windowHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, windowDepthRB);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, windowWidth, windowHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, windowFBO);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, windowColorRB);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, windowDepthRB);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "window: framebuffer incomplete\n");
+        return false;
+    }
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    return true;
+}
 
 
-    glUniform1i(glGetUniformLocation(shaderProgram, "UseLighting"), wasLightingOn);
+void reshape(int width, int height) {
+    windowWidth = std::max(width, 1);
+    windowHeight = std::max(height, 1);
+    glViewport(0, 0, windowWidth, windowHeight);
+    resizeWindowTarget();
+}
 
-    //Space Station (Large Gray Sphere)
-    glUniform3f(glGetUniformLocation(shaderProgram, "ObjectColor"), 0.6f, 0.6f, 0.6f); 
 
-    //Apply station rotation
-    mat4 stationTransform = Translate(100.0f, 10.0f, 10.0f) * RotateZ(stationRotationAngle);
-    glUniformMatrix4fv(ModelViewLoc, 1, GL_TRUE, view * stationTransform * Scale(20.0f, 20.0f, 20.0f));
 
-    glBindVertexArray(sphereVAO);
-    glDrawElements(GL_TRIANGLES, sphereIndices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+// Renders the full scene from TOP_VIEW with each planet path at increasing
+// planet counts and prints the average frame time of each: per-object draws,
+// instanced planets, and the whole scene through multi-draw indirect.
+void benchmarkPlanets() {
+    const int counts[] = { 8, 1000, 100000, 1000000 };
+    CameraView savedView = currentView;
+    bool savedInstancing = useInstancing;
+    bool savedIndirect = useIndirect;
+    currentView = TOP_VIEW;
+
+    std::cout << "planets    per-object ms   instanced ms   speedup    indirect ms" << std::endl;
+    for (int count : counts) {
+        generatePlanetField(count);
+        setupPlanetInstanceBuffer();
+        buildStaticBVH();
+
+        // The per-object loop is far slower at large counts, so fewer frames are averaged there
+        int frames = count <= 1000 ? 60 : (count <= 100000 ? 8 : 2);
+        double ms[3] = { 0.0, 0.0, 0.0 };
+        for (int path = 0; path < (indirectSupported ? 3 : 2); path++) {
+            useInstancing = (path == 1);
+            useIndirect = (path == 2);
+            renderScene();
+            glFinish();
+
+            auto start = std::chrono::steady_clock::now();
+            for (int f = 0; f < frames; f++) {
+                renderScene();
+                glFinish();
+            }
+            auto end = std::chrono::steady_clock::now();
+            ms[path] = std::chrono::duration<double, std::milli>(end - start).count() / frames;
+        }
+        printf("%7d %16.3f %14.3f %8.1fx %14.3f\n", count, ms[0], ms[1], ms[0] / ms[1], ms[2]);
+    }
 
-    //Attach a red tetrahedron to the front of the space station
-    glUniform3f(glGetUniformLocation(shaderProgram, "ObjectColor"), 1.0f, 0.0f, 0.0f);
-    mat4 stationFrontModel = stationTransform * Translate(0.0f, 20.0f, 0.0f) * Scale(4.0f, 4.0f, 4.0f);
-    glUniformMatrix4fv(ModelViewLoc, 1, GL_TRUE, view * stationFrontModel);
-    glBindVertexArray(tetraVAO);
-    glDrawElements(GL_TRIANGLES, tetrahedronIndices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    currentView = savedView;
+    useInstancing = savedInstancing;
+    useIndirect = savedIndirect;
+    generatePlanetField(planetCount);
+    setupPlanetInstanceBuffer();
+    buildStaticBVH();
+}
 
 
-    //Render planets
-    glUniform1i(glGetUniformLocation(shaderProgram, "UseLighting"), true);
-    glBindVertexArray(sphereVAO);
-    for (int i = 0; i < 8; i++) {
-        GLfloat x = planet_coords[i][0];
-        GLfloat y = planet_coords[i][1];
-        GLfloat z = planet_coords[i][2];
-
-        glUniform3f(glGetUniformLocation(shaderProgram, "ObjectColor"),
-            planet_colors[i][0],
-            planet_colors[i][1],
-            planet_colors[i][2]);
-
-        mat4 sphereModel = Translate(x / 8.0f, y / 8.0f, z / 8.0f) * Scale(5.0f, 5.0f, 5.0f);
-        glUniformMatrix4fv(ModelViewLoc, 1, GL_TRUE, view * sphereModel);
-        glDrawElements(GL_TRIANGLES, sphereIndices.size(), GL_UNSIGNED_INT, 0);
+// Renders the scene from TOP_VIEW with 1 to 10k point lights and prints the
+// average frame time, the CPU time spent clustering and how full the
+// clusters are.  Up to 1000 lights the same frames are also rendered with
+// a single cluster, where every lit fragment loops over every light.
+void benchmarkLights() {
+    if (!clusteredSupported) {
+        std::cout << "Clustered lighting needs OpenGL 4.3" << std::endl;
+        return;
     }
-    glBindVertexArray(0);
-    glutSwapBuffers();
+    const int counts[] = { 1, 10, 100, 1000, 10000 };
+    const int frames = 10;
+    const int clustered[3] = { ClusterTilesX, ClusterTilesY, ClusterSlices }, oneCluster[3] = { 1, 1, 1 };
+    CameraView savedView = currentView;
+    int savedCount = pointLightCount;
+    currentView = TOP_VIEW;
+
+    std::cout << "lights   frame ms   cluster ms   assigned    indices   mean/max per cluster   one cluster ms" << std::endl;
+    for (int count : counts) {
+        pointLightCount = count;
+        double ms[2] = { 0.0, 0.0 }, assignMs = 0.0;
+        ClusterStats stats;
+        for (int pass = 0; pass < (count <= 1000 ? 2 : 1); pass++) {
+            memcpy(clusterGrid, pass == 0 ? clustered : oneCluster, sizeof(clusterGrid));
+            renderScene();
+            glFinish();
+
+            double clusterMs = 0.0;
+            auto start = std::chrono::steady_clock::now();
+            for (int f = 0; f < frames; f++) {
+                renderScene();
+                glFinish();
+                clusterMs += clusteredLights.stats.milliseconds;
+            }
+            auto end = std::chrono::steady_clock::now();
+            ms[pass] = std::chrono::duration<double, std::milli>(end - start).count() / frames;
+            if (pass == 0) {
+                stats = clusteredLights.stats;
+                assignMs = clusterMs / frames;
+            }
+        }
+        char single[32] = "-";
+        if (ms[1] > 0.0) {
+            snprintf(single, sizeof(single), "%.3f", ms[1]);
+        }
+        printf("%6d %10.3f %12.3f %10d %10d %12.1f / %-6d %14s\n", count, ms[0], assignMs, stats.assigned, stats.indices,
+            stats.occupiedClusters > 0 ? (double)stats.indices / stats.occupiedClusters : 0.0, stats.maxPerCluster, single);
+    }
+
+    memcpy(clusterGrid, clustered, sizeof(clusterGrid));
+    currentView = savedView;
+    pointLightCount = savedCount;
+}
+
+
+// Flies the ship straight out through the universe at 8 units a tick, one
+// tick per frame behind the ship, first with sectors generated on the
+// workers and then on this thread, and prints frame times, the streaming
+// time on this thread and how many frames it pushed over StreamHitchMs
+void benchmarkUniverse() {
+    const int frames = 300;
+    CameraView savedView = currentView;
+    CollisionWorld* savedCollisions = simulation.collisions;
+    GravitySimulation* savedGravity = simulation.gravity;
+    currentView = BEHIND_SHIP;
+    simulation.collisions = nullptr;   // fly through whatever is in the way
+    simulation.gravity = nullptr;
+
+    std::cout << "generated on      frame p50    p99    max ms   streaming p50    p99    max ms   hitches   sectors   evicted" << std::endl;
+    for (int workers : { universeWorkers, 0 }) {
+        universe.release();
+        universe.start(universeSeed, sceneAnchor, workers, (size_t)(universeBudgetMB * 1048576.0));
+        universe.reportHitches = false;
+        simulation.current = SimState();
+        simulation.current.shipPosition += sceneAnchor;
+        simulation.current.shipDirection = normalize(vec3(1.0f, 0.35f, 0.0f));
+        simulation.current.shipSpeed = 8.0f;
+        simulation.previous = simulation.current;
+
+        std::vector<double> frameMs, streamMs;
+        for (int f = 0; f < frames; f++) {
+            auto start = std::chrono::steady_clock::now();
+            renderScene();
+            glFinish();
+            frameMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            streamMs.push_back(universe.stats.lastUpdateMs);
+            simulation.step();
+        }
+        const UniverseStats& stats = universe.stats;
+        printf("%-15s %9.2f %6.2f %9.2f %16.3f %6.3f %9.3f %9llu %9llu %9llu\n",
+            workers > 0 ? "workers" : "render thread",
+            percentile(frameMs, 0.5), percentile(frameMs, 0.99), *std::max_element(frameMs.begin(), frameMs.end()),
+            percentile(streamMs, 0.5), percentile(streamMs, 0.99), *std::max_element(streamMs.begin(), streamMs.end()),
+            (unsigned long long)stats.hitches, (unsigned long long)stats.generated, (unsigned long long)stats.evicted);
+    }
+    universe.release();
+    universe.stop();
+    currentView = savedView;
+    simulation.collisions = savedCollisions;
+    simulation.gravity = savedGravity;
+}
+
+
+// Renders the scene from TOP_VIEW with 1000 and 100k planets through the
+// per-object path, first with a uniform upload per draw and then with the
+// records streamed and drawn by base instance, and through the indirect
+// path; each with the stream buffer persistently mapped and then mapped per
+// allocation.  Frames aren't finished one by one, so the GPU can fall
+// behind and the fence waits show it.  Prints the average frame time, the
+// bytes streamed per frame and the fence waits.
+void benchmarkStream() {
+    const int counts[] = { 1000, 100000 };
+    struct Path {
+        const char* name;
+        bool records, indirect;
+    };
+    const Path paths[] = { { "uniforms", false, false }, { "records", true, false }, { "indirect", true, true } };
+    CameraView savedView = currentView;
+    bool savedInstancing = useInstancing;
+    bool savedIndirect = useIndirect;
+    currentView = TOP_VIEW;
+    useInstancing = false;
+
+    std::cout << "planets  per object  mapping        frame ms   KB/frame   waits   wait ms/frame   grown" << std::endl;
+    for (int count : counts) {
+        generatePlanetField(count);
+        setupPlanetInstanceBuffer();
+        buildStaticBVH();
+        int frames = count <= 1000 ? 30 : 4;
+        for (const Path& path : paths) {
+            if ((path.records && !baseInstanceSupported) || (path.indirect && !indirectSupported)) {
+                continue;
+            }
+            for (bool persistent : { true, false }) {
+                streamBuffer.init(StreamRegionBytes, persistent);
+                configureRenderBackend(path.records);
+                useIndirect = path.indirect;
+                renderScene();
+                glFinish();
+
+                streamBuffer.stats = StreamStats();
+                auto start = std::chrono::steady_clock::now();
+                for (int f = 0; f < frames; f++) {
+                    renderScene();
+                }
+                glFinish();
+                auto end = std::chrono::steady_clock::now();
+                streamBuffer.beginFrame();   // closes the last frame's counts
+
+                const StreamStats& stats = streamBuffer.stats;
+                double ms = std::chrono::duration<double, std::milli>(end - start).count() / frames;
+                printf("%7d  %-10s  %-12s %10.3f %10.1f %7llu %15.4f %7llu\n", count, path.name,
+                    streamBuffer.persistentlyMapped() ? "persistent" : "per alloc", ms, stats.totalBytes / 1024.0 / frames,
+                    (unsigned long long)stats.waits, stats.totalWaitMs / frames, (unsigned long long)stats.grows);
+            }
+        }
+    }
+
+    currentView = savedView;
+    useInstancing = savedInstancing;
+    useIndirect = savedIndirect;
+    streamBuffer.init(StreamRegionBytes, usePersistentMap);
+    streamBuffer.stats = StreamStats();
+    configureRenderBackend(baseInstanceSupported);
+    generatePlanetField(planetCount);
+    setupPlanetInstanceBuffer();
+    buildStaticBVH();
+}
+
+
+// Uploads highly tessellated spheres in both vertex formats and prints their
+// buffer sizes and vertex fetch rate.  The spheres are placed outside the clip
+// volume, so every vertex is fetched and shaded but nothing is rasterized.
+void benchmarkVertexFormats() {
+    const int bands[] = { 128, 512 };
+    const char* formatNames[2] = { "float", "packed" };
+    const int instances = 8, repeats = 10;
+
+    Simd::Mat4 identity;
+    uploadFrameData(identity, identity);
+    shaderProgram.use();
+    glUniformMatrix4fv(shaderProgram.modelLoc, 1, GL_FALSE, Simd::Translate(0.0f, 0.0f, 10.0f));
+
+    std::cout << "sphere    vertices   format   index   vertex KB   index KB   Mverts/s" << std::endl;
+    for (int band : bands) {
+        Mesh mesh = generateSphere(0.5f, band, band);
+        size_t bytes[2];
+        for (int format = 0; format < 2; format++) {
+            MeshRegistry registry;
+            int sphere = registry.add(mesh);
+            registry.upload((VertexFormat)format);
+
+            glBindVertexArray(registry.vao);
+            registry.drawInstanced(sphere, instances);
+            glFinish();
+            auto start = std::chrono::steady_clock::now();
+            for (int r = 0; r < repeats; r++) {
+                registry.drawInstanced(sphere, instances);
+            }
+            glFinish();
+            auto end = std::chrono::steady_clock::now();
+            glBindVertexArray(0);
+
+            double seconds = std::chrono::duration<double>(end - start).count();
+            double vertices = (double)mesh.indices.size() * instances * repeats;
+            bytes[format] = registry.vertexBytes() + registry.indexBytes();
+            printf("%3dx%-3d %10d %8s %7s %11.1f %10.1f %10.1f\n", band, band, (int)mesh.vertices.size(), formatNames[format],
+                registry.indexType(sphere) == GL_UNSIGNED_SHORT ? "16-bit" : "32-bit",
+                registry.vertexBytes() / 1024.0, registry.indexBytes() / 1024.0, vertices / seconds / 1e6);
+            registry.release();
+        }
+        printf("        %.1f KB saved (%.0f%%)\n", (bytes[0] - bytes[1]) / 1024.0, 100.0 * (bytes[0] - bytes[1]) / bytes[0]);
+    }
+
+    printf("scene arena: %.1f KB %s, %.1f KB as float\n", (meshes.vertexBytes() + meshes.indexBytes()) / 1024.0,
+        formatNames[meshes.format], meshes.floatBytes() / 1024.0);
+}
+
+
+// Times building a set of high-tessellation meshes three ways: generated with
+// no cache, cold (generated and written to the cache) and warm (mapped from
+// the files the cold pass wrote).  Each pass ends with the upload and a
+// glFinish.  The warm pass reads from the page cache, so it shows the cost
+// of the mapping, checksum and upload rather than of the disk itself.  Then
+// the same three passes rebuild every shader program: compiled, compiled
+// and saved, and loaded from the saved binaries.  A driver with a shader
+// cache of its own (Mesa's, unless MESA_SHADER_CACHE_DISABLE=true) already
+// shortens the compiled passes.
+void benchmarkStartup() {
+    const int sphereBands[] = { 256, 512 };
+    const int torusMajor = 512, torusMinor = 256;
+    const char* passNames[3] = { "no cache", "cold", "warm" };
+    const int warmRepeats = 5;
+
+    bool cacheWasOn = useMeshCache;
+    double best[3] = { 1e30, 1e30, 1e30 };
+    size_t arenaBytes = 0;
+    int hits = 0, misses = 0;
+    for (int pass = 0; pass < 3; pass++) {
+        useMeshCache = pass != 0;
+        if (pass == 1) {
+            meshCache.erase(torusKey(2.5f, 0.7f, torusMajor, torusMinor), meshFormat);
+            for (int bands : sphereBands) {
+                meshCache.erase(sphereKey(0.5f, bands, bands), meshFormat);
+            }
+        }
+        // The cold pass writes the files, so it can only run once
+        int repeats = pass == 2 ? warmRepeats : 1;
+        for (int r = 0; r < repeats; r++) {
+            int hitsBefore = meshCache.hits, missesBefore = meshCache.misses;
+            auto start = std::chrono::steady_clock::now();
+            MeshRegistry registry;
+            addTorus(registry, meshFormat, 2.5f, 0.7f, torusMajor, torusMinor);
+            for (int bands : sphereBands) {
+                addSphere(registry, meshFormat, 0.5f, bands, bands);
+            }
+            registry.upload(meshFormat);
+            meshCache.release();
+            glFinish();
+            auto end = std::chrono::steady_clock::now();
+
+            best[pass] = std::min(best[pass], std::chrono::duration<double, std::milli>(end - start).count());
+            arenaBytes = registry.vertexBytes() + registry.indexBytes();
+            hits = meshCache.hits - hitsBefore;
+            misses = meshCache.misses - missesBefore;
+            registry.release();
+        }
+        printf("%-9s %10.2f ms   %d hits, %d misses\n", passNames[pass], best[pass], hits, misses);
+    }
+    useMeshCache = cacheWasOn;
+
+    printf("arena: %.1f MB %s in %s; warm start is %.1fx faster than generating\n", arenaBytes / 1e6,
+        meshFormat == VERTEX_PACKED ? "packed" : "float", meshCache.directory.c_str(), best[0] / best[2]);
+
+    // The programs built by the last warm pass stay in use
+    bool shaderCacheWasOn = shaderCache.enabled;
+    double shaderBest[3] = { 1e30, 1e30, 1e30 };
+    for (int pass = 0; pass < 3; pass++) {
+        shaderCache.enabled = pass != 0;
+        shaderCache.overwrite = pass == 1;
+        int repeats = pass == 2 ? warmRepeats : 1;
+        for (int r = 0; r < repeats; r++) {
+            int hitsBefore = shaderCache.hits, missesBefore = shaderCache.misses;
+            auto start = std::chrono::steady_clock::now();
+            deletePrograms();
+            if (!buildPrograms()) {
+                fprintf(stderr, "shader programs failed to build\n");
+                return;
+            }
+            glFinish();
+            auto end = std::chrono::steady_clock::now();
+
+            shaderBest[pass] = std::min(shaderBest[pass], std::chrono::duration<double, std::milli>(end - start).count());
+            hits = shaderCache.hits - hitsBefore;
+            misses = shaderCache.misses - missesBefore;
+        }
+        printf("%-9s %10.2f ms   %d cached, %d compiled\n", passNames[pass], shaderBest[pass], hits, misses);
+    }
+    shaderCache.enabled = shaderCacheWasOn;
+    shaderCache.overwrite = false;
+
+    printf("shaders: %d programs in %s; warm start is %.1fx faster than compiling\n", hits + misses,
+        shaderCache.directory.c_str(), shaderBest[0] / shaderBest[2]);
 }
 
 
+// Loads the --replay log and sets up the world it was recorded in; call
+// before init()
+bool loadReplay() {
+    if (!inputLog.load(replayPath.c_str())) {
+        return false;
+    }
+    planetCount = inputLog.config.planets;
+    fleetSize = inputLog.config.fleet;
+    useGravity = inputLog.config.gravity;
+    useCollisions = inputLog.config.collisions;
+    sceneAnchor = dvec3(inputLog.config.worldOffset[0], inputLog.config.worldOffset[1], inputLog.config.worldOffset[2]);
+    useSimThread = false;   // replays step on the rendering thread, tick by tick
+    return true;
+}
+
+// Attaches the loaded log to the simulation; call after init()
+void startReplay() {
+    static InputReplay replay(inputLog, applyInputDirectly);
+    inputReplay = &replay;
+    simulation.replay = inputReplay;
+    inputReplay->start();
+    lastFrameTime = std::chrono::steady_clock::now();
+}
+
+// Applies keys pressed after the last tick, prints the summary and, with
+// --record, saves the log with the state this build ended in.  Returns
+// the process exit code: 0 when the replay matched its recording.
+int finishReplay() {
+    inputReplay->apply(simulation.tick);
+    bool match = inputReplay->printSummary(simulation.tick, simulation.checksum());
+    simulation.replay = nullptr;
+    if (!recordPath.empty() && inputReplay->finished(simulation.tick)) {
+        inputLog.stateChecksum = simulation.checksum();
+        if (inputLog.save(recordPath.c_str())) {
+            printf("re-recorded %s with checksum %016llx\n", recordPath.c_str(), (unsigned long long)inputLog.stateChecksum);
+            return 0;
+        }
+    }
+    return match ? 0 : 2;
+}
+
+// Saves the keys recorded during a live run, with the world it ran in and
+// where it ended
+void saveRecording() {
+    inputLog.config.planets = planetCount;
+    inputLog.config.fleet = fleetSize;
+    inputLog.config.gravity = useGravity;
+    inputLog.config.collisions = useCollisions;
+    inputLog.config.worldOffset[0] = sceneAnchor.x;
+    inputLog.config.worldOffset[1] = sceneAnchor.y;
+    inputLog.config.worldOffset[2] = sceneAnchor.z;
+    inputLog.endTick = simulation.tick;
+    inputLog.stateChecksum = simulation.checksum();
+    if (inputLog.save(recordPath.c_str())) {
+        printf("recorded %zu keys over %llu ticks to %s\n", inputLog.records.size(),
+            (unsigned long long)inputLog.endTick, recordPath.c_str());
+    }
+}
+
+
+struct OffscreenOptions {
+    int frames = 1;
+    std::string views = "cstw";   // camera keys, one image per view per frame
+    FrameFormat format = FRAME_PNG;
+    std::string prefix = "frame";
+    void (*benchmark)() = nullptr; // GL benchmark to run instead of capturing frames
+};
+
+// Headless replay: every frame is drawn from the recorded camera and
+// finished before the next one starts, so frame times include the GPU
+int runReplayOffscreen() {
+    while (advanceReplay()) {
+        renderScene();
+        glFinish();
+        reportFirstFrame();
+        inputReplay->frameDone();
+    }
+    int status = finishReplay();
+    finishProfiling();
+    destroyOffscreenContext();
+    return status;
+}
+
+// Headless batch render: one simulation tick per frame, every requested view
+// drawn into the offscreen framebuffer and written out. Raw frames keep
+// stdout to themselves; everything printed goes to stderr instead.
+int runOffscreen(const OffscreenOptions& options) {
+    if (options.format == FRAME_RAW && !options.benchmark && !reserveStdoutForFrames()) {
+        return 1;
+    }
+    if (!createOffscreenContext(windowWidth, windowHeight)) {
+        return 1;
+    }
+    if (!init()) {
+        destroyOffscreenContext();
+        return 1;
+    }
+    if (options.benchmark) {
+        options.benchmark();
+        destroyOffscreenContext();
+        return 0;
+    }
+    if (!replayPath.empty()) {
+        startReplay();
+        return runReplayOffscreen();
+    }
+
+    FrameCapture capture;
+    capture.init(windowWidth, windowHeight, options.format);
+    const char* extension = options.format == FRAME_PPM ? "ppm" : "png";
+
+    int images = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < options.frames; frame++) {
+        for (char view : options.views) {
+            cameraViewForKey(view, currentView);
+            renderScene();
+
+            char path[512];
+            snprintf(path, sizeof(path), "%s_%c_%05d.%s", options.prefix.c_str(), view, frame, extension);
+            capture.capture(path);
+            images++;
+            reportFirstFrame();
+        }
+        simulation.step();
+    }
+    capture.finish();
+    glFinish();
+    auto end = std::chrono::steady_clock::now();
+    finishProfiling();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    fprintf(stderr, "offscreen: %d images (%dx%d) in %.3f s: %.1f images/sec, %.1f MB read back\n",
+        images, windowWidth, windowHeight, seconds, images / seconds, capture.bytesWritten() / 1e6);
+
+    capture.release();
+    destroyOffscreenContext();
+    return 0;
+}
+
 
 int main(int argc, char** argv) {
+    bool benchMeshGenerators = false;
+    bool benchGravity = false;
+    bool benchCollisions = false;
+    bool benchFleet = false;
+    bool benchMatrices = false;
+    bool benchLatency = false;
+    long long simTicks = -1;
+    bool offscreen = false;
+    OffscreenOptions offscreenOptions;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--planets") == 0 && i + 1 < argc) {
+            planetCount = std::max(0, atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--no-indirect") == 0) {
+            useIndirect = false;
+        }
+        else if (strcmp(argv[i], "--bench-planets") == 0) {
+            offscreenOptions.benchmark = benchmarkPlanets;
+        }
+        else if (strcmp(argv[i], "--gravity") == 0) {
+            useGravity = true;
+        }
+        else if (strcmp(argv[i], "--fleet") == 0 && i + 1 < argc) {
+            fleetSize = std::max(0, atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--bench-fleet") == 0) {
+            benchFleet = true;
+        }
+        else if (strcmp(argv[i], "--no-collisions") == 0) {
+            useCollisions = false;
+        }
+        else if (strcmp(argv[i], "--bench-collisions") == 0) {
+            benchCollisions = true;
+        }
+        else if (strcmp(argv[i], "--bench-matrix") == 0) {
+            benchMatrices = true;
+        }
+        else if (strcmp(argv[i], "--no-sim-thread") == 0) {
+            useSimThread = false;
+        }
+        else if (strcmp(argv[i], "--bench-latency") == 0) {
+            benchLatency = true;
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--replay-fast") == 0) {
+            replayFast = true;
+        }
+        else if (strcmp(argv[i], "--bench-gravity") == 0) {
+            benchGravity = true;
+        }
+        else if (strcmp(argv[i], "--bench-meshgen") == 0) {
+            benchMeshGenerators = true;
+        }
+        else if (strcmp(argv[i], "--bench-vertex") == 0) {
+            offscreenOptions.benchmark = benchmarkVertexFormats;
+        }
+        else if (strcmp(argv[i], "--bench-startup") == 0) {
+            offscreenOptions.benchmark = benchmarkStartup;
+        }
+        else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+            pointLightCount = std::max(0, atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--universe") == 0 && i + 1 < argc) {
+            useUniverse = true;
+            universeSeed = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--universe-budget") == 0 && i + 1 < argc) {
+            universeBudgetMB = std::max(0.0, atof(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--bench-universe") == 0) {
+            offscreenOptions.benchmark = benchmarkUniverse;
+        }
+        else if (strcmp(argv[i], "--bench-stream") == 0) {
+            offscreenOptions.benchmark = benchmarkStream;
+        }
+        else if (strcmp(argv[i], "--bench-lights") == 0) {
+            offscreenOptions.benchmark = benchmarkLights;
+        }
+        else if (strcmp(argv[i], "--mesh-cache") == 0 && i + 1 < argc) {
+            meshCache.directory = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-mesh-cache") == 0) {
+            useMeshCache = false;
+        }
+        else if (strcmp(argv[i], "--shader-cache") == 0 && i + 1 < argc) {
+            shaderCache.directory = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-shader-cache") == 0) {
+            shaderCache.enabled = false;
+        }
+        else if (strcmp(argv[i], "--float-vertices") == 0) {
+            meshFormat = VERTEX_FLOAT;
+        }
+        else if (strcmp(argv[i], "--sim-ticks") == 0 && i + 1 < argc) {
+            simTicks = atoll(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--offscreen") == 0) {
+            offscreen = true;
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            offscreenOptions.frames = std::max(0, atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--views") == 0 && i + 1 < argc) {
+            offscreenOptions.views = argv[++i];
+            CameraView view;
+            for (char key : offscreenOptions.views) {
+                if (!cameraViewForKey(key, view)) {
+                    fprintf(stderr, "unknown view '%c' in --views (expected c, s, t or w)\n", key);
+                    return 1;
+                }
+            }
+        }
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (!parseFrameFormat(argv[++i], offscreenOptions.format)) {
+                fprintf(stderr, "unknown frame format '%s' (expected ppm, png or raw)\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            offscreenOptions.prefix = argv[++i];
+        }
+        else if (strcmp(argv[i], "--profile-csv") == 0 && i + 1 < argc) {
+            profileCsvPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--profile-frames") == 0 && i + 1 < argc) {
+            profileHistory = std::max(1, atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--world-offset") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%lf,%lf,%lf", &sceneAnchor.x, &sceneAnchor.y, &sceneAnchor.z) != 3) {
+                fprintf(stderr, "--world-offset expects X,Y,Z\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--no-reversed-z") == 0) {
+            useReversedZ = false;
+        }
+        else if (strcmp(argv[i], "--no-persistent-map") == 0) {
+            usePersistentMap = false;
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &windowWidth, &windowHeight) != 2 || windowWidth <= 0 || windowHeight <= 0) {
+                fprintf(stderr, "--size expects WIDTHxHEIGHT\n");
+                return 1;
+            }
+        }
+    }
+
+    // Headless: measure the simulation alone, no window or GL context needed
+    if (simTicks >= 0) {
+        benchmarkSimulation((uint64_t)simTicks);
+        return 0;
+    }
+    if (benchMeshGenerators) {
+        benchmarkMeshGenerators();
+        return 0;
+    }
+    if (benchGravity) {
+        benchmarkGravity();
+        return 0;
+    }
+    if (benchCollisions) {
+        benchmarkCollisions();
+        return 0;
+    }
+    if (benchFleet) {
+        benchmarkFleet();
+        return 0;
+    }
+    if (benchMatrices) {
+        Simd::benchmarkMatrices();
+        return 0;
+    }
+    if (benchLatency) {
+        benchmarkSimThread();
+        return 0;
+    }
+
+    // A replay overrides the world options with the ones it was recorded with
+    if (!replayPath.empty() && !loadReplay()) {
+        return 1;
+    }
+
+    // Render farm path: no display, no GLUT
+    if (offscreen) {
+        return runOffscreen(offscreenOptions);
+    }
+
     glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
-    glutInitWindowSize(800, 600);
+    glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_GLUTMAINLOOP_RETURNS);
+    // Depth lives in the window's render target, not the window itself
+    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA);
+    glutInitWindowSize(windowWidth, windowHeight);
     glutCreateWindow("MajorTom");
     glewInit();
-    init();
-    generateSphere(0.5f, 30, 30);
-    setupSphereBuffers();
-    glutTimerFunc(16, update, 0);
-    glutTimerFunc(16, timer, 0);
+    if (!init() || !resizeWindowTarget()) {
+        return 1;
+    }
+    if (offscreenOptions.benchmark) {
+        offscreenOptions.benchmark();
+        return 0;
+    }
+    lastFrameTime = std::chrono::steady_clock::now();
+    if (!replayPath.empty()) {
+        startReplay();
+    }
+    else if (useSimThread) {
+        simThread.start(simulation, applyInput, currentView);
+    }
+    glutIdleFunc(idle);
     glutDisplayFunc(display);
+    glutReshapeFunc(reshape);
     glutKeyboardFunc(keyboard);
     glutSpecialFunc(specialKeyboard);
     glutMainLoop();
 
-    return 0;
+    if (simThread.running()) {
+        simThread.stop();
+        simThread.printSummary();
+    }
+    int status = 0;
+    if (inputReplay) {
+        status = finishReplay();
+    }
+    else if (!recordPath.empty()) {
+        saveRecording();
+    }
+    finishProfiling();
+    return status;
 }
-